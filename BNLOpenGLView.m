@@ -7,6 +7,7 @@
 
 // Local includes.
 #include "config.h"
+#include "frame_timer.h"
 #include "luarender.h"
 #include "render.h"
 
@@ -57,6 +58,9 @@ static void runloop() {
   CGLSetCurrentContext(glView.cglContext);
   
   if (do_use_lua) {
+    // The display link sets the frame rate, so we advance by each frame's
+    // measured duration.
+    luarender__update(frame_timer__tick());
     luarender__draw(glView.xWindowSize, glView.yWindowSize);
   } else {
     render__draw(glView.xWindowSize, glView.yWindowSize);
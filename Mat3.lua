@@ -87,45 +87,34 @@ function Mat3:__mul(m)
     -- Error level 2 indicates this is the caller's fault.
     error('Expected arg to be a Mat3', 2)
   end
-  local m_mt = getmetatable(m)
-  if m_mt ~= Vec3 and m_mt ~= Mat3 then
+  local is_vec = Vec3.is_vec3(m)
+  if not is_vec and getmetatable(m) ~= Mat3 then
     -- Error level 2 indicates this is the caller's fault.
     error('A Mat3 must multiply with a Vec3 or Mat3', 2)
   end
 
-  -- Internally, this is always matrix multiplication.
-  -- When m is a Vec3, we convert it to a matrix and then convert the output to
-  -- a vector afterwards.
-
-  -- Convert input to a matrix if needed.
-  if m_mt == Vec3 then
-    m = {{m[1]}, {m[2]}, {m[3]}}
+  -- A Mat3 times a Vec3 is done directly, as it's the common case.
+  if is_vec then
+    return Vec3:new(self[1][1] * m[1] + self[1][2] * m[2] + self[1][3] * m[3],
+                    self[2][1] * m[1] + self[2][2] * m[2] + self[2][3] * m[3],
+                    self[3][1] * m[1] + self[3][2] * m[2] + self[3][3] * m[3])
   end
 
   -- Perform the multiplication.
-  local num_cols = #m[1]
   local out = {{}, {}, {}}
-  for i = 1, 3 do for j = 1, num_cols do
+  for i = 1, 3 do for j = 1, 3 do
     out[i][j] = 0
     for k = 1, 3 do
       out[i][j] = out[i][j] + self[i][k] * m[k][j]
     end
   end end
 
-  -- Convert output to a vector if needed.
-  if m_mt == Vec3 then
-    for i = 1, 3 do
-      out[i] = out[i][1]
-    end
-  end
-
-  -- The output has the same type as the input.
-  return setmetatable(out, m_mt)
+  return setmetatable(out, Mat3)
 end
 
 -- The return value of this is a unitary matrix M such that M * dir = (0, 0, 1).
 function Mat3:rotate_to_z(dir)
-  assert(getmetatable(dir) == Vec3, 'dir expected to be a Vec3')
+  assert(Vec3.is_vec3(dir), 'dir expected to be a Vec3')
   local v3 = Vec3:new(dir):normalize()
 
   -- Find vectors v1 and v2 so that {v1, v2, v3} are orthonormal and satisfy the
@@ -58,7 +58,7 @@ local v, w
 v = Vec3:new(1, 0, 0)
 w = M * v
 
-assert(getmetatable(w) == Vec3)
+assert(Vec3.is_vec3(w))
 assert(#w == 3)
 assert(w[1] == 1 and w[2] == 4 and w[3] == 7)
 
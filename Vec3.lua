@@ -7,15 +7,44 @@ A class to make it easier to work with 3-vectors.
 I'll try to make this class a bit like the built-in string module, which can be
 used either as an independent module, or called as methods on strings.
 
+Under LuaJIT, if the do_use_ffi_vec3 global is true when this module is first
+required, Vec3:new makes FFI structs of three doubles rather than tables. The
+JIT can keep those in registers, so that vector math in compiled code doesn't
+allocate at all. They're indexed v[1], v[2], v[3] just like tables. Plain
+{x, y, z} tables given to Vec3.normalize or Vec3.set still become table Vec3s,
+and the two kinds mix freely. Vec3.is_vec3 recognizes either kind, while
+getmetatable only recognizes table Vec3s.
+
+Structs are off by default as they're slower overall for now: code that the JIT
+doesn't compile pays for a Lua function call on each v[i] of a struct.
+
 --]]
 
 local Vec3 = {}
 
 
+-- Internal globals.
+
+local has_ffi, ffi = false, nil
+if rawget(_G, 'do_use_ffi_vec3') then
+  has_ffi, ffi = pcall(require, 'ffi')
+end
+
+-- This is the FFI type of Vec3s under LuaJIT, and nil elsewhere. It's set up at
+-- the end of this file, once all the methods exist.
+local vec3_ctype = nil
+
+
 -- Internal functions.
 
+-- Returns true for tables and Vec3 structs.
+local function is_indexable(v)
+  local t = type(v)
+  return t == 'table' or t == 'cdata'
+end
+
 function vectorize_if_regular_table(t)
-  if getmetatable(t) == nil then
+  if type(t) == 'table' and getmetatable(t) == nil then
     Vec3.__index = Vec3
     setmetatable(t, Vec3)
   end
@@ -28,12 +57,18 @@ end
 -- This may be called with either params x, y, z, or with a single table
 -- containing the {x, y, z} values.
 function Vec3:new(x, y, z)
-  local v = {x, y, z}
-  if type(x) == 'table' then
-    v = {x[1], x[2], x[3]}  -- It would be bad form to steal x itself as v.
+  if is_indexable(x) then
+    x, y, z = x[1], x[2], x[3]  -- It would be bad form to steal x itself as v.
   end
+  if vec3_ctype then return vec3_ctype(x, y, z) end
   self.__index = self
-  return setmetatable(v, self)
+  return setmetatable({x, y, z}, self)
+end
+
+-- The struct check comes first as the JIT can't compile getmetatable on cdata.
+function Vec3.is_vec3(v)
+  return (vec3_ctype ~= nil and ffi.istype(vec3_ctype, v)) or
+         getmetatable(v) == Vec3
 end
 
 function Vec3:length()
@@ -41,9 +76,8 @@ function Vec3:length()
 end
 
 function Vec3:distance(other)
-  local d = {}
-  for i = 1, 3 do d[i] = self[i] - other[i] end
-  return math.sqrt(d[1] ^ 2 + d[2] ^ 2 + d[3] ^ 2)
+  local d1, d2, d3 = self[1] - other[1], self[2] - other[2], self[3] - other[3]
+  return math.sqrt(d1 ^ 2 + d2 ^ 2 + d3 ^ 2)
 end
 
 function Vec3:normalize()
@@ -55,7 +89,7 @@ function Vec3:normalize()
 end
 
 function Vec3:dot(other)
-  if type(other) ~= 'table' then
+  if not is_indexable(other) then
     -- Error level 2 indicates this is the caller's fault.
     error('Expected 2nd arg to be a vector', 2)
   end
@@ -65,7 +99,7 @@ function Vec3:dot(other)
 end
 
 function Vec3:cross(other)
-  if type(other) ~= 'table' then
+  if not is_indexable(other) then
     -- Error level 2 indicates this is the caller's fault.
     error('Expected 2nd arg to be a vector', 2)
   end
@@ -95,11 +129,11 @@ function Vec3:__add(other)
 end
 
 function Vec3:__sub(other)
-  if type(self) ~= 'table' then
+  if not is_indexable(self) then
     -- Error level 2 indicates this is the caller's fault.
     error('Expected 1st arg to be a vector', 2)
   end
-  if type(other) ~= 'table' then
+  if not is_indexable(other) then
     -- Error level 2 indicates this is the caller's fault.
     error('Expected 2nd arg to be a vector', 2)
   end
@@ -108,9 +142,9 @@ function Vec3:__sub(other)
 end
 
 function Vec3:__mul(other)
-  if getmetatable(self) == Vec3 and type(other) == 'number' then
+  if Vec3.is_vec3(self) and type(other) == 'number' then
     return Vec3:new(self[1] * other, self[2] * other, self[3] * other)
-  elseif type(self) == 'number' and getmetatable(other) == Vec3 then
+  elseif type(self) == 'number' and Vec3.is_vec3(other) then
     return Vec3:new(self * other[1], self * other[2], self * other[3])
   else
     -- Error level 2 indicates this is the caller's fault. Which it is.
@@ -119,7 +153,7 @@ function Vec3:__mul(other)
 end
 
 function Vec3:__div(other)
-  if getmetatable(self) == Vec3 and type(other) == 'number' then
+  if Vec3.is_vec3(self) and type(other) == 'number' then
     return Vec3:new(self[1] / other, self[2] / other, self[3] / other)
   else
     -- Error level 2 indicates this is the caller's fault. Which it is.
@@ -147,4 +181,34 @@ function Vec3:has_nan()
   return false
 end
 
+-- Set up the struct type under LuaJIT. Its metatable can't change once it's
+-- given to ffi.metatype, so this comes after the methods it refers to.
+
+if has_ffi then
+  ffi.cdef 'typedef struct { double x, y, z; } Vec3;'
+  vec3_ctype = ffi.metatype('Vec3', {
+    __index = function (v, k)
+      if     k == 1 then return v.x
+      elseif k == 2 then return v.y
+      elseif k == 3 then return v.z
+      end
+      return Vec3[k]
+    end,
+    __newindex = function (v, k, val)
+      if     k == 1 then v.x = val
+      elseif k == 2 then v.y = val
+      elseif k == 3 then v.z = val
+      else
+        -- Error level 2 indicates this is the caller's fault.
+        error('A Vec3 only has the keys 1, 2, and 3', 2)
+      end
+    end,
+    __len = function () return 3 end,
+    __add = Vec3.__add,
+    __sub = Vec3.__sub,
+    __mul = Vec3.__mul,
+    __div = Vec3.__div
+  })
+end
+
 return Vec3
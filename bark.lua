@@ -11,6 +11,9 @@ already have rings.
 
 local bark = {}
 
+local bones       = require 'bones'
+local cull_groups = require 'cull_groups'
+
 local Vec3 = require 'Vec3'
 
 
@@ -19,8 +22,8 @@ local Vec3 = require 'Vec3'
 -- This expects two sequence tables in `t` and `suffix.
 -- It appends the contents of `suffix` to the end of `t`.
 local function append(t, suffix)
-  for _, val in ipairs(suffix) do
-    table.insert(t, val)
+  for i = 1, #suffix do
+    table.insert(t, suffix[i])
   end
 end
 
@@ -30,78 +33,97 @@ local function add_mod(x, y, m)
   return (x + y - 1) % m + 1
 end
 
-local function add_stick_bark(tree)
+-- These are the skin weights of the vertices of each pair of stick triangles
+-- made by add_stick_bark; 1 is a vertex on the top ring, and 0 is one on the
+-- bottom ring.
+local stick_weights = {1, 0, 1, 1, 0, 0}
+
+-- This appends the triangles of the stick starting at tree_pt to bark_pts, and
+-- their skin to the flat sequence skin; see bones.lua.
+local function add_stick_bark(bark_pts, skin, tree_pt)
+
+  if tree_pt.kind ~= 'child' then return end
+
+  -- The two rings will have the same number of points except when the
+  -- upward tree point is a leaf.
+  local up_pt = tree_pt.up
+  assert(#tree_pt.ring == #up_pt.ring or up_pt.kind == 'leaf')
+
+  -- Find out which point to start with in the top ring.
+  local ray = tree_pt.ring[1] - tree_pt.ring_center
+  local up  = up_pt.pt - tree_pt.pt
+  local out = ray:cross(up)
+  -- We want the first top-ring point that's clockwise - when looking down -
+  -- from our ray. A clockwise top_ray will have top_ray:dot(out) >= 0.
+  local up_start               -- This will be the first index in up.ring.
+  local best_dot = -math.huge  -- We'll maximize up_ray:dot(ray).
+  for i = 1, #up_pt.ring do
+    local top_ray = up_pt.ring[i] - up_pt.ring_center
+    local d = top_ray:dot(ray)
+    if top_ray:dot(out) >= 0 and d > best_dot then
+      best_dot, up_start = d, i
+    end
+  end
+  assert(best_dot >= 0)
+  assert(up_start)
+
+  -- Set up the triangles, two per quad between the rings. The indices i and
+  -- up_i step around the rings together, wrapping without any mod.
+  local ring, up_ring = tree_pt.ring, up_pt.ring
+  local n, up_n = #ring, #up_ring
+  local up_i = up_start
+  for i = 1, n do
+    local next_i    = (i    == n   ) and 1 or i + 1
+    local up_next_i = (up_i == up_n) and 1 or up_i + 1
+    local bot, bot_next = ring[i],       ring[next_i]
+    local top, top_next = up_ring[up_i], up_ring[up_next_i]
+
+    -- Triangle 1.
+    append(bark_pts, top)
+    append(bark_pts, bot)
+    append(bark_pts, top_next)
+
+    -- Triangle 2.
+    append(bark_pts, top_next)
+    append(bark_pts, bot)
+    append(bark_pts, bot_next)
+
+    -- The vertices of the top ring are weighted to move with the stick's own
+    -- bone, and those of the bottom ring with its parent bone.
+    for _, weight in ipairs(stick_weights) do
+      bones.add_skin(skin, tree_pt, weight, 1)
+    end
 
-  if tree.bark == nil then tree.bark = {} end
-  if tree.bark.pts == nil then tree.bark.pts = {} end
-  local bark_pts = tree.bark.pts
+    up_i = up_next_i
+  end
 
-  for tree_idx = 1, #tree do
-    local tree_pt = tree[tree_idx]
-    if tree_pt.kind == 'child' then
-
-      -- The two rings will have the same number of points except when the
-      -- upward tree point is a leaf.
-      local up_pt = tree_pt.up
-      assert(#tree_pt.ring == #up_pt.ring or up_pt.kind == 'leaf')
-
-      -- Find out which point to start with in the top ring.
-      local ray = tree_pt.ring[1] - tree_pt.ring_center
-      local up  = up_pt.pt - tree_pt.pt
-      local out = ray:cross(up)
-      -- We want the first top-ring point that's clockwise - when looking down -
-      -- from our ray. A clockwise top_ray will have top_ray:dot(out) >= 0.
-      local up_start               -- This will be the first index in up.ring.
-      local best_dot = -math.huge  -- We'll maximize up_ray:dot(ray).
-      for i = 1, #up_pt.ring do
-        local top_ray = up_pt.ring[i] - up_pt.ring_center
-        local d = top_ray:dot(ray)
-        if top_ray:dot(out) >= 0 and d > best_dot then
-          best_dot, up_start = d, i
-        end
-      end
-      assert(best_dot >= 0)
-      assert(up_start)
-
-      -- Set up the triangles.
-      for i = 0, #tree_pt.ring - 1 do
-        -- Triangle 1.
-        append(bark_pts, up_pt.ring[add_mod(up_start, i, #up_pt.ring)])
-        append(bark_pts, tree_pt.ring[i % #tree_pt.ring + 1])
-        append(bark_pts, up_pt.ring[add_mod(up_start, i + 1, #up_pt.ring)])
-
-        -- Triangle 2.
-        append(bark_pts, up_pt.ring[add_mod(up_start, i + 1, #up_pt.ring)])
-        append(bark_pts, tree_pt.ring[i % #tree_pt.ring + 1])
-        append(bark_pts, tree_pt.ring[(i + 1) % #tree_pt.ring + 1])
-      end
+  --[[
+  -- Set up the triangle strip.
+  local num_pairs = #tree_pt.ring + 1
+  local bark_pts = {}  -- A flat sequence of bark points.
+  for i = 0, num_pairs - 1 do
+    append(bark_pts, up_pt.ring[add_mod(up_start, i, #up_pt.ring)])
+    append(bark_pts, tree_pt.ring[i % #tree_pt.ring + 1])
+  end
+  assert(#bark_pts == 3 * 2 * num_pairs)  -- They're pairs of triples.
 
-      --[[
-      -- Set up the triangle strip.
-      local num_pairs = #tree_pt.ring + 1
-      local bark_pts = {}  -- A flat sequence of bark points.
-      for i = 0, num_pairs - 1 do
-        append(bark_pts, up_pt.ring[add_mod(up_start, i, #up_pt.ring)])
-        append(bark_pts, tree_pt.ring[i % #tree_pt.ring + 1])
-      end
-      assert(#bark_pts == 3 * 2 * num_pairs)  -- They're pairs of triples.
+  tree_pt.stick_bark = VertexArray:new(bark_pts, 'triangle strip')
+  --]]
+end
 
-      tree_pt.stick_bark = VertexArray:new(bark_pts, 'triangle strip')
-      --]]
-    end
-  end
+-- This returns the coordinates of (to - from):cross(u), where u = (u1, u2, u3),
+-- without making any new tables.
+local function cross_from(from, to, u1, u2, u3)
+  local r1, r2, r3 = to[1] - from[1], to[2] - from[2], to[3] - from[3]
+  return r2 * u3 - r3 * u2, r3 * u1 - r1 * u3, r1 * u2 - r2 * u1
 end
 
-local function add_joint_piece(tree, tree_pt,
+local function add_joint_piece(bark_pts, tree_pt,
                                top_pts, top_first, top_last,
                                bot_pts, bot_first, bot_last)
   assert(top_first < top_last and top_last <= #top_pts)
   assert(bot_first < bot_last and bot_last <= #bot_pts)
 
-  if tree.bark == nil then tree.bark = {} end
-  if tree.bark.pts == nil then tree.bark.pts = {} end
-  local bark_pts = tree.bark.pts
-
   local leafward = tree_pt.pt - tree_pt.down.pt
 
   local pts  = {top_pts,   bot_pts}
@@ -121,14 +143,18 @@ local function add_joint_piece(tree, tree_pt,
     end
 
     if new_idx == false then
-      -- Find the potential normals so we know which triangle to add.
-      local normals = {}
-      local up = pts[1][idx[1]] - pts[2][idx[2]]
-      for i = 1, 2 do
-        local right = pts[i][idx[i] + 1] - pts[2][idx[2]]
-        table.insert(normals, right:cross(up))
-      end
-      if normals[1]:cross(leafward):dot(normals[2]) > 0 then
+      -- Find the potential normals so we know which triangle to add. This is
+      -- done with plain numbers as it runs for every joint triangle.
+      local top, bot = pts[1][idx[1]], pts[2][idx[2]]
+      local u1, u2, u3 = top[1] - bot[1], top[2] - bot[2], top[3] - bot[3]
+      local a1, a2, a3 = cross_from(bot, pts[1][idx[1] + 1], u1, u2, u3)
+      local b1, b2, b3 = cross_from(bot, pts[2][idx[2] + 1], u1, u2, u3)
+      local l = leafward
+      -- This is normals[1]:cross(leafward):dot(normals[2]).
+      local turn = (a2 * l[3] - a3 * l[2]) * b1 +
+                   (a3 * l[1] - a1 * l[3]) * b2 +
+                   (a1 * l[2] - a2 * l[1]) * b3
+      if turn > 0 then
         -- In this case, normal[2] is farther clockwise.
         new_idx = 2
       else
@@ -143,57 +169,59 @@ local function add_joint_piece(tree, tree_pt,
   until idx[1] == last[1] and idx[2] == last[2]
 end
 
-local function add_joint_bark(tree)
-  for tree_idx = 1, #tree do
-    local tree_pt = tree[tree_idx]
-    if tree_pt.kind == 'parent' then
+-- This appends the triangles of the joint at tree_pt to bark_pts, and their
+-- skin to the flat sequence skin. The whole joint moves with the stick below
+-- it.
+local function add_joint_bark(bark_pts, skin, tree_pt)
+  if tree_pt.kind ~= 'parent' then return end
+  local num_pts_before = #bark_pts
+
+  -- Set up top_pts with the combined points of the top rings.
+  local top_pts = {}
+  for _, kid in ipairs(tree_pt.kids) do
+    for i = 2, #kid.ring do
+      table.insert(top_pts, kid.ring[i])
+    end
+  end
 
-      -- Set up top_pts with the combined points of the top rings.
-      local top_pts = {}
-      for _, kid in ipairs(tree_pt.kids) do
-        for i = 2, #kid.ring do
-          table.insert(top_pts, kid.ring[i])
-        end
+  -- Set up bot_pts to have the points of tree_pt.ring, but with a
+  -- carefully-chosen first point.
+  local mid_pt = tree_pt.kids[1].ring_meet_mid_pt
+  local bot_idx = {}
+  for i = 1, 2 do
+    local top_ray = tree_pt.kids[i].ring[2] - mid_pt
+    local best_dot, bot_start = -math.huge, nil
+    for i = 1, #tree_pt.ring do
+      local bot_ray = tree_pt.ring[i] - tree_pt.ring_center
+      local d = bot_ray:dot(top_ray)
+      if d > best_dot then
+        best_dot, bot_start = d, i
       end
+    end
+    bot_idx[i] = bot_start
+  end
+  local bot_pts = {}
+  local num_pts = #tree_pt.ring
+  for i = bot_idx[1], bot_idx[1] + num_pts - 1 do
+    bot_pts[#bot_pts + 1] = tree_pt.ring[(i - 1) % num_pts + 1]
+  end
 
-      -- Set up bot_pts to have the points of tree_pt.ring, but with a
-      -- carefully-chosen first point.
-      local mid_pt = tree_pt.kids[1].ring_meet_mid_pt
-      local bot_idx = {}
-      for i = 1, 2 do
-        local top_ray = tree_pt.kids[i].ring[2] - mid_pt
-        local best_dot, bot_start = -math.huge, nil
-        for i = 1, #tree_pt.ring do
-          local bot_ray = tree_pt.ring[i] - tree_pt.ring_center
-          local d = bot_ray:dot(top_ray)
-          if d > best_dot then
-            best_dot, bot_start = d, i
-          end
-        end
-        bot_idx[i] = bot_start
-      end
-      local bot_pts = {}
-      local num_pts = #tree_pt.ring
-      for i = bot_idx[1], bot_idx[1] + num_pts - 1 do
-        bot_pts[#bot_pts + 1] = tree_pt.ring[(i - 1) % num_pts + 1]
-      end
+  -- The letter k indicates the halfway-around index within {top,bot}_pts.
+  local bot_k = (bot_idx[2] - bot_idx[1]) % num_pts + 1
+  local top_k = #tree_pt.kids[1].ring
 
-      -- The letter k indicates the halfway-around index within {top,bot}_pts.
-      local bot_k = (bot_idx[2] - bot_idx[1]) % num_pts + 1
-      local top_k = #tree_pt.kids[1].ring
+  -- Augment both top_pts and bot_pts with a repeat of their first point.
+  top_pts[#top_pts + 1] = top_pts[1]
+  bot_pts[#bot_pts + 1] = bot_pts[1]
 
-      -- Augment both top_pts and bot_pts with a repeat of their first point.
-      top_pts[#top_pts + 1] = top_pts[1]
-      bot_pts[#bot_pts + 1] = bot_pts[1]
+  -- Add triangles in two pieces: one for each of the top rings.
+  local k = #tree_pt.kids[1].ring
+  add_joint_piece(bark_pts, tree_pt, top_pts, 1, top_k, bot_pts, 1, bot_k)
+  add_joint_piece(bark_pts, tree_pt,
+                  top_pts, top_k, #top_pts,
+                  bot_pts, bot_k, #bot_pts)
 
-      -- Add triangles in two pieces: one for each of the top rings.
-      local k = #tree_pt.kids[1].ring
-      add_joint_piece(tree, tree_pt, top_pts, 1, top_k, bot_pts, 1, bot_k)
-      add_joint_piece(tree, tree_pt,
-                      top_pts, top_k, #top_pts,
-                      bot_pts, bot_k, #bot_pts)
-    end
-  end
+  bones.add_skin(skin, tree_pt.down, 1, (#bark_pts - num_pts_before) / 3)
 end
 
 -- TODO Consider removing this.
@@ -272,11 +300,40 @@ function bark.add_bark(tree)
     assert(tree_pt.ring, 'Expected that all tree pts would have a ring.')
   end
 
-  -- Add the bark.
-  add_stick_bark(tree)
-  add_joint_bark(tree)
-  --local yellow = {1, 1, 0}
-  tree.bark.v_array = VertexArray:new(tree.bark.pts, 'triangles')
+  -- Add the bark. We do this in tree order, which is depth-first, so that the
+  -- bark of each cull group - and of each subtree - is contiguous.
+  -- Each tree point's vertex count is kept so that the bark of a single point
+  -- can be found and replaced later; see bark.add_pt_bark.
+  tree.bark      = tree.bark or {}
+  tree.bark.pts  = tree.bark.pts or {}
+  tree.bark.skin = tree.bark.skin or {}
+  for tree_idx = 1, #tree do
+    local tree_pt = tree[tree_idx]
+    local num_pts = #tree.bark.pts
+    bark.add_pt_bark(tree.bark.pts, tree.bark.skin, tree_pt)
+    tree_pt.num_bark_vertices = (#tree.bark.pts - num_pts) / 3
+  end
+  bark.update_groups(tree)
+end
+
+-- This appends the bark triangles that belong to tree_pt to the flat sequence
+-- bark_pts, and their skin to the flat sequence skin. Child points own the bark
+-- of their stick, and parent points own the bark of their joint; other points
+-- have no bark. The tree is expected to have bones; see bones.lua.
+function bark.add_pt_bark(bark_pts, skin, tree_pt)
+  add_stick_bark(bark_pts, skin, tree_pt)
+  add_joint_bark(bark_pts, skin, tree_pt)
+end
+
+-- This sets up tree.bark.groups from the num_bark_vertices and cull_group
+-- values of the tree points. It's called again when those values change.
+function bark.update_groups(tree)
+  tree.bark.groups = {sizes = {}}
+  for tree_idx = 1, #tree do
+    local tree_pt = tree[tree_idx]
+    cull_groups.add(tree.bark.groups, tree_pt.cull_group,
+                    tree_pt.num_bark_vertices)
+  end
 end
 
 
@@ -0,0 +1,120 @@
+--[[
+
+bones.lua
+
+A module to set up the bones of a tree, which the Wind module sways.
+
+Each stick of a tree is a bone. The bone of a stick is numbered by the `bone`
+field of its child item; bone 0 is the ground, which never moves, and is the
+parent of the trunk's bone. Each bone's parent has a lower number than it does.
+Bones keep their numbers when a tree is edited. The numbers of dropped sticks
+are kept in tree.free_bones, and new sticks reuse them where that keeps this
+order, so that editing a tree doesn't keep adding bones.
+
+The bones of a tree are kept in tree.bones, a flat sequence with these 8
+numbers for each bone, in order of bone number, starting with bone 1:
+
+   parent bone, base x, y, z, tip x, y, z, radius
+
+The radius is that of the ring at the stick's base; thin bones sway more than
+thick ones.
+
+Each bark and leaf vertex is skinned by 3 numbers: its bone, the parent of its
+bone, and a weight. The vertex moves with the parent's transform when the weight
+is 0, and with its bone's transform when it's 1. The skin of a sequence of
+vertices is a flat sequence of these triples; see bones.add_skin.
+
+--]]
+
+local bones = {}
+
+
+-- Internal functions.
+
+-- This returns a bone number for a new stick whose parent bone is parent_bone.
+-- It's the lowest free number above parent_bone, or else a new one.
+local function new_bone(tree, parent_bone)
+  local free = tree.free_bones
+  -- Binary search for the first free number above parent_bone.
+  local lo, hi = 1, #free + 1
+  while lo < hi do
+    local mid = math.floor((lo + hi) / 2)
+    if free[mid] > parent_bone then hi = mid else lo = mid + 1 end
+  end
+  if lo <= #free then return table.remove(free, lo) end
+  tree.num_bones = tree.num_bones + 1
+  return tree.num_bones
+end
+
+
+-- Public functions.
+
+-- This numbers the bones of any new sticks of the tree, and sets tree.bones to
+-- match the tree's current skeleton. It expects the tree to have rings.
+function bones.update_bones(tree)
+  tree.num_bones  = tree.num_bones or 0
+  tree.bones      = tree.bones or {}
+  tree.free_bones = tree.free_bones or {}
+  local b = tree.bones
+  for i = 1, #tree do
+    local stick = tree[i]
+    if stick.kind == 'child' then
+      local parent_bone = stick.parent and stick.parent.down.bone or 0
+      -- The tree is in depth-first order, so a stick's parent is numbered
+      -- before the stick is.
+      if stick.bone == nil then stick.bone = new_bone(tree, parent_bone) end
+      local j = 8 * (stick.bone - 1)
+      b[j + 1] = parent_bone
+      for k = 1, 3 do
+        b[j + 1 + k] = stick.pt[k]
+        b[j + 4 + k] = stick.up.pt[k]
+      end
+      b[j + 8] = (stick.ring[1] - stick.ring_center):length()
+    end
+  end
+end
+
+-- This frees the bones of the sticks in the sequence tree_pts, which have been
+-- dropped from the tree, so that bones.update_bones can reuse their numbers.
+-- The entries of freed bones stay in tree.bones until they're reused.
+function bones.free_bones(tree, tree_pts)
+  tree.free_bones = tree.free_bones or {}
+  local free = tree.free_bones
+  for _, tree_pt in ipairs(tree_pts) do
+    if tree_pt.kind == 'child' and tree_pt.bone then
+      free[#free + 1] = tree_pt.bone
+    end
+  end
+  table.sort(free)
+end
+
+-- This appends num_vertices skin triples to the flat sequence skin, each of
+-- which puts a vertex on the bone of stick with the given weight.
+function bones.add_skin(skin, stick, weight, num_vertices)
+  if num_vertices == 0 then return end
+  local bone   = stick.bone
+  local parent = stick.parent and stick.parent.down.bone or 0
+  local n = #skin
+  for i = 0, num_vertices - 1 do
+    skin[n + 3 * i + 1] = bone
+    skin[n + 3 * i + 2] = parent
+    skin[n + 3 * i + 3] = weight
+  end
+end
+
+-- This appends the skin of tree_pt's leaf vertices to the flat sequence skin.
+-- Each leaf glob moves with the stick that ends at its fork.
+function bones.add_leaf_skin(skin, tree_pt)
+  bones.add_skin(skin, tree_pt.down, 1, tree_pt.num_leaf_vertices or 0)
+end
+
+-- This returns the skin of all of the tree's leaf vertices, which are expected
+-- to be in tree order.
+function bones.leaf_skin(tree)
+  local skin = {}
+  for i = 1, #tree do bones.add_leaf_skin(skin, tree[i]) end
+  return skin
+end
+
+
+return bones
@@ -0,0 +1,16 @@
+// clock.c
+//
+
+#include "clock.h"
+
+// Standard library includes.
+#include <time.h>
+
+
+// Public functions.
+
+double clock__now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
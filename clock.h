@@ -0,0 +1,10 @@
+// clock.h
+//
+// A monotonic clock, for timing frames and work.
+//
+
+#pragma once
+
+// Returns the current time in seconds. Only differences between return values
+// are meaningful; the clock isn't affected by changes to the wall-clock time.
+double clock__now();
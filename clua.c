@@ -4,6 +4,8 @@
 #include "clua.h"
 
 // Local includes.
+#include "clock.h"
+#include "cstructs/allocator.h"
 #include "file.h"
 
 // Library includes.
@@ -12,8 +14,6 @@
 
 // System includes.
 #include <errno.h>
-#include <mach/mach.h>
-#include <mach/mach_time.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
@@ -23,6 +23,21 @@
 #define dbg__printf(...) printf(__VA_ARGS__)
 
 
+// Internal types and globals.
+
+// Pooled states keep blocks of up to max_pooled_size bytes in pools, one per
+// size class of 16, 32, 48, .., max_pooled_size bytes. Lua's tables, strings,
+// and closures are mostly this small.
+#define size_class_step  16
+#define num_size_classes 16
+#define max_pooled_size  (size_class_step * num_size_classes)
+#define pool_chunk_size  (64 * 1024)
+
+typedef struct {
+  Allocator pools[num_size_classes];
+} Pools;
+
+
 // Internal functions.
 
 void clua__print(const char *s) {
@@ -86,12 +101,7 @@ endargs:;  // Semi-colon here as an empty statement so we can declare nresults.
   int nresults = (int)strlen(types);
   int results_left = nresults;
   int error = lua_pcall(L, nargs, nresults, 0);
-  if (error) {
-    char msg[512];
-    snprintf(msg, 512, "Error in call to %s.%s:", mod, fn);
-    clua__print(msg);
-    clua__print_error(L);
-  }
+  if (error) clua__print_call_error(L, mod, fn);
   const char *type_err_fmt =
       "clua__call type error: bad result type - expected type %s\n";
   
@@ -179,26 +189,82 @@ static const char *clua__lua_dir() {
 }
 
 
+// Pooled allocation functions.
+
+// Returns the size class of size bytes, or -1 if they're too many to pool.
+static int size_class(size_t size) {
+  if (size > max_pooled_size) return -1;
+  return (int)((size - 1) / size_class_step);
+}
+
+static void *alloc_block(Pools *pools, size_t size) {
+  int c = size_class(size);
+  if (c == -1) return malloc(size);
+  return allocator__alloc(pools->pools[c], (c + 1) * size_class_step);
+}
+
+static void free_block(Pools *pools, void *ptr, size_t size) {
+  if (ptr == NULL) return;
+  int c = size_class(size);
+  if (c == -1) {
+    free(ptr);
+  } else {
+    allocator__free(pools->pools[c], ptr, size);
+  }
+}
+
+// This is the lua_Alloc of pooled states. Lua always passes the size it last
+// asked for as osize, so blocks don't need headers to know their class.
+static void *pooled_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pools *pools = (Pools *)ud;
+
+  if (nsize == 0) {
+    free_block(pools, ptr, osize);
+    return NULL;
+  }
+  // When ptr is NULL, osize is the type of the new object rather than a size.
+  if (ptr == NULL) return alloc_block(pools, nsize);
+
+  int old_class = size_class(osize);
+  int new_class = size_class(nsize);
+  if (old_class == -1 && new_class == -1) return realloc(ptr, nsize);
+  if (old_class == new_class) return ptr;
+
+  void *new_ptr = alloc_block(pools, nsize);
+  if (new_ptr == NULL) return NULL;  // Lua expects ptr to be left alone.
+  memcpy(new_ptr, ptr, osize < nsize ? osize : nsize);
+  free_block(pools, ptr, osize);
+  return new_ptr;
+}
+
+static void delete_pools(Pools *pools) {
+  for (int c = 0; c < num_size_classes; ++c) {
+    allocator__delete_pool(pools->pools[c]);
+  }
+  free(pools);
+}
+
+// This matches the panic function of states made by luaL_newstate.
+static int panic(lua_State *L) {
+  dbg__printf("PANIC: unprotected error in call to Lua API (%s)\n",
+              lua_tostring(L, -1));
+  return 0;  // Return to Lua to abort.
+}
+
+
 // Lua-public functions.
 
 static int timestamp(lua_State *L) {
-  static int did_initialize = FALSE;
-  static mach_timebase_info_data_t timebase_info;
-  if (!did_initialize) {
-    mach_timebase_info(&timebase_info);
-    did_initialize = TRUE;
-  }
-  uint64_t abs_time = mach_absolute_time();
-  lua_pushnumber(L,
-      (double)abs_time * timebase_info.numer / timebase_info.denom / 1e9f);
+  lua_pushnumber(L, clock__now());
   return 1;  // 1 = number of return values
 }
 
 
-// C-public functions.
+// Internal: state setup.
 
-lua_State *clua__new_state() {
-  lua_State *L = luaL_newstate();
+// This sets up a new state with the standard libraries, our Lua directory in
+// package.path, and the timestamp global.
+static void set_up_state(lua_State *L) {
   luaL_openlibs(L);
   
   char new_lua_path[1024];
@@ -220,10 +286,44 @@ lua_State *clua__new_state() {
   // Stack = [timestamp]
   lua_setglobal(L, "timestamp");
   // Stack = []
-  
+}
+
+
+// C-public functions.
+
+lua_State *clua__new_state() {
+  lua_State *L = luaL_newstate();
+  set_up_state(L);
   return L;
 }
 
+lua_State *clua__new_pooled_state() {
+#if LUA_VERSION_NUM == 501
+  // LuaJIT's own allocator already pools small blocks, and 64-bit builds of
+  // it may not accept other allocators.
+  return clua__new_state();
+#else
+  Pools *pools = malloc(sizeof(Pools));
+  for (int c = 0; c < num_size_classes; ++c) {
+    size_t block_size = (c + 1) * size_class_step;
+    pools->pools[c] = allocator__new_pool(block_size,
+                                          pool_chunk_size / block_size);
+  }
+
+  lua_State *L = lua_newstate(pooled_alloc, pools);
+  lua_atpanic(L, panic);
+  set_up_state(L);
+  return L;
+#endif
+}
+
+void clua__close_state(lua_State *L) {
+  void *ud;
+  lua_Alloc alloc = lua_getallocf(L, &ud);
+  lua_close(L);
+  if (alloc == pooled_alloc) delete_pools((Pools *)ud);
+}
+
 // Most of this function is from a similar function in the book Programming in
 // Lua by Roberto Ierusalimschy, 3rd edition.
 void clua__dump_stack(lua_State *L) {
@@ -269,6 +369,37 @@ void clua__call(lua_State *L, const char *mod,
   va_end(args);
 }
 
+int clua__ref(lua_State *L, const char *mod, const char *fn) {
+  lua_getglobal(L, mod);
+      // stack = [.., mod]
+  if (!lua_istable(L, -1)) {
+    dbg__printf("clua__ref: module '%s' is not loaded\n", mod);
+    lua_pop(L, 1);
+    return LUA_NOREF;
+  }
+  lua_getfield(L, -1, fn);
+      // stack = [.., mod, mod.fn]
+  lua_remove(L, -2);
+      // stack = [.., mod.fn]
+  if (!lua_isfunction(L, -1)) {
+    dbg__printf("clua__ref: %s.%s is not a function\n", mod, fn);
+    lua_pop(L, 1);
+    return LUA_NOREF;
+  }
+  return luaL_ref(L, LUA_REGISTRYINDEX);  // This pops mod.fn.
+}
+
+void clua__unref(lua_State *L, int ref) {
+  luaL_unref(L, LUA_REGISTRYINDEX, ref);
+}
+
+void clua__print_call_error(lua_State *L, const char *mod, const char *fn) {
+  char msg[512];
+  snprintf(msg, 512, "Error in call to %s.%s:", mod, fn);
+  clua__print(msg);
+  clua__print_error(L);
+}
+
 // Debugging functions, meant to be called from an interactive C debugger.
 
 void clua__run(lua_State *L, const char *cmd) {  
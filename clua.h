@@ -12,7 +12,27 @@
 // C-public functions.
 
 lua_State * clua__new_state();
+
+// A pooled state keeps its small blocks in size-class pools of its own, which
+// suits a state that churns through short-lived tables. Like any state, it's
+// only to be used by one thread at a time. Pools only give their memory back
+// when the state is closed with clua__close_state, which works for any state.
+lua_State * clua__new_pooled_state();
+void        clua__close_state(lua_State *L);
+
 void        clua__call(lua_State *L, const char *mod,
                        const char *fn, const char *types, ...);
+
+// These keep a module function, mod.fn, in the registry so it can be called
+// without looking it up by name; see lua_function.h. If mod.fn isn't a
+// function, this prints a message and returns LUA_NOREF.
+int         clua__ref  (lua_State *L, const char *mod, const char *fn);
+void        clua__unref(lua_State *L, int ref);
+
+// This prints and pops the error message on top of L's stack, after a failed
+// call to mod.fn.
+void        clua__print_call_error(lua_State *L, const char *mod,
+                                   const char *fn);
+
 void        clua__run          (lua_State *L, const char *cmd);
 void        clua__dump_stack(lua_State *L);
@@ -17,14 +17,59 @@
 // simplified version of the algorithms used.
 #define    is_tree_2d         NO
 
+// Trees are made from the species named here, separated by spaces. Each is
+// described by the file species/<name>.species; see species.h. Each new single
+// tree takes the next species in turn, and a forest mixes them all.
+#define    species_names      "default"
+
+// These are the defaults for the species parameters that a species file leaves
+// out, and they shape trees made without a species.
 #define    max_tree_height    10
 #define    min_tree_height     7
+#define    branch_size_factor 0.79
+#define    max_ring_pts       6
 
 // This modifies the view transform by effectively zooming toward or away from
 // the tree.
 #define    zoom_scale         2.3
 
-#define    branch_size_factor 0.79
-#define    max_ring_pts       6
-
 #define    do_draw_rings      NO
+
+// If this is above zero, render.lua draws a square grid of this many trees on
+// each side, using the Forest module, instead of a single tree.
+#define    forest_grid_size   0
+#define    forest_spacing     1.5
+
+// Forest cull groups are the subtrees rooted at sticks of this depth; sticks
+// closer to the trunk get their own groups.
+#define    cull_group_depth   3
+
+// Forest parts farther than this from the eye, in model space, aren't drawn.
+// Use 0 to turn off distance culling.
+#define    forest_cull_distance 60.0
+
+// If this is YES and the Lua scripts run on LuaJIT, Vec3s are FFI structs
+// rather than tables; see Vec3.lua. It has no effect under PUC Lua.
+#define    do_use_ffi_vec3    NO
+
+// If this is YES, single trees are generated on a background thread, so the
+// first frames are drawn before the tree is ready, and regenerating never
+// blocks rendering.
+#define    do_generate_async  YES
+
+// This scales how far the wind sways the branches of single trees; see wind.h.
+// Use 0 for still trees.
+#define    wind_strength      1.0
+
+// At most this many megabytes of new vertex data are sent to the gpu per frame,
+// so that trees streaming in don't cause frame time spikes. Use 0 for no limit.
+#define    upload_budget_mb   2.0
+
+// These control the portable glfw_main.c render loop. If fixed_update_rate is
+// above zero, the animation advances in fixed steps at that many updates per
+// second; otherwise it advances by each frame's measured duration. Frame
+// pacing stats are printed every frame_stats_interval seconds; use 0 to turn
+// them off.
+#define    do_use_vsync       YES
+#define    fixed_update_rate  120
+#define    frame_stats_interval 5.0
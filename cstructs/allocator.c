@@ -0,0 +1,253 @@
+// allocator.c
+//
+
+#include "allocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The memprofile macros need to come after the system headers.
+#if defined(DEBUG) || defined(MEMPROFILE)
+#include "memprofile.h"
+#endif
+
+// The function members of an allocator are called as (allocator->fn)(..) so
+// that the memprofile macros for malloc, realloc, and free leave them alone.
+
+
+// Internal types and globals.
+
+// Pool blocks and thread-local size classes are multiples of this many bytes.
+#define alignment 16
+
+#define align_up(n) (((n) + alignment - 1) & ~(size_t)(alignment - 1))
+
+// A free block, in either a pool or a thread-local cache.
+typedef struct Block {
+  struct Block *next;
+} Block;
+
+typedef struct PoolChunk {
+  struct PoolChunk *prev;
+} PoolChunk;
+
+#define pool_chunk_header_size align_up(sizeof(PoolChunk))
+
+typedef struct {
+  AllocatorStruct allocator;  // This is first so an Allocator is also a Pool.
+  size_t          block_size;
+  int             blocks_per_chunk;
+  Block          *free_blocks;
+  PoolChunk      *chunks;
+} Pool;
+
+// The thread-local size classes are 16, 32, 64, .., max_class_size bytes.
+#define num_classes    7
+#define max_class_size (alignment << (num_classes - 1))
+
+// The most blocks each thread keeps per size class; others go to the heap.
+#define max_cached_blocks 64
+
+static __thread Block *cached_blocks[num_classes];
+static __thread int    num_cached_blocks[num_classes];
+
+
+// Internal functions.
+
+static void *heap_alloc(void *context, size_t size) {
+  (void)context;
+  return malloc(size);
+}
+
+static void *heap_realloc(void *context, void *ptr, size_t old_size,
+                          size_t new_size) {
+  (void)context;
+  (void)old_size;
+  return realloc(ptr, new_size);
+}
+
+static void heap_free(void *context, void *ptr, size_t size) {
+  (void)context;
+  (void)size;
+  free(ptr);
+}
+
+// This moves a block from one allocator to another when it changes hands
+// during a realloc.
+static void *move_block(void *context, void *ptr, size_t old_size,
+                        size_t new_size,
+                        void *(*alloc)(void *, size_t),
+                        void  (*free_block)(void *, void *, size_t)) {
+  void *new_ptr = alloc(context, new_size);
+  memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+  free_block(context, ptr, old_size);
+  return new_ptr;
+}
+
+// Pool functions.
+
+static void add_pool_chunk(Pool *pool) {
+  PoolChunk *chunk = malloc(pool_chunk_header_size +
+                            pool->block_size * pool->blocks_per_chunk);
+  chunk->prev  = pool->chunks;
+  pool->chunks = chunk;
+
+  char *blocks = (char *)chunk + pool_chunk_header_size;
+  for (int i = pool->blocks_per_chunk - 1; i >= 0; --i) {
+    Block *block = (Block *)(blocks + i * pool->block_size);
+    block->next       = pool->free_blocks;
+    pool->free_blocks = block;
+  }
+}
+
+static void *pool_alloc(void *context, size_t size) {
+  Pool *pool = (Pool *)context;
+  if (size > pool->block_size) return malloc(size);
+  if (pool->free_blocks == NULL) add_pool_chunk(pool);
+  Block *block      = pool->free_blocks;
+  pool->free_blocks = block->next;
+  return block;
+}
+
+static void pool_free(void *context, void *ptr, size_t size) {
+  Pool *pool = (Pool *)context;
+  if (ptr == NULL) return;
+  if (size > pool->block_size) {
+    free(ptr);
+    return;
+  }
+  Block *block      = (Block *)ptr;
+  block->next       = pool->free_blocks;
+  pool->free_blocks = block;
+}
+
+static void *pool_realloc(void *context, void *ptr, size_t old_size,
+                          size_t new_size) {
+  Pool *pool = (Pool *)context;
+  if (ptr == NULL) return pool_alloc(context, new_size);
+  int was_in_pool = (old_size <= pool->block_size);
+  int is_in_pool  = (new_size <= pool->block_size);
+  if (was_in_pool && is_in_pool) return ptr;
+  if (!was_in_pool && !is_in_pool) return realloc(ptr, new_size);
+  return move_block(context, ptr, old_size, new_size, pool_alloc, pool_free);
+}
+
+// Thread-local functions.
+
+// Returns the size class for size bytes, or -1 if they're too many to cache.
+static int class_of_size(size_t size) {
+  if (size > max_class_size) return -1;
+  int    class_index = 0;
+  size_t class_size  = alignment;
+  while (class_size < size) {
+    class_size <<= 1;
+    ++class_index;
+  }
+  return class_index;
+}
+
+static void *thread_local_alloc(void *context, size_t size) {
+  (void)context;
+  int c = class_of_size(size);
+  if (c == -1) return malloc(size);
+  Block *block = cached_blocks[c];
+  if (block == NULL) return malloc(alignment << c);
+  cached_blocks[c] = block->next;
+  num_cached_blocks[c]--;
+  return block;
+}
+
+static void thread_local_free(void *context, void *ptr, size_t size) {
+  (void)context;
+  int c = class_of_size(size);
+  if (ptr == NULL) return;
+  if (c == -1 || num_cached_blocks[c] == max_cached_blocks) {
+    free(ptr);
+    return;
+  }
+  Block *block     = (Block *)ptr;
+  block->next      = cached_blocks[c];
+  cached_blocks[c] = block;
+  num_cached_blocks[c]++;
+}
+
+static void *thread_local_realloc(void *context, void *ptr, size_t old_size,
+                                  size_t new_size) {
+  if (ptr == NULL) return thread_local_alloc(context, new_size);
+  int old_class = class_of_size(old_size);
+  int new_class = class_of_size(new_size);
+  if (old_class == -1 && new_class == -1) return realloc(ptr, new_size);
+  if (old_class == new_class) return ptr;
+  return move_block(context, ptr, old_size, new_size,
+                    thread_local_alloc, thread_local_free);
+}
+
+static AllocatorStruct thread_local_allocator = {
+  .alloc   = thread_local_alloc,
+  .realloc = thread_local_realloc,
+  .free    = thread_local_free,
+  .context = NULL
+};
+
+
+// Public functions.
+
+void *allocator__alloc(Allocator allocator, size_t size) {
+  if (allocator == NULL) return heap_alloc(NULL, size);
+  return (allocator->alloc)(allocator->context, size);
+}
+
+void *allocator__realloc(Allocator allocator, void *ptr,
+                         size_t old_size, size_t new_size) {
+  if (allocator == NULL) return heap_realloc(NULL, ptr, old_size, new_size);
+  return (allocator->realloc)(allocator->context, ptr, old_size, new_size);
+}
+
+void allocator__free(Allocator allocator, void *ptr, size_t size) {
+  if (allocator == NULL) {
+    heap_free(NULL, ptr, size);
+  } else {
+    (allocator->free)(allocator->context, ptr, size);
+  }
+}
+
+Allocator allocator__new_pool(size_t block_size, int blocks_per_chunk) {
+  Pool *pool = malloc(sizeof(Pool));
+  pool->allocator.alloc   = pool_alloc;
+  pool->allocator.realloc = pool_realloc;
+  pool->allocator.free    = pool_free;
+  pool->allocator.context = pool;
+
+  if (block_size < sizeof(Block)) block_size = sizeof(Block);
+  pool->block_size       = align_up(block_size);
+  pool->blocks_per_chunk = blocks_per_chunk > 0 ? blocks_per_chunk : 1;
+  pool->free_blocks      = NULL;
+  pool->chunks           = NULL;
+
+  return &pool->allocator;
+}
+
+void allocator__delete_pool(Allocator allocator) {
+  Pool *pool = (Pool *)allocator;
+  while (pool->chunks) {
+    PoolChunk *prev = pool->chunks->prev;
+    free(pool->chunks);
+    pool->chunks = prev;
+  }
+  free(pool);
+}
+
+Allocator allocator__thread_local() {
+  return &thread_local_allocator;
+}
+
+void allocator__thread_local_trim() {
+  for (int c = 0; c < num_classes; ++c) {
+    while (cached_blocks[c]) {
+      Block *next = cached_blocks[c]->next;
+      free(cached_blocks[c]);
+      cached_blocks[c] = next;
+    }
+    num_cached_blocks[c] = 0;
+  }
+}
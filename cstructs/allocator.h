@@ -0,0 +1,70 @@
+// allocator.h
+//
+// A pluggable source of memory for Arrays, Maps, and Lists.
+//
+// An Allocator is a table of functions plus a context that's passed to each of
+// them. Every function is also told the size of the block it works on, so that
+// allocators don't need to track sizes themselves. A NULL Allocator stands for
+// the heap, using malloc, realloc, and free.
+//
+// Containers take an Allocator when they're created, and use it for all of
+// their memory, including their own structs; see array__new_with_allocator,
+// map__new_with_allocator, and list__insert_with_allocator. An Allocator must
+// outlive the containers that use it.
+//
+// Ready-made allocators:
+//
+//   * The arena allocator of an Arena, from arena__allocator. Its free does
+//     nothing; memory comes back when the arena is reset.
+//   * A pool allocator, which hands out fixed-size blocks from a free list. It
+//     suits containers of many small items, such as the pairs and list entries
+//     of a Map. Larger requests go to the heap.
+//   * The thread-local allocator, which keeps a per-thread cache of freed small
+//     blocks, sorted by size, so that each thread mostly reuses its own memory
+//     without touching the shared heap. Its blocks may be freed on any thread.
+//
+// Pool and arena allocators aren't thread-safe; each thread is expected to use
+// its own.
+//
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct {
+  void *(*alloc)  (void *context, size_t size);
+  void *(*realloc)(void *context, void *ptr, size_t old_size, size_t new_size);
+  void  (*free)   (void *context, void *ptr, size_t size);
+  void   *context;
+} AllocatorStruct;
+
+typedef AllocatorStruct *Allocator;
+
+
+// These call into allocator, or into the heap if allocator is NULL.
+
+void *allocator__alloc   (Allocator allocator, size_t size);
+void *allocator__realloc (Allocator allocator, void *ptr,
+                          size_t old_size, size_t new_size);
+void  allocator__free    (Allocator allocator, void *ptr, size_t size);
+
+
+// Pool allocators.
+
+// Returns a new pool of blocks of block_size bytes, which grabs
+// blocks_per_chunk blocks from the heap at a time.
+Allocator allocator__new_pool    (size_t block_size, int blocks_per_chunk);
+
+// Frees all of the pool's blocks, including blocks still in use. Requests
+// larger than a block come from the heap and aren't tracked by the pool; they
+// must be freed with allocator__free before the pool is deleted.
+void      allocator__delete_pool (Allocator pool);
+
+
+// The thread-local allocator.
+
+Allocator allocator__thread_local      ();
+
+// Frees the blocks cached by the calling thread. Threads that use the
+// thread-local allocator are expected to call this before they exit.
+void      allocator__thread_local_trim ();
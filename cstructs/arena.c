@@ -0,0 +1,171 @@
+// arena.c
+//
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The memprofile macros need to come after the system headers.
+#if defined(DEBUG) || defined(MEMPROFILE)
+#include "memprofile.h"
+#endif
+
+
+// Internal types and globals.
+
+// Every block starts at a multiple of this many bytes from its chunk's start.
+#define alignment 16
+
+#define align_up(n) (((n) + alignment - 1) & ~(size_t)(alignment - 1))
+
+typedef struct Chunk {
+  struct Chunk *prev;  // The previous chunk, or NULL for the first one.
+  size_t        size;  // The number of usable bytes.
+  size_t        used;
+} Chunk;
+
+#define header_size align_up(sizeof(Chunk))
+
+struct ArenaStruct {
+  AllocatorStruct  allocator;   // The table returned by arena__allocator.
+  Chunk           *chunk;       // The newest chunk; others are reached by prev.
+  size_t           chunk_size;  // The minimum size of a new chunk.
+  size_t           total_size;  // The sum of the sizes of all chunks.
+  void            *last;        // The newest block; it can be resized in place.
+};
+
+
+// Internal functions.
+
+static char *chunk_data(Chunk *chunk) {
+  return (char *)chunk + header_size;
+}
+
+// Adds a chunk with room for at least min_size bytes. Each new chunk is at
+// least as big as all the earlier ones together, so a growing arena only needs
+// a few of them.
+static void add_chunk(Arena arena, size_t min_size) {
+  size_t size = arena->chunk_size;
+  if (size < arena->total_size) size = arena->total_size;
+  if (size < min_size)          size = min_size;
+
+  Chunk *chunk = malloc(header_size + size);
+  chunk->prev  = arena->chunk;
+  chunk->size  = size;
+  chunk->used  = 0;
+
+  arena->chunk       = chunk;
+  arena->total_size += size;
+}
+
+// These adapt the arena to the Allocator interface.
+
+static void *alloc_from_arena(void *context, size_t size) {
+  return arena__alloc((Arena)context, size);
+}
+
+static void *realloc_from_arena(void *context, void *ptr, size_t old_size,
+                                size_t new_size) {
+  return arena__realloc((Arena)context, ptr, old_size, new_size);
+}
+
+static void free_to_arena(void *context, void *ptr, size_t size) {
+  (void)context;
+  (void)ptr;
+  (void)size;
+  // Arena memory is only released by arena__reset and arena__delete.
+}
+
+static void free_chunks(Arena arena) {
+  while (arena->chunk) {
+    Chunk *prev = arena->chunk->prev;
+    free(arena->chunk);
+    arena->chunk = prev;
+  }
+  arena->total_size = 0;
+}
+
+
+// Public functions.
+
+Arena arena__new(size_t chunk_size) {
+  Arena arena = malloc(sizeof(struct ArenaStruct));
+  arena->chunk      = NULL;
+  arena->chunk_size = align_up(chunk_size > 0 ? chunk_size : 1);
+  arena->total_size = 0;
+  arena->last       = NULL;
+
+  arena->allocator.alloc   = alloc_from_arena;
+  arena->allocator.realloc = realloc_from_arena;
+  arena->allocator.free    = free_to_arena;
+  arena->allocator.context = arena;
+
+  return arena;
+}
+
+void arena__delete(Arena arena) {
+  free_chunks(arena);
+  free(arena);
+}
+
+void *arena__alloc(Arena arena, size_t size) {
+  size = align_up(size);
+  Chunk *chunk = arena->chunk;
+  if (chunk == NULL || chunk->used + size > chunk->size) {
+    add_chunk(arena, size);
+    chunk = arena->chunk;
+  }
+  void *block  = chunk_data(chunk) + chunk->used;
+  chunk->used += size;
+  arena->last  = block;
+  return block;
+}
+
+void *arena__realloc(Arena arena, void *ptr, size_t old_size,
+                     size_t new_size) {
+  if (ptr == NULL) return arena__alloc(arena, new_size);
+
+  // The newest block can grow or shrink in place if its chunk has room.
+  Chunk *chunk = arena->chunk;
+  if (ptr == arena->last) {
+    size_t start = (char *)ptr - chunk_data(chunk);
+    if (start + align_up(new_size) <= chunk->size) {
+      chunk->used = start + align_up(new_size);
+      return ptr;
+    }
+  }
+  if (new_size <= old_size) return ptr;
+
+  void *block = arena__alloc(arena, new_size);
+  memcpy(block, ptr, old_size);
+  return block;
+}
+
+void arena__reset(Arena arena) {
+  if (arena->chunk && arena->chunk->prev) {
+    size_t total_size = arena->total_size;
+    free_chunks(arena);
+    add_chunk(arena, total_size);
+  }
+  if (arena->chunk) arena->chunk->used = 0;
+  arena->last = NULL;
+}
+
+size_t arena__bytes_used(Arena arena) {
+  size_t used = 0;
+  for (Chunk *chunk = arena->chunk; chunk; chunk = chunk->prev) {
+    used += chunk->used;
+  }
+  return used;
+}
+
+int arena__num_chunks(Arena arena) {
+  int num_chunks = 0;
+  for (Chunk *chunk = arena->chunk; chunk; chunk = chunk->prev) ++num_chunks;
+  return num_chunks;
+}
+
+Allocator arena__allocator(Arena arena) {
+  return &arena->allocator;
+}
@@ -0,0 +1,59 @@
+// arena.h
+//
+// A bump allocator for memory that's all released at once.
+//
+// An arena hands out memory from a chain of large chunks. Each allocation only
+// moves a pointer forward, and nothing is freed on its own. Instead,
+// arena__reset makes all of the arena's memory available again at once, and
+// arena__delete frees it. Any container can keep its memory in an arena through
+// arena__allocator; see allocator.h and array__new_in_arena.
+//
+// When a reset arena had grown past its first chunk, its chunks are replaced by
+// a single chunk as big as all of them, so an arena that's reused for similar
+// work settles down to one allocation.
+//
+// Arenas aren't thread-safe; each thread is expected to use its own.
+//
+// Usage:
+//
+//   Arena arena = arena__new(1 << 20);  // The minimum chunk size, in bytes.
+//   Array pts   = array__new_in_arena(arena, 64, sizeof(float));
+//   ..
+//   arena__reset(arena);                // Now pts and all else are gone.
+//   ..
+//   arena__delete(arena);
+//
+
+#pragma once
+
+#include "allocator.h"
+
+#include <stddef.h>
+
+typedef struct ArenaStruct *Arena;
+
+Arena  arena__new        (size_t chunk_size);
+void   arena__delete     (Arena arena);
+
+// Returns size bytes, aligned for any type.
+void  *arena__alloc      (Arena arena, size_t size);
+
+// This expects ptr to be NULL, or a block of old_size bytes from this arena.
+// The latest block from the arena is resized in place when there's room;
+// others are copied to a new block when they grow.
+void  *arena__realloc    (Arena arena, void *ptr, size_t old_size,
+                          size_t new_size);
+
+// Makes all of the arena's memory available again.
+void   arena__reset      (Arena arena);
+
+// Returns the number of bytes handed out since the arena was created or reset,
+// including alignment padding.
+size_t arena__bytes_used (Arena arena);
+
+// Returns the number of chunks the arena has allocated.
+int    arena__num_chunks (Arena arena);
+
+// Returns an Allocator that takes memory from the arena, and never frees it.
+// It's valid until the arena is deleted.
+Allocator arena__allocator (Arena arena);
@@ -5,7 +5,7 @@
 
 #include "array.h"
 
-#ifdef DEBUG
+#if defined(DEBUG) || defined(MEMPROFILE)
 #include "memprofile.h"
 #endif
 
@@ -14,9 +14,39 @@
 #include <string.h>
 
 
+// Internal globals.
+
+static long num_reallocs = 0;
+
+
+// Internal functions.
+
+// Sets the capacity of array, keeping its items.
+static void set_capacity(Array array, int capacity) {
+  int old_capacity = array->capacity;
+  array->capacity = capacity;
+  array->items = allocator__realloc(array->allocator,
+                                    array->items,                     // ptr
+                                    old_capacity * array->item_size,  // old
+                                    array->capacity * array->item_size);
+  // Arrays may be used on several threads at once.
+  __atomic_fetch_add(&num_reallocs, 1, __ATOMIC_RELAXED);
+}
+
+// Gives array room for at least min_capacity items. Capacity grows
+// geometrically, so appending n items one at a time costs O(log n) reallocs.
+static void grow(Array array, int min_capacity) {
+  if (array->capacity >= min_capacity) return;
+  int capacity = array->capacity * 2;
+  if (capacity < min_capacity) capacity = min_capacity;
+  set_capacity(array, capacity);
+}
+
+
+// Public functions.
+
 Array array__new(int capacity, size_t item_size) {
-  Array array = malloc(sizeof(ArrayStruct));
-  return array__init(array, capacity, item_size);
+  return array__new_with_allocator(NULL, capacity, item_size);
 }
 
 Array array__init(Array array, int capacity, size_t item_size) {
@@ -25,6 +55,7 @@ Array array__init(Array array, int capacity, size_t item_size) {
   array->capacity = capacity;
   array->item_size = item_size;
   array->releaser = NULL;
+  array->allocator = NULL;
   if (capacity) {
     array->items = malloc((int)item_size * capacity);
   } else {
@@ -33,6 +64,24 @@ Array array__init(Array array, int capacity, size_t item_size) {
   return array;
 }
 
+Array array__new_with_allocator(Allocator allocator, int capacity,
+                                size_t item_size) {
+  if (capacity < 1) capacity = 1;
+  Array array = allocator__alloc(allocator, sizeof(ArrayStruct));
+  array->count = 0;
+  array->capacity = capacity;
+  array->item_size = item_size;
+  array->releaser = NULL;
+  array->allocator = allocator;
+  array->items = allocator__alloc(allocator, item_size * capacity);
+  return array;
+}
+
+Array array__new_in_arena(Arena arena, int capacity, size_t item_size) {
+  return array__new_with_allocator(arena__allocator(arena), capacity,
+                                   item_size);
+}
+
 void array__clear_with_context(Array array, void *context) {
   if (array->releaser) {
     for (int i = 0; i < array->count; ++i) {
@@ -45,13 +94,14 @@ void array__clear_with_context(Array array, void *context) {
 void array__release_with_context(void *array, void *context) {
   Array a = (Array)array;
   array__clear_with_context(a, context);
-  free(a->items);
+  allocator__free(a->allocator, a->items, a->capacity * a->item_size);
+  a->items = NULL;
   a->capacity = 0;
 }
 
 void array__delete_with_context(Array array, void *context) {
   array__release_with_context(array, context);
-  free(array);
+  allocator__free(array->allocator, array, sizeof(ArrayStruct));
 }
 
 void array__clear(Array array) {
@@ -75,16 +125,33 @@ void array__add_item_ptr(Array array, void *item) {
 }
 
 void *array__new_ptr(Array array) {
-  if (array->count == array->capacity) {
-    array->capacity *= 2;
-    if (array->capacity == 0) array->capacity = 1;
-    array->items = realloc(array->items,
-                           array->capacity * (int)array->item_size);
-  }
+  if (array->count == array->capacity) grow(array, array->count + 1);
   array->count++;
   return array__item_ptr(array, array->count - 1);
 }
 
+void array__reserve(Array array, int capacity) {
+  if (array->capacity < capacity) set_capacity(array, capacity);
+}
+
+void *array__append_n(Array array, void *items, int num_items) {
+  int old_count = array->count;
+  array__resize_uninitialized(array, old_count + num_items);
+  void *first_new_item = array__item_ptr(array, old_count);
+  memcpy(first_new_item, items, num_items * array->item_size);
+  return first_new_item;
+}
+
+void *array__resize_uninitialized(Array array, int count) {
+  grow(array, count);
+  array->count = count;
+  return array->items;
+}
+
+long array__num_reallocs() {
+  return __atomic_load_n(&num_reallocs, __ATOMIC_RELAXED);
+}
+
 void array__insert_items(Array array, int index, void *items, int num_items) {
   // array starts as <prefix> <suffix>; we'll move over <suffix> so it becomes
   //                 <prefix> <new-items> <suffix>.
@@ -105,11 +172,7 @@ void array__insert_items(Array array, int index, void *items, int num_items) {
 }
 
 void array__append_array(Array dst, Array src) {
-  // We avoid using array__for since we don't know which type of pointer to use.
-  for (int i = 0; i < src->count; ++i) {
-    void *item = array__item_ptr(src, i);
-    array__add_item_ptr(dst, item);
-  }
+  array__append_n(dst, src->items, src->count);
 }
 
 int array__index_of(Array array, void *item) {
@@ -130,16 +193,7 @@ void array__remove_item(Array array, void *item) {
 
 void array__add_zeroed_items(Array array, int num_items) {
   int new_count = array->count + num_items;
-  int resize_needed = 0;
-  while (array->capacity < new_count) {
-    array->capacity *= 2;
-    if (array->capacity == 0) array->capacity = 1;
-    resize_needed = 1;
-  }
-  if (resize_needed) {
-    array->items = realloc(array->items,
-                           array->capacity * (int)array->item_size);
-  }
+  grow(array, new_count);
   void *bytes_to_zero = array__item_ptr(array, array->count);
   memset(bytes_to_zero, 0, num_items * array->item_size);
   array->count = new_count;
@@ -10,6 +10,9 @@
 
 #pragma once
 
+#include "allocator.h"
+#include "arena.h"
+
 #include <stdlib.h>
 
 typedef void (*Releaser)(void *item, void *context);
@@ -20,6 +23,7 @@ typedef struct {
   size_t   item_size;
   Releaser releaser;
   char *   items;
+  Allocator allocator;  // The source of items and array; NULL for the heap.
 } ArrayStruct;
 
 typedef ArrayStruct *Array;
@@ -33,6 +37,15 @@ Array array__new  (int capacity, size_t item_size);
 // For use on an allocated but uninitialized array struct.
 Array array__init (Array array, int capacity, size_t item_size);
 
+// Allocates a new array whose struct and items come from allocator.
+Array array__new_with_allocator (Allocator allocator, int capacity,
+                                 size_t item_size);
+
+// Allocates a new array whose struct and items live in the given arena. Items
+// are still released as usual, but no memory is freed until the arena is reset
+// or deleted, which also makes the array unusable.
+Array array__new_in_arena (Arena arena, int capacity, size_t item_size);
+
 
 // The next three methods are O(1) if there's no releaser; O(n) if there is.
 void  array__clear   (Array array);  // Releases all items and sets count to 0.
@@ -54,6 +67,26 @@ void    array__add_item_ptr(Array array, void *item);
 void *  array__new_ptr(Array array);
 #define array__new_val(a, type) (*(type *)array__new_ptr(a))
 
+// Capacity planning. Callers that know how many items they'll add can make room
+// for them up front, rather than paying for a realloc every time the array
+// doubles. Implicit growth doubles the capacity, or more if needed.
+
+// Makes room for at least capacity items in total; count is unchanged.
+void    array__reserve             (Array array, int capacity);
+
+// Appends num_items items copied from items, with at most one realloc. The
+// items are expected to be outside of array. Returns a pointer to the first new
+// item.
+void *  array__append_n            (Array array, void *items, int num_items);
+
+// Sets the count, growing the array if needed. New items aren't initialized.
+// Returns array->items.
+void *  array__resize_uninitialized(Array array, int count);
+
+// Returns the number of times the items of any array have been reallocated.
+// This is meant for profiling; see also memprofile.h.
+long    array__num_reallocs        ();
+
 // Possibly linear time operations.
 
 void array__insert_items (Array array, int index, void *items, int num_items);
@@ -81,6 +114,18 @@ void array__add_zeroed_items (Array array, int num_items);
        item_ptr = (type)array__item_ptr(array, ++index))
 // The (type) cast in array__for is required by C++.
 
+// Loop over an array by pointer, without any index arithmetic.
+// Example: array__for_range(item_type *, item_ptr, array) { /* loop body */ }
+
+// The type is expected to point to items of exactly array->item_size bytes.
+// Unlike array__for, the end of the loop is fixed when it starts, so the loop
+// body must not add or remove items.
+#define array__for_range(type, item_ptr, array)                            \
+  for (char *__end = (array)->items + (array)->count * (array)->item_size,  \
+            *__tmpptr = __end; __tmpptr; __tmpptr = NULL)                   \
+  for (type item_ptr = (type)(array)->items; (char *)item_ptr < __end;      \
+       ++item_ptr)
+
 typedef int (*array__CompareFunction)(void *, const void *, const void *);
 
 void array__sort(Array array,
@@ -12,6 +12,8 @@
 extern "C" {
 #endif
 
+#include "allocator.h"
+#include "arena.h"
 #include "array.h"
 #include "list.h"
 #include "map.h"
@@ -5,21 +5,29 @@
 
 #include "list.h"
 
-#ifdef DEBUG
+#if defined(DEBUG) || defined(MEMPROFILE)
 #include "memprofile.h"
 #endif
 
 void list__insert(List *list, void *item) {
+  list__insert_with_allocator(list, item, NULL);  // NULL --> allocator
+}
+
+void list__insert_with_allocator(List *list, void *item, Allocator allocator) {
   List next_list = *list;
-  *list = malloc(sizeof(ListStruct));
+  *list = allocator__alloc(allocator, sizeof(ListStruct));
   (*list)->item = item;
   (*list)->next = next_list;
 }
 
 void *list__remove_first(List *list) {
+  return list__remove_first_with_allocator(list, NULL);  // NULL --> allocator
+}
+
+void *list__remove_first_with_allocator(List *list, Allocator allocator) {
   if (*list == NULL) { return NULL; }  // See note [1] below.
   ListStruct removed_item = **list;
-  free(*list);
+  allocator__free(allocator, *list, sizeof(ListStruct));
   *list = removed_item.next;
   return removed_item.item;
 }
@@ -43,10 +51,17 @@ void list__delete(List *list) {
 }
 
 void list__delete_and_release(List *list, Releaser releaser, void *context) {
+  list__delete_and_release_with_allocator(list, releaser, context,
+                                          NULL);  // NULL --> allocator
+}
+
+void list__delete_and_release_with_allocator(List *list, Releaser releaser,
+                                             void *context,
+                                             Allocator allocator) {
   while (*list) {
     List next = (*list)->next;
     if (releaser) releaser((*list)->item, context);
-    free(*list);
+    allocator__free(allocator, *list, sizeof(ListStruct));
     *list = next;
   }
   // This leaves *list == NULL, as we want.
@@ -29,6 +29,15 @@ void *list__move_first   (List *from, List *to);
 void list__delete             (List *list);
 void list__delete_and_release (List *list, Releaser releaser, void *context);
 
+// These do the same jobs as the above ones with entries from allocator, which
+// must be the allocator that every entry of the list came from.
+void  list__insert_with_allocator       (List *list, void *item,
+                                         Allocator allocator);
+void *list__remove_first_with_allocator (List *list, Allocator allocator);
+void  list__delete_and_release_with_allocator(List *list, Releaser releaser,
+                                              void *context,
+                                              Allocator allocator);
+
 List *list__find_entry (List *list,
                         void *needle,
                         int (*val_eq_needle)(void *, void *));
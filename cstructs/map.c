@@ -3,71 +3,238 @@
 // https://github.com/tylerneylon/cstructs
 //
 // Internal structure:
-// An array of buckets of size s = 2^n, where n grows to keep
-// the average load below 8.
-// We look up x by finding i = hash(x), then checking buckets
-// [i % s, i % (s/2), i % (s/4), ... ] down to % MIN_BUCKETS.
-// If avg load is > 8 just after an addition, we double the
-// number of buckets.
+// An open-addressed table of capacity = 2^n slots, each holding a key/value
+// pair inline, along with one control byte per slot. A control byte is either
+// ctrl_empty, ctrl_deleted, or - for a full slot - the top 7 bits of the
+// mixed hash of its key (its h2). The other bits (its h1) pick where a lookup
+// starts.
+//
+// Lookups scan a group of control bytes at a time, comparing them all to h2 at
+// once with SSE2 when it's available, and with word-sized bit tricks
+// otherwise. Only slots whose h2 matches have their keys compared, so a lookup
+// usually touches one group of control bytes and one slot. Groups are probed
+// in a triangular sequence until a group with an empty slot is seen.
+//
+// The first group_width control bytes are mirrored after the last one, so
+// that a group read at any slot index stays within the control bytes.
+// Unset keys leave tombstones behind; the table is rehashed when it runs out
+// of empty slots, and doubles when it's more than 7/16 full.
 //
 
 #include "map.h"
 
-#ifdef DEBUG
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The memprofile macros need to come after the system headers.
+#if defined(DEBUG) || defined(MEMPROFILE)
 #include "memprofile.h"
 #endif
 
-#include "list.h"
+#define MIN_CAPACITY 16
+
+#define ctrl_empty   ((signed char)-128)
+#define ctrl_deleted ((signed char)-2)
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define group_width 16
+#define mask_shift  0   // Each slot is 1 bit of a match mask.
+
+typedef __m128i Group;
+
+#else
+
+#define group_width 8
+#define mask_shift  3   // Each slot is the high bit of a byte of a match mask.
+
+typedef uint64_t Group;
+
+#define lsbs 0x0101010101010101ull
+#define msbs 0x8080808080808080ull
+
+#endif
+
+
+// Internal functions.
+// ===================
+
+// Group functions. Each match function returns a mask with a set bit for each
+// matching control byte of the group; the slot index of a set bit i, relative
+// to the start of the group, is i >> mask_shift.
+
+#if defined(__SSE2__)
+
+static Group load_group(signed char *ctrl) {
+  return _mm_loadu_si128((const __m128i *)ctrl);
+}
+
+static uint64_t match_byte(Group group, signed char byte) {
+  return (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(byte),
+                                                    group));
+}
+
+static uint64_t match_empty(Group group) {
+  return match_byte(group, ctrl_empty);
+}
+
+// Empty and deleted are the only negative values below -1.
+static uint64_t match_empty_or_deleted(Group group) {
+  return (uint16_t)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1),
+                                                    group));
+}
+
+#else
+
+// This expects a little-endian cpu.
+static Group load_group(signed char *ctrl) {
+  Group group;
+  memcpy(&group, ctrl, sizeof(group));
+  return group;
+}
+
+// This may report a false match just after a true one, which is harmless as
+// keys are compared anyway.
+static uint64_t match_byte(Group group, signed char byte) {
+  uint64_t x = group ^ (lsbs * (unsigned char)byte);
+  return (x - lsbs) & ~x & msbs;
+}
+
+// Of the special bytes, only empty has its high bit set and bit 1 unset.
+static uint64_t match_empty(Group group) {
+  return group & ~(group << 6) & msbs;
+}
+
+// Both special bytes have their high bit set and bit 0 unset.
+static uint64_t match_empty_or_deleted(Group group) {
+  return group & ~(group << 7) & msbs;
+}
+
+#endif
+
+static int lowest_bit(uint64_t mask) {
+  return __builtin_ctzll(mask) >> mask_shift;
+}
+
+// Other functions.
+
+// Spreads the bits of the user's hash across 64 bits, so that h1 and h2 both
+// depend on all of them.
+static uint64_t mix(int h) {
+  return (uint64_t)(unsigned int)h * 0x9E3779B97F4A7C15ull;
+}
 
-#define MIN_BUCKETS 16
-#define MAX_LOAD 2.5
+static size_t      h1(uint64_t m) { return (size_t)(m >> 25); }
+static signed char h2(uint64_t m) { return (signed char)(m >> 57); }
 
+static size_t table_size(int capacity) {
+  return capacity * sizeof(map__key_value) + capacity + group_width;
+}
 
-// Internal function declarations.
-// ===============================
+static void set_ctrl(Map map, int i, signed char c) {
+  map->ctrl[i] = c;
+  if (i < group_width) map->ctrl[map->capacity + i] = c;
+}
 
-List *find_with_hash(Map map, void *needle, int h);
-List *bucket_find(List *bucket, void *needle, map__Eq eq);
-void double_size(Map map);
-void release_and_free_pair(Map map, map__key_value *pair);
+// Sets up an empty table of the given capacity, leaving the old one alone.
+static void init_table(Map map, int capacity) {
+  char *table = allocator__alloc(map->allocator, table_size(capacity));
+  map->slots       = (map__key_value *)table;
+  map->ctrl        = (signed char *)(table + capacity * sizeof(map__key_value));
+  map->capacity    = capacity;
+  map->growth_left = capacity - capacity / 8 - map->count;
+  memset(map->ctrl, ctrl_empty, capacity + group_width);
+}
 
-// This will be called from the array module.
-void release_bucket(void *bucket, void *map);
+static void free_table(Map map, map__key_value *slots, int capacity) {
+  allocator__free(map->allocator, slots, table_size(capacity));
+}
 
-// This will be called from the list module.
-void release_key_value_pair(void *pair, void *map);
+// Returns the pair with a key equal to needle, or NULL if there isn't one.
+static map__key_value *find(Map map, void *needle, uint64_t m) {
+  size_t      mask = map->capacity - 1;
+  size_t      pos  = h1(m) & mask;
+  signed char h    = h2(m);
+  for (size_t step = group_width;; pos = (pos + step) & mask,
+                                   step += group_width) {
+    Group group = load_group(map->ctrl + pos);
+    for (uint64_t bits = match_byte(group, h); bits; bits &= bits - 1) {
+      map__key_value *pair = map->slots + ((pos + lowest_bit(bits)) & mask);
+      if (map->eq(pair->key, needle)) return pair;
+    }
+    if (match_empty(group)) return NULL;
+  }
+}
+
+// Returns the index of the first empty or deleted slot on the probe sequence
+// of m. There always is one, as the table never fills up.
+static int find_free_slot(Map map, uint64_t m) {
+  size_t mask = map->capacity - 1;
+  size_t pos  = h1(m) & mask;
+  for (size_t step = group_width;; pos = (pos + step) & mask,
+                                   step += group_width) {
+    uint64_t bits = match_empty_or_deleted(load_group(map->ctrl + pos));
+    if (bits) return (int)((pos + lowest_bit(bits)) & mask);
+  }
+}
+
+// Moves all pairs into a new table of the given capacity, which drops any
+// tombstones.
+static void resize(Map map, int capacity) {
+  map__key_value *old_slots    = map->slots;
+  signed char    *old_ctrl     = map->ctrl;
+  int             old_capacity = map->capacity;
+
+  init_table(map, capacity);
+  for (int i = 0; i < old_capacity; ++i) {
+    if (old_ctrl[i] < 0) continue;
+    uint64_t m = mix(map->hash(old_slots[i].key));
+    int j = find_free_slot(map, m);
+    set_ctrl(map, j, h2(m));
+    map->slots[j] = old_slots[i];
+  }
+  free_table(map, old_slots, old_capacity);
+}
+
+static void release_pair(Map map, map__key_value *pair) {
+  if (map->key_releaser)   map->key_releaser  (pair->key,   NULL);
+  if (map->value_releaser) map->value_releaser(pair->value, NULL);
+}
 
 
 // Public functions.
 // =================
 
 Map map__new(map__Hash hash, map__Eq eq) {
-  Map map = malloc(sizeof(MapStruct));
-  map->count = 0;
+  return map__new_with_allocator(hash, eq, NULL);  // NULL --> allocator
+}
 
-  map->buckets = array__new(MIN_BUCKETS, sizeof(void *));
-  map->buckets->releaser = release_bucket;
-  array__add_zeroed_items(map->buckets, MIN_BUCKETS);
+Map map__new_with_allocator(map__Hash hash, map__Eq eq, Allocator allocator) {
+  Map map = allocator__alloc(allocator, sizeof(MapStruct));
+  map->count = 0;
+  map->allocator = allocator;
+  init_table(map, MIN_CAPACITY);
 
   map->hash = hash;
   map->eq = eq;
   map->key_releaser = NULL;
   map->value_releaser = NULL;
-  map->pair_alloc = malloc;
   return map;
 }
 
 void map__delete(Map map) {
-  array__delete_with_context(map->buckets, map);
-  free(map);
+  map__clear(map);
+  free_table(map, map->slots, map->capacity);
+  allocator__free(map->allocator, map, sizeof(MapStruct));
 }
 
 map__key_value *map__set(Map map, void *key, void *value) {
-  int h = map->hash(key);
-  List *entry = find_with_hash(map, key, h);
-  map__key_value *pair;
-  if (entry) {
-    pair = (*entry)->item;
+  uint64_t m = mix(map->hash(key));
+  map__key_value *pair = find(map, key, m);
+  if (pair) {
     if (map->key_releaser && pair->key != key) {
       map->key_releaser(pair->key, NULL);
     }
@@ -77,123 +244,50 @@ map__key_value *map__set(Map map, void *key, void *value) {
     }
     pair->value = value;
     return pair;
-  } else {
-    // New pair.
-    pair = map->pair_alloc(sizeof(map__key_value));
-    pair->key = key;
-    pair->value = value;
-
-    double load = (map->count + 1) / (map->buckets->count);
-    if (load > MAX_LOAD) double_size(map);
+  }
 
-    int n = map->buckets->count;
-    int index = ((unsigned int)h) % n;
-    List *bucket = (List *)array__item_ptr(map->buckets, index);
-    list__insert(bucket, pair);
-    map->count++;
+  // New pair.
+  if (map->growth_left == 0) {
+    // Only grow if tombstones aren't what's using up the room.
+    int is_full = (map->count + 1 > map->capacity * 7 / 16);
+    resize(map, is_full ? map->capacity * 2 : map->capacity);
   }
+  int i = find_free_slot(map, m);
+  if (map->ctrl[i] == ctrl_empty) map->growth_left--;
+  set_ctrl(map, i, h2(m));
+  pair = map->slots + i;
+  pair->key = key;
+  pair->value = value;
+  map->count++;
   return pair;
 }
 
 void map__unset(Map map, void *key) {
-  int h = map->hash(key);
-  List *entry = find_with_hash(map, key, h);
-  if (entry == NULL) return;
-  release_and_free_pair(map, (*entry)->item);
-  list__remove_first(entry);
+  map__key_value *pair = find(map, key, mix(map->hash(key)));
+  if (pair == NULL) return;
+  release_pair(map, pair);
+  set_ctrl(map, (int)(pair - map->slots), ctrl_deleted);
   map->count--;
 }
 
 map__key_value *map__get(Map map, void *needle) {
-  List *entry = find_with_hash(map, needle, map->hash(needle));
-  return entry ? (*entry)->item : NULL;
+  return find(map, needle, mix(map->hash(needle)));
 }
 
 void map__clear(Map map) {
-  array__for(void **, elt_ptr, map->buckets, index) {
-    List *list_ptr = (List *)elt_ptr;
-    list__delete_and_release(list_ptr, release_key_value_pair, map);
+  for (int i = 0; i < map->capacity; ++i) {
+    if (map->ctrl[i] >= 0) release_pair(map, map->slots + i);
   }
+  memset(map->ctrl, ctrl_empty, map->capacity + group_width);
   map->count = 0;
+  map->growth_left = map->capacity - map->capacity / 8;
 }
 
 map__key_value *map__next(Map map, int *i, void **p) {
-  // *i is the bucket index.
-  // *p is the List entry in that bucket.
-  List entry = (List)(*p);
-  while (entry == NULL && *i < (map->buckets->count - 1)) {
-    (*i)++;
-    entry = *(List *)array__item_ptr(map->buckets, *i);
-  }
-  if (entry == NULL && *i == (map->buckets->count - 1)) {
-    *p = (void *)(1);  // A token non-NULL pointer to end the outer loops.
-    return NULL;
-  }
-  void *item = entry->item;
-  *p = (void *)entry->next;
-  return item;
-}
-
-// private functions
-// =================
-
-List *find_with_hash(Map map, void *needle, int h) {
-  int n = map->buckets->count;
-  int index = ((unsigned int)h) % n;
-  List *bucket = (List *)array__item_ptr(map->buckets, index);
-  return bucket_find(bucket, needle, map->eq);
-}
-
-typedef struct {
-  void *needle;
-  map__Eq eq;
-} needle_info;
-
-int pair_matches_needle_info(void *p, void *i) {
-  map__key_value *pair = (map__key_value *)p;
-  needle_info *info = (needle_info *)i;
-  return info->eq(pair->key, info->needle);
-}
-
-List *bucket_find(List *bucket, void *needle, map__Eq eq) {
-  needle_info info;
-  info.needle = needle;
-  info.eq = eq;
-  return list__find_entry(bucket, &info, pair_matches_needle_info);
-}
-
-void double_size(Map map) {
-  array__add_zeroed_items(map->buckets, map->buckets->count);
-  int n = map->buckets->count;
-  array__for(List *, bucket, map->buckets, index) {
-    List *entry = bucket;
-    while (*entry) {
-      map__key_value *pair = (*entry)->item;
-      unsigned int h = map->hash(pair->key);
-      int bucket_index = h % n;
-      if (bucket_index == index) {
-        entry = &((*entry)->next);
-        continue;
-      }
-      list__remove_first(entry);
-      List *new_bucket = (List *)array__item_ptr(map->buckets, bucket_index);
-      list__insert(new_bucket, pair);
-    }
-    // The last half of the list is all new; no need to look at it.
-    if (index >= n / 2) break;
+  // *i is the index of the last slot seen, starting at -1.
+  while (++(*i) < map->capacity) {
+    if (map->ctrl[*i] >= 0) return map->slots + *i;
   }
-}
-
-void release_and_free_pair(Map map, map__key_value *pair) {
-  if (map->key_releaser)   map->key_releaser  (pair->key,   NULL);
-  if (map->value_releaser) map->value_releaser(pair->value, NULL);
-  free(pair);
-}
-
-void release_key_value_pair(void *pair, void *map) {
-  release_and_free_pair((Map)map, (map__key_value *)pair);
-}
-
-void release_bucket(void *bucket, void *map) {
-  list__delete_and_release((List *)bucket, release_key_value_pair, map);
+  *p = (void *)(1);  // A token non-NULL pointer to end the outer loops.
+  return NULL;
 }
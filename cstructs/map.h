@@ -5,6 +5,10 @@
 // C-based hash map.
 // Lookups are fast, sizing grows as needed.
 //
+// Pairs are kept inline in an open-addressed table, so a pointer returned by
+// map__set or map__get is only valid until the next map__set of a new key, or
+// the next map__clear. Unsetting a key leaves other pairs in place.
+//
 
 #pragma once
 
@@ -14,29 +18,35 @@
 
 typedef int    ( *map__Hash  )(void *);
 typedef int    ( *map__Eq    )(void *, void*);
-typedef void * ( *map__Alloc )(size_t);
-
-typedef struct {
-  int        count;
-  Array      buckets;
-  map__Hash  hash;
-  map__Eq    eq;
-  Releaser   key_releaser;
-  Releaser   value_releaser;
-  map__Alloc pair_alloc;  // Default=malloc; customize to add fields per item.
-} MapStruct;
-
-typedef MapStruct *Map;
 
 typedef struct {
   void *key;
   void *value;
 } map__key_value;
 
+typedef struct {
+  int              count;
+  int              capacity;     // The number of slots; a power of 2.
+  int              growth_left;  // The number of empty slots we may still fill.
+  signed char *    ctrl;         // One control byte per slot, and a few more.
+  map__key_value * slots;
+  map__Hash        hash;
+  map__Eq          eq;
+  Releaser         key_releaser;
+  Releaser         value_releaser;
+  Allocator        allocator;    // The source of all map memory; NULL for heap.
+} MapStruct;
+
+typedef MapStruct *Map;
+
 
 Map              map__new    (map__Hash hash, map__Eq eq);
 void             map__delete (Map map);
 
+// Allocates a new map whose struct and table come from allocator.
+Map              map__new_with_allocator (map__Hash hash, map__Eq eq,
+                                          Allocator allocator);
+
 map__key_value * map__set    (Map map, void *key, void *value);
 void             map__unset  (Map map, void *key);
 map__key_value * map__get    (Map map, void *needle);
@@ -0,0 +1,102 @@
+// map_bench.c
+//
+// A standalone benchmark of Map on int and pointer keys. It times inserts,
+// lookups that hit and miss, and deleting the map, per key.
+//
+// Build and run it with, for example:
+//
+//   cc -O2 -std=gnu99 -o map_bench map_bench.c {allocator,arena,array,map}.c
+//   ./map_bench
+//
+// To compare against another version of Map, check out that version's
+// cstructs into another directory and build this file against it.
+//
+
+#include "map.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+// Internal functions.
+
+static int int_hash(void *key) {
+  return (int)(long)key;
+}
+
+static int ptr_hash(void *key) {
+  long bits = (long)key;
+  return (int)(bits ^ (bits >> 32));
+}
+
+static int eq(void *key1, void *key2) {
+  return key1 == key2;
+}
+
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void run(const char *name, map__Hash hash, void **keys, int n) {
+  int num_rounds = 10;
+
+  double start = now();
+  Map map = map__new(hash, eq);
+  for (int i = 0; i < n; ++i) map__set(map, keys[i], keys[i]);
+  double inserted = now();
+
+  // Look keys up in a scattered order so that consecutive lookups don't share
+  // cache lines.
+  long num_hits = 0;
+  for (int r = 0; r < num_rounds; ++r) {
+    for (int i = 0; i < n; ++i) {
+      num_hits += (map__get(map, keys[(i * 7919L) % n]) != NULL);
+    }
+  }
+  double looked_up = now();
+
+  long num_misses = 0;
+  for (int i = 0; i < n; ++i) {
+    num_misses += (map__get(map, (void *)(long)(-i - 1)) == NULL);
+  }
+  double missed = now();
+
+  map__delete(map);
+  double deleted = now();
+
+  double ns = 1e9 / n;
+  printf("%-7s n=%7d  insert %6.1f ns  hit %6.1f ns  miss %6.1f ns  "
+         "delete %6.1f ns\n", name, n,
+         (inserted - start)  * ns,
+         (looked_up - inserted) * ns / num_rounds,
+         (missed - looked_up) * ns,
+         (deleted - missed) * ns);
+  if (num_hits != (long)n * num_rounds || num_misses != n) {
+    printf("Error: expected every lookup to hit, and every miss to miss.\n");
+    exit(1);
+  }
+}
+
+
+// Main.
+
+int main() {
+  int sizes[] = {1000, 100000, 1000000};
+  for (int s = 0; s < 3; ++s) {
+    int    n    = sizes[s];
+    void **keys = malloc(n * sizeof(void *));
+
+    for (int i = 0; i < n; ++i) keys[i] = (void *)(long)(i + 1);
+    run("int", int_hash, keys, n);
+
+    for (int i = 0; i < n; ++i) keys[i] = malloc(24);
+    run("pointer", ptr_hash, keys, n);
+    for (int i = 0; i < n; ++i) free(keys[i]);
+
+    free(keys);
+  }
+  return 0;
+}
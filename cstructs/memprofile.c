@@ -3,6 +3,11 @@
 // https://github.com/tylerneylon/cstructs
 //
 
+// This makes dladdr available with glibc; it must come before any includes.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "memprofile.h"
 
 #undef malloc
@@ -19,108 +24,347 @@
 #include <malloc/malloc.h>
 #else
 #include <malloc.h>
-#define malloc_size malloc_usable_size 
+#define malloc_size malloc_usable_size
+#endif
 #endif
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <execinfo.h>
 #endif
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 
-// Enable strncpy on windows.
-#ifdef _WIN32
-#define strncpy(dst, src, num) strncpy_s(dst, num, src, _TRUNCATE)
+// Internal types and globals.
+
+// Each thread's state is only written by that thread, and read by any thread
+// that dumps. Shared fields are written with relaxed atomic stores, which cost
+// the same as plain stores on common cpus, so that those reads aren't races.
+#define bump(field, delta) \
+    __atomic_store_n(&(field), (field) + (delta), __ATOMIC_RELAXED)
+#define peek(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+#define max_stages  32
+#define num_sites   1024  // A power of 2.
+#define num_callers 4     // The number of stack frames kept above a site.
+
+typedef struct {
+  const char *name;  // NULL for an unused stage.
+  long        num_allocs;
+  long        num_reallocs;
+  long        num_frees;
+  long        alloc_bytes;
+  long        free_bytes;
+  long        live_bytes;
+  long        peak_bytes;
+} Stage;
+
+// A site is a malloc or realloc call, along with the functions that led to it.
+typedef struct {
+  const char *file;  // NULL for an unused site.
+  int         line;
+  void       *callers[num_callers];
+  long        num_samples;
+  long        bytes;
+} Site;
+
+typedef struct ThreadState {
+  struct ThreadState *next;  // The list of all threads' states.
+  long                bytes_until_sample;
+  uint32_t            rng;
+  int                 stage;  // The index of the current stage.
+  Stage               stages[max_stages];
+  Site                sites[num_sites];
+} ThreadState;
+
+// This is a lock-free stack; states are pushed but never removed.
+static ThreadState *all_states = NULL;
+
+static __thread ThreadState *my_state = NULL;
+
+static long sample_interval = 512 * 1024;
+
+// Stage 0 is the initial stage; the last one collects any stages past the
+// others. Site 0 collects any sites past the others.
+static const char *initial_stage = "none";
+static const char *other_stage   = "other";
+static const char *other_site    = "other";
+
+
+// Internal functions.
+
+static ThreadState *get_state() {
+  if (my_state) return my_state;
+
+  ThreadState *state = calloc(1, sizeof(ThreadState));
+  state->rng = (uint32_t)(uintptr_t)state | 1;
+  state->bytes_until_sample = 1;  // The first allocation starts sampling.
+  state->stages[0].name = initial_stage;
+  state->sites[0].file  = other_site;
+
+  // Push the state onto all_states.
+  state->next = __atomic_load_n(&all_states, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&all_states, &state->next, state,
+                                      1,                   // weak
+                                      __ATOMIC_RELEASE,    // on success
+                                      __ATOMIC_RELAXED));  // on failure
+  my_state = state;
+  return state;
+}
+
+// Returns a random distance to the next sample, averaging sample_interval.
+static long next_sample_distance(ThreadState *state) {
+  long interval = peek(sample_interval);
+  if (interval <= 1) return 1;
+
+  // This is xorshift32.
+  uint32_t x = state->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  state->rng = x;
+  return 1 + (long)(x % (uint32_t)(2 * interval - 1));
+}
+
+static Site *find_site(ThreadState *state, const char *file, int line,
+                       void **callers) {
+  uintptr_t h = (uintptr_t)file * 31 + line;
+  for (int i = 0; i < num_callers; ++i) h = h * 31 + (uintptr_t)callers[i];
+  h = (uint32_t)h * 2654435761u;
+
+  size_t callers_size = num_callers * sizeof(void *);
+  for (int i = 0; i < num_sites; ++i) {
+    int   index = (h + i) & (num_sites - 1);
+    Site *site  = state->sites + index;
+    if (index == 0) continue;  // Site 0 is the overflow site.
+    if (site->file == file && site->line == line &&
+        memcmp(site->callers, callers, callers_size) == 0) {
+      return site;
+    }
+    if (site->file == NULL) {
+      site->line = line;
+      memcpy(site->callers, callers, callers_size);
+      __atomic_store_n(&site->file, file, __ATOMIC_RELEASE);
+      return site;
+    }
+  }
+  return state->sites;
+}
+
+// Records num_bytes new bytes allocated at file:line, taking any samples that
+// fall within them. This isn't inlined so that the number of frames between it
+// and the malloc call is known.
+__attribute__((noinline))
+static void sample(ThreadState *state, const char *file, int line,
+                   size_t num_bytes) {
+  state->bytes_until_sample -= num_bytes;
+  if (state->bytes_until_sample > 0) return;
+
+  long num_samples = 0;
+  while (state->bytes_until_sample <= 0) {
+    state->bytes_until_sample += next_sample_distance(state);
+    ++num_samples;
+  }
+
+  // Skip the frames of this function and of memop.
+  void *frames[num_callers + 3] = {NULL};
+#ifndef _WIN32
+  backtrace(frames, num_callers + 3);
 #endif
+  void **callers = frames + 3;
+
+  long  interval = peek(sample_interval);
+  Site *site     = find_site(state, file, line, callers);
+  bump(site->num_samples, num_samples);
+  bump(site->bytes,       num_samples * (interval > 1 ? interval : 1));
+}
 
+static void add_live_bytes(Stage *stage, long delta) {
+  bump(stage->live_bytes, delta);
+  if (stage->live_bytes > stage->peak_bytes) {
+    __atomic_store_n(&stage->peak_bytes, stage->live_bytes, __ATOMIC_RELAXED);
+  }
+}
 
-#define tableSize 500
+// Dump functions.
 
-static int byteDelta[tableSize];
-static char rowFile[tableSize][512];
-static int rowLine[tableSize];
-static int isZeroed = 0;
+typedef struct {
+  const char *name;
+  long        values[7];
+} StageTotal;
 
+typedef struct {
+  char key[512];  // The file:line of the site, then its callers, all with ';'.
+  long num_samples;
+  long bytes;
+} SiteTotal;
+
+static int compare_stage_totals(const void *a, const void *b) {
+  return strcmp(((StageTotal *)a)->name, ((StageTotal *)b)->name);
+}
 
-int rowNum(char *file, int line) {
-  char *c = file;
-  unsigned int val = 0;
-  while (*c++) {
-    val *= 123;
-    val += *c;
+static int compare_site_totals(const void *a, const void *b) {
+  return strcmp(((SiteTotal *)a)->key, ((SiteTotal *)b)->key);
+}
+
+static void add_stage(StageTotal *totals, int *num_totals, Stage *stage,
+                      const char *name) {
+  int i;
+  for (i = 0; i < *num_totals; ++i) {
+    if (strcmp(totals[i].name, name) == 0) break;
+  }
+  if (i == *num_totals) {
+    memset(totals + i, 0, sizeof(StageTotal));
+    totals[i].name = name;
+    ++(*num_totals);
   }
-  val *= 93;
-  val += line;
-  return val % tableSize;
+  long *v = totals[i].values;
+  v[0] += peek(stage->num_allocs);
+  v[1] += peek(stage->num_reallocs);
+  v[2] += peek(stage->num_frees);
+  v[3] += peek(stage->alloc_bytes);
+  v[4] += peek(stage->free_bytes);
+  v[5] += peek(stage->live_bytes);
+  v[6] += peek(stage->peak_bytes);
 }
 
-void *memop(char *file, int line, void *ptr, int numBytes, int isRealloc) {
-  if (!isZeroed) {
-    for (int i = 0; i < tableSize; ++i) byteDelta[i] = 0;
-    isZeroed = 1;
+// Writes the key of site to key, naming each caller by its symbol. Symbols are
+// used rather than addresses so that keys match across runs.
+static void write_site_key(char *key, size_t key_size, Site *site,
+                           const char *file) {
+  int len = snprintf(key, key_size, "%s:%d", file, site->line);
+  for (int i = 0; i < num_callers && site->callers[i]; ++i) {
+    const char *name = "?";
+#ifndef _WIN32
+    Dl_info info;
+    if (dladdr(site->callers[i], &info) && info.dli_sname) {
+      name = info.dli_sname;
+    }
+#endif
+    if (len >= (int)key_size) break;
+    len += snprintf(key + len, key_size - len, ";%s", name);
   }
-  int row = rowNum(file, line);
-  strncpy(rowFile[row], file, 511);
-  rowFile[row][511] = '\0';
-  rowLine[row] = line;
-  if (isRealloc) {
-    int prevSize = (int)malloc_size(ptr);
-    void *vp = realloc(ptr, numBytes);
-    byteDelta[row] += (malloc_size(vp) - prevSize);
-    return vp;
+}
+
+static void add_site(SiteTotal *totals, int *num_totals, Site *site,
+                     const char *file) {
+  char key[sizeof(totals->key)];
+  write_site_key(key, sizeof(key), site, file);
+
+  int i;
+  for (i = 0; i < *num_totals; ++i) {
+    if (strcmp(totals[i].key, key) == 0) break;
   }
-  if (numBytes >= 0) {
-    void *vp = malloc(numBytes);
-    byteDelta[row] += malloc_size(vp);
-    return vp;
-  } else {
-    byteDelta[row] -= malloc_size(ptr);
+  if (i == *num_totals) {
+    strcpy(totals[i].key, key);
+    totals[i].num_samples = 0;
+    totals[i].bytes       = 0;
+    ++(*num_totals);
+  }
+  totals[i].num_samples += peek(site->num_samples);
+  totals[i].bytes       += peek(site->bytes);
+}
+
+
+// Public functions.
+
+void *memop(const char *file, int line, void *ptr, size_t size, int op) {
+  ThreadState *state = get_state();
+  Stage       *stage = state->stages + state->stage;
+
+  size_t old_size = ptr ? malloc_size(ptr) : 0;
+  void  *new_ptr  = NULL;
+  size_t new_size = 0;
+
+  if (op == memprofile__op_free) {
     free(ptr);
-    return NULL;
+    if (ptr) bump(stage->num_frees, 1);
+  } else {
+    new_ptr  = (op == memprofile__op_realloc) ? realloc(ptr, size)
+                                              : malloc(size);
+    new_size = new_ptr ? malloc_size(new_ptr) : 0;
+    if (new_ptr == NULL && size > 0) old_size = 0;  // A failed realloc.
+    if (op == memprofile__op_realloc && ptr) {
+      bump(stage->num_reallocs, 1);
+    } else {
+      bump(stage->num_allocs, 1);
+    }
+    if (new_size > old_size) sample(state, file, line, new_size - old_size);
+  }
+
+  bump(stage->alloc_bytes, new_size);
+  bump(stage->free_bytes,  old_size);
+  add_live_bytes(stage, (long)new_size - (long)old_size);
+  return new_ptr;
+}
+
+const char *memprofile__set_stage(const char *name) {
+  ThreadState *state = get_state();
+  const char  *old   = state->stages[state->stage].name;
+
+  int i = 0;
+  while (i < max_stages - 1 && state->stages[i].name &&
+         strcmp(state->stages[i].name, name) != 0) {
+    ++i;
+  }
+  if (i == max_stages - 1) name = other_stage;
+  if (state->stages[i].name == NULL) {
+    __atomic_store_n(&state->stages[i].name, name, __ATOMIC_RELEASE);
   }
+  state->stage = i;
+  return old;
 }
 
-void printmeminfo() {
-  int totalDelta = 0;
-
-  int fileNet[128];
-  char files[128][512];
-  int numFiles = 0;
-
-  for (int i = 0; i < tableSize; ++i) {
-    if (byteDelta[i] != 0) {
-      totalDelta += byteDelta[i];
-      printf("%26s:%5d: %10d\n", rowFile[i], rowLine[i], byteDelta[i]);
-
-      int fileIndex = -1;
-      for (int j = 0; j < numFiles; ++j) {
-        if (strcmp(files[j], rowFile[i]) == 0) {
-          fileIndex = j;
-          break;
-        }
-      }
-      if (fileIndex == -1) {
-        fileIndex = numFiles++;
-        strncpy(files[fileIndex], rowFile[i], 511);
-        files[fileIndex][511] = '\0';
-        fileNet[fileIndex] = 0;
+void memprofile__set_sample_interval(size_t bytes) {
+  __atomic_store_n(&sample_interval, (long)bytes, __ATOMIC_RELAXED);
+}
+
+void memprofile__dump(FILE *out) {
+  int num_states = 0;
+  ThreadState *first = __atomic_load_n(&all_states, __ATOMIC_ACQUIRE);
+  for (ThreadState *s = first; s; s = s->next) ++num_states;
+
+  StageTotal *stages = malloc(num_states * max_stages * sizeof(StageTotal) + 1);
+  SiteTotal  *sites  = malloc(num_states * num_sites  * sizeof(SiteTotal)  + 1);
+  int num_stages = 0;
+  int num_sites_seen = 0;
+
+  for (ThreadState *s = first; s; s = s->next) {
+    for (int i = 0; i < max_stages; ++i) {
+      const char *name = __atomic_load_n(&s->stages[i].name, __ATOMIC_ACQUIRE);
+      if (name) add_stage(stages, &num_stages, s->stages + i, name);
+    }
+    for (int i = 0; i < num_sites; ++i) {
+      const char *file = __atomic_load_n(&s->sites[i].file, __ATOMIC_ACQUIRE);
+      if (file && peek(s->sites[i].num_samples)) {
+        add_site(sites, &num_sites_seen, s->sites + i, file);
       }
-      fileNet[fileIndex] += byteDelta[i];
     }
   }
-  printf("%32s: %10d\n", "total", totalDelta);
-  printf("\nPer file net:\n");
-  for (int i = 0; i < numFiles; ++i) {
-    printf("%32s: %10d\n", files[i], fileNet[i]);
-  }
+  qsort(stages, num_stages,     sizeof(StageTotal), compare_stage_totals);
+  qsort(sites,  num_sites_seen, sizeof(SiteTotal),  compare_site_totals);
 
-#ifndef __APPLE__
-#ifndef _WIN32
-  // malloc_stats doesn't exist in mac os x or windows.
-  printf("malloc_stats:\n");
-  malloc_stats();
-#endif
-#endif
+  fprintf(out, "memprofile 1\n");
+  fprintf(out, "sample_interval %ld\n", peek(sample_interval));
+  for (int i = 0; i < num_stages; ++i) {
+    long *v = stages[i].values;
+    fprintf(out, "stage %s allocs %ld reallocs %ld frees %ld alloc_bytes %ld "
+                 "free_bytes %ld live_bytes %ld peak_bytes %ld\n",
+            stages[i].name, v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
+  }
+  for (int i = 0; i < num_sites_seen; ++i) {
+    fprintf(out, "site %s samples %ld bytes %ld\n",
+            sites[i].key, sites[i].num_samples, sites[i].bytes);
+  }
 
+  free(stages);
+  free(sites);
 }
 
+void printmeminfo() {
+  memprofile__dump(stdout);
+}
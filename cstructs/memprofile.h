@@ -2,17 +2,81 @@
 //
 // https://github.com/tylerneylon/cstructs
 //
+// A sampling memory profiler that's cheap and thread-safe enough to leave on
+// in batch jobs.
+//
+// Sources that include this header have their malloc, realloc, and free calls
+// redirected through memop. The cstructs sources include it when DEBUG or
+// MEMPROFILE is defined.
+//
+// Each thread keeps its own counters, so the fast path takes no locks and
+// shares no cache lines. Results from all threads are merged only when they're
+// dumped.
+//
+// What's measured:
+//
+//   * Stages. Each thread has a current stage, set by memprofile__set_stage.
+//     For each stage, the profiler counts allocs, reallocs, and frees, and the
+//     bytes allocated and freed, exactly. It also tracks live bytes, which are
+//     the bytes allocated minus the bytes freed during the stage, and their
+//     peak. Frees count toward the freeing thread's stage. Merged peaks are
+//     the sum of per-thread peaks, so they're an upper bound.
+//
+//   * Call sites. Allocated bytes are sampled about once every sample
+//     interval bytes, as tcmalloc does. Each sample is charged to the
+//     file:line of its malloc or realloc along with the few functions that
+//     called it, so each site's sampled bytes are an unbiased estimate of the
+//     bytes it allocated. An interval of 1 records every byte exactly. Callers
+//     are named with dladdr, which only knows exported symbols; on Linux, link
+//     with -rdynamic to see more than "?".
+//
+// The dump format has one record per line, sorted by name, so that two dumps
+// can be compared with diff:
+//
+//   memprofile 1
+//   sample_interval <bytes>
+//   stage <name> allocs <n> reallocs <n> frees <n> alloc_bytes <n>
+//       free_bytes <n> live_bytes <n> peak_bytes <n>    (all on one line)
+//   site <file>:<line>;<caller>;<caller's caller>;.. samples <n> bytes <n>
+//
+// Stage names are expected to be string literals without spaces.
+//
 
 #pragma once
 
-void *memop(char *file, int line, void *ptr, int numBytes, int isRealloc);
+#include <stddef.h>
+#include <stdio.h>
+
+enum {
+  memprofile__op_malloc,
+  memprofile__op_realloc,
+  memprofile__op_free
+};
+
+// Does the work of malloc, realloc, or free - as given by op - and records it.
+void *memop(const char *file, int line, void *ptr, size_t size, int op);
+
+// Sets the calling thread's stage, and returns its previous one. The initial
+// stage is "none". The name is expected to outlive the profiler.
+const char *memprofile__set_stage(const char *stage);
+
+// Sets the mean number of bytes between samples, for all threads. This is
+// expected to be called before any allocations are made.
+void memprofile__set_sample_interval(size_t bytes);
+
+// Writes the merged results of all threads to out.
+void memprofile__dump(FILE *out);
+
+// Dumps to stdout.
 void printmeminfo();
 
 #if 1
 
-#define malloc(numBytes) memop(__FILE__, __LINE__, NULL, (int)numBytes, 0)
+#define malloc(numBytes) \
+    memop(__FILE__, __LINE__, NULL, numBytes, memprofile__op_malloc)
 #define realloc(oldPtr, numBytes) \
-    memop(__FILE__, __LINE__, oldPtr, (int)numBytes, 1)
-#define free(ptr) memop(__FILE__, __LINE__, ptr, -1, 0)
+    memop(__FILE__, __LINE__, oldPtr, numBytes, memprofile__op_realloc)
+#define free(ptr) \
+    memop(__FILE__, __LINE__, ptr, 0, memprofile__op_free)
 
 #endif
@@ -0,0 +1,183 @@
+// cull.cc
+//
+
+#include "cull.h"
+
+#include "glm/glm.hpp"
+#define GLM_FORCE_RADIANS
+#include "glm/gtc/type_ptr.hpp"
+using namespace glm;
+
+#include <float.h>
+#include <math.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#define for_i_3 for(int i = 0; i < 3; ++i)
+
+
+// Internal functions.
+
+static void set_plane(cull__Frustum *frustum, int i, vec4 plane) {
+  float len = length(vec3(plane));
+  if (len > 0) plane /= len;
+  frustum->x[i] = plane.x;
+  frustum->y[i] = plane.y;
+  frustum->z[i] = plane.z;
+  frustum->w[i] = plane.w;
+}
+
+// Returns cull__outside, cull__intersects, or cull__inside based on the
+// distance from frustum->eye to the box.
+static cull__Result test_distance(const cull__Frustum *frustum,
+                                  const GLfloat       *center,
+                                  const GLfloat       *extent) {
+  if (frustum->max_distance <= 0) return cull__inside;
+
+  float near_sq = 0, far_sq = 0;
+  for_i_3 {
+    float d    = fabsf(frustum->eye[i] - center[i]);
+    float near = fmaxf(d - extent[i], 0);
+    float far  = d + extent[i];
+    near_sq   += near * near;
+    far_sq    += far  * far;
+  }
+  float max_sq = frustum->max_distance * frustum->max_distance;
+  if (near_sq > max_sq) return cull__outside;
+  if (far_sq  > max_sq) return cull__intersects;
+  return cull__inside;
+}
+
+#ifdef __SSE__
+
+// This tests all eight planes, four at a time. A box is outside if it's
+// entirely on the outer side of any plane, and inside if it's entirely on the
+// inner side of every plane.
+static cull__Result test_planes(const cull__Frustum *frustum,
+                                const GLfloat       *center,
+                                const GLfloat       *extent) {
+  const __m128 sign_bit = _mm_set1_ps(-0.0f);
+  const __m128 zero     = _mm_setzero_ps();
+
+  __m128 cx = _mm_set1_ps(center[0]);
+  __m128 cy = _mm_set1_ps(center[1]);
+  __m128 cz = _mm_set1_ps(center[2]);
+  __m128 ex = _mm_set1_ps(extent[0]);
+  __m128 ey = _mm_set1_ps(extent[1]);
+  __m128 ez = _mm_set1_ps(extent[2]);
+
+  int is_out = 0, is_partial = 0;
+  for (int k = 0; k < 8; k += 4) {
+    __m128 px = _mm_loadu_ps(frustum->x + k);
+    __m128 py = _mm_loadu_ps(frustum->y + k);
+    __m128 pz = _mm_loadu_ps(frustum->z + k);
+    __m128 pw = _mm_loadu_ps(frustum->w + k);
+
+    // dist is the signed distance from each plane to the center, and radius is
+    // the box's extent projected onto each plane normal.
+    __m128 dist   = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, cx),
+                                          _mm_mul_ps(py, cy)),
+                               _mm_add_ps(_mm_mul_ps(pz, cz), pw));
+    __m128 radius = _mm_add_ps(_mm_add_ps(
+                        _mm_mul_ps(_mm_andnot_ps(sign_bit, px), ex),
+                        _mm_mul_ps(_mm_andnot_ps(sign_bit, py), ey)),
+                        _mm_mul_ps(_mm_andnot_ps(sign_bit, pz), ez));
+
+    is_out     |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, radius), zero));
+    is_partial |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(dist, radius), zero));
+  }
+
+  if (is_out)     return cull__outside;
+  if (is_partial) return cull__intersects;
+  return cull__inside;
+}
+
+#else
+
+static cull__Result test_planes(const cull__Frustum *frustum,
+                                const GLfloat       *center,
+                                const GLfloat       *extent) {
+  cull__Result result = cull__inside;
+  for (int i = 0; i < 8; ++i) {
+    float dist   = frustum->x[i] * center[0] +
+                   frustum->y[i] * center[1] +
+                   frustum->z[i] * center[2] + frustum->w[i];
+    float radius = fabsf(frustum->x[i]) * extent[0] +
+                   fabsf(frustum->y[i]) * extent[1] +
+                   fabsf(frustum->z[i]) * extent[2];
+    if (dist + radius < 0) return cull__outside;
+    if (dist - radius < 0) result = cull__intersects;
+  }
+  return result;
+}
+
+#endif
+
+
+// Public functions.
+
+extern "C" void cull__set_frustum(cull__Frustum *frustum,
+                                  const GLfloat *mvp,
+                                  const GLfloat *model_view,
+                                  GLfloat        max_distance) {
+  mat4 m = make_mat4(mvp);
+
+  // Each plane is a sum or difference of the last row and another row of m.
+  vec4 rows[4];
+  for (int i = 0; i < 4; ++i) {
+    rows[i] = vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+  }
+  for (int i = 0; i < 3; ++i) {
+    set_plane(frustum, 2 * i,     rows[3] + rows[i]);
+    set_plane(frustum, 2 * i + 1, rows[3] - rows[i]);
+  }
+
+  // The last two planes contain all points.
+  for (int i = 6; i < 8; ++i) set_plane(frustum, i, vec4(0, 0, 0, 1));
+
+  // The eye is at the origin of view space.
+  vec4 eye = inverse(make_mat4(model_view)) * vec4(0, 0, 0, 1);
+  for_i_3 frustum->eye[i] = eye[i] / eye.w;
+  frustum->max_distance   = max_distance;
+}
+
+extern "C" cull__Result cull__test_box(const cull__Frustum *frustum,
+                                       const GLfloat       *center,
+                                       const GLfloat       *extent) {
+  cull__Result dist_result = test_distance(frustum, center, extent);
+  if (dist_result == cull__outside) return cull__outside;
+  cull__Result plane_result = test_planes(frustum, center, extent);
+  return plane_result < dist_result ? plane_result : dist_result;
+}
+
+extern "C" void cull__find_box(const GLfloat *pts, int num_pts, size_t stride,
+                               GLfloat *center, GLfloat *extent) {
+  vec3 lo(FLT_MAX), hi(-FLT_MAX);
+  const char *bytes = (const char *)pts;
+  for (int j = 0; j < num_pts; ++j) {
+    vec3 pt = make_vec3((const GLfloat *)(bytes + j * stride));
+    lo = min(lo, pt);
+    hi = max(hi, pt);
+  }
+  if (num_pts == 0) lo = hi = vec3(0);
+  for_i_3 {
+    center[i] = (lo[i] + hi[i]) / 2;
+    extent[i] = (hi[i] - lo[i]) / 2;
+  }
+}
+
+extern "C" void cull__xform_box(const GLfloat *xform,
+                                const GLfloat *center,  const GLfloat *extent,
+                                GLfloat *new_center,    GLfloat *new_extent) {
+  // The new extent along each axis sums the absolute contributions of each of
+  // the old axes.
+  mat4 m = make_mat4(xform);
+  vec4 c = m * vec4(make_vec3(center), 1);
+  for_i_3 {
+    new_center[i] = c[i];
+    new_extent[i] = 0;
+    for (int j = 0; j < 3; ++j) new_extent[i] += fabsf(m[j][i]) * extent[j];
+  }
+}
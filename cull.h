@@ -0,0 +1,69 @@
+// cull.h
+//
+// View frustum and distance culling of axis-aligned bounding boxes.
+//
+// A cull__Frustum is built once per frame from the matrix that takes model
+// space to clip space. Boxes are then tested in that same model space. Each
+// box is given by its center and its extent, which is half its size along each
+// axis.
+//
+// The six frustum planes are tested together, four at a time, using SSE when
+// it's available.
+//
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "glinclude.h"
+
+#include <stddef.h>
+
+typedef enum {
+  cull__outside,
+  cull__intersects,
+  cull__inside
+} cull__Result;
+
+// The planes are stored as separate x, y, z, and w arrays, padded to eight
+// planes with planes that every point is inside of. A point p is inside the
+// i-th plane when x[i] * p.x + y[i] * p.y + z[i] * p.z + w[i] >= 0.
+typedef struct {
+  GLfloat x[8];
+  GLfloat y[8];
+  GLfloat z[8];
+  GLfloat w[8];
+
+  // Boxes with no point within max_distance of eye are outside.
+  GLfloat eye[3];
+  GLfloat max_distance;
+} cull__Frustum;
+
+// This expects mvp and model_view to be column-major 4x4 matrices.
+// A max_distance <= 0 turns off distance culling.
+void cull__set_frustum(cull__Frustum *frustum,
+                       const GLfloat *mvp,
+                       const GLfloat *model_view,
+                       GLfloat        max_distance);
+
+cull__Result cull__test_box(const cull__Frustum *frustum,
+                            const GLfloat       *center,
+                            const GLfloat       *extent);
+
+// This finds the bounding box of the given points, which are expected to be
+// num_pts triples of floats, each stride bytes apart.
+void cull__find_box(const GLfloat *pts, int num_pts, size_t stride,
+                    GLfloat *center, GLfloat *extent);
+
+// This finds the bounding box, in the new space, of the box given by center and
+// extent after it's transformed by xform, which is a column-major 4x4 matrix
+// with no projective part.
+void cull__xform_box(const GLfloat *xform,
+                     const GLfloat *center,  const GLfloat *extent,
+                     GLfloat *new_center,    GLfloat *new_extent);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,34 @@
+--[[
+
+cull_groups.lua
+
+A module to count the vertices of each cull group of a tree.
+
+The bark and leaf vertices of a tree are in tree order, so the vertices of each
+cull group are contiguous; see add_cull_groups in make_tree.lua. A groups table
+has a `sizes` sequence with the number of vertices of each run of points that
+share a cull group, which is what the Forest culls by.
+
+--]]
+
+local cull_groups = {}
+
+
+-- Public functions.
+
+-- This expects `groups` to be a table with a `sizes` sequence. It adds
+-- num_vertices to the last size if the last group had the same id, and
+-- otherwise starts a new group.
+function cull_groups.add(groups, id, num_vertices)
+  if num_vertices == 0 then return end
+  local sizes = groups.sizes
+  if #sizes > 0 and groups.last_id == id then
+    sizes[#sizes] = sizes[#sizes] + num_vertices
+  else
+    sizes[#sizes + 1] = num_vertices
+    groups.last_id = id
+  end
+end
+
+
+return cull_groups
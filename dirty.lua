@@ -0,0 +1,314 @@
+--[[
+
+dirty.lua
+
+A module to find the parts of a tree that need to be rebuilt after an edit, and
+the vertex ranges they occupy.
+
+Each tree point produces a range of the tree's bark vertices and a range of its
+leaf vertices, both in tree order. These fields of each tree point are kept up
+to date by dirty.update_ranges:
+
+   idx               = the index of the point in the tree
+   bark_first        = the number of its first vertex in tree.bark.pts
+   num_bark_vertices = its number of bark vertices (set by bark.lua)
+   leaf_first        = the number of its first vertex in tree.leaf_pts
+   num_leaf_vertices = its number of leaf vertices (set by leaf_globs.lua)
+
+Vertex number v starts at byte 12 * (v - 1) of a VertexArray's position buffer
+and at byte 4 * (v - 1) of its normal buffer.
+
+These are the dependencies between the parts of a tree:
+
+ * The ring size of a child point depends on the size of its up point, and the
+   ring size of a parent point depends on the sizes of its kids; see
+   get_ring_radius in rings.lua. So size changes spread toward the trunk.
+ * The ring of a child point depends on its size and stick, and also on the
+   size and stick of its sibling, as the two rings share a segment at their
+   fork; see get_center_ray_and_angle in rings.lua. Other rings depend only on
+   their own size and stick.
+ * The bark of a child point is its stick, which depends on its ring and the
+   ring of its up point. The bark of a parent point is its joint, which depends
+   on its ring and the rings of its kids.
+ * A leaf glob depends on the positions of the points leafward of its fork.
+
+Usage:
+
+  local edit = dirty.new_edit(tree)
+  dirty.mark_moved(edit, tree_pt)  -- After changing tree_pt.pt.
+  dirty.mark_size(edit, tree_pt)   -- After changing what tree_pt's ring size
+                                   -- depends on, such as max_ring_pts.
+
+  -- This finds what to rebuild; see dirty.propagate.
+  local plan = dirty.propagate(edit)
+
+  -- This rebuilds it, and returns the changes as sequences of
+  -- {first, count, pts, skin} patches to pass to VertexArray:replace_range in
+  -- order.
+  local bark_patches, leaf_patches = dirty.rebuild(edit)
+
+--]]
+
+local dirty = {}
+
+
+-- Requires.
+
+local bark       = require 'bark'
+local bones      = require 'bones'
+local leaf_globs = require 'leaf_globs'
+local rings      = require 'rings'
+local seq        = require 'seq'
+
+
+-- Internal functions.
+
+-- This returns the point whose ring size depends on that of tree_pt, or nil
+-- for the trunk.
+local function trunkward(tree_pt)
+  if tree_pt.kind == 'child' then return tree_pt.parent end
+  return tree_pt.down
+end
+
+-- This returns the sequence of {first, count, tree_pts} vertex ranges, in
+-- increasing order, that hold the old vertices of the key set of tree points
+-- `pts`. The vertices of `kind`, which is 'bark' or 'leaf', are used. The new
+-- points replacing an old subtree, if any, share the single range new[kind].
+-- Ranges that touch are merged.
+local function find_ranges(tree, pts, new, kind)
+  local first_key = kind .. '_first'
+  local count_key = 'num_' .. kind .. '_vertices'
+
+  local pieces = {}
+  for tree_pt in pairs(pts) do
+    if not new or tree_pt.idx < new.first or tree_pt.idx > new.last then
+      pieces[#pieces + 1] = {
+        first    = tree_pt[first_key],
+        count    = tree_pt[count_key] or 0,
+        idx      = tree_pt.idx,
+        tree_pts = {tree_pt}
+      }
+    end
+  end
+  if new then
+    local piece = {first = new[kind].first, count = new[kind].count,
+                   idx = new.first, tree_pts = {}}
+    for i = new.first, new.last do
+      piece.tree_pts[#piece.tree_pts + 1] = tree[i]
+    end
+    pieces[#pieces + 1] = piece
+  end
+  -- Points without vertices can share a first vertex with their neighbors;
+  -- those are kept in tree order.
+  table.sort(pieces, function (a, b)
+    if a.first ~= b.first then return a.first < b.first end
+    return a.idx < b.idx
+  end)
+
+  local ranges, range = {}, nil
+  for _, piece in ipairs(pieces) do
+    if range and piece.first == range.first + range.count then
+      range.count = range.count + piece.count
+      seq.append(range.tree_pts, piece.tree_pts)
+    else
+      range = {first = piece.first, count = piece.count, tree_pts = {}}
+      seq.append(range.tree_pts, piece.tree_pts)
+      ranges[#ranges + 1] = range
+    end
+  end
+  return ranges
+end
+
+-- This builds the new vertices of each of the given ranges, in the flat
+-- sequence pts, by calling add_pt_vertices(patch, tree_pt) for each of its tree
+-- points, which appends to patch.pts and to patch.skin. The flat sequence skin
+-- is updated to match; see bones.lua. This sets the count_key field of those
+-- points, and returns the patches in the order they can be applied; the last
+-- range is patched first, so that the old positions of the others stay valid.
+local function replace_ranges(pts, skin, ranges, count_key, add_pt_vertices)
+  local patches = {}
+  for i = #ranges, 1, -1 do
+    local range = ranges[i]
+    local patch = {first = range.first, count = range.count,
+                   pts   = {},          skin  = {}}
+    for _, tree_pt in ipairs(range.tree_pts) do
+      local num_pts = #patch.pts
+      add_pt_vertices(patch, tree_pt)
+      tree_pt[count_key] = (#patch.pts - num_pts) / 3
+    end
+    -- Both pts and skin have 3 numbers per vertex.
+    seq.splice(pts,  3 * (patch.first - 1) + 1, 3 * patch.count, patch.pts)
+    seq.splice(skin, 3 * (patch.first - 1) + 1, 3 * patch.count, patch.skin)
+    patches[#patches + 1] = patch
+  end
+  return patches
+end
+
+
+-- Public functions.
+
+-- This sets the idx, bark_first, and leaf_first fields of every tree point.
+function dirty.update_ranges(tree)
+  local bark_first, leaf_first = 1, 1
+  for i = 1, #tree do
+    local tree_pt = tree[i]
+    tree_pt.idx        = i
+    tree_pt.bark_first = bark_first
+    tree_pt.leaf_first = leaf_first
+    bark_first = bark_first + tree_pt.num_bark_vertices
+    leaf_first = leaf_first + (tree_pt.num_leaf_vertices or 0)
+  end
+end
+
+-- This returns a new, empty edit of tree. The tree's ranges are expected to be
+-- up to date.
+function dirty.new_edit(tree)
+  return {tree = tree, sizes = {}, rings = {}, moved = {}}
+end
+
+-- This notes that the ring size of tree_pt may have changed.
+function dirty.mark_size(edit, tree_pt)
+  edit.sizes[tree_pt] = true
+end
+
+-- This notes that tree_pt.pt has changed. A fork appears three times in the
+-- tree, and each of its items is expected to be marked.
+function dirty.mark_moved(edit, tree_pt)
+  edit.moved[tree_pt] = true
+
+  -- Mark the rings at both ends of the stick, and the ring of the stick's
+  -- sibling, as its direction changed.
+  local stick = (tree_pt.kind == 'child') and tree_pt or tree_pt.down
+  edit.rings[stick]    = true
+  edit.rings[stick.up] = true
+  if stick.parent then edit.rings[rings.get_sibling(stick)] = true end
+end
+
+-- This notes that tree[first..last] are new points that replaced the sequence
+-- of points old_sub, which formed a subtree. The new forks can reuse the shapes
+-- of old leaf globs by mapping them in old_globs, which is optional.
+-- Only one subtree can be replaced per edit.
+function dirty.mark_replaced(edit, first, last, old_sub, old_globs)
+  assert(edit.new == nil, 'Expected at most one replaced subtree per edit.')
+  local new = {
+    first     = first,
+    last      = last,
+    bark      = {first = old_sub[1].bark_first, count = 0},
+    leaf      = {first = old_sub[1].leaf_first, count = 0},
+    old_globs = old_globs
+  }
+  for _, tree_pt in ipairs(old_sub) do
+    new.bark.count = new.bark.count + tree_pt.num_bark_vertices
+    new.leaf.count = new.leaf.count + (tree_pt.num_leaf_vertices or 0)
+  end
+  edit.new = new
+  edit.sizes[edit.tree[first]] = true
+end
+
+-- This finds the minimal set of tree points to rebuild for the edit, and
+-- returns it as a plan table with these keys:
+--
+--   rings, bark, globs = key sets of the points that need a new ring, new bark,
+--                        and a new leaf glob
+--   bark_ranges        = a sequence of the {first, count} ranges of the old
+--   leaf_ranges          bark and leaf vertices to be replaced
+--
+-- Whether a change spreads depends on the new ring sizes and leaf distances, so
+-- this updates those as it goes, and builds the new leaf globs. This is called
+-- by dirty.rebuild, and can be called before it to see what will change.
+function dirty.propagate(edit)
+  if edit.plan then return edit.plan end
+
+  local tree = edit.tree
+  local new  = edit.new
+  local plan = {rings = {}, bark = {}, globs = {}}
+  if new then
+    -- The indexes after the new points have shifted.
+    for i = new.first, #tree do tree[i].idx = i end
+    for i = new.first, new.last do plan.rings[tree[i]] = true end
+  end
+
+  -- Follow each size change toward the trunk until a size stays the same. The
+  -- deepest points go first, so each size is computed from up-to-date ones.
+  local sizes = {}
+  for tree_pt in pairs(edit.sizes) do sizes[#sizes + 1] = tree_pt end
+  table.sort(sizes, function (a, b) return a.idx > b.idx end)
+  for _, tree_pt in ipairs(sizes) do
+    while tree_pt and rings.update_size(tree_pt) do
+      plan.rings[tree_pt] = true
+      if tree_pt.kind == 'child' and tree_pt.parent then
+        plan.rings[rings.get_sibling(tree_pt)] = true
+      end
+      tree_pt = trunkward(tree_pt)
+    end
+  end
+  for tree_pt in pairs(edit.rings) do plan.rings[tree_pt] = true end
+
+  -- Find the bark that touches a changed ring.
+  for tree_pt in pairs(plan.rings) do
+    if tree_pt.kind == 'child' then
+      plan.bark[tree_pt] = true
+      if tree_pt.parent then plan.bark[tree_pt.parent] = true end
+    else
+      plan.bark[tree_pt.down] = true
+      if tree_pt.kind == 'parent' then plan.bark[tree_pt] = true end
+    end
+  end
+
+  -- Find the leaf globs whose leaf points have moved or changed.
+  local starts, new_forks = {}, {}
+  for tree_pt in pairs(edit.moved) do starts[#starts + 1] = tree_pt end
+  if new then
+    starts[#starts + 1] = tree[new.first].parent
+    for i = new.first, new.last do
+      if tree[i].kind == 'parent' then new_forks[#new_forks + 1] = tree[i] end
+    end
+  end
+  plan.new_globs = leaf_globs.update_leaves(starts, new_forks,
+                                            new and new.old_globs)
+  for fork in pairs(plan.new_globs) do plan.globs[fork] = true end
+
+  plan.bark_ranges = find_ranges(tree, plan.bark,  new, 'bark')
+  plan.leaf_ranges = find_ranges(tree, plan.globs, new, 'leaf')
+
+  edit.plan = plan
+  return plan
+end
+
+-- This rebuilds what the edit changed, updating tree.bark.pts, tree.leaf_pts,
+-- their skins, tree.bones, and the ranges of the tree points. It returns
+-- bark_patches, leaf_patches, which are sequences of
+--   {first = first vertex, count = old vertex count, pts = new flat vertices,
+--    skin  = the skin of the new vertices}
+-- in the order they can be passed to VertexArray:replace_range.
+function dirty.rebuild(edit)
+  local tree = edit.tree
+  local plan = dirty.propagate(edit)
+
+  for tree_pt in pairs(plan.rings) do rings.update_ring(tree_pt) end
+  bones.update_bones(tree)
+
+  local function add_pt_bark(patch, tree_pt)
+    bark.add_pt_bark(patch.pts, patch.skin, tree_pt)
+  end
+  local function add_pt_leaves(patch, tree_pt)
+    local glob = plan.new_globs[tree_pt] or {}
+    seq.append(patch.pts, glob)
+    bones.add_skin(patch.skin, tree_pt.down, 1, #glob / 3)
+  end
+  local bark_patches = replace_ranges(tree.bark.pts, tree.bark.skin,
+                                      plan.bark_ranges, 'num_bark_vertices',
+                                      add_pt_bark)
+  local leaf_patches = replace_ranges(tree.leaf_pts, tree.leaf_skin,
+                                      plan.leaf_ranges, 'num_leaf_vertices',
+                                      add_pt_leaves)
+
+  bark.update_groups(tree)
+  leaf_globs.update_groups(tree)
+  dirty.update_ranges(tree)
+
+  return bark_patches, leaf_patches
+end
+
+
+return dirty
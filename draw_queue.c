@@ -0,0 +1,147 @@
+// draw_queue.c
+//
+
+#include "draw_queue.h"
+
+// Local includes.
+#include "cstructs/cstructs.h"
+#include "glstate.h"
+
+// Standard library includes.
+#include <string.h>
+
+
+// Internal types and globals.
+
+// Per-program data. The last color is kept so that we can skip redundant
+// uniform updates; uniform values persist with the program across frames.
+typedef struct {
+  GLuint                   program;
+  draw_queue__ProgramSetup setup;
+  int                      has_color;
+  GLfloat                  last_color[3];
+} ProgramInfo;
+
+static Array programs = NULL;
+static Array items    = NULL;
+
+
+// Internal functions.
+
+static void init_if_needed() {
+  if (items) return;
+  programs = array__new(4,  sizeof(ProgramInfo));
+  items    = array__new(64, sizeof(draw_queue__Item));
+}
+
+static ProgramInfo *find_program_info(GLuint program) {
+  array__for(ProgramInfo *, info, programs, i) {
+    if (info->program == program) return info;
+  }
+  return NULL;
+}
+
+static int compare_items(void *context, const void *a, const void *b) {
+  (void)context;
+  const draw_queue__Item *item1 = (const draw_queue__Item *)a;
+  const draw_queue__Item *item2 = (const draw_queue__Item *)b;
+  if (item1->program != item2->program) {
+    return item1->program < item2->program ? -1 : 1;
+  }
+  if (item1->vao != item2->vao) return item1->vao < item2->vao ? -1 : 1;
+  if (item1->buffer_texture != item2->buffer_texture) {
+    return item1->buffer_texture < item2->buffer_texture ? -1 : 1;
+  }
+  return 0;
+}
+
+static void send_color(ProgramInfo *info, GLint color_loc,
+                       const GLfloat *color) {
+  if (info && info->has_color &&
+      memcmp(info->last_color, color, sizeof(info->last_color)) == 0) {
+    return;
+  }
+  glUniform3fv(color_loc,  // location
+               1,          // count
+               color);     // data
+  if (info) {
+    info->has_color = 1;
+    memcpy(info->last_color, color, sizeof(info->last_color));
+  }
+}
+
+// Public functions.
+
+void draw_queue__set_program_setup(GLuint                   program,
+                                   draw_queue__ProgramSetup fn) {
+  init_if_needed();
+  ProgramInfo *info = find_program_info(program);
+  if (info == NULL) {
+    info = (ProgramInfo *)array__new_ptr(programs);
+    info->program   = program;
+    info->has_color = 0;
+  }
+  info->setup = fn;
+}
+
+void draw_queue__add(draw_queue__Item *item) {
+  init_if_needed();
+  array__add_item_ptr(items, item);
+}
+
+void draw_queue__send_color(GLuint program, GLint color_loc,
+                            const GLfloat *color) {
+  init_if_needed();
+  send_color(find_program_info(program), color_loc, color);
+}
+
+void draw_queue__flush() {
+  init_if_needed();
+
+  array__sort(items, compare_items, NULL);  // NULL --> context
+
+  ProgramInfo *info    = NULL;
+  GLuint       program = 0;
+
+  array__for(draw_queue__Item *, item, items, i) {
+
+    // Switch programs, and send per-program uniforms, as needed.
+    if (i == 0 || item->program != program) {
+      program = item->program;
+      glstate__use_program(program);
+      info = find_program_info(program);
+      if (info && info->setup) info->setup(program);
+    }
+
+    glstate__bind_vertex_array(item->vao);
+    if (item->buffer_texture) {
+      glstate__bind_buffer_texture(item->buffer_texture);
+    }
+    if (item->color_loc >= 0) send_color(info, item->color_loc, item->color);
+
+    if (item->draw_count > 0) {
+      glMultiDrawArrays(item->mode, item->firsts, item->counts,
+                        item->draw_count);
+      continue;
+    }
+
+    if (item->index_type == 0) {
+      glDrawArrays(item->mode, item->first, item->count);
+      continue;
+    }
+
+    if (item->use_restart) {
+      glstate__enable(GL_PRIMITIVE_RESTART);
+    } else {
+      glstate__disable(GL_PRIMITIVE_RESTART);
+    }
+    GLsizei index_size = item->index_type == GL_UNSIGNED_INT   ? 4 :
+                         item->index_type == GL_UNSIGNED_SHORT ? 2 : 1;
+    glDrawElements(item->mode,                                    // mode
+                   item->count,                                   // count
+                   item->index_type,                              // type
+                   (void *)(size_t)(item->first * index_size));  // offset
+  }
+
+  array__clear(items);
+}
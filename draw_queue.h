@@ -0,0 +1,68 @@
+// draw_queue.h
+//
+// A per-frame queue of draw calls.
+//
+// Draws are collected with draw_queue__add and executed by draw_queue__flush,
+// which sorts them by program, then by vertex array object, and then by buffer
+// texture, so that each is bound as few times as possible. All state changes go
+// through the glstate module, so redundant calls are skipped across frames as
+// well.
+//
+// Uniforms that are shared by every draw using a program - such as the mvp
+// matrix - are sent by a per-program setup function, which is called once per
+// flush, when that program is first made current.
+//
+// Usage:
+//
+//   // Once, after loading a program:
+//   draw_queue__set_program_setup(program, send_my_uniforms);
+//
+//   // Any number of times per frame:
+//   draw_queue__Item item = { .program = program, .vao = vao, .. };
+//   draw_queue__add(&item);
+//
+//   // Once per frame, after all draws are added:
+//   draw_queue__flush();
+//
+
+#pragma once
+
+#include "glinclude.h"
+
+typedef void (*draw_queue__ProgramSetup)(GLuint program);
+
+typedef struct {
+  GLuint  program;
+  GLuint  vao;
+  GLenum  mode;         // A primitive type such as GL_TRIANGLES.
+  GLint   first;        // The first vertex, or first index for indexed draws.
+  GLsizei count;        // The number of vertices or indices to draw.
+  GLenum  index_type;   // 0 for glDrawArrays; else the glDrawElements type.
+  int     use_restart;  // Nonzero to enable GL_PRIMITIVE_RESTART.
+  GLint   color_loc;    // If this is >= 0, color is sent to it as a vec3.
+  GLfloat color[3];
+
+  // If draw_count > 0, this is a multi-draw of non-indexed ranges, and the
+  // firsts and counts arrays are used in place of first and count. These
+  // arrays must stay valid until the next flush.
+  const GLint   *firsts;
+  const GLsizei *counts;
+  GLsizei        draw_count;
+
+  // If nonzero, this is bound as the GL_TEXTURE_BUFFER on texture unit 0.
+  GLuint  buffer_texture;
+} draw_queue__Item;
+
+void draw_queue__set_program_setup(GLuint program, draw_queue__ProgramSetup fn);
+
+// The item is copied, so the caller may reuse it after this returns.
+void draw_queue__add(draw_queue__Item *item);
+
+// Sends color, a vec3, to color_loc of program, which must be the current
+// program. This is for draws made outside the queue; it keeps the queue's
+// record of each program's last color up to date.
+void draw_queue__send_color(GLuint program, GLint color_loc,
+                            const GLfloat *color);
+
+// Executes and then removes all queued draws.
+void draw_queue__flush();
@@ -0,0 +1,120 @@
+// file_posix.c
+//
+// The non-Apple implementation of file.h. On macOS, file.m is used instead.
+//
+// Packaged files are looked up under the directory named by the TREES_DIR
+// environment variable, or under the current directory if it's not set. Both
+// the directory itself and its shaders and species subdirectories are searched,
+// matching the repo layout.
+//
+
+#ifndef __APPLE__
+
+#include "file.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define path_len 4096
+
+
+// Internal functions.
+
+static const char *resource_dir() {
+  const char *dir = getenv("TREES_DIR");
+  return dir ? dir : ".";
+}
+
+
+// Public functions.
+
+// Returns NULL if the file can't be found.
+char *file__get_path(const char *filename) {
+  static char path[path_len];
+
+  static const char *subdirs[] = {"", "shaders/", "species/"};
+  int num_subdirs = (int)(sizeof(subdirs) / sizeof(subdirs[0]));
+  for (int i = 0; i < num_subdirs; ++i) {
+    snprintf(path, path_len, "%s/%s%s", resource_dir(), subdirs[i], filename);
+    if (file__exists(path)) return path;
+  }
+  return NULL;
+}
+
+char *file__save_dir() {
+  // This leaves room for the file name that file__account_path appends.
+  static char save_dir[path_len - sizeof("/account")];
+
+  const char *home = getenv("HOME");
+  snprintf(save_dir, sizeof(save_dir), "%s/.trees", home ? home : ".");
+
+  return save_dir;
+}
+
+char *file__account_path() {
+  static char path[path_len];
+
+  snprintf(path, path_len, "%s/account", file__save_dir());
+
+  return path;
+}
+
+int file__make_dir_if_needed(const char *dir) {
+  char path[path_len];
+  snprintf(path, path_len, "%s", dir);
+
+  // Create each missing parent directory, then the directory itself.
+  for (char *sep = strchr(path + 1, file__path_sep); sep;
+       sep = strchr(sep + 1, file__path_sep)) {
+    *sep = '\0';
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) goto error;
+    *sep = file__path_sep;
+  }
+  if (mkdir(path, 0755) == 0 || errno == EEXIST) return 1;
+
+error:
+  printf("Error creating %s: %s\n", dir, strerror(errno));
+  return 0;
+}
+
+int file__exists(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0;
+}
+
+char *file__contents(const char *path, size_t *size) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return NULL;
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *file_contents = malloc(*size + 1);
+  *size = fread(file_contents, 1, *size, f);
+  file_contents[*size] = '\0';
+  fclose(f);
+
+  return file_contents;
+}
+
+int file__write(const char *path, const char *contents) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    printf("Error: fopen failed in %s.\n", __func__);
+    return 0;
+  }
+  size_t num_bytes = strlen(contents);
+  size_t bytes_written = fwrite(contents, 1 /* elt size */,
+                                num_bytes /* num elts */, f);
+  fclose(f);
+  if (bytes_written < num_bytes) {
+    printf("Error: only wrote %zu bytes in %s; tried to write %zu.\n",
+           bytes_written, __func__, num_bytes);
+    return 0;
+  }
+  return 1;
+}
+
+#endif  // __APPLE__
@@ -0,0 +1,697 @@
+// forest.cc
+//
+
+#include "forest.h"
+
+extern "C" {
+#include "cstructs/cstructs.h"
+#include "cull.h"
+#include "draw_queue.h"
+#include "frame_uniforms.h"
+#include "glhelp.h"
+#include "glstate.h"
+#include "luahelp.h"
+#include "normals.h"
+#include "upload_queue.h"
+#include "lua/lauxlib.h"
+}
+
+#include "config.h"
+
+#include "glm/glm.hpp"
+#define GLM_FORCE_RADIANS
+#include "glm/gtc/matrix_transform.hpp"
+using namespace glm;
+
+#include "glinclude.h"
+
+#include <float.h>
+#include <math.h>
+
+#define forest_metatable "Trees.Forest"
+
+// The number of vertices each arena can hold before it first grows.
+#define initial_arena_capacity (1 << 16)
+
+
+// Internal types and globals.
+
+// State shared across all Forest instances.
+static GLuint program;
+static GLint  color_loc;
+
+typedef enum {
+  material_bark,
+  material_leaves,
+  num_materials
+} Material;
+
+static const GLfloat material_colors[num_materials][3] = {
+  {0.494, 0.349, 0.204},  // Bark; this matches VertexArray's default color.
+  {0.0,   0.6,   0.0  }   // Leaves.
+};
+
+// The normal is octahedral-encoded as two normalized shorts; the vertex shader
+// decodes it.
+typedef struct {
+  GLfloat pt[3];
+  GLshort normal[2];
+  GLuint  tree_index;
+} Vertex;
+
+// In quantized forests, each position is stored as normalized shorts relative
+// to its tree's bounding box; the 4th short is padding. The mapping back to
+// tree space is folded into the tree's matrix.
+typedef struct {
+  GLshort pt[4];
+  GLshort normal[2];
+  GLuint  tree_index;
+} QuantizedVertex;
+
+// The mapping from tree space to quantized positions.
+typedef struct {
+  vec3 center;
+  vec3 extent;
+} Quantization;
+
+// An arena is a growable vertex buffer shared by all trees for one material.
+typedef struct {
+  GLuint  vao;
+  GLuint  vbo;
+  int     num_vertices;
+  int     capacity;
+  int     is_quantized;
+  GLsizei vertex_size;  // Either sizeof(Vertex) or sizeof(QuantizedVertex).
+
+  // Group items for every tree; each tree's groups are contiguous.
+  Array  groups;
+
+  // These are the GLint firsts and GLsizei counts drawn in the current frame.
+  Array  firsts;
+  Array  counts;
+} VertexArena;
+
+// A group is a range of vertices - usually one subtree of the skeleton - along
+// with its bounding box in forest space. The groups are the leaves of a
+// two-level bounding volume hierarchy with one tree's box at the root.
+typedef struct {
+  GLfloat center[3];
+  GLfloat extent[3];
+  GLint   first;
+  GLsizei count;
+} Group;
+
+// The vertex range and groups used by one tree within each arena.
+typedef struct {
+  GLint   first[num_materials];
+  GLsizei count[num_materials];
+  int     group_first[num_materials];
+  int     num_groups[num_materials];
+
+  // The bounding box of the whole tree in forest space.
+  GLfloat center[3];
+  GLfloat extent[3];
+
+  // The tree isn't drawn until all of its vertices have reached the gpu.
+  int     num_pending_uploads;
+} Tree;
+
+// State owned by any single Forest instance.
+typedef struct {
+  VertexArena arenas[num_materials];
+  Array       trees;   // Tree items.
+  Array       xforms;  // mat4 items; xforms[i] is the model matrix of tree i.
+  GLuint      xforms_vbo;
+  GLuint      xforms_tex;
+  int         xforms_are_dirty;
+  int         is_quantized;
+} Forest;
+
+// Names for vertex attribute indexes in our vertex shader.
+enum {
+  v_position,
+  color,
+  normal,
+  tree_index
+};
+
+
+// Internal: OpenGL utility code.
+
+// Initialize data that's constant across all instances.
+// This function is expected to be called only once.
+static void gl_init() {
+  program   = glhelp__load_program("forest.vert.glsl",
+                                   "bark.frag.glsl");
+  color_loc = glGetUniformLocation(program, "color");
+
+  // The tree transforms are always on texture unit 0.
+  glUniform1i(glGetUniformLocation(program, "tree_xforms"), 0);
+}
+
+// This expects arena->vao and arena->vbo to be bound.
+static void set_vertex_attribs(VertexArena *arena) {
+  int    q = arena->is_quantized;
+  size_t pt_offset     = q ? offsetof(QuantizedVertex, pt)
+                           : offsetof(Vertex,          pt);
+  size_t normal_offset = q ? offsetof(QuantizedVertex, normal)
+                           : offsetof(Vertex,          normal);
+  size_t index_offset  = q ? offsetof(QuantizedVertex, tree_index)
+                           : offsetof(Vertex,          tree_index);
+
+  glEnableVertexAttribArray(v_position);
+  glVertexAttribPointer(v_position,                   // attrib index
+                        3,                            // num coords
+                        q ? GL_SHORT : GL_FLOAT,      // coord type
+                        q ? GL_TRUE  : GL_FALSE,      // gpu should normalize
+                        arena->vertex_size,           // stride
+                        (void *)pt_offset);           // offset
+  glEnableVertexAttribArray(normal);
+  glVertexAttribPointer(normal,                       // attrib index
+                        2,                            // num coords
+                        GL_SHORT,                     // coord type
+                        GL_TRUE,                      // gpu should normalize
+                        arena->vertex_size,           // stride
+                        (void *)normal_offset);       // offset
+  glEnableVertexAttribArray(tree_index);
+  glVertexAttribIPointer(tree_index,                  // attrib index
+                         1,                           // num coords
+                         GL_UNSIGNED_INT,             // coord type
+                         arena->vertex_size,          // stride
+                         (void *)index_offset);       // offset
+}
+
+static void arena_init(VertexArena *arena, int is_quantized) {
+  arena->num_vertices = 0;
+  arena->capacity     = initial_arena_capacity;
+  arena->is_quantized = is_quantized;
+  arena->vertex_size  = is_quantized ? sizeof(QuantizedVertex) : sizeof(Vertex);
+  arena->groups       = array__new(64, sizeof(Group));
+  arena->firsts       = array__new(16, sizeof(GLint));
+  arena->counts       = array__new(16, sizeof(GLsizei));
+
+  glGenVertexArrays(1, &arena->vao);
+  glstate__bind_vertex_array(arena->vao);
+  glGenBuffers(1, &arena->vbo);
+  glstate__bind_array_buffer(arena->vbo);
+  glBufferData(GL_ARRAY_BUFFER,                      // buffer use target
+               arena->capacity * arena->vertex_size, // size
+               NULL,                                 // data
+               GL_STATIC_DRAW);                      // usage hint
+  set_vertex_attribs(arena);
+}
+
+// Grows the arena, if needed, so that it can hold num_new more vertices.
+// The existing vertices are copied on the gpu.
+static void arena_reserve(VertexArena *arena, int num_new) {
+  int needed = arena->num_vertices + num_new;
+  if (needed <= arena->capacity) return;
+
+  int new_capacity = arena->capacity;
+  while (new_capacity < needed) new_capacity *= 2;
+
+  GLuint new_vbo;
+  glGenBuffers(1, &new_vbo);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, new_vbo);
+  glBufferData(GL_COPY_WRITE_BUFFER,                 // buffer use target
+               new_capacity * arena->vertex_size,    // size
+               NULL,                                 // data
+               GL_STATIC_DRAW);                      // usage hint
+  glBindBuffer(GL_COPY_READ_BUFFER, arena->vbo);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER,                // read target
+                      GL_COPY_WRITE_BUFFER,               // write target
+                      0,                                  // read offset
+                      0,                                  // write offset
+                      arena->num_vertices * arena->vertex_size);  // size
+  glstate__delete_buffer(arena->vbo);
+
+  arena->vbo      = new_vbo;
+  arena->capacity = new_capacity;
+
+  // Point the vao at the new buffer.
+  glstate__bind_vertex_array(arena->vao);
+  glstate__bind_array_buffer(arena->vbo);
+  set_vertex_attribs(arena);
+}
+
+// Returns the nearest short to x, in [-1, 1], as a normalized short.
+static GLshort quantize(float x) {
+  x = fmaxf(-1.0f, fminf(1.0f, x));
+  return (GLshort)lrintf(x * 32767.0f);
+}
+
+// This is called by the upload queue when one of a tree's uploads is finished.
+static void upload_done(void *owner, int tree_idx) {
+  Forest *forest = (Forest *)owner;
+  Tree   *tree   = (Tree *)array__item_ptr(forest->trees, tree_idx);
+  tree->num_pending_uploads--;
+}
+
+// Makes room for num_new more vertices at the end of the arena, and returns the
+// index of the first one.
+static GLint arena_alloc(VertexArena *arena, int num_new) {
+  arena_reserve(arena, num_new);
+  GLint first = arena->num_vertices;
+  arena->num_vertices += num_new;
+  return first;
+}
+
+// Queues up the upload of the given triangle corners, as a flat array of
+// floats, into the arena starting at vertex first. Quantized arenas use quant
+// to map the points into [-1, 1]^3. The upload's priority is based on the
+// distance from center to the camera, and it counts toward the given tree's
+// num_pending_uploads.
+static void arena_upload(VertexArena *arena, Array pts, GLint first,
+                         GLuint tree_idx, Quantization *quant, Forest *forest,
+                         Tree *tree) {
+  Array normals  = normals__new_for_vertices(pts, 0);  // 0 --> not a strip
+  int   num_new  = pts->count / 3;
+  char *vertices = (char *)malloc(num_new * arena->vertex_size);
+  for (int i = 0; i < num_new; ++i) {
+    GLfloat *pt = (GLfloat *)array__item_ptr(pts,     3 * i);
+    GLfloat *n  = (GLfloat *)array__item_ptr(normals, 3 * i);
+    char *vertex = vertices + i * arena->vertex_size;
+    if (arena->is_quantized) {
+      QuantizedVertex *v = (QuantizedVertex *)vertex;
+      for (int j = 0; j < 3; ++j) {
+        v->pt[j] = quantize((pt[j] - quant->center[j]) / quant->extent[j]);
+      }
+      v->pt[3] = 0;
+      normals__encode_octahedral(n, v->normal);
+      v->tree_index = tree_idx;
+    } else {
+      Vertex *v = (Vertex *)vertex;
+      for (int j = 0; j < 3; ++j) v->pt[j] = pt[j];
+      normals__encode_octahedral(n, v->normal);
+      v->tree_index = tree_idx;
+    }
+  }
+  array__delete(normals);
+
+  if (num_new == 0) {
+    free(vertices);
+    return;
+  }
+
+  upload_queue__Job job = {
+    .vbo        = &arena->vbo,
+    .offset     = first * arena->vertex_size,
+    .size       = num_new * arena->vertex_size,
+    .data       = vertices,
+    .has_center = 1,
+    .center     = {tree->center[0], tree->center[1], tree->center[2]},
+    .owner      = forest,
+    .done       = upload_done,
+    .tag        = (int)tree_idx
+  };
+  upload_queue__add(&job);
+  tree->num_pending_uploads++;
+}
+
+static void arena_release(VertexArena *arena) {
+  glstate__delete_vertex_array(arena->vao);
+  glstate__delete_buffer(arena->vbo);
+  array__delete(arena->groups);
+  array__delete(arena->firsts);
+  array__delete(arena->counts);
+}
+
+// Adds a range to the arena's draw list for this frame, merging it into the
+// previous range when they're adjacent.
+static void arena_add_range(VertexArena *arena, GLint first, GLsizei count) {
+  if (count == 0) return;
+  int n = arena->counts->count;
+  if (n > 0) {
+    GLint   *last_first = (GLint   *)array__item_ptr(arena->firsts, n - 1);
+    GLsizei *last_count = (GLsizei *)array__item_ptr(arena->counts, n - 1);
+    if (*last_first + *last_count == first) {
+      *last_count += count;
+      return;
+    }
+  }
+  array__new_val(arena->firsts, GLint)   = first;
+  array__new_val(arena->counts, GLsizei) = count;
+}
+
+// Raises a Lua error unless the value at the given stack index is nil or a
+// sequence of group vertex counts that add up to num_vertices. This is called
+// before anything is allocated, as a Lua error would leak it.
+static void check_group_sizes(lua_State *L, int index, int num_vertices) {
+  if (lua_isnoneornil(L, index)) return;
+  luahelp__check_indexable(L, index);
+  int sum = 0;
+  int n   = (int)luaL_len(L, index);
+  for (int i = 1; i <= n; ++i) {
+    lua_geti(L, index, i);
+    sum += (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  if (sum != num_vertices) {
+    luaL_argerror(L, index,
+                  "expected group sizes to add up to the vertex count");
+  }
+}
+
+// Reads the sequence of group vertex counts at the given stack index into a new
+// Array of ints. If the value there is nil, the result is a single group of all
+// num_vertices vertices. The counts are expected to have passed
+// check_group_sizes.
+static Array new_group_sizes(lua_State *L, int index, int num_vertices) {
+  Array sizes = array__new(16, sizeof(int));
+  if (lua_isnoneornil(L, index)) {
+    array__new_val(sizes, int) = num_vertices;
+    return sizes;
+  }
+  int n = (int)luaL_len(L, index);
+  for (int i = 1; i <= n; ++i) {
+    lua_geti(L, index, i);
+    array__new_val(sizes, int) = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  return sizes;
+}
+
+// Appends one Group per size to the arena, and returns the index of the first
+// one. The pts are the tree's vertices in tree space, and the groups' boxes are
+// found in forest space via xform.
+static int arena_add_groups(VertexArena *arena, Array pts, GLint first,
+                            Array sizes, mat4 xform) {
+  int group_first = arena->groups->count;
+  GLint vertex    = 0;
+  array__for(int *, size, sizes, i) {
+    if (*size == 0) continue;
+    Group *group = (Group *)array__new_ptr(arena->groups);
+    GLfloat center[3], extent[3];
+    cull__find_box((GLfloat *)array__item_ptr(pts, 3 * vertex),  // pts
+                   *size,                                       // num_pts
+                   3 * sizeof(GLfloat),                         // stride
+                   center, extent);
+    cull__xform_box(&xform[0][0], center, extent,
+                    group->center, group->extent);
+    group->first = first + vertex;
+    group->count = *size;
+    vertex += *size;
+  }
+  return group_first;
+}
+
+// Sets quant to map the bounding box of all the given points to [-1, 1]^3.
+static void find_quantization(Array pts[num_materials], Quantization *quant) {
+  vec3 lo(FLT_MAX), hi(-FLT_MAX);
+  for (int i = 0; i < num_materials; ++i) {
+    for (int j = 0; j + 2 < pts[i]->count; j += 3) {
+      GLfloat *pt = (GLfloat *)array__item_ptr(pts[i], j);
+      lo = min(lo, vec3(pt[0], pt[1], pt[2]));
+      hi = max(hi, vec3(pt[0], pt[1], pt[2]));
+    }
+  }
+  if (lo.x > hi.x) lo = hi = vec3(0);  // There are no points.
+
+  quant->center = (lo + hi) / 2.0f;
+  // A flat box would make for a singular matrix, so we keep a minimum extent.
+  quant->extent = max((hi - lo) / 2.0f, vec3(1e-6f));
+}
+
+// Sets the tree's box to contain all of its groups.
+static void find_tree_box(Forest *forest, Tree *tree) {
+  vec3 lo(FLT_MAX), hi(-FLT_MAX);
+  for (int i = 0; i < num_materials; ++i) {
+    Array groups = forest->arenas[i].groups;
+    for (int j = 0; j < tree->num_groups[i]; ++j) {
+      Group *group = (Group *)array__item_ptr(groups, tree->group_first[i] + j);
+      vec3 center  = vec3(group->center[0], group->center[1], group->center[2]);
+      vec3 extent  = vec3(group->extent[0], group->extent[1], group->extent[2]);
+      lo = min(lo, center - extent);
+      hi = max(hi, center + extent);
+    }
+  }
+  if (lo.x > hi.x) lo = hi = vec3(0);  // The tree is empty.
+  for (int i = 0; i < 3; ++i) {
+    tree->center[i] = (lo[i] + hi[i]) / 2;
+    tree->extent[i] = (hi[i] - lo[i]) / 2;
+  }
+}
+
+// Adds the visible parts of the tree to each arena's draw ranges.
+static void add_visible_ranges(Forest *forest, Tree *tree,
+                               cull__Frustum *frustum) {
+  if (tree->num_pending_uploads > 0) return;
+  cull__Result tree_result = cull__test_box(frustum, tree->center,
+                                            tree->extent);
+  if (tree_result == cull__outside) return;
+
+  for (int i = 0; i < num_materials; ++i) {
+    VertexArena *arena = &forest->arenas[i];
+    if (tree_result == cull__inside) {
+      arena_add_range(arena, tree->first[i], tree->count[i]);
+      continue;
+    }
+    for (int j = 0; j < tree->num_groups[i]; ++j) {
+      Group *group = (Group *)array__item_ptr(arena->groups,
+                                              tree->group_first[i] + j);
+      cull__Result result = cull__test_box(frustum, group->center,
+                                           group->extent);
+      if (result != cull__outside) {
+        arena_add_range(arena, group->first, group->count);
+      }
+    }
+  }
+}
+
+static void update_xforms_if_needed(Forest *forest) {
+  if (!forest->xforms_are_dirty) return;
+  glBindBuffer(GL_TEXTURE_BUFFER, forest->xforms_vbo);
+  glBufferData(GL_TEXTURE_BUFFER,                                  // target
+               forest->xforms->count * forest->xforms->item_size,  // size
+               forest->xforms->items,                              // data
+               GL_STATIC_DRAW);                                    // usage
+  forest->xforms_are_dirty = 0;
+}
+
+
+// Internal: Lua C functions.
+
+// Lua C function.
+// Expected parameters: [options]
+// where options may have a boolean quantize_positions key.
+static int forest__new(lua_State *L) {
+
+  int is_quantized = 0;
+  if (lua_istable(L, 2)) {
+    lua_getfield(L, 2, "quantize_positions");
+    is_quantized = lua_toboolean(L, -1);
+  }
+
+  lua_settop(L, 0);
+      // stack = []
+
+  // Create a Forest instance and set its metatable.
+  Forest *forest = (Forest *)lua_newuserdata(L, sizeof(Forest));
+      // stack = [forest]
+  luaL_getmetatable(L, forest_metatable);
+      // stack = [forest, mt]
+  lua_setmetatable(L, 1);
+      // stack = [forest]
+
+  // Set up the C data.
+  for (int i = 0; i < num_materials; ++i) {
+    arena_init(&forest->arenas[i], is_quantized);
+  }
+  forest->is_quantized     = is_quantized;
+  forest->trees            = array__new(16, sizeof(Tree));
+  forest->xforms           = array__new(16, sizeof(mat4));
+  forest->xforms_are_dirty = 1;
+
+  glGenBuffers(1, &forest->xforms_vbo);
+  glGenTextures(1, &forest->xforms_tex);
+  glstate__bind_buffer_texture(forest->xforms_tex);
+  glBindBuffer(GL_TEXTURE_BUFFER, forest->xforms_vbo);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, forest->xforms_vbo);
+
+  glhelp__error_check;
+
+  return 1;  // --> 1 Lua return value
+}
+
+// Lua C function.
+// Expected parameters: self, bark_pts, leaf_pts, x, y, z,
+//                      [angle, [bark_group_sizes, leaf_group_sizes]]
+static int forest__add_tree(lua_State *L) {
+
+  Forest *forest = (Forest *)luaL_checkudata(L, 1, forest_metatable);
+  luahelp__check_indexable(L, 2);
+  luahelp__check_indexable(L, 3);
+  vec3  position = vec3(luaL_checknumber(L, 4),
+                        luaL_checknumber(L, 5),
+                        luaL_checknumber(L, 6));
+  float angle    = luaL_optnumber(L, 7, 0.0);
+
+  mat4 xform = translate(mat4(1.0), position);
+  xform      = rotate(xform, angle, vec3(0.0, 1.0, 0.0));
+
+  for (int i = 0; i < num_materials; ++i) {
+    check_group_sizes(L, 8 + i, (int)lua_rawlen(L, 2 + i) / 3);
+  }
+
+  Array pts[num_materials];
+  for (int i = 0; i < num_materials; ++i) {
+    pts[i] = luahelp__new_float_array(L, 2 + i);
+  }
+
+  // The quantization maps the tree's bounding box, in tree space, to [-1, 1]^3.
+  // The reverse mapping is folded into the matrix sent to the gpu.
+  Quantization quant;
+  mat4 gpu_xform = xform;
+  if (forest->is_quantized) {
+    find_quantization(pts, &quant);
+    gpu_xform = scale(translate(xform, quant.center), quant.extent);
+  }
+
+  GLuint tree_idx = forest->trees->count;
+  Tree tree;
+  for (int i = 0; i < num_materials; ++i) {
+    VertexArena *arena = &forest->arenas[i];
+    Array  sizes = new_group_sizes(L, 8 + i, pts[i]->count / 3);
+    tree.count[i]       = pts[i]->count / 3;
+    tree.first[i]       = arena_alloc(arena, tree.count[i]);
+    tree.group_first[i] = arena_add_groups(arena, pts[i], tree.first[i],
+                                           sizes, xform);
+    tree.num_groups[i]  = arena->groups->count - tree.group_first[i];
+    array__delete(sizes);
+  }
+  find_tree_box(forest, &tree);
+
+  // The vertices are sent to the gpu over the next few frames, nearest trees
+  // first.
+  tree.num_pending_uploads = 0;
+  for (int i = 0; i < num_materials; ++i) {
+    arena_upload(&forest->arenas[i], pts[i], tree.first[i], tree_idx, &quant,
+                 forest, &tree);
+    array__delete(pts[i]);
+  }
+  array__add_item_val(forest->trees, tree);
+  array__add_item_val(forest->xforms, gpu_xform);
+  forest->xforms_are_dirty = 1;
+
+  glhelp__error_check;
+
+  return 0;  // --> 0 Lua return values
+}
+
+// Lua C function.
+// Expected parameters: self
+static int forest__draw(lua_State *L) {
+
+  Forest *forest = (Forest *)luaL_checkudata(L, 1, forest_metatable);
+  update_xforms_if_needed(forest);
+
+  // Set up the frustum in forest space.
+  GLfloat mvp[16], model_view[16];
+  frame_uniforms__get_mvp(mvp);
+  frame_uniforms__get_model_view(model_view);
+  cull__Frustum frustum;
+  cull__set_frustum(&frustum, mvp, model_view, forest_cull_distance);
+
+  // Collect this frame's visible ranges.
+  for (int i = 0; i < num_materials; ++i) {
+    array__clear(forest->arenas[i].firsts);
+    array__clear(forest->arenas[i].counts);
+  }
+  array__for(Tree *, tree, forest->trees, tree_idx) {
+    add_visible_ranges(forest, tree, &frustum);
+  }
+
+  for (int i = 0; i < num_materials; ++i) {
+    VertexArena *arena = &forest->arenas[i];
+    if (arena->counts->count == 0) continue;
+
+    // Queue up the draw.
+    const GLfloat *color = material_colors[i];
+    draw_queue__Item item = {
+      .program        = program,
+      .vao            = arena->vao,
+      .mode           = GL_TRIANGLES,
+      .first          = 0,
+      .count          = 0,
+      .index_type     = 0,
+      .use_restart    = 0,
+      .color_loc      = color_loc,
+      .color          = {color[0], color[1], color[2]},
+      .firsts         = (GLint   *)arena->firsts->items,
+      .counts         = (GLsizei *)arena->counts->items,
+      .draw_count     = arena->counts->count,
+      .buffer_texture = forest->xforms_tex
+    };
+    draw_queue__add(&item);
+  }
+
+  return 0;  // --> 0 Lua return values
+}
+
+// Lua C function.
+// Expected parameters: self
+// Returns true once every tree's vertices have been sent to the gpu.
+static int forest__is_uploaded(lua_State *L) {
+
+  Forest *forest = (Forest *)luaL_checkudata(L, 1, forest_metatable);
+  int is_uploaded = 1;
+  array__for(Tree *, tree, forest->trees, i) {
+    if (tree->num_pending_uploads > 0) is_uploaded = 0;
+  }
+  lua_pushboolean(L, is_uploaded);
+
+  return 1;  // --> 1 Lua return value
+}
+
+// Lua C function.
+// Expected parameters: self
+static int forest__gc(lua_State *L) {
+
+  Forest *forest = (Forest *)luaL_checkudata(L, 1, forest_metatable);
+
+  // A queued draw may still refer to our objects.
+  draw_queue__flush();
+  upload_queue__cancel(forest);
+
+  for (int i = 0; i < num_materials; ++i) arena_release(&forest->arenas[i]);
+  array__delete(forest->trees);
+  array__delete(forest->xforms);
+  glstate__delete_buffer(forest->xforms_vbo);
+  glstate__delete_texture(forest->xforms_tex);
+
+  return 0;  // --> 0 Lua return values
+}
+
+
+// Public functions.
+
+#define add_fn(fn, name)        \
+    lua_pushcfunction(L, fn);   \
+    lua_setfield(L, -2, name);
+
+extern "C" void forest__load_lib(lua_State *L) {
+
+  // If this metatable already exists, the library is already loaded.
+  if (!luaL_newmetatable(L, forest_metatable)) return;
+
+  // metatable.__index = metatable
+  lua_pushvalue(L, -1);            // --> stack = [.., mt, mt]
+  lua_setfield(L, -2, "__index");  // --> stack = [.., mt]
+
+  // Add the instance methods.
+  add_fn(forest__add_tree,    "add_tree");
+  add_fn(forest__draw,        "draw");
+  add_fn(forest__is_uploaded, "is_uploaded");
+  add_fn(forest__gc,          "__gc");
+
+  lua_pop(L, 1);  // --> stack = [..]
+
+  // Add `Forest` as a global module table with a single `new` function.
+  static const struct luaL_Reg lib[] = {
+    {"new", forest__new},
+    {NULL, NULL}};
+  luaL_newlib(L, lib);         // --> stack = [.., Forest]
+  lua_setglobal(L, "Forest");  // --> stack = [..]
+
+  gl_init();
+}
@@ -0,0 +1,55 @@
+// forest.h
+//
+// A Lua-facing library for drawing many trees with very few draw calls.
+//
+// Every tree's bark and leaf triangles are sub-allocated from two large shared
+// vertex buffers - one per material - that grow as needed. Each vertex carries
+// the index of its tree, and each tree's model matrix is kept in a buffer
+// texture, so all the trees that use a material are drawn with a single
+// glMultiDrawArrays call.
+//
+// Lua interface:
+//
+//   -- Do this once. If quantize_positions is true, positions are stored as
+//   -- 16-bit values relative to each tree's bounding box, rather than as
+//   -- floats, which shrinks each vertex from 20 to 16 bytes.
+//   forest = Forest:new([{quantize_positions = true}])
+//
+//   -- Do this once per tree. The points are flat sequences of triangle
+//   -- corners, in the same format as VertexArray:new expects. The tree is
+//   -- translated to (x, y, z) after being rotated by the optional angle, in
+//   -- radians, around the y axis.
+//   --
+//   -- The optional group sizes are sequences of vertex counts that split the
+//   -- points into consecutive cull groups, such as the subtrees below a given
+//   -- depth. Each group that's outside the view frustum, or farther away than
+//   -- forest_cull_distance, is skipped when drawing. Without them, each
+//   -- material is culled as a whole.
+//   forest:add_tree(bark_pts, leaf_pts, x, y, z,
+//                   [angle, [bark_group_sizes, leaf_group_sizes]])
+//
+//   -- Each tree's vertices are sent to the gpu over the next few frames by
+//   -- the upload_queue module, nearest trees first, and a tree isn't drawn
+//   -- until all of its vertices are there. This returns true once every tree
+//   -- is ready.
+//   forest:is_uploaded()
+//
+//   -- Call this for every frame where you want to draw the forest.
+//   -- Like VertexArray:draw, this queues up the draws. The culling is based on
+//   -- the matrices most recently given to the frame_uniforms module.
+//   forest:draw()
+//
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lua/lua.h"
+
+void forest__load_lib(lua_State *L);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,66 @@
+// frame_timer.c
+//
+
+#include "frame_timer.h"
+
+// Local includes.
+#include "clock.h"
+
+// Standard library includes.
+#include <stdlib.h>
+#include <string.h>
+
+
+// Internal types and globals.
+
+// This is enough for a few seconds of frames at typical refresh rates.
+#define max_durations 512
+
+static double durations[max_durations];
+static int    num_durations = 0;
+static int    next_duration = 0;
+static double last_tick     = -1;
+
+
+// Internal functions.
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+
+// Public functions.
+
+double frame_timer__tick() {
+  double now = clock__now();
+  if (last_tick < 0) {
+    last_tick = now;
+    return 0;
+  }
+  double duration = now - last_tick;
+  last_tick = now;
+
+  durations[next_duration] = duration;
+  next_duration = (next_duration + 1) % max_durations;
+  if (num_durations < max_durations) num_durations++;
+
+  return duration;
+}
+
+void frame_timer__get_stats(frame_timer__Stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->num_frames = num_durations;
+  if (num_durations == 0) return;
+
+  double sorted[max_durations];
+  memcpy(sorted, durations, num_durations * sizeof(double));
+  qsort(sorted, num_durations, sizeof(double), compare_doubles);
+
+  double sum = 0;
+  for (int i = 0; i < num_durations; ++i) sum += sorted[i];
+  stats->mean = sum / num_durations;
+  stats->min  = sorted[0];
+  stats->max  = sorted[num_durations - 1];
+  stats->p99  = sorted[(num_durations - 1) * 99 / 100];
+}
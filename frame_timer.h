@@ -0,0 +1,23 @@
+// frame_timer.h
+//
+// Measures frame pacing.
+//
+// Call frame_timer__tick once per frame, right after the frame is presented.
+// The most recent frame durations are kept, and frame_timer__get_stats
+// summarizes them. Durations are in seconds.
+//
+
+#pragma once
+
+typedef struct {
+  int    num_frames;  // The number of durations summarized below.
+  double mean;
+  double min;
+  double max;
+  double p99;         // 99% of the frames took at most this long.
+} frame_timer__Stats;
+
+// Returns the time since the last call, or 0 on the first call.
+double frame_timer__tick();
+
+void   frame_timer__get_stats(frame_timer__Stats *stats);
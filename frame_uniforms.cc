@@ -0,0 +1,114 @@
+// frame_uniforms.cc
+//
+
+#include "frame_uniforms.h"
+
+#include "glm.hpp"
+#define GLM_FORCE_RADIANS
+#include "type_ptr.hpp"
+using namespace glm;
+
+#include <string.h>
+
+
+// Internal types and globals.
+
+// These structs follow the std140 layout rules. In particular, each column of
+// a mat3, and each vec3, takes up the space of a vec4.
+typedef struct {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  vec4 normal_xform[3];
+  vec4 light_dir;
+} FrameBlock;
+
+typedef struct {
+  mat4 model;
+} ObjectBlock;
+
+static GLuint frame_ubo  = 0;
+static GLuint object_ubo = 0;
+
+// CPU-side copies of the latest matrices.
+static mat4 last_view;
+static mat4 last_view_projection;
+static mat4 last_model;
+
+
+// Internal functions.
+
+static GLuint new_uniform_buffer(GLsizeiptr size, GLuint binding) {
+  GLuint ubo;
+  glGenBuffers(1, &ubo);
+  glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+  glBufferData(GL_UNIFORM_BUFFER,  // buffer use target
+               size,               // size
+               NULL,               // data
+               GL_DYNAMIC_DRAW);   // usage hint
+  glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+  return ubo;
+}
+
+static void bind_block(GLuint program, const char *name, GLuint binding) {
+  GLuint index = glGetUniformBlockIndex(program, name);
+  if (index == GL_INVALID_INDEX) return;  // The program doesn't use it.
+  glUniformBlockBinding(program, index, binding);
+}
+
+
+// Public functions.
+
+extern "C" void frame_uniforms__init() {
+  frame_ubo  = new_uniform_buffer(sizeof(FrameBlock),
+                                  frame_uniforms__frame_binding);
+  object_ubo = new_uniform_buffer(sizeof(ObjectBlock),
+                                  frame_uniforms__object_binding);
+}
+
+extern "C" void frame_uniforms__bind_program(GLuint program) {
+  bind_block(program, "Frame",  frame_uniforms__frame_binding);
+  bind_block(program, "Object", frame_uniforms__object_binding);
+}
+
+extern "C" void frame_uniforms__set_frame(const GLfloat *view,
+                                          const GLfloat *projection,
+                                          const GLfloat *normal_xform,
+                                          const GLfloat *light_dir) {
+  FrameBlock block;
+  block.view            = make_mat4(view);
+  block.projection      = make_mat4(projection);
+  block.view_projection = block.projection * block.view;
+  mat3 n = make_mat3(normal_xform);
+  for (int i = 0; i < 3; ++i) block.normal_xform[i] = vec4(n[i], 0);
+  block.light_dir       = vec4(make_vec3(light_dir), 0);
+
+  last_view            = block.view;
+  last_view_projection = block.view_projection;
+
+  glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo);
+  glBufferSubData(GL_UNIFORM_BUFFER,  // buffer use target
+                  0,                  // offset
+                  sizeof(block),      // size
+                  &block);            // data
+}
+
+extern "C" void frame_uniforms__set_model(const GLfloat *model) {
+  last_model = make_mat4(model);
+
+  glBindBuffer(GL_UNIFORM_BUFFER, object_ubo);
+  glBufferSubData(GL_UNIFORM_BUFFER,    // buffer use target
+                  0,                    // offset
+                  sizeof(ObjectBlock),  // size
+                  model);               // data
+}
+
+extern "C" void frame_uniforms__get_model_view(GLfloat *model_view) {
+  mat4 m = last_view * last_model;
+  memcpy(model_view, value_ptr(m), sizeof(m));
+}
+
+extern "C" void frame_uniforms__get_mvp(GLfloat *mvp) {
+  mat4 m = last_view_projection * last_model;
+  memcpy(mvp, value_ptr(m), sizeof(m));
+}
@@ -0,0 +1,61 @@
+// frame_uniforms.h
+//
+// Uniform buffers shared by all of our shader programs.
+//
+// The Frame block holds values that change at most once per frame, and the
+// Object block holds the model matrix. Each is updated with a single
+// glBufferSubData call, rather than with one glUniform* call per draw.
+//
+// The shaders declare these blocks as:
+//
+//   layout(std140) uniform Frame {
+//     mat4 view;
+//     mat4 projection;
+//     mat4 view_projection;
+//     mat3 normal_xform;
+//     vec3 light_dir;
+//   };
+//
+//   layout(std140) uniform Object {
+//     mat4 model;
+//   };
+//
+// All matrix parameters below are column-major, as in glm's &m[0][0].
+//
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "glinclude.h"
+
+// The uniform buffer binding points used for each block.
+#define frame_uniforms__frame_binding  0
+#define frame_uniforms__object_binding 1
+
+// This creates the buffers; it expects a current OpenGL context.
+void frame_uniforms__init();
+
+// Connects any Frame or Object blocks used by the program to our buffers.
+// This is called from glhelp__load_program, so it's done for every program.
+void frame_uniforms__bind_program(GLuint program);
+
+// The view_projection matrix is computed here. The light_dir is expected to
+// point toward the light and to be normalized.
+void frame_uniforms__set_frame(const GLfloat *view,
+                               const GLfloat *projection,
+                               const GLfloat *normal_xform,  // A mat3.
+                               const GLfloat *light_dir);    // A vec3.
+
+void frame_uniforms__set_model(const GLfloat *model);
+
+// These copy out the most recently set matrices, which is useful for culling.
+// Each output is a column-major 4x4 matrix.
+void frame_uniforms__get_model_view(GLfloat *model_view);
+void frame_uniforms__get_mvp       (GLfloat *mvp);
+
+#ifdef __cplusplus
+}
+#endif
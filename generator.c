@@ -0,0 +1,413 @@
+// generator.c
+//
+
+#include "generator.h"
+
+// Local includes.
+#include "clua.h"
+#include "cstructs/cstructs.h"
+#include "luahelp.h"
+#include "luarender.h"
+#include "species.h"
+#include "spsc.h"
+#include "vertex_array.h"
+#include "wind.h"
+
+// Library includes.
+#include "lua/lauxlib.h"
+
+// Standard library includes.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Profiling builds attribute the worker's memory use to generation stages.
+#ifdef MEMPROFILE
+#include "cstructs/memprofile.h"
+#define set_mem_stage(stage) memprofile__set_stage(stage)
+#else
+#define set_mem_stage(stage)
+#endif
+
+
+// Internal types and globals.
+
+// The flat triangle data of a finished tree. The normals are packed as the
+// VertexArray module expects. The bones and skins are in the formats of
+// bones.lua.
+typedef struct {
+  lua_Integer    seed;
+  const Species *species;  // NULL for the default species.
+  Array          bark_pts;
+  Array          bark_normals;
+  Array          bark_skin;
+  Array          leaf_pts;
+  Array          leaf_normals;
+  Array          leaf_skin;
+  Array          bones;
+} Tree;
+
+// The render thread drains this every frame, so it rarely holds more than one.
+#define queue_capacity 4
+
+static spsc__Queue finished_trees;  // Tree pointers, from worker to renderer.
+
+// Requests are rare, so they go through a mutex; this is also what lets the
+// worker sleep while it has nothing to do.
+static pthread_mutex_t request_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  request_cond  = PTHREAD_COND_INITIALIZER;
+static int             has_request   = 0;
+static lua_Integer     request_seed;
+static const Species  *request_species;
+
+static pthread_t worker;
+
+// The worker sets this if it can't start, such as when make_tree fails to
+// load, so that the render thread can report it rather than wait forever.
+static int worker_failed = 0;
+
+// The worker's collector is held off while make_tree.make runs, and works
+// through the garbage of each tree once it's been handed off. Between stages,
+// gc_checkpoint only collects once the heap has grown by this much since the
+// last collection, as a limit for unusually big trees.
+#define gc_held_limit_kb (256 * 1024)
+
+static int gc_kb_at_last_collect;  // Only used by the worker.
+
+static const char *partial_tree_metatable = "generator.PartialTree";
+
+
+// Internal functions.
+
+// Deletes the tree's arrays, any of which may be NULL.
+static void delete_arrays(Tree *tree) {
+  Array arrays[] = {tree->bark_pts, tree->bark_normals, tree->bark_skin,
+                    tree->leaf_pts, tree->leaf_normals, tree->leaf_skin,
+                    tree->bones};
+  int num_arrays = (int)(sizeof(arrays) / sizeof(arrays[0]));
+  for (int i = 0; i < num_arrays; ++i) {
+    if (arrays[i]) array__delete(arrays[i]);
+  }
+}
+
+static void delete_tree(Tree *tree) {
+  delete_arrays(tree);
+  free(tree);
+}
+
+// Lua C function, the __gc metamethod of a Tree held in a userdata while Lua
+// calls that may fail use it; see generate and generator__poll.
+// Expected parameters: a partial tree userdata.
+static int partial_tree_gc(lua_State *L) {
+  delete_arrays((Tree *)lua_touserdata(L, 1));
+  return 0;  // --> 0 Lua return values
+}
+
+// Adds the metatable of partial tree userdata to L's registry.
+static void add_partial_tree_metatable(lua_State *L) {
+  luaL_newmetatable(L, partial_tree_metatable);
+      // stack = [.., mt]
+  lua_pushcfunction(L, partial_tree_gc);
+      // stack = [.., mt, partial_tree_gc]
+  lua_setfield(L, -2, "__gc");
+      // stack = [.., mt]
+  lua_pop(L, 1);
+      // stack = [..]
+}
+
+// Lua C function, run on the worker thread between the stages of
+// make_tree.make, as the global gc_checkpoint.
+// Expected parameters: none.
+// Returns nothing.
+static int gc_checkpoint(lua_State *L) {
+  if (lua_gc(L, LUA_GCCOUNT, 0) - gc_kb_at_last_collect < gc_held_limit_kb) {
+    return 0;  // --> 0 Lua return values
+  }
+  lua_gc(L, LUA_GCRESTART, 0);
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  lua_gc(L, LUA_GCSTOP,    0);
+  gc_kb_at_last_collect = lua_gc(L, LUA_GCCOUNT, 0);
+  return 0;  // --> 0 Lua return values
+}
+
+// Lua C function, run on the worker thread.
+// Expected parameters: seed, species pointer (a light userdata, or nil for the
+//                      default species).
+// Returns a light userdata pointer to a new Tree.
+static int generate(lua_State *L) {
+  lua_Integer    seed    = luaL_checkinteger(L, 1);
+  const Species *species = lua_touserdata(L, 2);
+  lua_settop(L, 1);
+      // stack = [seed]
+
+  // The tree is built in a userdata, so that if an error cuts this short, the
+  // collector frees the arrays made so far. It's only copied to a plain Tree,
+  // which is what the render thread gets, once nothing else can fail.
+  Tree *partial = lua_newuserdata(L, sizeof(Tree));
+      // stack = [seed, partial]
+  memset(partial, 0, sizeof(Tree));
+  luaL_getmetatable(L, partial_tree_metatable);
+      // stack = [seed, partial, mt]
+  lua_setmetatable(L, -2);
+      // stack = [seed, partial]
+  partial->seed    = seed;
+  partial->species = species;
+
+  set_mem_stage("make_tree");
+  lua_getglobal(L, "make_tree");
+      // stack = [seed, partial, make_tree]
+  lua_getfield(L, -1, "make");
+      // stack = [seed, partial, make_tree, make_tree.make]
+  lua_pushinteger(L, seed);
+      // stack = [seed, partial, make_tree, make_tree.make, seed]
+  // make_tree can't find the default species on this thread, which has no
+  // species module, so it's pushed from here.
+  Species default_species;
+  if (species == NULL) {
+    species__set_defaults(&default_species, "default");
+    species = &default_species;
+  }
+  species__push_params(L, species);
+      // stack = [seed, partial, make_tree, make_tree.make, seed, params]
+  lua_call(L, 2, 1);
+      // stack = [seed, partial, make_tree, tree]
+
+  set_mem_stage("tree_arrays");
+  lua_getfield(L, -1, "bark");
+      // stack = [.., tree, tree.bark]
+  lua_getfield(L, -1, "pts");
+      // stack = [.., tree, tree.bark, tree.bark.pts]
+  partial->bark_pts = luahelp__new_float_array(L, lua_gettop(L));
+  lua_pop(L, 1);
+      // stack = [.., tree, tree.bark]
+  lua_getfield(L, -1, "skin");
+      // stack = [.., tree, tree.bark, tree.bark.skin]
+  partial->bark_skin = luahelp__new_float_array(L, lua_gettop(L));
+  lua_pop(L, 2);
+      // stack = [.., tree]
+  lua_getfield(L, -1, "leaf_pts");
+      // stack = [.., tree, tree.leaf_pts]
+  partial->leaf_pts = luahelp__new_float_array(L, lua_gettop(L));
+  lua_pop(L, 1);
+      // stack = [.., tree]
+  lua_getfield(L, -1, "leaf_skin");
+      // stack = [.., tree, tree.leaf_skin]
+  partial->leaf_skin = luahelp__new_float_array(L, lua_gettop(L));
+  lua_pop(L, 1);
+      // stack = [.., tree]
+  lua_getfield(L, -1, "bones");
+      // stack = [.., tree, tree.bones]
+  partial->bones = luahelp__new_float_array(L, lua_gettop(L));
+  lua_pop(L, 1);
+      // stack = [.., tree]
+
+  set_mem_stage("normals");
+  partial->bark_normals = vertex_array__new_packed_normals(partial->bark_pts);
+  partial->leaf_normals = vertex_array__new_packed_normals(partial->leaf_pts);
+  set_mem_stage("idle");
+
+  // Move the arrays out of the userdata, so its __gc leaves them alone.
+  Tree *tree = malloc(sizeof(Tree));
+  *tree = *partial;
+  memset(partial, 0, sizeof(Tree));
+
+  lua_pushlightuserdata(L, tree);
+      // stack = [seed, partial, make_tree, tree, tree_ptr]
+  return 1;  // --> 1 Lua return value
+}
+
+static void *worker_main(void *arg) {
+  (void)arg;
+  lua_State *L = clua__new_pooled_state();
+  luarender__set_config_constants(L);
+  lua_pushcfunction(L, gc_checkpoint);
+      // stack = [gc_checkpoint]
+  lua_setglobal(L, "gc_checkpoint");
+      // stack = []
+  add_partial_tree_metatable(L);
+
+  // make_tree = require 'make_tree'
+  lua_getglobal(L, "require");
+      // stack = [require]
+  lua_pushstring(L, "make_tree");
+      // stack = [require, "make_tree"]
+  if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+    printf("Error loading make_tree on the generator thread: %s\n",
+           lua_tostring(L, -1));
+    clua__close_state(L);
+    __atomic_store_n(&worker_failed, 1, __ATOMIC_RELEASE);
+    return NULL;
+  }
+      // stack = [make_tree]
+  lua_setglobal(L, "make_tree");
+      // stack = []
+
+  while (1) {
+    pthread_mutex_lock(&request_mutex);
+    while (!has_request) pthread_cond_wait(&request_cond, &request_mutex);
+    lua_Integer    seed    = request_seed;
+    const Species *species = request_species;
+    has_request = 0;
+    pthread_mutex_unlock(&request_mutex);
+
+    gc_kb_at_last_collect = lua_gc(L, LUA_GCCOUNT, 0);
+    lua_gc(L, LUA_GCSTOP, 0);
+    lua_pushcfunction(L, generate);
+        // stack = [generate]
+    lua_pushinteger(L, seed);
+        // stack = [generate, seed]
+    lua_pushlightuserdata(L, (void *)species);
+        // stack = [generate, seed, species]
+    int status = lua_pcall(L, 2, 1, 0);
+    lua_gc(L, LUA_GCRESTART, 0);
+    if (status != LUA_OK) {
+      printf("Error generating a tree: %s\n", lua_tostring(L, -1));
+      lua_settop(L, 0);
+      lua_gc(L, LUA_GCCOLLECT, 0);
+      continue;
+    }
+        // stack = [tree_ptr]
+    Tree *tree = lua_touserdata(L, -1);
+    lua_settop(L, 0);
+        // stack = []
+
+    while (!spsc__push(&finished_trees, tree)) {
+      struct timespec one_ms = {0, 1000000};
+      nanosleep(&one_ms, NULL);
+    }
+
+    // Drop the Lua-side tree, and the garbage made along with it, now that the
+    // tree is on its way and we're otherwise idle.
+    set_mem_stage("collect");
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    set_mem_stage("idle");
+  }
+
+  return NULL;
+}
+
+
+// Internal: Lua C functions.
+
+// Lua C function.
+// Expected parameters: [seed, [species name]].
+// Returns the seed.
+static int generator__request(lua_State *L) {
+  static lua_Integer num_requests = 0;
+  lua_Integer seed = luaL_optinteger(L, 1, time(NULL) + num_requests);
+  const char *name = luaL_optstring(L, 2, NULL);
+  num_requests++;
+
+  // The worker gets a pointer to the species, which is never changed or freed.
+  const Species *species = NULL;
+  if (name) {
+    species = species__find(name);
+    if (species == NULL) {
+      return luaL_error(L, "the species %s hasn't been loaded", name);
+    }
+  }
+
+  if (__atomic_load_n(&worker_failed, __ATOMIC_ACQUIRE)) {
+    return luaL_error(L, "the generator thread failed to start");
+  }
+
+  pthread_mutex_lock(&request_mutex);
+  request_seed    = seed;
+  request_species = species;
+  has_request     = 1;
+  pthread_cond_signal(&request_cond);
+  pthread_mutex_unlock(&request_mutex);
+
+  lua_pushinteger(L, seed);
+  return 1;  // --> 1 Lua return value
+}
+
+// Lua C function.
+// Expected parameters: none.
+static int generator__poll(lua_State *L) {
+  // Any requests made so far will never be met, so this says so once.
+  static int has_reported_failure = 0;
+  if (__atomic_load_n(&worker_failed, __ATOMIC_ACQUIRE) &&
+      !has_reported_failure) {
+    has_reported_failure = 1;
+    return luaL_error(L, "the generator thread failed to start");
+  }
+
+  // Only the newest finished tree is worth uploading.
+  Tree *tree = NULL, *next;
+  while ((next = spsc__pop(&finished_trees))) {
+    if (tree) delete_tree(tree);
+    tree = next;
+  }
+  if (tree == NULL) return 0;  // --> 0 Lua return values; this acts as nil
+
+  // The tree moves into a userdata, so that its arrays are freed by the
+  // collector if any of the calls below raises an error.
+  Tree *held = lua_newuserdata(L, sizeof(Tree));
+      // stack = [.., held]
+  *held = *tree;
+  free(tree);
+  tree = held;
+  luaL_getmetatable(L, partial_tree_metatable);
+      // stack = [.., held, mt]
+  lua_setmetatable(L, -2);
+      // stack = [.., held]
+
+  GLfloat green[3] = {0, 0.6, 0};
+  lua_newtable(L);
+      // stack = [.., held, t]
+  wind__push_new(L, tree->bones);
+      // stack = [.., held, t, wind]
+  vertex_array__push_new_triangles(L, tree->bark_pts, tree->bark_normals,
+                                   NULL);  // NULL --> the default bark color
+      // stack = [.., held, t, wind, bark_array]
+  vertex_array__skin_with_wind(L, -1, -2, tree->bark_skin);
+  lua_setfield(L, -3, "bark_array");
+      // stack = [.., held, t, wind]
+  vertex_array__push_new_triangles(L, tree->leaf_pts, tree->leaf_normals,
+                                   green);
+      // stack = [.., held, t, wind, leaf_array]
+  vertex_array__skin_with_wind(L, -1, -2, tree->leaf_skin);
+  lua_setfield(L, -3, "leaf_array");
+      // stack = [.., held, t, wind]
+  lua_setfield(L, -2, "wind");
+      // stack = [.., held, t]
+  lua_pushinteger(L, tree->seed);
+      // stack = [.., held, t, seed]
+  lua_setfield(L, -2, "seed");
+      // stack = [.., held, t]
+  lua_pushstring(L, tree->species ? tree->species->name : "default");
+      // stack = [.., held, t, species name]
+  lua_setfield(L, -2, "species");
+      // stack = [.., held, t]
+
+  // Everything has been copied, so the arrays can go now rather than whenever
+  // held is collected.
+  delete_arrays(tree);
+  memset(tree, 0, sizeof(Tree));
+  lua_remove(L, -2);
+      // stack = [.., t]
+
+  return 1;  // --> 1 Lua return value
+}
+
+
+// Public functions.
+
+void generator__load_lib(lua_State *L) {
+  // The worker runs for the life of the process.
+  spsc__init(&finished_trees, queue_capacity);
+  pthread_create(&worker, NULL, worker_main, NULL);
+
+  add_partial_tree_metatable(L);
+
+  // Add `generator` as a global module table.
+  static const struct luaL_Reg lib[] = {
+    {"request", generator__request},
+    {"poll",    generator__poll},
+    {NULL, NULL}};
+  luaL_newlib(L, lib);            // --> stack = [.., generator]
+  lua_setglobal(L, "generator");  // --> stack = [..]
+}
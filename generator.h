@@ -0,0 +1,35 @@
+// generator.h
+//
+// Generates trees on a background thread.
+//
+// The worker thread has its own Lua state, where it runs make_tree.make and
+// turns the result into flat vertex, normal, and skin arrays. Finished trees
+// are handed to the render thread through a lock-free single-producer,
+// single-consumer queue, so the render thread never waits on generation; it
+// only creates the OpenGL buffers once a tree is ready.
+//
+// Lua interface:
+//
+//   -- Asks for a new tree. A request that the worker hasn't started yet is
+//   -- replaced by a newer one. The seed defaults to a new value each call;
+//   -- either way, it's returned. The tree is of the named species, which is
+//   -- expected to be loaded already (see species.h), or of the default species
+//   -- if no name is given. Raises an error if the worker thread couldn't
+//   -- start, such as when make_tree fails to load.
+//   seed = generator.request([seed, [species_name]])
+//
+//   -- Returns nil if no new tree is ready. Otherwise this returns the most
+//   -- recently finished tree as a table with keys bark_array and leaf_array,
+//   -- which are VertexArrays that sway with the Wind in the wind key, seed,
+//   -- and species, the species name. Call this from the render thread. The
+//   -- first call after the worker fails to start raises an error.
+//   tree = generator.poll()
+//
+
+#pragma once
+
+#include "lua/lua.h"
+
+// This starts the worker thread. It expects the GL context to be current, as
+// generator.poll creates OpenGL objects.
+void generator__load_lib(lua_State *L);
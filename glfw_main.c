@@ -0,0 +1,158 @@
+// glfw_main.c
+//
+// A portable window and render loop, built on GLFW, for running the renderer
+// outside of the Cocoa app; main.m and BNLOpenGLView.m are the macOS
+// equivalent. Link this with clock.c, frame_timer.c, and the renderer's C and
+// C++ files, plus -lglfw and the platform's OpenGL library. On Linux, use
+// file_posix.c in place of file.m.
+//
+// The loop updates the animation at a fixed rate (see fixed_update_rate in
+// config.h) independently of how often frames are drawn, and measures frame
+// pacing with frame_timer.
+//
+
+#include "luarender.h"
+#include "render.h"
+
+// Local includes.
+#include "config.h"
+#include "frame_timer.h"
+
+// Library includes.
+#include <GLFW/glfw3.h>
+
+// Standard library includes.
+#include <stdio.h>
+
+
+// Define YES/NO so config.h's Objective-C style macro values work here.
+#define YES 1
+#define NO  0
+
+
+// Internal types and globals.
+
+// A long stall, such as from a debugger, shouldn't cause a flood of updates.
+#define max_update_time 0.25
+
+static double last_mouse_x = -1;
+static double last_mouse_y = -1;
+
+
+// Internal functions.
+
+// The render module expects mouse coordinates with y increasing upward, and
+// deltas as Core Graphics reports them, with y increasing downward.
+static void cursor_pos_callback(GLFWwindow *window, double x, double y) {
+  double dx = last_mouse_x < 0 ? 0 : x - last_mouse_x;
+  double dy = last_mouse_y < 0 ? 0 : y - last_mouse_y;
+  last_mouse_x = x;
+  last_mouse_y = y;
+
+  int w, h;
+  glfwGetWindowSize(window, &w, &h);
+  render__mouse_moved(x, h - y, dx, dy);
+}
+
+static void mouse_button_callback(GLFWwindow *window, int button, int action,
+                                  int mods) {
+  (void)mods;
+  if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) return;
+  double x, y;
+  glfwGetCursorPos(window, &x, &y);
+  int w, h;
+  glfwGetWindowSize(window, &w, &h);
+  render__mouse_down(x, h - y);
+}
+
+static void print_frame_stats() {
+  frame_timer__Stats stats;
+  frame_timer__get_stats(&stats);
+  printf("Frames: %d  mean %.2fms (%.1f fps)  min %.2fms  p99 %.2fms  "
+         "max %.2fms\n",
+         stats.num_frames, stats.mean * 1e3, 1.0 / stats.mean,
+         stats.min * 1e3, stats.p99 * 1e3, stats.max * 1e3);
+}
+
+static void update(double frame_time) {
+  static double time_to_simulate = 0;
+
+  if (fixed_update_rate <= 0) {
+    luarender__update(frame_time);
+    return;
+  }
+
+  const double step = 1.0 / fixed_update_rate;
+  time_to_simulate += frame_time;
+  if (time_to_simulate > max_update_time) time_to_simulate = max_update_time;
+  while (time_to_simulate >= step) {
+    luarender__update(step);
+    time_to_simulate -= step;
+  }
+}
+
+
+// Main.
+
+int main() {
+  if (!glfwInit()) {
+    printf("Error: glfwInit failed.\n");
+    return 1;
+  }
+
+  // Ask for the same context that BNLOpenGLView uses.
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+  glfwWindowHint(GLFW_OPENGL_PROFILE,        GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+  glfwWindowHint(GLFW_DEPTH_BITS,            24);
+  glfwWindowHint(GLFW_SAMPLES,               4);
+
+  GLFWwindow *window = glfwCreateWindow(800, 600,  // width, height
+                                        "Trees",   // title
+                                        NULL,      // monitor
+                                        NULL);     // context to share
+  if (window == NULL) {
+    printf("Error: couldn't create a window with an OpenGL 3.2 context.\n");
+    glfwTerminate();
+    return 1;
+  }
+  glfwMakeContextCurrent(window);
+  glfwSwapInterval(do_use_vsync ? 1 : 0);
+
+  glfwSetCursorPosCallback  (window, cursor_pos_callback);
+  glfwSetMouseButtonCallback(window, mouse_button_callback);
+
+  if (do_use_lua) {
+    luarender__init();
+  } else {
+    render__init();
+  }
+
+  double frame_time = frame_timer__tick();  // Starts the timer.
+  double time_since_stats = 0;
+  while (!glfwWindowShouldClose(window)) {
+    glfwPollEvents();
+
+    int w, h;
+    glfwGetFramebufferSize(window, &w, &h);
+    if (do_use_lua) {
+      update(frame_time);
+      luarender__draw(w, h);
+    } else {
+      render__draw(w, h);
+    }
+    glfwSwapBuffers(window);
+
+    frame_time = frame_timer__tick();
+    time_since_stats += frame_time;
+    if (frame_stats_interval > 0 && time_since_stats >= frame_stats_interval) {
+      print_frame_stats();
+      time_since_stats = 0;
+    }
+  }
+
+  glfwDestroyWindow(window);
+  glfwTerminate();
+  return 0;
+}
@@ -1,8 +1,10 @@
 #include "glhelp.h"
 
 #include "file.h"
+#include "frame_uniforms.h"
+#include "glstate.h"
 
-#include <OpenGL/gl3.h>
+#include "glinclude.h"
 
 #include <libgen.h>
 #include <stdio.h>
@@ -81,6 +83,9 @@ GLuint glhelp__load_program(const char *v_shader_file, const char *f_shader_file
     return 0;
   }
   
-  glUseProgram(program);
+  // Connect the program to the shared uniform buffers.
+  frame_uniforms__bind_program(program);
+  
+  glstate__use_program(program);
   return program;
 }
@@ -5,7 +5,7 @@
 
 #pragma once
 
-#import <OpenGL/OpenGL.h>
+#include "glinclude.h"
 
 // Check for any OpenGL errors up until this point. Call this like so:
 //   glhelp__error_check;  // Nothing else needed; don't use parentheses.
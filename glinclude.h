@@ -0,0 +1,20 @@
+// glinclude.h
+//
+// Includes the OpenGL 3.2+ core profile declarations on each platform.
+//
+// On macOS these come from the OpenGL framework. Elsewhere we use the Khronos
+// core profile header, which declares the same functions when
+// GL_GLEXT_PROTOTYPES is defined; link against libOpenGL (or libGL) to get
+// them.
+//
+
+#pragma once
+
+#ifdef __APPLE__
+#include <OpenGL/gl3.h>
+#else
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES 1
+#endif
+#include <GL/glcorearb.h>
+#endif
@@ -0,0 +1,101 @@
+// glstate.c
+//
+
+#include "glstate.h"
+
+#include <stddef.h>
+
+
+// Internal types and globals.
+
+// We use -1 to mean "unknown", which forces the next set call to go through.
+static GLint cur_program = -1;
+static GLint cur_vao     = -1;
+static GLint cur_vbo     = -1;
+static GLint cur_texture = -1;
+
+// Each capability is -1 (unknown), 0 (disabled), or 1 (enabled).
+static int depth_test        = -1;
+static int cull_face         = -1;
+static int primitive_restart = -1;
+
+
+// Internal functions.
+
+static int *cap_state(GLenum cap) {
+  switch (cap) {
+    case GL_DEPTH_TEST:        return &depth_test;
+    case GL_CULL_FACE:         return &cull_face;
+    case GL_PRIMITIVE_RESTART: return &primitive_restart;
+  }
+  return NULL;
+}
+
+
+// Public functions.
+
+void glstate__use_program(GLuint program) {
+  if (cur_program == (GLint)program) return;
+  glUseProgram(program);
+  cur_program = program;
+}
+
+void glstate__bind_vertex_array(GLuint vao) {
+  if (cur_vao == (GLint)vao) return;
+  glBindVertexArray(vao);
+  cur_vao = vao;
+}
+
+void glstate__bind_array_buffer(GLuint vbo) {
+  if (cur_vbo == (GLint)vbo) return;
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  cur_vbo = vbo;
+}
+
+void glstate__bind_buffer_texture(GLuint texture) {
+  if (cur_texture == (GLint)texture) return;
+  glBindTexture(GL_TEXTURE_BUFFER, texture);
+  cur_texture = texture;
+}
+
+void glstate__enable(GLenum cap) {
+  int *state = cap_state(cap);
+  if (state && *state == 1) return;
+  glEnable(cap);
+  if (state) *state = 1;
+}
+
+void glstate__disable(GLenum cap) {
+  int *state = cap_state(cap);
+  if (state && *state == 0) return;
+  glDisable(cap);
+  if (state) *state = 0;
+}
+
+void glstate__delete_vertex_array(GLuint vao) {
+  glDeleteVertexArrays(1, &vao);
+  // Deleting the bound vao reverts the binding to zero.
+  if (cur_vao == (GLint)vao) cur_vao = 0;
+}
+
+void glstate__delete_buffer(GLuint vbo) {
+  glDeleteBuffers(1, &vbo);
+  // Deleting the bound buffer reverts the binding to zero.
+  if (cur_vbo == (GLint)vbo) cur_vbo = 0;
+}
+
+void glstate__delete_texture(GLuint texture) {
+  glDeleteTextures(1, &texture);
+  // Deleting the bound texture reverts the binding to zero.
+  if (cur_texture == (GLint)texture) cur_texture = 0;
+}
+
+void glstate__reset() {
+  cur_program       = -1;
+  cur_vao           = -1;
+  cur_vbo           = -1;
+  cur_texture       = -1;
+  depth_test        = -1;
+  cull_face         = -1;
+  primitive_restart = -1;
+}
@@ -0,0 +1,40 @@
+// glstate.h
+//
+// A small cache of OpenGL binding state.
+//
+// Every function here skips the underlying GL call when the requested state is
+// already current. This only works if all code changing the tracked state goes
+// through this module, so prefer these functions over direct calls to
+// glUseProgram, glBindVertexArray, glBindBuffer(GL_ARRAY_BUFFER, ..),
+// glEnable, and glDisable.
+//
+// The GL_ELEMENT_ARRAY_BUFFER binding is not tracked since it's part of the
+// currently bound vertex array object; set it up once per vao instead.
+//
+
+#pragma once
+
+#include "glinclude.h"
+
+void glstate__use_program       (GLuint program);
+void glstate__bind_vertex_array (GLuint vao);
+void glstate__bind_array_buffer (GLuint vbo);
+
+// This binds a GL_TEXTURE_BUFFER texture to texture unit 0, which is the only
+// texture unit we use.
+void glstate__bind_buffer_texture(GLuint texture);
+
+// These only track the capabilities used by this project: GL_DEPTH_TEST,
+// GL_CULL_FACE, and GL_PRIMITIVE_RESTART. Other values are passed through.
+void glstate__enable  (GLenum cap);
+void glstate__disable (GLenum cap);
+
+// These delete the given objects and forget any cached bindings to them, since
+// OpenGL may hand out the same names again later.
+void glstate__delete_vertex_array (GLuint vao);
+void glstate__delete_buffer       (GLuint vbo);
+void glstate__delete_texture      (GLuint texture);
+
+// Forget all cached state. Call this after any code that may have changed the
+// tracked state without using this module.
+void glstate__reset();
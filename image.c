@@ -0,0 +1,141 @@
+// image.c
+//
+
+#include "image.h"
+
+// Standard library includes.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Internal types and globals.
+
+// The largest amount of data in a single uncompressed deflate block.
+#define max_block_size 65535
+
+static uint32_t crc_table[256];
+static int      crc_table_is_ready = 0;
+
+
+// Internal functions.
+
+static void init_crc_table() {
+  if (crc_table_is_ready) return;
+  for (uint32_t n = 0; n < 256; ++n) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    crc_table[n] = c;
+  }
+  crc_table_is_ready = 1;
+}
+
+static uint32_t update_crc(uint32_t crc, const uint8_t *bytes, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    crc = crc_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+static void put_u32(uint8_t *dst, uint32_t val) {
+  dst[0] = val >> 24;
+  dst[1] = val >> 16;
+  dst[2] = val >>  8;
+  dst[3] = val;
+}
+
+// Writes a chunk with the given 4-character type. Returns nonzero on success.
+static int write_chunk(FILE *f, const char *type,
+                       const uint8_t *data, uint32_t len) {
+  uint8_t header[8];
+  put_u32(header, len);
+  memcpy(header + 4, type, 4);
+
+  uint32_t crc = update_crc(0xffffffff, header + 4, 4);
+  crc = update_crc(crc, data, len) ^ 0xffffffff;
+  uint8_t footer[4];
+  put_u32(footer, crc);
+
+  return fwrite(header, 1, 8, f) == 8 &&
+         (len == 0 || fwrite(data, 1, len, f) == len) &&
+         fwrite(footer, 1, 4, f) == 4;
+}
+
+// Returns a new buffer with the zlib stream for the given bytes, using stored
+// deflate blocks. The caller frees it.
+static uint8_t *new_zlib_stream(const uint8_t *bytes, size_t len,
+                                size_t *out_len) {
+  size_t num_blocks = len / max_block_size + 1;
+  *out_len = 2 + num_blocks * 5 + len + 4;
+  uint8_t *out = malloc(*out_len);
+  uint8_t *p   = out;
+
+  *p++ = 0x78;  // Deflate with a 32k window.
+  *p++ = 0x01;  // No preset dictionary, fastest compression; a valid check.
+
+  uint32_t a = 1, b = 0;  // The Adler-32 sums.
+  size_t   pos = 0;
+  for (size_t i = 0; i < num_blocks; ++i) {
+    size_t block_len = len - pos;
+    if (block_len > max_block_size) block_len = max_block_size;
+    *p++ = (i == num_blocks - 1);  // The final-block bit, with type 0 (stored).
+    *p++ = block_len & 0xff;
+    *p++ = block_len >> 8;
+    *p++ = ~block_len & 0xff;
+    *p++ = (~block_len >> 8) & 0xff;
+    memcpy(p, bytes + pos, block_len);
+    for (size_t j = 0; j < block_len; ++j) {
+      a = (a + p[j]) % 65521;
+      b = (b + a)    % 65521;
+    }
+    p   += block_len;
+    pos += block_len;
+  }
+  put_u32(p, (b << 16) | a);
+
+  return out;
+}
+
+
+// Public functions.
+
+int image__write_png(const char *path, int width, int height,
+                     const uint8_t *rgb) {
+  init_crc_table();
+
+  // Each row is preceded by a filter-type byte, which we leave as 0 (none).
+  size_t   row_len = 1 + 3 * (size_t)width;
+  size_t   raw_len = row_len * height;
+  uint8_t *raw     = malloc(raw_len);
+  for (int y = 0; y < height; ++y) {
+    raw[y * row_len] = 0;
+    memcpy(raw + y * row_len + 1, rgb + 3 * (size_t)width * y, 3 * width);
+  }
+  size_t   zlib_len;
+  uint8_t *zlib = new_zlib_stream(raw, raw_len, &zlib_len);
+  free(raw);
+
+  uint8_t ihdr[13];
+  put_u32(ihdr,     width);
+  put_u32(ihdr + 4, height);
+  ihdr[8]  = 8;  // Bit depth.
+  ihdr[9]  = 2;  // Color type: rgb.
+  ihdr[10] = 0;  // Compression method.
+  ihdr[11] = 0;  // Filter method.
+  ihdr[12] = 0;  // Interlace method: none.
+
+  static const uint8_t signature[8] = {137, 'P', 'N', 'G',
+                                       '\r', '\n', 26, '\n'};
+
+  int   ok = 0;
+  FILE *f  = fopen(path, "wb");
+  if (f) {
+    ok = fwrite(signature, 1, 8, f) == 8             &&
+         write_chunk(f, "IHDR", ihdr, sizeof(ihdr))  &&
+         write_chunk(f, "IDAT", zlib, zlib_len)      &&
+         write_chunk(f, "IEND", NULL, 0);
+    ok = (fclose(f) == 0) && ok;
+  }
+  free(zlib);
+  return ok;
+}
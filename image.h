@@ -0,0 +1,17 @@
+// image.h
+//
+// Writing images to files.
+//
+// PNG files are written without any compression library; the image data is
+// stored in uncompressed deflate blocks. That makes the files larger than they
+// could be, but keeps them readable by any PNG decoder.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+// This expects rgb to hold width * height pixels, each as three bytes, with
+// the top row first. Returns nonzero on success.
+int image__write_png(const char *path, int width, int height,
+                     const uint8_t *rgb);
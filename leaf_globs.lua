@@ -8,7 +8,8 @@ A module to build leaf globs.
 
 local leaf_globs = {}
 
-local kmeans = require 'kmeans'
+local cull_groups = require 'cull_groups'
+local kmeans      = require 'kmeans'
 
 local Mat3 = require 'Mat3'
 local Vec3 = require 'Vec3'
@@ -21,20 +22,31 @@ local dbg = require 'dbg'
 
 local num_custers = 11
 
+-- Globs are added at forks this many sticks below their farthest leaf, with a
+-- radius of glob_scale times their distance to it, and glob_pts corners; see
+-- leaf_globs.set_glob_params.
+local glob_depth = 3
+local glob_scale = 1.2
+local glob_pts   = 30
+
 
 -- Internal functions.
 
 -- This expects two sequence tables in `t` and `suffix.
 -- It appends the contents of `suffix` to the end of `t`.
 local function append(t, suffix)
-  if type(suffix) ~= 'table' then table.insert(t, suffix); return end
-  for _, val in ipairs(suffix) do
-    table.insert(t, val)
+  if type(suffix) ~= 'table' and not Vec3.is_vec3(suffix) then
+    table.insert(t, suffix)
+    return
+  end
+  for i = 1, #suffix do
+    table.insert(t, suffix[i])
   end
 end
 
 -- This accepts an array of arrays and turns it into a flat array of the
 -- indirect elements. Eg, {{1, 2}, {3}, {4, 5, 6}} -> {1, 2, 3, 4, 5, 6}.
+-- Vec3s count as arrays.
 local function flatten(array)
   if type(array) ~= 'table' then return array end
 
@@ -173,7 +185,7 @@ local function tri_area(t)
 
   assert(type(t) == 'table')
   assert(#t == 3)
-  assert(getmetatable(t[1]) == Vec3)
+  assert(Vec3.is_vec3(t[1]))
 
   -- Calculate the area using Heron's formula.
 
@@ -189,11 +201,15 @@ local function tri_area(t)
   return math.sqrt(sp * (sp - s[1]) * (sp - s[2]) * (sp - s[3]))
 end
 
--- This expects two triangles as input, and returns true when
--- area(t1) < area(t2).
-local function sort_by_area(t1, t2)
-  assert(type(t1) == 'table' and type(t2) == 'table')
-  return tri_area(t1) < tri_area(t2)
+-- This returns the triangle with the largest area. Each triangle's area is
+-- cached in t.area, as a glob's triangles don't move while it's being built.
+local function largest_triangle(triangles)
+  local big_t, big_area = nil, -1
+  for _, t in ipairs(triangles) do
+    if t.area == nil then t.area = tri_area(t) end
+    if t.area > big_area then big_t, big_area = t, t.area end
+  end
+  return big_t
 end
 
 local function rand_pt_on_unit_sphere()
@@ -208,10 +224,10 @@ local function rand_pt_on_unit_sphere()
 end
 
 local function part_of_pt_orth_to_basis(p, basis)
-  assert(getmetatable(p) == Vec3)
+  assert(Vec3.is_vec3(p))
   assert(type(basis) == 'table')
   for _, basis_pt in pairs(basis) do
-    assert(getmetatable(basis_pt) == Vec3)
+    assert(Vec3.is_vec3(basis_pt))
   end
 
   for _, basis_pt in pairs(basis) do
@@ -241,7 +257,7 @@ local function add_lin_indep_pt(pts)
 end
 
 local function opposite(pt)
-  assert(getmetatable(pt) == Vec3)
+  assert(Vec3.is_vec3(pt))
   return pt * -1
 end
 
@@ -253,7 +269,7 @@ end
 
 local function rand_pt_in_triangle(t)
   assert(#t == 3)
-  for i = 1, 3 do assert(getmetatable(t[i]) == Vec3) end
+  for i = 1, 3 do assert(Vec3.is_vec3(t[i])) end
 
   -- Choose random barycentric coordinates: y1, y2, y3.
   -- https://en.wikipedia.org/wiki/Barycentric_coordinate_system
@@ -280,7 +296,7 @@ local function rand_pt_in_triangle(t)
 end
 
 local function triangle_is_counterclockwise(t)
-  assert(type(t) == 'table' and #t == 3 and getmetatable(t[1]) == Vec3)
+  assert(type(t) == 'table' and #t == 3 and Vec3.is_vec3(t[1]))
 
   -- Find the normal of t.
   local side1, side2 = t[2] - t[1], t[3] - t[2]
@@ -297,8 +313,8 @@ end
 -- (I'm not considering edge cases carefully here as I don't expect them as
 -- valid inputs.)
 local function pt_is_outside_triangle(pt, t)
-  assert(getmetatable(pt) == Vec3)
-  assert(type(t) == 'table' and #t == 3 and getmetatable(t[1]) == Vec3)
+  assert(Vec3.is_vec3(pt))
+  assert(type(t) == 'table' and #t == 3 and Vec3.is_vec3(t[1]))
 
   -- Find the normal of t that points away from the origin.
   local side1, side2 = t[2] - t[1], t[3] - t[2]
@@ -312,8 +328,8 @@ local function pt_is_outside_triangle(pt, t)
 end
 
 local function sort_counterclockwise_with_up_vec(center, up)
-  assert(getmetatable(center) == Vec3)
-  assert(getmetatable(up) == Vec3)
+  assert(Vec3.is_vec3(center))
+  assert(Vec3.is_vec3(up))
 
   -- Choose an out vector that is far from linearly dependent with up.
   local out = Vec3:new(1, 0, 0)
@@ -356,8 +372,7 @@ end
 local function add_new_point(triangles)
 
   -- Choose the largest triangle to help us generate a useful new point.
-  table.sort(triangles, sort_by_area)
-  local big_t = triangles[#triangles]
+  local big_t = largest_triangle(triangles)
 
   -- Choose a new point. This is guaranteed to be outside the current convex
   -- hull as it, and all old corners, are unit vectors.
@@ -443,22 +458,23 @@ local function max_dist_to_leaf(t)
   return t.max_edges_to_leaf, t.max_dist_to_leaf
 end
 
--- This returns all the leaf points, as a sequence, of the given tree.
-local function all_leaf_points(tree)
-
-  local function all_l_pts_leafward(tree_pt, l_pts)
-    if tree_pt.kind == 'leaf' then
-      table.insert(l_pts, tree_pt)
-    elseif tree_pt.kids then
-      all_l_pts_leafward(tree_pt.kids[1], l_pts)
-      all_l_pts_leafward(tree_pt.kids[2], l_pts)
-    else
-      assert(tree_pt.kind == 'child')
-      all_l_pts_leafward(tree_pt.up, l_pts)
-    end
-    return l_pts
+-- This appends the leaf points leafward from tree_pt to l_pts, and returns
+-- l_pts.
+local function all_l_pts_leafward(tree_pt, l_pts)
+  if tree_pt.kind == 'leaf' then
+    table.insert(l_pts, tree_pt)
+  elseif tree_pt.kids then
+    all_l_pts_leafward(tree_pt.kids[1], l_pts)
+    all_l_pts_leafward(tree_pt.kids[2], l_pts)
+  else
+    assert(tree_pt.kind == 'child')
+    all_l_pts_leafward(tree_pt.up, l_pts)
   end
+  return l_pts
+end
 
+-- This returns all the leaf points, as a sequence, of the given tree.
+local function all_leaf_points(tree)
   -- This depends on the fact that the first tree point is the trunk.
   return all_l_pts_leafward(tree[1], {})
 end
@@ -494,6 +510,44 @@ local function update_leaf_pts_hit(unhit_l_pts, center, radius)
   end
 end
 
+-- This returns a copy of the flat vertices of glob, which is a tree_pt.glob
+-- table, moved and scaled to have the given center and radius.
+local function moved_glob_pts(glob, center, radius)
+  local pts   = {}
+  local scale = radius / glob.radius
+  for i = 0, #glob.pts - 1 do
+    local j = i % 3 + 1
+    pts[i + 1] = (glob.pts[i + 1] - glob.center[j]) * scale + center[j]
+  end
+  return pts
+end
+
+-- This appends a glob for tree_pt to globs, in the style of idea 2 v3, if
+-- tree_pt is a fork glob_depth sticks below its farthest leaf and some of its
+-- leaf points aren't yet covered by a glob. It returns true if a glob was
+-- added.
+--
+-- The glob is kept in tree_pt.glob. If old_glob is given, the new glob has the
+-- same shape, which is much faster than making a new one.
+local function add_glob_if_needed(tree_pt, unhit_l_pts, globs, old_glob)
+  tree_pt.glob = nil
+  if tree_pt.has_glob or tree_pt.kind ~= 'parent' then return false end
+  local num_edges, distance = max_dist_to_leaf(tree_pt)
+  if num_edges ~= glob_depth or all_leaf_pts_hit(tree_pt) then return false end
+
+  local r = distance * glob_scale  -- Add a small buffer distance.
+  local pts
+  if old_glob then
+    pts = moved_glob_pts(old_glob, tree_pt.pt, r)
+  else
+    pts = leaf_globs.make_glob(tree_pt.pt, r, glob_pts)
+  end
+  tree_pt.glob = {center = tree_pt.pt, radius = r, pts = pts}
+  append(globs, pts)
+  update_leaf_pts_hit(unhit_l_pts, tree_pt.pt, r)
+  return true
+end
+
 
 -- Public functions.
 
@@ -505,7 +559,7 @@ end
 -- Outputs: a sequence table with a flat vertex array of triangle corners
 -- The output is designed to be usable as an input to VertexArray:new.
 function leaf_globs.make_glob(center, radius, num_pts, out_triangles)
-  assert(getmetatable(center) == Vec3)
+  assert(Vec3.is_vec3(center))
   assert(type(radius) == 'number')
   assert(type(num_pts) == 'number')
   assert(num_pts == math.floor(num_pts))
@@ -636,21 +690,22 @@ function leaf_globs.add_leaves_idea2_v3(tree)
   local unhit_l_pts = all_leaf_points(tree)
   local globs = {}
   local num_globs_added = 0
-  for _, tree_pt in pairs(tree) do
-    if not tree_pt.has_glob and tree_pt.kind == 'parent' then
-      local num_edges, distance = max_dist_to_leaf(tree_pt)
-      if num_edges == 3 and not all_leaf_pts_hit(tree_pt) then
-        local r = distance * 1.2  -- Add a small buffer distance.
-        leaf_globs.make_glob(tree_pt.pt, r, 30, globs)
-        update_leaf_pts_hit(unhit_l_pts, tree_pt.pt, r)
-        num_globs_added = num_globs_added + 1
-      end
+  -- The globs are added in tree order so that each cull group's leaves are
+  -- contiguous.
+  -- Each tree point's vertex count is kept so that its glob can be found and
+  -- replaced by leaf_globs.update_leaves.
+  for tree_idx = 1, #tree do
+    local tree_pt = tree[tree_idx]
+    local num_pts = #globs
+    if add_glob_if_needed(tree_pt, unhit_l_pts, globs) then
+      num_globs_added = num_globs_added + 1
     end
+    tree_pt.num_leaf_vertices = (#globs - num_pts) / 3
   end
+  leaf_globs.update_groups(tree)
 
-  local green = {0, 0.6, 0}
-  tree.leaves = VertexArray:new(globs, 'triangles', green)
-  --tree.leaves = VertexArray:new(globs, 'points', green, 10)
+  -- The caller creates any OpenGL objects for the globs, so that this can run
+  -- on a generator thread.
 
   print('Used ' .. num_globs_added .. ' leaf globs.')
 
@@ -740,4 +795,85 @@ function leaf_globs.add_leaves(tree)
   return leaf_globs.add_leaves_idea2_v3(tree)
 end
 
+-- This sets the depth, scale, and number of corners of the globs added after
+-- this call; see the glob_* parameters above.
+function leaf_globs.set_glob_params(depth, scale, num_pts)
+  glob_depth, glob_scale, glob_pts = depth, scale, num_pts
+end
+
+-- This sets up tree.leaf_groups from the num_leaf_vertices and cull_group
+-- values of the tree points. It's called again when those values change.
+function leaf_globs.update_groups(tree)
+  tree.leaf_groups = {sizes = {}}
+  for tree_idx = 1, #tree do
+    local tree_pt = tree[tree_idx]
+    cull_groups.add(tree.leaf_groups, tree_pt.cull_group,
+                    tree_pt.num_leaf_vertices or 0)
+  end
+end
+
+-- This rebuilds the globs that depend on edited parts of a tree. The leafward
+-- distances have changed for each point of the sequence `starts`, and for every
+-- point trunkward of them; new_forks is a sequence of forks that are new to the
+-- tree. This returns a table that maps each fork whose glob may have changed to
+-- the flat vertex sequence of its new glob, which is empty for forks that no
+-- longer have a glob.
+--
+-- The forks rebuilt are the new forks, plus each fork trunkward of the starts
+-- that had, or now has, a glob. The leaf points covered by their globs are
+-- chosen as in add_leaves_idea2_v3, except that globs elsewhere in the tree
+-- aren't counted as covering them. Each rebuilt fork that had a glob keeps its
+-- shape; new_forks can reuse the shapes of old globs by mapping them in
+-- old_globs, which is optional.
+function leaf_globs.update_leaves(starts, new_forks, old_globs)
+  -- Clear the cached distances from each start down to the trunk, then find
+  -- the forks that gain or lose a glob.
+  local old_num_edges = {}  -- This maps the cleared forks to their old values.
+  for _, tree_pt in ipairs(starts) do
+    while tree_pt and old_num_edges[tree_pt] == nil do
+      old_num_edges[tree_pt] = tree_pt.max_edges_to_leaf or false
+      tree_pt.max_edges_to_leaf = nil
+      if tree_pt.kind == 'child' then
+        tree_pt = tree_pt.parent
+      else
+        tree_pt = tree_pt.down
+      end
+    end
+  end
+  local reused_globs = {}  -- This maps the forks to rebuild to their old globs.
+  for tree_pt, old_value in pairs(old_num_edges) do
+    if tree_pt.kind == 'parent' and
+       (old_value == glob_depth or
+        max_dist_to_leaf(tree_pt) == glob_depth) then
+      reused_globs[tree_pt] = tree_pt.glob or false
+    end
+  end
+  for _, fork in ipairs(new_forks) do
+    reused_globs[fork] = old_globs and old_globs[fork] or false
+  end
+  local forks = {}
+  for fork in pairs(reused_globs) do forks[#forks + 1] = fork end
+  table.sort(forks, function (a, b) return a.idx < b.idx end)
+
+  -- Collect the leaf points of the rebuilt forks.
+  local unhit_l_pts, is_seen = {}, {}
+  for _, fork in ipairs(forks) do
+    for _, l_pt in ipairs(all_l_pts_leafward(fork, {})) do
+      if not is_seen[l_pt] then
+        is_seen[l_pt], l_pt.hit_by_glob = true, nil
+        unhit_l_pts[#unhit_l_pts + 1] = l_pt
+      end
+    end
+  end
+
+  local new_globs = {}
+  for _, fork in ipairs(forks) do
+    local glob = {}
+    add_glob_if_needed(fork, unhit_l_pts, glob, reused_globs[fork] or nil)
+    new_globs[fork] = glob
+  end
+
+  return new_globs
+end
+
 return leaf_globs
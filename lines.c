@@ -6,14 +6,18 @@
 
 // Local includes.
 #include "cstructs/cstructs.h"
+#include "draw_queue.h"
 #include "glhelp.h"
+#include "glstate.h"
+#include "luacompat.h"
+#include "stream_buffer.h"
 
 // Library includes.
 #include "lua/lauxlib.h"
 
 // OpenGL and standard library includes.
 #include <assert.h>
-#include <OpenGL/gl3.h>
+#include "glinclude.h"
 
 
 // Macros.
@@ -25,20 +29,16 @@
 // Internal types and globals.
 
 static GLuint  program;
-static GLint    vp_loc;
 static GLint color_loc;
 
-static lines__TransformCallback transform_callback = NULL;
-
 static float line_scale = 1.0;
 
 static Array lines = NULL;
 
-// Our code maintains two drawing states: empty or ready. Empty means that we
-// have no vao or vbo set up, and the vao value is 0. Ready means that both the
-// vao and vbo have data ready to draw, and the vao is nonzero.
-static GLuint vao  = 0;
-static GLuint vbo  = 0;
+// The lines are pushed into the stream buffer each time they're drawn, so that
+// changing them never requires new OpenGL objects. The vao is set up once.
+static GLuint                vao = 0;
+static stream_buffer__Buffer stream;
 
 // Names for vertex attribute indexes in our vertex shader.
 enum {
@@ -51,7 +51,6 @@ enum {
 static void gl_init() {
   program = glhelp__load_program("solid.vert.glsl",
                                  "solid.frag.glsl");
-  vp_loc    = glGetUniformLocation(program, "vp");
   color_loc = glGetUniformLocation(program, "color");
 
   // Set the line color to green.
@@ -59,6 +58,20 @@ static void gl_init() {
   glUniform4fv(color_loc,  // location
                1,          // count
                color);     // uniform value
+
+  // Each vertex is a triple of GLfloats.
+  stream_buffer__init(&stream, 3 * sizeof(GLfloat), 1024);  // 1024 = vertices
+
+  glGenVertexArrays(1, &vao);
+  glstate__bind_vertex_array(vao);
+  glstate__bind_array_buffer(stream.vbo);
+  glVertexAttribPointer(v_position,    // attrib index
+                        3,             // num coords
+                        GL_FLOAT,      // coord type
+                        GL_FALSE,      // gpu should normalize
+                        0,             // stride
+                        (void *)(0));  // offset
+  glEnableVertexAttribArray(v_position);
 }
 
 
@@ -98,43 +111,6 @@ static void init_if_needed() {
   lines = array__new(32, sizeof(GLfloat));
 }
 
-static void ensure_gl_data_is_empty() {
-  if (vao == 0) return;  // Stop if it's already empty.
-
-  glDeleteVertexArrays(1, &vao);
-  glDeleteBuffers(1, &vbo);
-
-  vao = 0;
-  vbo = 0;
-}
-
-
-static void ensure_gl_data_is_ready() {
-  if (vao != 0) {
-    glBindVertexArray(vao);
-    return;  // Stop early if the vao already exists.
-  }
-
-  glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-  // Set up the data in the vbo.
-
-  glBufferData(GL_ARRAY_BUFFER,                  // buffer use target
-               lines->count * lines->item_size,  // size
-               lines->items,                     // data
-               GL_STATIC_DRAW);                  // usage hint
-  glVertexAttribPointer(v_position,    // attrib index
-                        3,             // num coords
-                        GL_FLOAT,      // coord type
-                        GL_FALSE,      // gpu should normalize
-                        0,             // stride
-                        (void *)(0));  // offset
-  glEnableVertexAttribArray(v_position);
-}
-
 
 // Lua-facing functions.
 
@@ -142,8 +118,7 @@ static void ensure_gl_data_is_ready() {
 // They each have the format {x, y, z}.
 static int lines__add(lua_State *L) {
   init_if_needed();
-  ensure_gl_data_is_empty();  // The data is made ready when draw is called.
-  
+
   // Extract C-friendly points from the given Lua tables.
   GLfloat from[3];
   luaL_checkpoint(L, 1, from);
@@ -151,8 +126,7 @@ static int lines__add(lua_State *L) {
   luaL_checkpoint(L, 2, to);
 
   // All these lines are being aggregated in the `lines` array, and will be
-  // converted to an OpenGL vertex buffer object (vbo) on the next call to
-  // lines__draw_all.
+  // pushed to the gpu on the next call to lines__draw_all.
   
   // If line_scale is not 1, apply it to the line.
   if (line_scale != 1.0) {
@@ -175,31 +149,37 @@ static int lines__set_scale(lua_State *L) {
 }
 
 static int lines__reset(lua_State *L) {
+  (void)L;
 
   init_if_needed();
 
-  ensure_gl_data_is_empty();
   array__clear(lines);
 
   return 0;  // 0 --> no Lua return values
 }
 
+// The draw is added to the draw queue, which is flushed once per frame after
+// render.draw returns.
 static int lines__draw_all(lua_State *L) {
+  (void)L;
   init_if_needed();
 
-  // Make sure our program, vao, and vbo are set up and bound in OpenGL.
-  glUseProgram(program);
-  ensure_gl_data_is_ready();
-
-  // Set up the uniforms. The color has been set in gl_init().
-  
-  assert(transform_callback);
-  transform_callback(vp_loc);
-  
-  // Draw the lines.
-  glDrawArrays(GL_LINES,           // mode
-               0,                  // start
-               lines->count / 3);  // count
+  // Send this frame's copy of the lines to the gpu.
+  GLsizei num_vertices = lines->count / 3;
+  GLint   first        = stream_buffer__push(&stream, lines->items,
+                                             num_vertices);
+
+  // Queue up the lines. The color uniform has been set in gl_init(), and the
+  // transform comes from the shared uniform buffers.
+  draw_queue__Item item = {
+    .program   = program,
+    .vao       = vao,
+    .mode      = GL_LINES,
+    .first     = first,
+    .count     = num_vertices,
+    .color_loc = -1
+  };
+  draw_queue__add(&item);
 
   return 0;  // 0 --> no Lua return values
 }
@@ -221,7 +201,3 @@ void lines__load_lib(lua_State *L) {
 
   gl_init();
 }
-
-void lines__set_transform_callback(lines__TransformCallback callback) {
-  transform_callback = callback;
-}
@@ -21,7 +21,7 @@
 //   end
 //
 //   function draw()  -- Expected to be called every frame.
-//     lines.draw_all()
+//     lines.draw_all()  -- This is queued until draw_queue__flush is called.
 //   end
 //
 
@@ -29,12 +29,8 @@
 
 #include "lua/lua.h"
 
-#include <OpenGL/gl3.h>
-
-// A lines__TransformCallback is a function that accepts the location of a
-// shader uniform and sets a mat4 matrix value representing the current
-// transformation to be applied to all vertices.
-typedef void (*lines__TransformCallback)(GLint);
+#include "glinclude.h"
 
+// The transform applied to all vertices comes from the uniform buffers set up
+// in the frame_uniforms module.
 void lines__load_lib(lua_State *L);
-void lines__set_transform_callback(lines__TransformCallback callback);
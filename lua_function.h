@@ -0,0 +1,179 @@
+// lua_function.h
+//
+// Typed calls from C++ into Lua, for functions that are called often enough
+// that clua__call's lookups by name and type strings add up, such as
+// render.draw, which is called every frame.
+//
+// A LuaFunction is bound to a module function once, and keeps it as a registry
+// reference:
+//
+//   LuaFunction<bool(int, double)> fn;
+//   fn.bind(L, "mod", "fn");
+//   bool b = fn(3, 1.5);  // Calls mod.fn(3, 1.5).
+//
+// A call is a lua_rawgeti of the function, a push per argument, and a
+// lua_pcall. The pushes and the conversion of the result are picked by
+// overloading, so there's nothing to parse at run time, and a wrong number of
+// arguments doesn't compile.
+//
+// Arguments may be bool, int, float, double, const char *, or Array; results
+// may be any of these except const char *, or void. Other types don't compile.
+// An Array is passed as a light userdata pointing to it, which Lua code can
+// hand back to C, but can't index. Like clua__call, a call that raises an
+// error, or whose result has the wrong type, prints an error and returns a zero
+// result. A call of an unbound LuaFunction returns a zero result.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <type_traits>
+
+extern "C" {
+#include "clua.h"
+#include "cstructs/cstructs.h"
+#include "luacompat.h"
+}
+
+
+// Internal functions.
+
+// This catches argument types that would otherwise convert to one of the types
+// below, such as pointers, which convert to bool.
+template <typename T> void lua_function__push(lua_State *L, T value) = delete;
+
+static inline void lua_function__push(lua_State *L, bool b) {
+  lua_pushboolean(L, b);
+}
+
+static inline void lua_function__push(lua_State *L, int n) {
+  lua_pushinteger(L, n);
+}
+
+static inline void lua_function__push(lua_State *L, float x) {
+  lua_pushnumber(L, x);
+}
+
+static inline void lua_function__push(lua_State *L, double x) {
+  lua_pushnumber(L, x);
+}
+
+static inline void lua_function__push(lua_State *L, const char *s) {
+  lua_pushstring(L, s);
+}
+
+static inline void lua_function__push(lua_State *L, Array array) {
+  lua_pushlightuserdata(L, array);
+}
+
+static inline void lua_function__print_type_error(const char *mod,
+                                                  const char *fn) {
+  printf("Error in call to %s.%s: unexpected result type\n", mod, fn);
+}
+
+// Each LuaResult<T>::pop converts the result of mod.fn, on top of L's stack, to
+// a T, and pops it. If the result isn't a T, it prints an error and returns 0.
+template <typename T> struct LuaResult;
+
+template <> struct LuaResult<void> {
+  static void pop(lua_State *L, const char *mod, const char *fn) {
+    (void)L;
+    (void)mod;
+    (void)fn;
+  }
+};
+
+template <> struct LuaResult<bool> {
+  static bool pop(lua_State *L, const char *mod, const char *fn) {
+    if (!lua_isboolean(L, -1)) lua_function__print_type_error(mod, fn);
+    bool b = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    return b;
+  }
+};
+
+template <> struct LuaResult<double> {
+  static double pop(lua_State *L, const char *mod, const char *fn) {
+    int is_num;
+    double x = lua_tonumberx(L, -1, &is_num);
+    if (!is_num) lua_function__print_type_error(mod, fn);
+    lua_pop(L, 1);
+    return x;
+  }
+};
+
+template <> struct LuaResult<float> {
+  static float pop(lua_State *L, const char *mod, const char *fn) {
+    return (float)LuaResult<double>::pop(L, mod, fn);
+  }
+};
+
+template <> struct LuaResult<int> {
+  static int pop(lua_State *L, const char *mod, const char *fn) {
+    return (int)LuaResult<double>::pop(L, mod, fn);
+  }
+};
+
+template <> struct LuaResult<Array> {
+  static Array pop(lua_State *L, const char *mod, const char *fn) {
+    if (!lua_islightuserdata(L, -1)) lua_function__print_type_error(mod, fn);
+    Array array = (Array)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return array;
+  }
+};
+
+
+// Public types.
+
+template <typename Signature> class LuaFunction;
+
+template <typename Result, typename... Args>
+class LuaFunction<Result(Args...)> {
+ public:
+  LuaFunction() : L(NULL), ref(LUA_NOREF), mod(""), fn("") {}
+  ~LuaFunction() { unbind(); }
+
+  // Copies would share a reference, which they'd each release.
+  LuaFunction(const LuaFunction &) = delete;
+  LuaFunction &operator=(const LuaFunction &) = delete;
+
+  // The mod and fn strings are expected to outlive this LuaFunction.
+  void bind(lua_State *new_L, const char *new_mod, const char *new_fn) {
+    unbind();
+    L   = new_L;
+    mod = new_mod;
+    fn  = new_fn;
+    ref = clua__ref(L, mod, fn);
+  }
+
+  void unbind() {
+    if (ref != LUA_NOREF) clua__unref(L, ref);
+    ref = LUA_NOREF;
+  }
+
+  bool is_bound() const { return ref != LUA_NOREF; }
+
+  Result operator()(Args... args) {
+    if (ref == LUA_NOREF) return Result();
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+        // stack = [.., fn]
+    int pushes[] = {0, (lua_function__push(L, args), 0)...};
+    (void)pushes;
+        // stack = [.., fn, args]
+    int num_results = std::is_void<Result>::value ? 0 : 1;
+    if (lua_pcall(L, sizeof...(Args), num_results, 0) != LUA_OK) {
+      clua__print_call_error(L, mod, fn);
+      return Result();
+    }
+        // stack = [.., result], or [..] for a void Result
+    return LuaResult<Result>::pop(L, mod, fn);
+  }
+
+ private:
+  lua_State  *L;
+  int         ref;
+  const char *mod;
+  const char *fn;
+};
@@ -0,0 +1,63 @@
+// luacompat.h
+//
+// Lets the C side of the Lua bridge build against either PUC Lua 5.3, whose
+// headers and library are in lua/, or LuaJIT 2.1. To use LuaJIT, replace the
+// headers in lua/ with LuaJIT's lua.h, lualib.h, lauxlib.h, luaconf.h, and
+// luajit.h, and link libluajit.a instead of lua/liblua.a.
+//
+// The bridge is written against the 5.3 API. LuaJIT has the 5.1 API along with
+// a few 5.2 additions, such as lua_tonumberx and luaL_setfuncs; this header
+// fills in the rest of what the bridge uses. It has no effect under 5.3.
+//
+
+#pragma once
+
+#include "lua/lua.h"
+#include "lua/lauxlib.h"
+
+#if LUA_VERSION_NUM == 501
+
+#ifndef LUA_OK
+#define LUA_OK 0
+#endif
+
+#define lua_rawlen(L, index) lua_objlen(L, index)
+
+#define luaL_newlib(L, lib) (lua_newtable(L), luaL_register(L, NULL, lib))
+
+static inline int lua_absindex(lua_State *L, int index) {
+  if (index > 0 || index <= LUA_REGISTRYINDEX) return index;
+  return lua_gettop(L) + index + 1;
+}
+
+// Unlike 5.3's, this ignores any __len metamethod.
+static inline lua_Integer luaL_len(lua_State *L, int index) {
+  return (lua_Integer)lua_objlen(L, index);
+}
+
+static inline int lua_geti(lua_State *L, int index, lua_Integer i) {
+  index = lua_absindex(L, index);
+  lua_pushinteger(L, i);
+      // stack = [.., i]
+  lua_gettable(L, index);
+      // stack = [.., t[i]]
+  return lua_type(L, -1);
+}
+
+// In 5.1, a userdata's environment stands in for its user value, but it has to
+// be a table, so this keeps the value in one. There's no lua_getuservalue here,
+// as the bridge only sets user values to keep other values alive.
+static inline void lua_setuservalue(lua_State *L, int index) {
+  index = lua_absindex(L, index);
+      // stack = [.., value]
+  lua_createtable(L, 1, 0);
+      // stack = [.., value, env]
+  lua_insert(L, -2);
+      // stack = [.., env, value]
+  lua_rawseti(L, -2, 1);
+      // stack = [.., env]
+  lua_setfenv(L, index);
+      // stack = [..]
+}
+
+#endif
@@ -0,0 +1,71 @@
+// luahelp.c
+//
+
+#include "luahelp.h"
+
+// Library includes.
+#include "lua/lauxlib.h"
+
+
+// Public functions.
+
+// This function was originally based on code found here:
+// http://stackoverflow.com/questions/12256455/
+int luahelp__traceback_error(lua_State *L) {
+  int msg_index = lua_gettop(L);
+  lua_getglobal(L, "debug");
+  lua_getfield(L, -1, "traceback");
+  lua_pushvalue(L, msg_index);
+  lua_pushinteger(L, 2);
+  lua_call(L, 2, 1);
+  return lua_error(L);
+}
+
+Array luahelp__new_float_array(lua_State *L, int index) {
+
+  int arr_len = (int)lua_rawlen(L, index);
+
+  Array arr = array__new(arr_len, sizeof(float));
+  for (int i = 1;; lua_pop(L, 1), ++i) {
+      // stack = [.. lua_arr ..]
+    lua_rawgeti(L, index, i);
+      // stack = [.. lua_arr .. lua_arr[i]]
+    if (lua_isnil(L, -1)) break;
+    if (!lua_isnumber(L, -1)) {
+      array__delete(arr);
+      lua_pushstring(L, "Expected a flat array.");
+      luahelp__traceback_error(L);  // This function never returns.
+    }
+    array__new_val(arr, float) = lua_tonumber(L, -1);
+  }
+      // stack = [.. lua_arr .. nil]
+  lua_pop(L, 1);
+      // stack = [.. lua_arr ..]
+  return arr;
+}
+
+int luahelp__is_float_array(lua_State *L, int index) {
+  for (int i = 1;; lua_pop(L, 1), ++i) {
+      // stack = [.. lua_arr ..]
+    lua_rawgeti(L, index, i);
+      // stack = [.. lua_arr .. lua_arr[i]]
+    if (lua_isnil(L, -1)) break;
+    if (!lua_isnumber(L, -1)) {
+      lua_pop(L, 1);
+      return 0;
+    }
+  }
+      // stack = [.. lua_arr .. nil]
+  lua_pop(L, 1);
+      // stack = [.. lua_arr ..]
+  return 1;
+}
+
+void luahelp__check_indexable(lua_State *L, int narg) {
+  if (lua_istable(L, narg)) return;  // tables are indexable.
+  if (!luaL_getmetafield(L, narg, "__index")) {
+    // This function will show the user narg and the Lua-visible function name.
+    luaL_argerror(L, narg, "expected an indexable value such as a table");
+  }
+  lua_pop(L, 1);  // Pop the value of getmetable(narg).__index.
+}
@@ -0,0 +1,29 @@
+// luahelp.h
+//
+// Tools for more easily working with Lua from C.
+//
+
+#pragma once
+
+#include "cstructs/cstructs.h"
+#include "luacompat.h"
+
+// This function expects an error string to be on top of the stack. It raises
+// that message as a Lua error along with a stack trace starting with the first
+// callee before the current C function. This function does not return.
+int   luahelp__traceback_error(lua_State *L);
+
+// This creates an Array of GLfloat-sized floats from what is expected to be a
+// flat Lua array of numbers at the given index on L's stack. The caller is
+// responsible for calling array__delete on the returned Array. L's stack is
+// preserved.
+Array luahelp__new_float_array(lua_State *L, int index);
+
+// Returns nonzero if the value at the given index is a flat Lua array of
+// numbers, so that luahelp__new_float_array would succeed. This lets callers
+// check their arguments before allocating anything. L's stack is preserved.
+int   luahelp__is_float_array(lua_State *L, int index);
+
+// Raises a Lua argument error unless the value at narg is a table or has an
+// __index metamethod.
+void  luahelp__check_indexable(lua_State *L, int narg);
@@ -9,9 +9,19 @@
 extern "C" {
 
 #include "clua.h"
+#include "draw_queue.h"
 #include "file.h"
+#include "forest.h"
+#include "frame_uniforms.h"
+#include "generator.h"
+#include "glstate.h"
 #include "lines.h"
+#include "softrast.h"
+#include "species.h"
+#include "stream_buffer.h"
+#include "upload_queue.h"
 #include "vertex_array.h"
+#include "wind.h"
 
 #include "lua.h"
 #include "lualib.h"
@@ -21,6 +31,7 @@ extern "C" {
 
 // C++ friendly includes.
 #include "config.h"
+#include "lua_function.h"
 
 #include "glm.hpp"
 #define GLM_FORCE_RADIANS
@@ -47,28 +58,20 @@ typedef enum {
 
 static lua_State *L = NULL;
 
+// The render module's functions, which are bound once render.lua is loaded.
+static LuaFunction<void()> render_init;
+static LuaFunction<void()> render_draw;
+static LuaFunction<bool()> render_is_ready;
+
 static float aspect_ratio;
 static float angle = 0.0f;
+static int   do_auto_rotate = YES;
 
-static mat4 mvp;
-static mat3 normal_xform;
-
-
-// Internal functions.
+// This points toward the light used by the bark shader.
+static vec3 light_dir = normalize(vec3(1, 2, 2));
 
-static void send_mvp(GLint transform_loc) {
-  glUniformMatrix4fv(transform_loc,  // uniform location
-                     1,              // count
-                     GL_FALSE,       // don't use transpose
-                     &mvp[0][0]);    // src matrix
-}
 
-static void send_normal_xform(GLint transform_loc) {
-  glUniformMatrix3fv(transform_loc,         // uniform location
-                     1,                     // count
-                     GL_FALSE,              // don't use transpose
-                     &normal_xform[0][0]);  // src matrix
-}
+// Internal macros.
 
 #define set_lua_global_num(name)   \
     lua_pushnumber(L, name);       \
@@ -78,18 +81,28 @@ static void send_normal_xform(GLint transform_loc) {
     lua_pushboolean(L, name);       \
     lua_setglobal(L, #name);
 
-static void set_lua_config_constants() {
+#define set_lua_global_str(name)    \
+    lua_pushstring(L, name);        \
+    lua_setglobal(L, #name);
+
+
+// Public functions.
+
+extern "C" void luarender__set_config_constants(lua_State *L) {
   set_lua_global_num(min_tree_height);
   set_lua_global_num(max_tree_height);
   set_lua_global_num(branch_size_factor);
   set_lua_global_num(max_ring_pts);
   set_lua_global_bool(is_tree_2d);
   set_lua_global_bool(do_draw_rings);
+  set_lua_global_num(forest_grid_size);
+  set_lua_global_num(forest_spacing);
+  set_lua_global_num(cull_group_depth);
+  set_lua_global_bool(do_generate_async);
+  set_lua_global_bool(do_use_ffi_vec3);
+  set_lua_global_str(species_names);
 }
 
-
-// Public functions.
-
 extern "C" void luarender__init() {
   L = clua__new_state();
   
@@ -97,7 +110,7 @@ extern "C" void luarender__init() {
   luaL_openlibs(L);
 
   // Set shared constants from the conifg.h file.
-  set_lua_config_constants();
+  luarender__set_config_constants(L);
   
   // Load the render modules.
   char *filepath = file__get_path("render.lua");
@@ -114,42 +127,69 @@ extern "C" void luarender__init() {
   lua_setglobal(L, "render");
     // stack = []
   
+  // Set up the uniform buffers shared by all shaders.
+  frame_uniforms__init();
+  
   // Load and set up the lines module.
   lines__load_lib(L);
     // stack = []
-  lines__set_transform_callback(send_mvp);
   
   // Load and set up the vertex_array module.
   vertex_array__load_lib(L);
   // stack = []
+
+  // Load and set up the wind module.
+  wind__load_lib(L);
+  // stack = []
+
+  // Load and set up the forest module.
+  forest__load_lib(L);
+  // stack = []
+
+  // Load the species module, which reads the species files trees are made from.
+  species__load_lib(L);
+  // stack = []
+
+  // Start the tree generator thread, and load its Lua interface.
+  generator__load_lib(L);
+  // stack = []
+
+  // Load the softrast module, which renders thumbnails without the gpu.
+  softrast__load_lib(L);
+  // stack = []
   assert(lua_gettop(L) == 0);
-  vertex_array__set_mvp_callback(send_mvp);
-  vertex_array__set_normal_callback(send_normal_xform);
-  
+
+  render_init.bind(L, "render", "init");
+  render_draw.bind(L, "render", "draw");
+  render_is_ready.bind(L, "render", "is_ready");
+
   // Call render.init.
-  clua__call(L, "render", "init", "");  // "" --> no input, no output
+  render_init();
   
   // Any one-time OpenGL setup.
-  glEnable(GL_DEPTH_TEST);
+  glstate__enable(GL_DEPTH_TEST);
   glClearColor(1, 1, 1, 1);  // White.
 }
 
+extern "C" void luarender__update(double dt) {
+  wind__update(dt);
+
+  if (is_tree_2d || !do_auto_rotate) return;
+
+  // The rotation speed is in radians per second.
+  //angle += 0.048 * dt;  // Super slow.
+  angle += 0.3 * dt;      // Good speed.
+  //angle += 12.0 * dt;   // Super fast.
+}
+
 extern "C" void luarender__draw(int w, int h) {
   
-  // Clear view and set the aspect ratio and rotation angle.
+  // Clear view and set the aspect ratio.
   glViewport(0, 0, w, h);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   aspect_ratio = (float)w / h;
 
-  // TEMP! TODO Change back. The normal value is 0.01.
-  //if (!is_tree_2d) angle += 0.01;
-  
-  //if (!is_tree_2d) angle += 0.0008;  // Super slow.
-  if (!is_tree_2d) angle += 0.005;   // Good speed. (0.005)
-  //if (!is_tree_2d) angle += 0.2;     // Super fast.
-
-  
-  // Recompute the mvp matrix.
+  // Recompute the per-frame matrices.
   mat4 projection = perspective(45.0f, aspect_ratio, 0.1f, 1000.0f);
 
 
@@ -196,12 +236,37 @@ extern "C" void luarender__draw(int w, int h) {
 
   // We copy over the normal_xform at this point since this is the unity matrix
   // part of what we're doing to the model.
-  normal_xform = mat3(model);
+  mat3 normal_xform = mat3(model);
 
   model = translate(model, vec3(0, -3, 0));
   model = scale(model, vec3(zoom_scale));
-  mvp = projection * view * model;
 
-  // Call Lua render.draw() to finish.
-  clua__call(L, "render", "draw", "");  // "" --> no input or output
+  // Send the matrices to the shaders; these are shared by all draws.
+  frame_uniforms__set_frame(&view[0][0], &projection[0][0],
+                            &normal_xform[0][0], &light_dir[0]);
+  frame_uniforms__set_model(&model[0][0]);
+
+  // Send this frame's share of any pending buffer data; this uses the new
+  // matrices to send the data nearest the camera first.
+  upload_queue__run((size_t)(upload_budget_mb * (1 << 20)));
+
+  // Call Lua render.draw(), which queues up the frame's draws.
+  render_draw();
+
+  // Execute the queued draws.
+  draw_queue__flush();
+  stream_buffer__end_frame();
+}
+
+extern "C" void luarender__set_angle(float new_angle) {
+  angle          = new_angle;
+  do_auto_rotate = NO;
+}
+
+extern "C" void luarender__new_tree() {
+  render_init();
+}
+
+extern "C" int luarender__is_tree_ready() {
+  return render_is_ready();
 }
@@ -14,9 +14,31 @@
 extern "C" {
 #endif
 
+struct lua_State;
+
 void luarender__init();
+
+// Sets the Lua globals that mirror constants in config.h. This is used for
+// every Lua state that runs the tree-generation scripts.
+void luarender__set_config_constants(struct lua_State *L);
+
+// Advances the animation by dt seconds. This is independent of drawing so that
+// the animation speed doesn't depend on the frame rate.
+void luarender__update(double dt);
 void luarender__draw(int w, int h);
 
+// Sets the model's rotation angle, in radians, about the vertical axis. After
+// this is called, luarender__update no longer advances the angle.
+void luarender__set_angle(float new_angle);
+
+// Calls render.init again, which replaces the current tree or forest with a
+// freshly generated one.
+void luarender__new_tree();
+
+// Returns nonzero once the most recently requested tree can be drawn. Trees
+// generated in the background may take a while.
+int  luarender__is_tree_ready();
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -17,7 +17,10 @@ Here is the format of a tree table:
 
               -- Child items also have:
               parent   = parent_item,
-              up       = upward_item (upward = leafward)
+              up       = upward_item (upward = leafward),
+              gen_args = the add_to_tree arguments that made the subtree
+                         starting with this item (see regenerate_subtree)
+              bone     = the number of the stick's bone (see bones.lua)
              }
 
 Nonterminal points have 3 entries in this table - one as the child of the stick
@@ -35,8 +38,11 @@ local make_tree = {}
 -- Requires.
 
 local bark       = require 'bark'
+local bones      = require 'bones'
+local dirty      = require 'dirty'
 local leaf_globs = require 'leaf_globs'
 local rings      = require 'rings'
+local seq        = require 'seq'
 
 local Mat3  = require 'Mat3'
 local Vec3  = require 'Vec3'
@@ -53,23 +59,28 @@ end
 check_global('max_tree_height')
 check_global('branch_size_factor')
 check_global('max_ring_pts')
+check_global('cull_group_depth')
 
 local do_dbg_print = false
 
+-- The species C module; see species.h. It's captured here, before the species
+-- local below hides it. It's nil on the generator thread, which passes the
+-- default species' parameters itself rather than nil.
+local species_lib = species
 
--- Internal utility functions.
+-- The parameters of the species of tree that's being made or edited, in the
+-- format returned by species.load; see species.h. Per-level values are read
+-- with at_level. Trees made without a species use default_species, which is
+-- set from species.defaults when it's first needed.
+local default_species
+local species
 
--- This expects two sequence tables in `t` and `suffix.
--- It appends the contents of `suffix` to the end of `t`.
-local function append(t, suffix)
-  for _, val in ipairs(suffix) do
-    table.insert(t, val)
-  end
-end
 
--- This returns a random float in the range [min, max).
+-- Internal utility functions.
+
+-- This returns a random float in the range [min, max), or min if they're equal.
 local function uniform_rand(min, max)
-  assert(max > min)
+  assert(max >= min)
   return math.random() * (max - min) + min
 end
 
@@ -77,6 +88,31 @@ local function val_near_avg(avg)
   return uniform_rand(avg * 0.85, avg * 1.15)
 end
 
+-- This returns the value for the given level of a per-level species parameter.
+-- Levels past the end of values use its last value.
+local function at_level(values, level)
+  return values[math.min(level, #values)]
+end
+
+-- This makes sp, or the default species if it's nil, the species used by this
+-- module and the modules it uses to build trees.
+local function use_species(sp)
+  if sp == nil and default_species == nil then
+    default_species = species_lib.defaults()
+  end
+  species = sp or default_species
+  rings.set_max_pts(species.ring_resolution)
+  leaf_globs.set_glob_params(species.leaf_glob_depth, species.leaf_glob_scale,
+                             species.leaf_glob_pts)
+end
+
+-- The generator thread holds off its garbage collector while a tree is made,
+-- and sets the gc_checkpoint global to a C function that collects between
+-- stages if the garbage has piled too high. Elsewhere, checkpoints do nothing.
+local function gc_checkpoint()
+  if _G.gc_checkpoint then _G.gc_checkpoint() end
+end
+
 local function dbg_pr(...)
   if not do_dbg_print then return end
   print(string.format(...))
@@ -87,12 +123,12 @@ end
 local function add_line(tree, from, to, parent)
 
   assert(tree)
-  assert(from and getmetatable(from) == Vec3)
-  assert(to   and getmetatable(to)   == Vec3)
+  assert(from and Vec3.is_vec3(from))
+  assert(to   and Vec3.is_vec3(to))
   assert(parent == nil or type(parent) == 'table')
 
   -- Add the from item.
-  assert(getmetatable(from) == Vec3)
+  assert(Vec3.is_vec3(from))
   local from_item = { pt = from, kind = 'child', parent = parent }
   tree[#tree + 1] = from_item
 
@@ -116,23 +152,38 @@ local function add_to_tree(args, tree)
   -- We expect to have a parent unless this is the top-level call, in which case
   -- we expect to have no tree and no parent.
   assert((args.parent and tree) or (tree == nil and args.parent == nil))
-  assert(getmetatable(args.direction) == Vec3)
+  assert(Vec3.is_vec3(args.direction))
   tree = tree or {}
 
   args.direction:normalize()
   local len = val_near_avg(args.avg_len)
   add_line(tree, args.origin, args.origin + len * args.direction, args.parent)
 
+  -- Keep a copy of the arguments so this subtree can be regenerated later. The
+  -- caller reuses its args table for the sibling subtree.
+  tree[#tree - 1].gen_args = {
+    origin        = args.origin,
+    direction     = args.direction,
+    avg_len       = args.avg_len,
+    min_len       = args.min_len,
+    max_recursion = args.max_recursion,
+    min_recursion = args.min_recursion,
+    out           = args.out
+  }
+
   if len < args.min_len or args.max_recursion == 0 then
     return
   end
 
+  -- The trunk is at level 1.
+  local level = species.max_height - args.max_recursion + 1
+
   local w1 = val_near_avg(0.5)
   local w2 = 1 - w1
 
   local subtree_args = {
     min_len       = args.min_len,
-    avg_len       = args.avg_len * branch_size_factor,
+    avg_len       = args.avg_len * at_level(species.length_decay, level),
     origin        = args.origin + len * args.direction,
     parent        = tree[#tree],
     max_recursion = args.max_recursion - 1,
@@ -140,7 +191,8 @@ local function add_to_tree(args, tree)
   }
 
   -- Allow early cutoffs based on min_recursion.
-  if args.min_recursion <= 0 and math.random() < 0.3 then
+  if args.min_recursion <= 0 and
+     math.random() < at_level(species.cutoff_prob, level) then
     return
   end
 
@@ -154,15 +206,17 @@ local function add_to_tree(args, tree)
   --
   --     http://math.stackexchange.com/a/44691/10785
 
-  local split_angle = val_near_avg(0.55)  -- This is in radians.
+  -- This is in radians.
+  local split_angle = val_near_avg(at_level(species.split_angle, level))
   local turn_angle  = uniform_rand(0.0, 2 * math.pi)
 
   if args.max_recursion % 2 ~= 0 then
-    turn_angle = math.pi / 2
+    turn_angle = species.turn_angle
   else
     turn_angle = 0
   end
-  turn_angle = turn_angle + uniform_rand(-0.7, 0.7)
+  local jitter = species.turn_jitter
+  turn_angle = turn_angle + uniform_rand(-jitter, jitter)
 
   -- Find out_dir orthogonal to direction.
   local out_dir = args.out
@@ -191,8 +245,8 @@ local function add_to_tree(args, tree)
   -- Maintain a flat array of vertex positions for lines to illustrate the out
   -- directions at each branching point.
   if tree.out_dir_pts == nil then tree.out_dir_pts = {} end
-  append(tree.out_dir_pts, tree[#tree].pt)
-  append(tree.out_dir_pts, tree[#tree].pt + out_dir * 0.1)
+  seq.append(tree.out_dir_pts, tree[#tree].pt)
+  seq.append(tree.out_dir_pts, tree[#tree].pt + out_dir * 0.1)
 
   subtree_args.direction = dir1
   add_to_tree(subtree_args, tree)
@@ -204,33 +258,202 @@ local function add_to_tree(args, tree)
 end
 
 
+-- This resets fork.out to be orthogonal to the sticks of both kids, which
+-- rings.lua expects, after either of them has moved. The kids' gen_args are
+-- updated to match.
+local function update_out(fork)
+  local dirs = {}
+  for i = 1, 2 do
+    local kid = fork.kids[i]
+    dirs[i] = kid.up.pt - kid.pt
+  end
+  local out = dirs[2]:cross(dirs[1])
+  if out:length() < 1e-9 then return end  -- The sticks are parallel.
+  fork.out = out:normalize()
+  for i = 1, 2 do fork.kids[i].gen_args.out = fork.out end
+end
+
+-- This sets tree_pt.depth to the number of sticks between tree_pt's stick and
+-- the trunk, and sets tree_pt.cull_group to an id shared by the tree points of
+-- each cull group. Each stick at a depth <= cull_group_depth starts a new
+-- group, and deeper sticks join the group of their ancestor at that depth.
+-- Since the tree is in depth-first order, each group is contiguous within it.
+local function add_cull_groups(tree)
+  local num_groups = 0
+  for i = 1, #tree do
+    local tree_pt = tree[i]
+    if tree_pt.kind == 'child' then
+      local parent  = tree_pt.parent
+      tree_pt.depth = parent and parent.depth + 1 or 0
+      if tree_pt.depth <= cull_group_depth then
+        num_groups = num_groups + 1
+        tree_pt.cull_group = num_groups
+      else
+        tree_pt.cull_group = parent.cull_group
+      end
+    else
+      tree_pt.depth      = tree_pt.down.depth
+      tree_pt.cull_group = tree_pt.down.cull_group
+    end
+  end
+end
+
 -- Public functions.
 
-function make_tree.make()
+-- If seed is given, the random number generator is reseeded with it first, so
+-- that the same seed always produces the same tree. The tree is of the given
+-- species, which is a table returned by species.load, or of the default species
+-- if it's nil. The species is kept in tree.species.
+function make_tree.make(seed, sp)
+
+  if seed then
+    print('random seed = ' .. seed)
+    math.randomseed(seed)
+  end
+  use_species(sp)
 
   local tree_add_params = {
     origin        = Vec3:new(0, 0, 0),
     direction     = Vec3:new(0, 1, 0),
-    avg_len       = 0.5,
-    min_len       = 0.01,
-    max_recursion = max_tree_height,
-    min_recursion = min_tree_height
+    avg_len       = species.trunk_len,
+    min_len       = species.min_len,
+    max_recursion = species.max_height,
+    min_recursion = species.min_height
   }
 
   -- TEMP NOTE: The tree table can hold all the data previously held in
   --            tree_pts, tree_pt_info, and leaves. Non-top-level calls to
   --            add_to_tree can receive it as a second param.
   local tree = add_to_tree(tree_add_params)
+  tree.species = species
+  add_cull_groups(tree)
+  gc_checkpoint()
   rings.add_rings(tree)
+  bones.update_bones(tree)
+  gc_checkpoint()
   bark.add_bark(tree)
+  gc_checkpoint()
   -- TEMP
-  leaf_globs.add_leaves(tree)
+  -- The flat leaf triangle corners are kept for Forest:add_tree.
+  tree.leaf_pts  = leaf_globs.add_leaves(tree)
+  gc_checkpoint()
+  tree.leaf_skin = bones.leaf_skin(tree)
+  dirty.update_ranges(tree)
 
   print('Lua: num_pts=' .. #tree)
 
   return tree
 end
 
+-- This regenerates the subtree that starts with the stick at tree[idx], which
+-- is expected to be a child point other than the trunk, and leaves the rest of
+-- the tree as it is. Only the rings, bark, and leaf globs that depend on the
+-- subtree are rebuilt, as found by dirty.lua, so this is much faster than
+-- make_tree.make for all but the biggest subtrees.
+--
+-- The subtree is built from the given seed, or else from the seed it was last
+-- regenerated from, or else from a new seed. It keeps the direction of its
+-- first stick unless a new direction is given; only the part of that direction
+-- that's orthogonal to the fork's out direction is used. A subtree regenerated
+-- from the same seed in a new direction has the same shape and vertex counts as
+-- before, so a tree editor can call this repeatedly as a branch is dragged, and
+-- only overwrite vertices in place.
+--
+-- This returns bark_patches, leaf_patches, which describe the changes to
+-- tree.bark.pts and tree.leaf_pts, and to their skins, as sequences of
+--   {first = first vertex, count = old vertex count, pts = new flat vertices,
+--    skin  = the skin of the new vertices (see bones.lua)}
+-- in the order they can be passed to VertexArray:replace_range. The points of
+-- the new subtree replace the old ones in tree, starting at tree[idx].
+function make_tree.regenerate_subtree(tree, idx, seed, direction)
+  local start_time = timestamp()
+  use_species(tree.species)
+
+  local old_root = tree[idx]
+  assert(old_root and old_root.kind == 'child' and old_root.parent,
+         'Expected tree[idx] to start a stick other than the trunk; use ' ..
+         'make_tree.make to regenerate the whole tree.')
+
+  -- Find last, the index of the old subtree's last point. Since the tree is in
+  -- depth-first order, that's the top of its last stick.
+  local last_pt = old_root.up
+  while last_pt.kids do last_pt = last_pt.kids[2].up end
+  local last = idx + 1
+  while tree[last] ~= last_pt do last = last + 1 end
+
+  -- Keep the old points, since the edit needs their vertex ranges.
+  local old_sub = {}
+  for i = idx, last do old_sub[#old_sub + 1] = tree[i] end
+
+  -- Build the new skeleton from the old arguments.
+  local args = {}
+  for key, val in pairs(old_root.gen_args) do args[key] = val end
+  args.parent = old_root.parent
+  if direction then
+    -- Both sticks of a fork must be orthogonal to the fork's out direction,
+    -- which is args.out, for their rings to meet; see rings.lua.
+    args.direction = direction - args.out * direction:dot(args.out)
+  else
+    args.direction = Vec3:new(args.direction)
+  end
+  seed = seed or old_root.seed or math.random(2^30)
+  math.randomseed(seed)
+
+  local kids    = args.parent.kids
+  local kid_idx = (kids[1] == old_root) and 1 or 2
+  local sub     = {}
+  add_to_tree(args, sub)
+  -- add_line appended the new root to the parent's kids. It goes in the old
+  -- root's place, since the order of the kids decides the shape of the fork.
+  kids[kid_idx] = table.remove(kids)
+  sub[1].seed   = seed
+
+  seq.splice(tree, idx, last - idx + 1, sub)
+  last = idx + #sub - 1
+  bones.free_bones(tree, old_sub)
+  add_cull_groups(tree)
+
+  -- A subtree rebuilt from its last seed has the same shape as before, so its
+  -- points line up with the old ones, and the old leaf globs can be reused.
+  local old_globs = {}
+  if seed == old_root.seed and #sub == #old_sub then
+    for i, old_pt in ipairs(old_sub) do old_globs[sub[i]] = old_pt.glob end
+  end
+
+  local edit = dirty.new_edit(tree)
+  dirty.mark_replaced(edit, idx, last, old_sub, old_globs)
+  local bark_patches, leaf_patches = dirty.rebuild(edit)
+
+  dbg_pr('regenerate_subtree: %d pts in %.2fms', #sub,
+         (timestamp() - start_time) * 1000)
+
+  return bark_patches, leaf_patches
+end
+
+-- This moves the point of the skeleton at tree[idx] to the Vec3 pt, and
+-- rebuilds what depends on it. A fork appears as three items in the tree, and
+-- all three are moved. This returns bark_patches, leaf_patches in the same
+-- format as make_tree.regenerate_subtree.
+function make_tree.move_point(tree, idx, pt)
+  use_species(tree.species)
+  local tree_pt = tree[idx]
+  local items   = {tree_pt}
+  local fork    = (tree_pt.kind == 'parent') and tree_pt or tree_pt.parent
+  if fork then items = {fork, fork.kids[1], fork.kids[2]} end
+
+  local edit  = dirty.new_edit(tree)
+  local forks = {}  -- The forks with a moved stick.
+  for _, item in ipairs(items) do
+    item.pt:set(pt)
+    dirty.mark_moved(edit, item)
+    local stick = (item.kind == 'child') and item or item.down
+    if stick.parent then forks[stick.parent] = true end
+  end
+  for fork in pairs(forks) do update_out(fork) end
+
+  return dirty.rebuild(edit)
+end
+
 
 -- Initialization.
 
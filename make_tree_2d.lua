@@ -81,7 +81,7 @@ end
 
 local function add_to_tree(args, tree)
   assert(args.parent)
-  assert(getmetatable(args.direction) == Vec3)
+  assert(Vec3.is_vec3(args.direction))
   tree = tree or {}
 
   args.direction:normalize()
@@ -0,0 +1,236 @@
+// normals.cc
+//
+
+#include "normals.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define for_i_3 for(int i = 0; i < 3; ++i)
+
+
+// Internal types and globals.
+
+// Triangles packed so that corner c of triangle k is at
+// (x[c][k], y[c][k], z[c][k]).
+typedef struct {
+  float *x[3];
+  float *y[3];
+  float *z[3];
+  int    num_tris;
+} PackedTriangles;
+
+// The smallest length we'll normalize. Degenerate triangles get zero normals.
+static const float min_len = 1e-20f;
+
+
+// Internal functions.
+
+// Sets up tris with room for num_tris triangles in a single allocation; the
+// caller frees tris->x[0].
+static void init_packed(PackedTriangles *tris, int num_tris) {
+  // We round up so that the vector loops can read whole lanes.
+  int padded    = (num_tris + 7) & ~7;
+  float *floats = (float *)calloc(9 * padded + 1, sizeof(float));
+  for (int c = 0; c < 3; ++c) {
+    tris->x[c] = floats + (3 * c + 0) * padded;
+    tris->y[c] = floats + (3 * c + 1) * padded;
+    tris->z[c] = floats + (3 * c + 2) * padded;
+  }
+  tris->num_tris = num_tris;
+}
+
+// Gathers triangle k from pts, where its corners start at vertex index
+// first_vertex(k), which is 3k for triangles and k for strips.
+static void pack(PackedTriangles *tris, const float *pts, int is_strip) {
+  for (int k = 0; k < tris->num_tris; ++k) {
+    const float *pt = pts + 3 * (is_strip ? k : 3 * k);
+    for (int c = 0; c < 3; ++c) {
+      tris->x[c][k] = pt[3 * c + 0];
+      tris->y[c][k] = pt[3 * c + 1];
+      tris->z[c][k] = pt[3 * c + 2];
+    }
+  }
+}
+
+// Finds n = normalize(cross(p1 - p0, p2 - p1)) for triangles [from, to).
+static void face_normals_scalar(const PackedTriangles *tris, int from, int to,
+                                float *nx, float *ny, float *nz) {
+  for (int k = from; k < to; ++k) {
+    float ax = tris->x[1][k] - tris->x[0][k];
+    float ay = tris->y[1][k] - tris->y[0][k];
+    float az = tris->z[1][k] - tris->z[0][k];
+    float bx = tris->x[2][k] - tris->x[1][k];
+    float by = tris->y[2][k] - tris->y[1][k];
+    float bz = tris->z[2][k] - tris->z[1][k];
+    float cx = ay * bz - az * by;
+    float cy = az * bx - ax * bz;
+    float cz = ax * by - ay * bx;
+    float len = sqrtf(cx * cx + cy * cy + cz * cz);
+    float inv = len > min_len ? 1.0f / len : 0.0f;
+    nx[k] = cx * inv;
+    ny[k] = cy * inv;
+    nz[k] = cz * inv;
+  }
+}
+
+#if defined(__AVX2__)
+
+#define lanes      8
+#define vec_t      __m256
+#define v_load     _mm256_loadu_ps
+#define v_store    _mm256_storeu_ps
+#define v_add      _mm256_add_ps
+#define v_sub      _mm256_sub_ps
+#define v_mul      _mm256_mul_ps
+#define v_div      _mm256_div_ps
+#define v_sqrt     _mm256_sqrt_ps
+#define v_set1     _mm256_set1_ps
+#define v_and      _mm256_and_ps
+#define v_gt(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+
+#elif defined(__SSE__)
+
+#define lanes      4
+#define vec_t      __m128
+#define v_load     _mm_loadu_ps
+#define v_store    _mm_storeu_ps
+#define v_add      _mm_add_ps
+#define v_sub      _mm_sub_ps
+#define v_mul      _mm_mul_ps
+#define v_div      _mm_div_ps
+#define v_sqrt     _mm_sqrt_ps
+#define v_set1     _mm_set1_ps
+#define v_and      _mm_and_ps
+#define v_gt(a, b) _mm_cmpgt_ps(a, b)
+
+#endif
+
+#ifdef lanes
+
+// This is the same as face_normals_scalar, but handles `lanes` triangles at a
+// time. It returns the number of triangles handled, which is a multiple of
+// lanes; the caller finishes the rest.
+static int face_normals_vector(const PackedTriangles *tris,
+                               float *nx, float *ny, float *nz) {
+  int k;
+  for (k = 0; k + lanes <= tris->num_tris; k += lanes) {
+    vec_t x0 = v_load(tris->x[0] + k), x1 = v_load(tris->x[1] + k);
+    vec_t y0 = v_load(tris->y[0] + k), y1 = v_load(tris->y[1] + k);
+    vec_t z0 = v_load(tris->z[0] + k), z1 = v_load(tris->z[1] + k);
+    vec_t x2 = v_load(tris->x[2] + k);
+    vec_t y2 = v_load(tris->y[2] + k);
+    vec_t z2 = v_load(tris->z[2] + k);
+
+    vec_t ax = v_sub(x1, x0), ay = v_sub(y1, y0), az = v_sub(z1, z0);
+    vec_t bx = v_sub(x2, x1), by = v_sub(y2, y1), bz = v_sub(z2, z1);
+
+    vec_t cx = v_sub(v_mul(ay, bz), v_mul(az, by));
+    vec_t cy = v_sub(v_mul(az, bx), v_mul(ax, bz));
+    vec_t cz = v_sub(v_mul(ax, by), v_mul(ay, bx));
+
+    vec_t len_sq = v_add(v_add(v_mul(cx, cx), v_mul(cy, cy)), v_mul(cz, cz));
+    vec_t len    = v_sqrt(len_sq);
+
+    // Lanes with tiny lengths are zeroed out instead of divided by ~0.
+    vec_t mask = v_gt(len, v_set1(min_len));
+    vec_t inv  = v_and(mask, v_div(v_set1(1.0f), len));
+
+    v_store(nx + k, v_mul(cx, inv));
+    v_store(ny + k, v_mul(cy, inv));
+    v_store(nz + k, v_mul(cz, inv));
+  }
+  return k;
+}
+
+#endif
+
+static void face_normals(const PackedTriangles *tris,
+                         float *nx, float *ny, float *nz) {
+  int done = 0;
+#ifdef lanes
+  done = face_normals_vector(tris, nx, ny, nz);
+#endif
+  face_normals_scalar(tris, done, tris->num_tris, nx, ny, nz);
+}
+
+static float clampf(float x, float lo, float hi) {
+  return x < lo ? lo : (x > hi ? hi : x);
+}
+
+
+// Public functions.
+
+extern "C" Array normals__new_for_vertices(Array v_pts, int is_strip) {
+
+  int num_pts  = v_pts->count / 3;
+  int num_tris = is_strip ? (num_pts >= 3 ? num_pts - 2 : 0) : num_pts / 3;
+
+  PackedTriangles tris;
+  init_packed(&tris, num_tris);
+  pack(&tris, (const float *)v_pts->items, is_strip);
+
+  float *n = (float *)calloc(3 * num_tris + 1, sizeof(float));
+  float *nx = n, *ny = n + num_tris, *nz = n + 2 * num_tris;
+  face_normals(&tris, nx, ny, nz);
+
+  // Spread the face normals out to the vertices.
+  Array n_vecs = array__new(v_pts->count, sizeof(float));
+  array__add_zeroed_items(n_vecs, v_pts->count);
+  float *out = (float *)n_vecs->items;
+  for (int k = 0; k < num_tris; ++k) {
+    if (is_strip) {
+      // Triangle k ends at vertex k + 2, and every other one is clockwise.
+      float sign = (k % 2) ? -1.0f : 1.0f;
+      float *v   = out + 3 * (k + 2);
+      v[0] = sign * nx[k];
+      v[1] = sign * ny[k];
+      v[2] = sign * nz[k];
+    } else {
+      for (int c = 0; c < 3; ++c) {
+        float *v = out + 3 * (3 * k + c);
+        v[0] = nx[k];
+        v[1] = ny[k];
+        v[2] = nz[k];
+      }
+    }
+  }
+
+  free(n);
+  free(tris.x[0]);
+
+  return n_vecs;
+}
+
+extern "C" uint32_t normals__pack_2_10_10_10(const float *n) {
+  // Each component becomes a signed 10-bit integer in [-511, 511], with x in
+  // the lowest bits. The 2-bit w is left as zero.
+  uint32_t packed = 0;
+  for_i_3 {
+    int32_t v = (int32_t)lrintf(clampf(n[i], -1, 1) * 511.0f);
+    packed |= ((uint32_t)v & 0x3ff) << (10 * i);
+  }
+  return packed;
+}
+
+extern "C" void normals__encode_octahedral(const float *n, int16_t *out) {
+  // Project onto the octahedron |x| + |y| + |z| = 1, and then fold the lower
+  // half over the upper half.
+  float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+  float x  = l1 > 0 ? n[0] / l1 : 0;
+  float y  = l1 > 0 ? n[1] / l1 : 0;
+  if (n[2] < 0) {
+    float fx = (1 - fabsf(y)) * (x >= 0 ? 1 : -1);
+    float fy = (1 - fabsf(x)) * (y >= 0 ? 1 : -1);
+    x = fx;
+    y = fy;
+  }
+  out[0] = (int16_t)lrintf(clampf(x, -1, 1) * 32767.0f);
+  out[1] = (int16_t)lrintf(clampf(y, -1, 1) * 32767.0f);
+}
@@ -0,0 +1,50 @@
+// normals.h
+//
+// Normal vector computation and encoding for flat-shaded vertex arrays.
+//
+// Our shaders use flat shading, so only the normal of the last vertex of each
+// triangle - the provoking vertex - affects what's drawn.
+//
+// The normals are found one triangle at a time by a kernel that works on
+// triangles packed as separate x, y, and z arrays, which lets it process eight
+// triangles at once with AVX2, or four with SSE. There's a scalar fallback.
+//
+// Normals can also be encoded more compactly than as three floats:
+//
+//  * normals__pack_2_10_10_10 gives a single 32-bit value suitable for a
+//    GL_INT_2_10_10_10_REV attribute with normalization on. This needs no
+//    shader changes, as the attribute is seen as a vec3 (or vec4) there.
+//
+//  * normals__encode_octahedral gives two 16-bit values suitable for a
+//    normalized GL_SHORT vec2 attribute. Shaders decode it like so:
+//
+//      vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+//      if (n.z < 0) n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+//      n = normalize(n);
+//
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "cstructs/cstructs.h"
+
+#include <stdint.h>
+
+// This expects v_pts to be an Array of floats, with each triple of floats being
+// one vertex. It returns a new Array of floats with one normal vector per
+// vertex; the caller is responsible for calling array__delete on it.
+// If is_strip is nonzero, the vertices are treated as a triangle strip, which
+// means that every other triangle is clockwise. Otherwise each triple of
+// vertices is a separate triangle, and all three vertices get its normal.
+Array    normals__new_for_vertices(Array v_pts, int is_strip);
+
+// These expect n to point to a unit vector as three floats.
+uint32_t normals__pack_2_10_10_10  (const float *n);
+void     normals__encode_octahedral(const float *n, int16_t *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,222 @@
+// offscreen.c
+//
+
+#include "offscreen.h"
+
+// Local includes.
+#include "glinclude.h"
+#include "image.h"
+
+// Library includes.
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// Standard library includes.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Internal types and globals.
+
+// The number of frames that can be in flight between glReadPixels and the
+// png being written.
+#define num_pbos 3
+
+typedef struct {
+  GLuint  pbo;
+  GLsync  fence;  // NULL when there's no pending frame in this pbo.
+  char   *path;
+} Readback;
+
+static int        width;
+static int        height;
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static GLuint     fbo;
+static GLuint     renderbuffers[2];  // Color, then depth.
+static Readback   readbacks[num_pbos];
+static int        next_readback = 0;
+static uint8_t   *rgb;               // Scratch space for png rows.
+
+
+// Internal functions.
+
+// Prefer the surfaceless Mesa platform, which needs no X server or gpu; fall
+// back to the default display.
+static EGLDisplay get_display() {
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+      eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (get_platform_display) {
+    EGLDisplay d = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                        EGL_DEFAULT_DISPLAY, NULL);
+    if (d != EGL_NO_DISPLAY) return d;
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+static int init_context() {
+  display = get_display();
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+    printf("Error: couldn't initialize an EGL display.\n");
+    return 0;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    printf("Error: EGL doesn't support desktop OpenGL here.\n");
+    return 0;
+  }
+
+  EGLint config_attribs[] = {
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE
+  };
+  EGLConfig config;
+  EGLint    num_configs;
+  if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) ||
+      num_configs < 1) {
+    printf("Error: no EGL config supports OpenGL.\n");
+    return 0;
+  }
+
+  EGLint context_attribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION,       3,
+    EGL_CONTEXT_MINOR_VERSION,       3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+  if (context == EGL_NO_CONTEXT) {
+    printf("Error: couldn't create an OpenGL 3.3 core context.\n");
+    return 0;
+  }
+
+  // We never draw to a window surface; everything goes into our fbo.
+  if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    printf("Error: surfaceless contexts aren't supported.\n");
+    return 0;
+  }
+  return 1;
+}
+
+static int init_framebuffer() {
+  glGenRenderbuffers(2, renderbuffers);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER,        // target
+                            GL_COLOR_ATTACHMENT0,  // attachment
+                            GL_RENDERBUFFER,       // renderbuffer target
+                            renderbuffers[0]);     // renderbuffer
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER,        // target
+                            GL_DEPTH_ATTACHMENT,   // attachment
+                            GL_RENDERBUFFER,       // renderbuffer target
+                            renderbuffers[1]);     // renderbuffer
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    printf("Error: the offscreen framebuffer is incomplete.\n");
+    return 0;
+  }
+
+  // The fbo stays bound for the life of the context, so the renderer draws
+  // into it as it would into a window.
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  return 1;
+}
+
+// Waits for the readback's copy to finish, and writes its png.
+static void write_readback(Readback *readback) {
+  if (readback->fence == NULL) return;
+
+  GLenum status;
+  do {
+    status = glClientWaitSync(readback->fence,             // sync
+                              GL_SYNC_FLUSH_COMMANDS_BIT,  // flags
+                              1000000);                    // timeout in ns
+  } while (status == GL_TIMEOUT_EXPIRED);
+  glDeleteSync(readback->fence);
+  readback->fence = NULL;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->pbo);
+  const uint8_t *rgba = glMapBufferRange(GL_PIXEL_PACK_BUFFER,    // target
+                                         0,                       // offset
+                                         4 * width * height,      // length
+                                         GL_MAP_READ_BIT);        // access
+  if (rgba) {
+    // OpenGL's rows start at the bottom, and png's start at the top.
+    for (int y = 0; y < height; ++y) {
+      const uint8_t *src = rgba + 4 * width * (height - 1 - y);
+      uint8_t       *dst = rgb  + 3 * width * y;
+      for (int x = 0; x < width; ++x) memcpy(dst + 3 * x, src + 4 * x, 3);
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    if (!image__write_png(readback->path, width, height, rgb)) {
+      printf("Error: couldn't write %s.\n", readback->path);
+    }
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  free(readback->path);
+  readback->path = NULL;
+}
+
+
+// Public functions.
+
+int offscreen__init(int w, int h) {
+  width  = w;
+  height = h;
+  if (!init_context() || !init_framebuffer()) return 0;
+
+  for (int i = 0; i < num_pbos; ++i) {
+    glGenBuffers(1, &readbacks[i].pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readbacks[i].pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER,  // buffer use target
+                 4 * width * height,    // size
+                 NULL,                  // data
+                 GL_STREAM_READ);       // usage hint
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  rgb = malloc(3 * width * height);
+
+  return 1;
+}
+
+void offscreen__save_frame(const char *path) {
+  Readback *readback = &readbacks[next_readback];
+  next_readback = (next_readback + 1) % num_pbos;
+
+  // Finish off the frame that used this pbo last, if there was one.
+  write_readback(readback);
+
+  // With a pack buffer bound, glReadPixels returns without waiting for the
+  // frame to finish rendering.
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->pbo);
+  glReadPixels(0, 0, width, height,       // x, y, width, height
+               GL_RGBA, GL_UNSIGNED_BYTE,  // format, type
+               NULL);                      // offset into the pbo
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  readback->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,
+                                0);  // 0 --> flags
+  readback->path  = strdup(path);
+}
+
+void offscreen__finish() {
+  // Write pending frames in the order they were saved.
+  for (int i = 0; i < num_pbos; ++i) {
+    write_readback(&readbacks[(next_readback + i) % num_pbos]);
+  }
+
+  for (int i = 0; i < num_pbos; ++i) glDeleteBuffers(1, &readbacks[i].pbo);
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteRenderbuffers(2, renderbuffers);
+  free(rgb);
+
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(display, context);
+  eglTerminate(display);
+}
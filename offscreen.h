@@ -0,0 +1,35 @@
+// offscreen.h
+//
+// A headless OpenGL context that renders into a framebuffer object and saves
+// frames as png files, so the regular renderer can run without a window.
+//
+// The context comes from EGL with the surfaceless Mesa platform when it's
+// available, which works with llvmpipe on machines without a gpu or display.
+// It's a 3.3 core profile context, so the production shaders run unchanged.
+//
+// Frames are read back asynchronously: offscreen__save_frame starts a copy
+// into one of a small ring of pixel buffer objects and returns right away. The
+// png for that frame is written when its buffer comes around again, by which
+// time the copy has usually finished, or by offscreen__finish.
+//
+// Usage:
+//
+//   offscreen__init(width, height);  // Creates and binds the context and fbo.
+//   luarender__init();
+//   for (..) {
+//     luarender__draw(width, height);
+//     offscreen__save_frame(path);
+//   }
+//   offscreen__finish();             // Writes any pending frames.
+//
+
+#pragma once
+
+// Returns nonzero on success. On failure, this prints the reason.
+int  offscreen__init(int width, int height);
+
+// Queues up a readback of the current framebuffer contents into a png at path.
+void offscreen__save_frame(const char *path);
+
+// Writes all pending frames and releases the context.
+void offscreen__finish();
@@ -0,0 +1,64 @@
+// offscreen_main.c
+//
+// A command-line program that renders turntable images of trees without a
+// window, using the same renderer and shaders as the app.
+//
+// Usage:
+//
+//   trees_offscreen <out_dir> [num_trees] [frames_per_tree] [size]
+//
+// This writes <out_dir>/tree<i>_frame<j>.png for each tree i and frame j; the
+// frames of each tree are evenly spaced around a full turn. The Lua and shader
+// files are found through the TREES_DIR environment variable (see
+// file_posix.c). On Linux, link it with offscreen.c, file_posix.c, and the
+// renderer's other C and C++ files in place of main.m, file.m, and the
+// Objective-C view classes, plus -llua -lEGL -lOpenGL -lpthread.
+//
+
+#include "luarender.h"
+#include "offscreen.h"
+
+// Local includes.
+#include "file.h"
+
+// Standard library includes.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define path_len 4096
+
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: %s <out_dir> [num_trees] [frames_per_tree] [size]\n",
+           argv[0]);
+    return 1;
+  }
+  const char *out_dir         = argv[1];
+  int         num_trees       = argc > 2 ? atoi(argv[2]) : 1;
+  int         frames_per_tree = argc > 3 ? atoi(argv[3]) : 1;
+  int         size            = argc > 4 ? atoi(argv[4]) : 512;
+
+  if (!file__make_dir_if_needed(out_dir)) return 1;
+  if (!offscreen__init(size, size))       return 1;
+
+  // This generates the first tree.
+  luarender__init();
+
+  char path[path_len];
+  for (int i = 0; i < num_trees; ++i) {
+    if (i > 0) luarender__new_tree();
+    // Frames drawn while waiting also send the tree's data to the gpu.
+    while (!luarender__is_tree_ready()) luarender__draw(size, size);
+    for (int j = 0; j < frames_per_tree; ++j) {
+      luarender__set_angle(2 * M_PI * j / frames_per_tree);
+      luarender__draw(size, size);
+      snprintf(path, path_len, "%s/tree%03d_frame%03d.png", out_dir, i, j);
+      offscreen__save_frame(path);
+    }
+  }
+
+  offscreen__finish();
+  return 0;
+}
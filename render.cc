@@ -3,13 +3,16 @@
 // C-only includes.
 extern "C" {
 #include "cstructs/cstructs.h"
+#include "draw_queue.h"
+#include "frame_uniforms.h"
 #include "glhelp.h"
+#include "glstate.h"
 }
 
 // C++ friendly includes.
 #include "config.h"
 
-#include <OpenGL/gl3.h>
+#include "glinclude.h"
 
 #include "glm.hpp"
 #define GLM_FORCE_RADIANS
@@ -42,6 +45,12 @@ typedef struct {
   int ring_pt_of_top0;  // Used for child points only.
 } Pt_info;
 
+// A stick runs from the child point at index up to the point at index + 1.
+typedef struct {
+  int index;
+  int n, m;  // The number of points in the bottom and top rings.
+} Stick;
+
 static GLuint line_program, bark_program;
 static GLuint vao;
 static GLuint vbo;
@@ -51,6 +60,13 @@ static mat4 view;
 
 static int num_pts;
 
+// All of the tree's arrays live in tree_arena, so that a new tree only needs a
+// few large allocations, and the old tree is dropped by a single reset. The
+// short-lived arrays used while building joint bark live in scratch_arena.
+#define tree_arena_chunk_size (1 << 20)
+static Arena tree_arena    = NULL;
+static Arena scratch_arena = NULL;
+
 static Array tree_pts     = NULL;
 static Array tree_pt_info = NULL;
 
@@ -68,16 +84,24 @@ static bool do_draw_stick_bark  = true;
 static bool do_draw_joint_bark  = true;
 
 static GLuint rings_vao;
+static GLuint rings_vbo;
 
 static GLvoid *stick_line_elts;
 static GLsizei num_stick_line_elts;
 static GLuint stick_lines_vbo;
 
+// The stick and joint bark are each drawn with their own vao, which shares
+// the rings_vbo positions and bark_colors_vbo, but has its own normals and
+// element buffer.
+static GLuint bark_colors_vbo;
+
+static GLuint stick_bark_vao;
 static GLuint stick_bark_vbo;
 static Array stick_bark_pts     = NULL;
 static Array stick_bark_normals = NULL;
 static GLuint stick_bark_normal_vbo;
 
+static GLuint joint_bark_vao;
 static GLuint joint_bark_vbo;
 static Array joint_bark_pts     = NULL;
 static Array joint_bark_normals = NULL;
@@ -199,7 +223,7 @@ static void add_to_tree(vec3 origin,
   vec3 dir1 = vec3(turn * rotate(mat4(1),  split_angle * w2, other_dir) * vec4(direction, 0));
   vec3 dir2 = vec3(turn * rotate(mat4(1), -split_angle * w1, other_dir) * vec4(direction, 0));
   
-  if (branch_pts == NULL) branch_pts = array__new(0, sizeof(int));
+  if (branch_pts == NULL) branch_pts = array__new_in_arena(tree_arena, 0, sizeof(int));
   
   int tree_pt = tree_pts->count - 3;  // Index of last point; each point has 3 coordinates.
   array__add_item_val(branch_pts, tree_pt);
@@ -554,24 +578,26 @@ static void add_rings() {
   
 }
 
-// The output all goes into tree_pts and related global arrays.
+// The output all goes into tree_pts and related global arrays, which are kept
+// in tree_arena. This drops any previous tree's arrays.
 static void make_a_tree() {
   
-  if (tree_pts == NULL) {
-    tree_pts = array__new(0, 3 * sizeof(GLfloat));
-  }
-  
-  if (tree_pt_info == NULL) {
-    tree_pt_info = array__new(0, sizeof(Pt_info));
+  if (tree_arena == NULL) {
+    tree_arena = arena__new(tree_arena_chunk_size);
+  } else {
+    arena__reset(tree_arena);
   }
   
-  if (leaves == NULL) {
-    leaves = array__new(0, sizeof(int));
-  }
+  tree_pts     = array__new_in_arena(tree_arena, 0, 3 * sizeof(GLfloat));
+  tree_pt_info = array__new_in_arena(tree_arena, 0, sizeof(Pt_info));
+  leaves       = array__new_in_arena(tree_arena, 0, sizeof(int));
+  ring_pts     = array__new_in_arena(tree_arena, 0, 3 * sizeof(GLfloat));
   
-  if (ring_pts == NULL) {
-    ring_pts = array__new(0, 3 * sizeof(GLfloat));
-  }
+  branch_pts         = NULL;
+  stick_bark_pts     = NULL;
+  stick_bark_normals = NULL;
+  joint_bark_pts     = NULL;
+  joint_bark_normals = NULL;
   
   vec3  origin    = vec3(0.0);
   vec3  direction = vec3(0.0, 1.0, 0.0);
@@ -616,32 +642,115 @@ static void draw_ring_subtree_at_index(int index) {
 
 }
 
-static void use_program(GLuint program, mat4 &mvp, mat3 &normal_matrix) {
-  glUseProgram(program);
+// Sets up a vao for one kind of bark. This expects the rings_vbo and
+// bark_colors_vbo to already be set up.
+static GLuint new_bark_vao(GLuint normal_vbo, GLuint element_vbo) {
+  GLuint bark_vao;
+  glGenVertexArrays(1, &bark_vao);
+  glstate__bind_vertex_array(bark_vao);
   
-  GLuint mvp_loc = glGetUniformLocation(program, "mvp");
-  glUniformMatrix4fv(mvp_loc, 1 /* count */, GL_FALSE /* transpose */, &mvp[0][0]);
+  glstate__bind_array_buffer(rings_vbo);
+  set_3f_attrib(0);
+  glstate__bind_array_buffer(bark_colors_vbo);
+  set_3f_attrib(1);
+  glstate__bind_array_buffer(normal_vbo);
+  set_3f_attrib(2);
+  
+  // The element array binding is part of the vao's state.
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_vbo);
   
-  GLuint normal_matrix_loc = glGetUniformLocation(program, "normal_xform");
-  glUniformMatrix3fv(normal_matrix_loc, 1 /* count */, GL_FALSE /* transpose */, &normal_matrix[0][0]);
+  return bark_vao;
 }
 
-static void use_normal_vbo(GLuint normal_vbo) {
-  glBindBuffer(GL_ARRAY_BUFFER, normal_vbo);
-  set_3f_attrib(2);
+// The bark kernels.
+//
+// Each stick's bark is a triangle strip between the ring at its bottom and the
+// ring at its top, which has as many points unless the top is a leaf, in which
+// case it's a single point. Each joint's bark zips the top rings of its two
+// children to the ring below them. Rings have between 3 and max_ring_pts
+// points, so the kernels are templates on their ring sizes, for sizes 3 to 8.
+// With a constant size, a loop around a ring can be unrolled, and wrapping
+// around it takes no division. A size of 0 gives the generic kernel, which
+// handles any size.
+
+// Returns x mod N for 0 <= x < 2 * N, or x mod n if N is 0.
+template <int N> static inline int ring_mod(int x, int n) {
+  if (N == 1) return 0;
+  if (N == 0) return x % n;
+  return x < N ? x : x - N;
+}
+
+// The normal points outward from the face with counterclockwise points.
+static vec3 get_tri_normal(vec3 &pt0, vec3 &pt1, vec3 &pt2) {
+  return normalize(cross(pt1 - pt0, pt2 - pt0));
+}
+
+// Appends the triangle strip of the stick from bottom up to top to
+// stick_bark_pts, and sets the normals of its points. N and M are the sizes of
+// the bottom and top rings.
+template <int N, int M>
+static void add_stick_strip(Pt_info *bottom, Pt_info *top) {
+  
+  int n = N ? N : bottom->ring_end - bottom->ring_start;
+  int m = M ? M : top->ring_end    - top->ring_start;
+  int bottom_offset = bottom->ring_pt_of_top0 - bottom->ring_start;
+  
+  int count = stick_bark_pts->count;
+  GLuint *strip = (GLuint *)array__resize_uninitialized(stick_bark_pts,
+                                                        count + 2 * n + 2);
+  strip += count;
+  
+  vec3 pts[3];  // The last three points of the strip, oldest first.
+  for (int i = 0; i <= n; ++i) {
+    
+    GLuint pair[2] = {
+      (GLuint)(top->ring_start    + ring_mod<M>(i, m)),
+      (GLuint)(bottom->ring_start + ring_mod<N>(bottom_offset + i, n))
+    };
+    
+    for (int k = 0; k < 2; ++k) {
+      *strip++ = pair[k];
+      pts[0] = pts[1];
+      pts[1] = pts[2];
+      get_pt(ring_pts, pair[k], pts[2]);
+      if (i == 0) continue;
+      // It's a triangle strip; the triangles ending at bottom points are
+      // oriented clockwise.
+      vec3 normal = get_tri_normal(pts[0], pts[1], pts[2]);
+      if (k == 1) normal *= -1;
+      set_pt(stick_bark_normals, pair[k], normal);
+    }
+    
+  }
 }
 
-// The normal points outward from the face with counterclockwise points; the reverse
-// bool changes that. This is useful for things like triangle strips.
-static vec3 &get_normal_from_last_tri(Array pt_elts, bool reverse = false) {
-  static vec3 normal;
-  vec3 pts[3];
-  for (int i = 3; i > 0; --i) {
-    get_pt(ring_pts, array__item_val(pt_elts, pt_elts->count - i, GLuint), pts[3 - i]);
+typedef void (*StickKernel)(Pt_info *bottom, Pt_info *top);
+
+#define stick_kernel_case(n) \
+    case n: return add_stick_strip<n, n>
+
+// Returns the kernel for a stick whose rings have n and m points.
+static StickKernel find_stick_kernel(int n, int m) {
+  if (n == 3 && m == 1) return add_stick_strip<3, 1>;  // A stick up to a leaf.
+  if (n != m) return add_stick_strip<0, 0>;
+  switch (n) {
+    stick_kernel_case(3);
+    stick_kernel_case(4);
+    stick_kernel_case(5);
+    stick_kernel_case(6);
+    stick_kernel_case(7);
+    stick_kernel_case(8);
   }
-  normal = normalize(cross(pts[1] - pts[0], pts[2] - pts[0]));
-  if (reverse) normal *= -1;
-  return normal;
+  return add_stick_strip<0, 0>;
+}
+
+// Sticks are sorted by their ring sizes so that runs of them share a kernel.
+static int compare_sticks(const void *a, const void *b) {
+  const Stick *s = (const Stick *)a;
+  const Stick *t = (const Stick *)b;
+  if (s->n != t->n) return s->n - t->n;
+  if (s->m != t->m) return s->m - t->m;
+  return s->index - t->index;
 }
 
 static void setup_stick_bark() {
@@ -650,139 +759,129 @@ static void setup_stick_bark() {
   restart_index = ring_pts->count;
   glPrimitiveRestartIndex(restart_index);
   
-  stick_bark_pts     = array__new(0,                   sizeof(GLuint));
-  stick_bark_normals = array__new(ring_pts->count, 3 * sizeof(GLfloat));
+  stick_bark_pts     = array__new_in_arena(tree_arena, 0, sizeof(GLuint));
+  stick_bark_normals = array__new_in_arena(tree_arena, ring_pts->count,
+                                           3 * sizeof(GLfloat));
   
   // The stick bark normals will be set instead of added, so initialize it with all-0 data.
   array__add_zeroed_items(stick_bark_normals, ring_pts->count);
   
+  if (scratch_arena == NULL) scratch_arena = arena__new(4096);
+  arena__reset(scratch_arena);
+  int num_sticks = tree_pts->count / 2;
+  Array sticks   = array__new_in_arena(scratch_arena, num_sticks, sizeof(Stick));
+  
+  // Each stick is a strip of 2 points per ring point plus 2 to close it, and
+  // sticks after the first are preceded by a restart index.
+  int num_stick_bark_pts = 0;
   for (int i = 0; i < tree_pts->count; i += 2) {
-    
-    if (i) array__add_item_val(stick_bark_pts, restart_index);
-    
     Pt_info *a_info = (Pt_info *)array__item_ptr(tree_pt_info, i);
     Pt_info *b_info = (Pt_info *)array__item_ptr(tree_pt_info, i + 1);
+    Stick *stick = (Stick *)array__new_ptr(sticks);
+    stick->index = i;
+    stick->n     = a_info->ring_end - a_info->ring_start;
+    stick->m     = b_info->ring_end - b_info->ring_start;
+    num_stick_bark_pts += (i ? 1 : 0) + 2 * stick->n + 2;
+  }
+  array__reserve(stick_bark_pts, num_stick_bark_pts);
+  
+  qsort(sticks->items, sticks->count, sizeof(Stick), compare_sticks);
+  
+  StickKernel kernel = NULL;
+  array__for(Stick *, stick, sticks, i) {
     
-    int start[2] = { a_info->ring_start,      b_info->ring_start };
-    int   end[2] = { a_info->ring_end,        b_info->ring_end   };
-    int index[2] = { a_info->ring_pt_of_top0, b_info->ring_start };
-    
-    int num_points = 2 * (end[0] - start[0]) + 2;
+    if (i) array__add_item_val(stick_bark_pts, restart_index);
     
-    int k = 1;
-    for (int j = 0; j < num_points; ++j) {
-      
-      array__add_item_val(stick_bark_pts, index[k]);
-      
-      if (j >= 2) {
-        bool reverse = (k == 0);  // It's a triangle strip; every other triangle is oriented clockwise.
-          vec3 normal = get_normal_from_last_tri(stick_bark_pts, reverse);
-        set_pt(stick_bark_normals, index[k], normal);
-      }
-      
-      index[k]++;
-      if (index[k] == end[k]) index[k] = start[k];
-      k = 1 - k;
-      
+    if (i == 0 || stick->n != stick[-1].n || stick->m != stick[-1].m) {
+      kernel = find_stick_kernel(stick->n, stick->m);
     }
     
+    kernel((Pt_info *)array__item_ptr(tree_pt_info, stick->index),
+           (Pt_info *)array__item_ptr(tree_pt_info, stick->index + 1));
+    
   }
   
   glGenBuffers(1, &stick_bark_vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, stick_bark_vbo);
-  glBufferData(GL_ARRAY_BUFFER,
-               stick_bark_pts->count * stick_bark_pts->item_size,
-               stick_bark_pts->items,
-               GL_STATIC_DRAW);
+  glstate__bind_array_buffer(stick_bark_vbo);
+  set_buffer_data(stick_bark_pts);
 
   
-  Array stick_bark_colors = array__new(0, 3 * sizeof(GLfloat));
+  Array stick_bark_colors = array__new_in_arena(tree_arena, ring_pts->count,
+                                                3 * sizeof(GLfloat));
   
-  for (int i = 0; i < ring_pts->count; ++i) {
-    GLfloat rgb[3];
-    for (int j = 0; j < 3; ++j) rgb[j] = (float)rand() / RAND_MAX;
-    array__add_item_val(stick_bark_colors, rgb);
+  GLfloat *rgb = (GLfloat *)array__resize_uninitialized(stick_bark_colors,
+                                                        ring_pts->count);
+  for (int i = 0; i < 3 * ring_pts->count; ++i) {
+    rgb[i] = (float)rand() / RAND_MAX;
   }
   
-  GLuint colors_vbo;
-  glGenBuffers(1, &colors_vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, colors_vbo);
+  glGenBuffers(1, &bark_colors_vbo);
+  glstate__bind_array_buffer(bark_colors_vbo);
   set_buffer_data(stick_bark_colors);
-  set_3f_attrib(1);
     
   glGenBuffers(1, &stick_bark_normal_vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, stick_bark_normal_vbo);
+  glstate__bind_array_buffer(stick_bark_normal_vbo);
   set_buffer_data(stick_bark_normals);
+  
+  stick_bark_vao = new_bark_vao(stick_bark_normal_vbo, stick_bark_vbo);
 }
 
-#define add_from(x) \
-    array__add_item_ptr(joint_bark_pts, array__item_ptr(x##_arr, x##_idx % x))
-
-// Inserts values into the joint_bark_pts array.
-static void add_triangles_for_joint_bark(Array m_arr, Array n_arr) {
+// Appends the triangles that zip the m points of top to the n points of bottom
+// to joint_bark_pts, and sets the normal of the last point of each triangle.
+// Both top and bottom are expected to repeat their first point at their end. N
+// is n, or 0 for the generic kernel.
+template <int N>
+static void add_joint_zipper(GLuint *top, int m, GLuint *bottom, int n) {
   
-  if (false) {
-    printf("m_arr: ");
-    array__for(GLuint *, m_val, m_arr, i) {
-      if ((char *)m_val != m_arr->items) printf(", ");
-      printf("%d", *m_val);
-    }
-    printf("\n");
-    
-    printf("n_arr: ");
-    array__for(GLuint *, n_val, n_arr, i) {
-      if ((char *)n_val != n_arr->items) printf(", ");
-      printf("%d", *n_val);
-    }
-    printf("\n");
-  }
-
+  if (N) n = N;
   
-  int m = m_arr->count;
-  int n = n_arr->count;
+  // Each triangle moves one step along either top or bottom.
+  int count = joint_bark_pts->count;
+  GLuint *tri = (GLuint *)array__resize_uninitialized(joint_bark_pts,
+                                                      count + 3 * (m + n));
+  tri += count;
   
   int m_idx = 0;
   int n_idx = 0;
   
   do {
     
-    //printf("will add m[%d]\n", m_idx);
-    add_from(m);
-    //printf("will add n[%d]\n", n_idx);
-    add_from(n);
-    
-    float m_next = (m_idx + 1.0) / m;
-    float n_next = (n_idx + 1.0) / n;
+    tri[0] = top[m_idx];
+    tri[1] = bottom[n_idx];
     
-    if (m_next < n_next) {
-      
-      m_idx++;
-      //printf("will add m[%d]\n", m_idx);
-      add_from(m);
-      
+    // Step along the ring that's behind, as a fraction of the way around it.
+    if ((m_idx + 1) * n < (n_idx + 1) * m) {
+      tri[2] = top[++m_idx];
     } else {
-      
-      n_idx++;
-      //printf("will add n[%d]\n", n_idx);
-      add_from(n);
-      
+      tri[2] = bottom[++n_idx];
     }
     
-    vec3 normal = get_normal_from_last_tri(joint_bark_pts);
-    GLuint last_index = array__item_val(joint_bark_pts, joint_bark_pts->count - 1, GLuint);
-    set_pt(joint_bark_normals, last_index, normal);
+    vec3 pts[3];
+    for (int i = 0; i < 3; ++i) get_pt(ring_pts, tri[i], pts[i]);
+    vec3 normal = get_tri_normal(pts[0], pts[1], pts[2]);
+    set_pt(joint_bark_normals, tri[2], normal);
+    
+    tri += 3;
     
   } while (m_idx < m || n_idx < n);
-  
-  if (false) {
-    printf("Triangles:\n");
-    array__for(GLuint *, pt, joint_bark_pts, i) {
-      printf("%s", i % 3 ? ", " : "  ");
-      printf("%d", *pt);
-      if (i % 3 == 2) printf("\n");
-    }
-    printf("\n");
+}
+
+typedef void (*JointKernel)(GLuint *top, int m, GLuint *bottom, int n);
+
+#define joint_kernel_case(n) \
+    case n: return add_joint_zipper<n>
+
+// Returns the kernel for a joint whose bottom ring has n points.
+static JointKernel find_joint_kernel(int n) {
+  switch (n) {
+    joint_kernel_case(3);
+    joint_kernel_case(4);
+    joint_kernel_case(5);
+    joint_kernel_case(6);
+    joint_kernel_case(7);
+    joint_kernel_case(8);
   }
+  return add_joint_zipper<0>;
 }
 
 static bool pt_is_leaf(int index) {
@@ -799,8 +898,17 @@ static void setup_subtree_joint_bark(int parent_index) {
     child_info[i] = (Pt_info *)array__item_ptr(tree_pt_info, kids[i]);
   }
   
-  Array top    = array__new(0, sizeof(GLuint));
-  Array bottom = array__new(0, sizeof(GLuint));
+  // The scratch arena is reset per joint, as joint_bark_pts in tree_arena grows
+  // in between.
+  arena__reset(scratch_arena);
+  int num_top    = 0;
+  int num_bottom = parent_info->ring_end - parent_info->ring_start;
+  for (int i = 0; i < 2; ++i) {
+    num_top += child_info[i]->ring_end - child_info[i]->ring_start - 1;
+  }
+  // Each array gets a repeat of its first point so the kernel needn't wrap.
+  Array top    = array__new_in_arena(scratch_arena, num_top    + 1, sizeof(GLuint));
+  Array bottom = array__new_in_arena(scratch_arena, num_bottom + 1, sizeof(GLuint));
   
   for (int r_index = parent_info->ring_start; r_index < parent_info->ring_end; ++r_index) {
     array__add_item_val(bottom, r_index);
@@ -812,10 +920,11 @@ static void setup_subtree_joint_bark(int parent_index) {
     }
   }
   
-  add_triangles_for_joint_bark(top, bottom);
+  array__add_item_ptr(top,    array__item_ptr(top,    0));
+  array__add_item_ptr(bottom, array__item_ptr(bottom, 0));
   
-  array__delete(top);
-  array__delete(bottom);
+  JointKernel kernel = find_joint_kernel(num_bottom);
+  kernel((GLuint *)top->items, num_top, (GLuint *)bottom->items, num_bottom);
   
   
   for (int i = 0; i < 2; ++i) {
@@ -829,8 +938,10 @@ static void setup_subtree_joint_bark(int parent_index) {
 // work fine, but will result in some adjacent triangles of the same color.
 static void setup_joint_bark() {
   
-  joint_bark_pts     = array__new(0,                   sizeof(GLuint));
-  joint_bark_normals = array__new(ring_pts->count, 3 * sizeof(GLfloat));
+  joint_bark_pts     = array__new_in_arena(tree_arena, 0, sizeof(GLuint));
+  joint_bark_normals = array__new_in_arena(tree_arena, ring_pts->count,
+                                           3 * sizeof(GLfloat));
+  if (scratch_arena == NULL) scratch_arena = arena__new(4096);
   
   // The normals will be set instead of added, so we premark the space as used.
   joint_bark_normals->count = ring_pts->count;
@@ -838,15 +949,14 @@ static void setup_joint_bark() {
   setup_subtree_joint_bark(1);
   
   glGenBuffers(1, &joint_bark_vbo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, joint_bark_vbo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-               joint_bark_pts->count * joint_bark_pts->item_size,
-               joint_bark_pts->items,
-               GL_STATIC_DRAW);
+  glstate__bind_array_buffer(joint_bark_vbo);
+  set_buffer_data(joint_bark_pts);
   
   glGenBuffers(1, &joint_bark_normal_vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, joint_bark_normal_vbo);
+  glstate__bind_array_buffer(joint_bark_normal_vbo);
   set_buffer_data(joint_bark_normals);
+  
+  joint_bark_vao = new_bark_vao(joint_bark_normal_vbo, joint_bark_vbo);
 }
 
 
@@ -857,16 +967,19 @@ extern "C" {
   void render__init() {
     glClearColor(0, 0.3, 0.1, 1.0);
     
-    glEnable(GL_CULL_FACE);
+    glstate__enable(GL_CULL_FACE);
+    glstate__enable(GL_DEPTH_TEST);
+    
+    frame_uniforms__init();
     
     line_program = glhelp__load_program("line_vs.glsl", "line_fs.glsl");
     bark_program = glhelp__load_program("bark.vert.glsl", "bark.frag.glsl");
     
     glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    glstate__bind_vertex_array(vao);
     
     glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glstate__bind_array_buffer(vbo);
     
     make_a_tree();
     GLsizeiptr    data_size = tree_pts->count * tree_pts->item_size;
@@ -934,11 +1047,10 @@ extern "C" {
     }
     
     glGenVertexArrays(1, &rings_vao);
-    glBindVertexArray(rings_vao);
+    glstate__bind_vertex_array(rings_vao);
     
-    GLuint rings_vbo;
     glGenBuffers(1, &rings_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, rings_vbo);
+    glstate__bind_array_buffer(rings_vbo);
     glBufferData(GL_ARRAY_BUFFER,
                  ring_pts->count * ring_pts->item_size,
                  ring_pts->items,
@@ -1018,21 +1130,23 @@ extern "C" {
     model = translate(model, vec3(0, -3, 0));
     model = scale(model, vec3(zoom_scale));
     
-    mat4 mvp = projection * view * model;
     mat3 normal_matrix = mat3(view * model);
+    vec3 light_dir     = normalize(vec3(1, 2, 2));
+    frame_uniforms__set_frame(&view[0][0], &projection[0][0], &normal_matrix[0][0], &light_dir[0]);
+    frame_uniforms__set_model(&model[0][0]);
     
     if (do_draw_skeleton) {
 
-      use_program(line_program, mvp, normal_matrix);
-      glBindVertexArray(vao);
+      glstate__use_program(line_program);
+      glstate__bind_vertex_array(vao);
       glDrawArrays(GL_LINES, 0, num_pts);
       
     }
     
     if (do_draw_rings || do_draw_stick_lines) {
       
-      use_program(line_program, mvp, normal_matrix);
-      glBindVertexArray(rings_vao);
+      glstate__use_program(line_program);
+      glstate__bind_vertex_array(rings_vao);
       
       if (do_draw_rings) draw_ring_subtree_at_index(0);
       
@@ -1044,30 +1158,48 @@ extern "C" {
     
     if (do_draw_stick_bark) {
       
-      use_program(bark_program, mvp, normal_matrix);
-      use_normal_vbo(stick_bark_normal_vbo);
-      
-      glEnable(GL_DEPTH_TEST);
-      
-      glEnable(GL_PRIMITIVE_RESTART);
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stick_bark_vbo);
-      glDrawElements(GL_TRIANGLE_STRIP, stick_bark_pts->count, GL_UNSIGNED_INT, NULL);
-      glDisable(GL_PRIMITIVE_RESTART);
+      draw_queue__Item item = {
+        .program        = bark_program,
+        .vao            = stick_bark_vao,
+        .mode           = GL_TRIANGLE_STRIP,
+        .first          = 0,
+        .count          = stick_bark_pts->count,
+        .index_type     = GL_UNSIGNED_INT,
+        .use_restart    = 1,
+        .color_loc      = -1,
+        .color          = {0, 0, 0},
+        .firsts         = NULL,
+        .counts         = NULL,
+        .draw_count     = 0,
+        .buffer_texture = 0
+      };
+      draw_queue__add(&item);
       
     }
     
     if (do_draw_joint_bark) {
       
-      use_program(bark_program, mvp, normal_matrix);
-      use_normal_vbo(joint_bark_normal_vbo);
-      
-      glEnable(GL_DEPTH_TEST);
-      
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, joint_bark_vbo);
-      glDrawElements(GL_TRIANGLES, joint_bark_pts->count, GL_UNSIGNED_INT, NULL);
+      draw_queue__Item item = {
+        .program        = bark_program,
+        .vao            = joint_bark_vao,
+        .mode           = GL_TRIANGLES,
+        .first          = 0,
+        .count          = joint_bark_pts->count,
+        .index_type     = GL_UNSIGNED_INT,
+        .use_restart    = 0,
+        .color_loc      = -1,
+        .color          = {0, 0, 0},
+        .firsts         = NULL,
+        .counts         = NULL,
+        .draw_count     = 0,
+        .buffer_texture = 0
+      };
+      draw_queue__add(&item);
       
     }
     
+    draw_queue__flush();
+    
   }
   
   void render__mouse_moved(int x, int y, double dx, double dy) {
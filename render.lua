@@ -12,7 +12,7 @@ local render = {}
 -- Requires.
 
 -- Expected to be preloaded:
---  lines
+--  lines, VertexArray, Wind, Forest, generator, softrast, species
 
 local make_tree
 if is_tree_2d then
@@ -28,18 +28,31 @@ local Vec3       = require 'Vec3'
 
 -- Internal globals.
 
-local tree = false
+local tree   = false
+local forest = false
+
+-- The seed of the newest tree requested from the generator thread.
+local wanted_seed = false
+
+-- A generated tree whose buffers are still being sent to the gpu.
+local incoming_tree = false
+
+-- The species named by species_names, as tables returned by species.load, and
+-- the index of the one that the next tree is made from.
+local all_species  = {}
+local next_species = 1
 
 
 -- Internal functions.
 
 local function setup_lines()
+  lines.reset()
   lines.set_scale(1.0)
 
   -- Draw trunk and branch lines.
   for i = 1, #tree, 2 do
-    assert(type(tree[i].pt) == 'table' and #tree[i].pt == 3)
-    assert(type(tree[i + 1].pt) == 'table' and #tree[i + 1].pt == 3)
+    assert(Vec3.is_vec3(tree[i].pt))
+    assert(Vec3.is_vec3(tree[i + 1].pt))
     lines.add(tree[i].pt, tree[i + 1].pt)
   end
 
@@ -54,6 +67,87 @@ local function setup_lines()
   end
 end
 
+-- This returns the species of the next tree, taking each of all_species in
+-- turn, or nil for the default species if there are none.
+local function take_species()
+  if #all_species == 0 then return nil end
+  local sp = all_species[next_species]
+  next_species = next_species % #all_species + 1
+  return sp
+end
+
+-- This asks the generator thread for a tree of the next species.
+local function request_tree(seed)
+  local sp = take_species()
+  return generator.request(seed, sp and sp.name)
+end
+
+-- This creates the OpenGL objects for a tree returned from make_tree.make.
+-- Trees with bones sway in the wind.
+local function add_v_arrays(t)
+  local green = {0, 0.6, 0}
+  t.bark.v_array = VertexArray:new(t.bark.pts, 'triangles')
+  t.leaves       = VertexArray:new(t.leaf_pts, 'triangles', green)
+  if t.bones then
+    t.wind = Wind:new(t.bones)
+    t.bark.v_array:set_wind(t.wind, t.bark.skin)
+    t.leaves:set_wind(t.wind, t.leaf_skin)
+  end
+end
+
+-- This swaps in the newest tree from the generator thread, if there is one and
+-- its buffers have been uploaded. Returns true when there's a tree to draw.
+local function poll_generator()
+  local new_tree = generator.poll()
+  if new_tree then
+    incoming_tree = {
+      bark   = {v_array = new_tree.bark_array},
+      leaves = new_tree.leaf_array,
+      wind   = new_tree.wind,
+      seed   = new_tree.seed
+    }
+  end
+  -- The current tree is drawn until the new one is fully on the gpu. The old
+  -- tree's buffers are freed when it's garbage collected.
+  if incoming_tree and incoming_tree.bark.v_array:is_uploaded() and
+                       incoming_tree.leaves:is_uploaded() then
+    tree, incoming_tree = incoming_tree, false
+  end
+  return tree ~= false
+end
+
+-- This builds forest_grid_size^2 trees, centered around the origin, and adds
+-- them all to a single Forest instance.
+local function setup_forest()
+  forest = Forest:new({quantize_positions = true})
+  local offset = (forest_grid_size - 1) * forest_spacing / 2
+  for i = 0, forest_grid_size - 1 do
+    for j = 0, forest_grid_size - 1 do
+      local t = make_tree.make(nil, take_species())
+      forest:add_tree(t.bark.pts, t.leaf_pts,
+                      i * forest_spacing - offset,  -- x
+                      0,                            -- y
+                      j * forest_spacing - offset,  -- z
+                      math.random() * 2 * math.pi,  -- angle
+                      t.bark.groups.sizes,
+                      t.leaf_groups.sizes)
+    end
+  end
+end
+
+-- This sends the patches returned by a make_tree edit to the gpu, along with
+-- the tree's edited bones.
+local function apply_patches(bark_patches, leaf_patches)
+  tree.wind:set_bones(tree.bones)
+  for _, patch in ipairs(bark_patches) do
+    tree.bark.v_array:replace_range(patch.first, patch.count, patch.pts,
+                                    patch.skin)
+  end
+  for _, patch in ipairs(leaf_patches) do
+    tree.leaves:replace_range(patch.first, patch.count, patch.pts, patch.skin)
+  end
+end
+
 -- These next two functions are not meant to be called during normal use.
 -- They're here as a way to help test/debug the TriangleStrip class.
 
@@ -75,7 +169,28 @@ end
 
 -- This is expected to be called once at program startup.
 function render.init()
-  tree = make_tree.make()
+  -- This is also called for each new tree in batch runs, which reuse the
+  -- species.
+  if #all_species == 0 then
+    for name in species_names:gmatch('%S+') do
+      all_species[#all_species + 1] = species.load(name)
+    end
+  end
+
+  if forest_grid_size > 0 then
+    setup_forest()
+    return
+  end
+
+  -- When generating in the background, the first frames are drawn without a
+  -- tree, and it appears as soon as it's ready.
+  if do_generate_async then
+    wanted_seed = request_tree()
+    return
+  end
+
+  tree = make_tree.make(nil, take_species())
+  add_v_arrays(tree)
   setup_lines()
 
   out_dir_v_array = VertexArray:new(tree.out_dir_pts, 'lines')
@@ -90,8 +205,67 @@ function render.init()
   --]]
 end
 
+-- This replaces the current tree with a new one of the next species, made from
+-- the given seed, or from a new seed if none is given. In the background
+-- generation mode, the current tree is drawn until the new one is ready.
+function render.regenerate(seed)
+  if do_generate_async then
+    wanted_seed = request_tree(seed)
+    return
+  end
+  tree = make_tree.make(seed, take_species())
+  add_v_arrays(tree)
+end
+
+-- This regenerates the branch that starts at tree[idx], along with everything
+-- leafward of it, and patches the changed vertex ranges of the tree's buffers.
+-- See make_tree.regenerate_subtree for the meaning of seed and direction; a
+-- tree editor can call this with a fixed seed as a branch is dragged.
+function render.regenerate_subtree(idx, seed, direction)
+  assert(tree and tree.bark.pts and make_tree.regenerate_subtree,
+         'regenerate_subtree expects a single 3d tree generated on this thread')
+  apply_patches(make_tree.regenerate_subtree(tree, idx, seed, direction))
+end
+
+-- This moves the skeleton point at tree[idx] to the Vec3 pt, and patches the
+-- changed vertex ranges of the tree's buffers.
+function render.move_point(idx, pt)
+  assert(tree and tree.bark.pts and make_tree.move_point,
+         'move_point expects a single 3d tree generated on this thread')
+  apply_patches(make_tree.move_point(tree, idx, pt))
+end
+
+-- This returns true once the most recently requested tree, or the whole
+-- forest, is ready to draw.
+-- It's mainly for batch rendering, which waits for each background-generated
+-- tree.
+function render.is_ready()
+  if forest then return forest:is_uploaded() end
+  if not do_generate_async then return true end
+  return poll_generator() and tree.seed == wanted_seed
+end
+
+-- This renders the current tree on the cpu and saves it as a png file. The
+-- image is square, with size pixels on a side; the default size is 256.
+function render.save_thumbnail(filename, size)
+  assert(tree and tree.bark.pts,
+         'save_thumbnail expects a single tree generated on this thread')
+  size = size or 256
+  return softrast.write_png(filename, size, size, {
+    {pts = tree.bark.pts,       color = {0.494, 0.349, 0.204}},
+    {pts = tree.leaf_pts or {}, color = {0.0,   0.6,   0.0}}
+  })
+end
+
 -- This is expected to be called once per render cycle.
 function render.draw()
+  if forest then
+    forest:draw()
+    return
+  end
+
+  if do_generate_async and not poll_generator() then return end
+
   -- lines.draw_all()
 
   -- TEMP
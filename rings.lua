@@ -15,6 +15,12 @@ local Mat3 = require 'Mat3'
 local Vec3 = require 'Vec3'
 
 
+-- Internal globals.
+
+-- The most points in any ring; see rings.set_max_pts.
+local max_pts = max_ring_pts
+
+
 -- Debug functions.
 
 local last_timestamp = false
@@ -40,12 +46,12 @@ local function check_tree_integrity(tree)
   local fmt = 'Expected %s to be a Vec3.'
   for i = 1, #tree do
     local tree_pt = tree[i]
-    assertup(getmetatable(tree_pt.pt) == Vec3, fmt:format('tree_pt.pt'))
+    assertup(Vec3.is_vec3(tree_pt.pt), fmt:format('tree_pt.pt'))
     if tree_pt.down then
-      assertup(getmetatable(tree_pt.down.pt) == Vec3,
+      assertup(Vec3.is_vec3(tree_pt.down.pt),
                fmt:format('tree_pt.down.pt'))
     elseif tree_pt.up then
-      assertup(getmetatable(tree_pt.up.pt) == Vec3,
+      assertup(Vec3.is_vec3(tree_pt.up.pt),
                fmt:format('tree_pt.up.pt'))
     end
   end
@@ -73,26 +79,26 @@ local function get_num_pts(tree_pt)
               get_num_pts(tree_pt.kids[2]) - 2
   end
 
-  num_pts = math.min(num_pts, max_ring_pts)
+  num_pts = math.min(num_pts, max_pts)
   tree_pt.ring_num_pts = num_pts
   return num_pts
 end
 
 local function get_up_vec(tree_pt)
-  assert(getmetatable(tree_pt.pt) == Vec3)
+  assert(Vec3.is_vec3(tree_pt.pt))
 
   local up
   if tree_pt.kind == 'child' then
     assert(tree_pt.up and tree_pt.up.kind)
-    assert(getmetatable(tree_pt.up.pt) == Vec3)
+    assert(Vec3.is_vec3(tree_pt.up.pt))
     up = tree_pt.up.pt - tree_pt.pt
   else
     assert(tree_pt.down and tree_pt.down.kind)
-    assert(getmetatable(tree_pt.pt) == Vec3)
-    assert(getmetatable(tree_pt.down.pt) == Vec3)
+    assert(Vec3.is_vec3(tree_pt.pt))
+    assert(Vec3.is_vec3(tree_pt.down.pt))
     up = tree_pt.pt - tree_pt.down.pt
   end
-  assert(getmetatable(up) == Vec3)
+  assert(Vec3.is_vec3(up))
   return up
 end
 
@@ -303,15 +309,15 @@ local function add_ring_to_pt(tree_pt)
     tree_pt.ring = {tree_pt.pt}
   else                                         -- The trunk or branch cases.
     local num_pts     = get_num_pts(tree_pt)
-                        assert(num_pts <= max_ring_pts)
+                        assert(num_pts <= max_pts)
     -- `angle` is the angle in radius between outgoing rays from the center.
     local angle       = 2 * math.pi / num_pts
     local up          = get_up_vec(tree_pt)
-                        assert(getmetatable(up) == Vec3)
+                        assert(Vec3.is_vec3(up))
     -- `ray` is the vector of the first outgoing ray from the center.
     local center, ray, angle = get_center_ray_and_angle(tree_pt, num_pts, angle)
-                               assert(getmetatable(center) == Vec3)
-                               assert(getmetatable(ray) == Vec3)
+                               assert(Vec3.is_vec3(center))
+                               assert(Vec3.is_vec3(ray))
     local R                  = Mat3:rotate(angle, up)
 
     tree_pt.ring_center = center
@@ -324,6 +330,14 @@ local function add_ring_to_pt(tree_pt)
   end
 end
 
+-- This clears the cached ring size of tree_pt so it's recomputed when it's next
+-- needed.
+local function clear_ring_size(tree_pt)
+  tree_pt.ring_num_pts = nil
+  tree_pt.ring_radius  = nil
+  tree_pt.ring_angle   = nil
+end
+
 local function debug_print_ring(tree_pt)
   print('')
   print('ring: ' .. dbg.val_to_str(tree_pt.ring))
@@ -355,6 +369,34 @@ function rings.add_rings(tree)
   end
 end
 
+-- This recomputes the cached ring size of tree_pt, which is expected to be out
+-- of date, and returns true if it changed. The sizes leafward of tree_pt are
+-- expected to be up to date, or not yet computed. See dirty.lua for the points
+-- that depend on this size.
+function rings.update_size(tree_pt)
+  local old_num_pts, old_radius = tree_pt.ring_num_pts, tree_pt.ring_radius
+  clear_ring_size(tree_pt)
+  get_ring_radius(tree_pt)
+  return tree_pt.ring_num_pts ~= old_num_pts or
+         tree_pt.ring_radius  ~= old_radius
+end
+
+-- This rebuilds the ring of tree_pt from the cached ring sizes.
+function rings.update_ring(tree_pt)
+  add_ring_to_pt(tree_pt)
+end
+
+-- This sets the most points in the rings sized after this call, which starts as
+-- the max_ring_pts global. The sizes of existing rings are kept until they're
+-- cleared.
+function rings.set_max_pts(n)
+  max_pts = n
+end
+
+-- This returns the other kid of the parent of tree_pt, which is expected to be
+-- a child point.
+rings.get_sibling = get_sibling
+
 -- TEMP
 print('max_ring_pts = ' .. max_ring_pts)
 
@@ -0,0 +1,36 @@
+--[[
+
+seq.lua
+
+A module of helper functions for sequence tables, shared by make_tree.lua and
+dirty.lua.
+
+--]]
+
+local seq = {}
+
+
+-- Public functions.
+
+-- This expects two sequence tables in `t` and `suffix.
+-- It appends the contents of `suffix` to the end of `t`.
+function seq.append(t, suffix)
+  for i = 1, #suffix do
+    table.insert(t, suffix[i])
+  end
+end
+
+-- This replaces the num_old values of the sequence t starting at index first
+-- with the values of the sequence new_vals, shifting later values as needed.
+function seq.splice(t, first, num_old, new_vals)
+  local n     = #t
+  local shift = #new_vals - num_old
+  if shift ~= 0 then
+    table.move(t, first + num_old, n, first + num_old + shift)
+    for i = n + shift + 1, n do t[i] = nil end
+  end
+  table.move(new_vals, 1, #new_vals, first, t)
+end
+
+
+return seq
@@ -5,10 +5,16 @@ out vec4 out_color;
 flat in vec3 triColorOut;
 flat in vec3 normal;
 
+layout(std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  mat3 normal_xform;
+  vec3 light_dir;
+};
+
 void main() {
   
-  vec3 light_dir = normalize(vec3(1, 2, 2));
-  
   out_color = vec4(triColorOut, 1.0);
   
   //float mult = (clamp(dot(normal, light_dir), 0.3, 1));
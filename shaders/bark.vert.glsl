@@ -7,12 +7,22 @@ layout(location = 2) in vec3 normalIn;
 flat out vec3 triColorOut;
 flat out vec3 normal;
 
-uniform mat4 mvp;
-uniform mat3 normal_xform;
+layout(std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  mat3 normal_xform;
+  vec3 light_dir;
+};
+
+layout(std140) uniform Object {
+  mat4 model;
+};
+
 uniform vec3 color;
 
 void main() {
-  gl_Position = mvp * vec4(vPosition, 1);
+  gl_Position = view_projection * model * vec4(vPosition, 1);
   triColorOut = triColorIn;
   triColorOut = vec3(0.494, 0.349, 0.204);
   triColorOut = color;
@@ -0,0 +1,50 @@
+// bark_wind.vert.glsl
+//
+// The bark shader's vertex stage for arrays that sway in the wind; see wind.h.
+// Each vertex is moved by a blend of the transforms of its bone and of that
+// bone's parent.
+//
+
+#version 330 core
+
+layout(location = 0) in vec3  vPosition;
+layout(location = 2) in vec3  normalIn;
+layout(location = 3) in uvec2 bones;   // The vertex's bone, then its parent.
+layout(location = 4) in float weight;  // 1 for the bone, 0 for the parent.
+
+flat out vec3 triColorOut;
+flat out vec3 normal;
+
+layout(std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  mat3 normal_xform;
+  vec3 light_dir;
+};
+
+layout(std140) uniform Object {
+  mat4 model;
+};
+
+uniform vec3 color;
+
+// Each bone's transform is stored as four consecutive columns.
+uniform samplerBuffer palette;
+
+mat4 bone_xform(uint bone) {
+  int base = 4 * int(bone);
+  return mat4(texelFetch(palette, base + 0),
+              texelFetch(palette, base + 1),
+              texelFetch(palette, base + 2),
+              texelFetch(palette, base + 3));
+}
+
+void main() {
+  mat4 xform = weight * bone_xform(bones.x) + (1 - weight) * bone_xform(bones.y);
+  gl_Position = view_projection * model * xform * vec4(vPosition, 1);
+  triColorOut = color;
+
+  // The bones only rotate, so the blend is close to a rotation.
+  normal      = normal_xform * normalize(mat3(xform) * normalIn);
+}
@@ -0,0 +1,51 @@
+#version 330 core
+
+// In quantized forests, this is in [-1, 1]^3, and tree_model includes the
+// mapping back to tree space.
+layout(location = 0) in vec3 vPosition;
+layout(location = 2) in vec2 normalIn;  // Octahedral-encoded.
+layout(location = 3) in uint tree_index;
+
+flat out vec3 triColorOut;
+flat out vec3 normal;
+
+layout(std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  mat3 normal_xform;
+  vec3 light_dir;
+};
+
+layout(std140) uniform Object {
+  mat4 model;
+};
+
+uniform vec3 color;
+
+// Each tree's model matrix is stored as four consecutive columns.
+uniform samplerBuffer tree_xforms;
+
+vec3 decode_normal(vec2 e) {
+  vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+  if (n.z < 0) n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+  return normalize(n);
+}
+
+void main() {
+  int  base = 4 * int(tree_index);
+  mat4 tree_model = mat4(texelFetch(tree_xforms, base + 0),
+                         texelFetch(tree_xforms, base + 1),
+                         texelFetch(tree_xforms, base + 2),
+                         texelFetch(tree_xforms, base + 3));
+  gl_Position = view_projection * model * tree_model * vec4(vPosition, 1);
+  triColorOut = color;
+
+  // Trees are only rotated around the y axis, but tree_model may also scale
+  // each axis to undo quantization, so we normalize its columns to recover the
+  // rotation.
+  mat3 tree_rotation = mat3(normalize(tree_model[0].xyz),
+                            normalize(tree_model[1].xyz),
+                            normalize(tree_model[2].xyz));
+  normal      = normal_xform * tree_rotation * decode_normal(normalIn);
+}
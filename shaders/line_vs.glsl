@@ -2,8 +2,18 @@
 
 layout(location = 0) in vec3 vPosition;
 
-uniform mat4 mvp;
+layout(std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  mat3 normal_xform;
+  vec3 light_dir;
+};
+
+layout(std140) uniform Object {
+  mat4 model;
+};
 
 void main() {
-  gl_Position = mvp * vec4(vPosition, 1);
+  gl_Position = view_projection * model * vec4(vPosition, 1);
 }
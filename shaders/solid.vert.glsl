@@ -5,8 +5,18 @@
 
 layout(location = 0) in vec3 v_position;
 
-uniform mat4 vp;
+layout(std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  mat3 normal_xform;
+  vec3 light_dir;
+};
+
+layout(std140) uniform Object {
+  mat4 model;
+};
 
 void main() {
-  gl_Position = vp * vec4(v_position, 1.0);
+  gl_Position = view_projection * model * vec4(v_position, 1.0);
 }
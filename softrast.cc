@@ -0,0 +1,450 @@
+// softrast.cc
+//
+
+#include "softrast.h"
+
+extern "C" {
+#include "cstructs/cstructs.h"
+#include "image.h"
+#include "luahelp.h"
+#include "lua/lauxlib.h"
+}
+
+#include "glm/glm.hpp"
+#define GLM_FORCE_RADIANS
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/type_ptr.hpp"
+using namespace glm;
+
+#include <float.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// Tiles are tile_size x tile_size pixels.
+#define tile_size 64
+
+// Threads beyond this many don't help with thumbnail-sized images.
+#define max_threads 64
+
+
+// Internal types and globals.
+
+// A triangle that's been transformed into pixel coordinates - with y = 0 at the
+// top - and shaded. Its vertices are in counterclockwise order as seen on the
+// screen, so its edge functions are nonnegative inside it.
+typedef struct {
+  float   x[3];
+  float   y[3];
+  float   z[3];     // Depth, in [0, 1] when between the near and far planes.
+  uint8_t rgb[3];
+  int     min_x, min_y, max_x, max_y;  // The pixel bounds, inclusive.
+} ScreenTri;
+
+struct softrast__Target {
+  int      width;
+  int      height;
+  int      tiles_x;
+  int      tiles_y;
+  uint8_t *pixels;
+  float   *depth;
+
+  mat4     mvp;
+  mat3     normal_xform;
+  vec3     light_dir;
+
+  Array    tris;          // ScreenTri items.
+  Array   *bins;          // One Array of int triangle indexes per tile.
+  int      next_tile;     // Tiles are claimed by threads via an atomic add.
+};
+
+
+// Internal functions.
+
+static int clampi(int x, int lo, int hi) {
+  return x < lo ? lo : (x > hi ? hi : x);
+}
+
+// Adds the given triangle, in clip coordinates, to target->tris. This expects
+// every vertex to have w > 0.
+static void add_screen_tri(softrast__Target *target, vec4 clip[3],
+                           const uint8_t *rgb) {
+  ScreenTri tri;
+  for (int i = 0; i < 3; ++i) {
+    vec3 ndc = vec3(clip[i]) / clip[i].w;
+    tri.x[i] = (ndc.x * 0.5f + 0.5f) * target->width;
+    tri.y[i] = (0.5f - ndc.y * 0.5f) * target->height;
+    tri.z[i] =  ndc.z * 0.5f + 0.5f;
+  }
+
+  // Make the triangle counterclockwise on the screen, and drop it if it's
+  // degenerate.
+  float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) -
+               (tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+  if (area == 0) return;
+  if (area < 0) {
+    float tmp;
+    tmp = tri.x[1]; tri.x[1] = tri.x[2]; tri.x[2] = tmp;
+    tmp = tri.y[1]; tri.y[1] = tri.y[2]; tri.y[2] = tmp;
+    tmp = tri.z[1]; tri.z[1] = tri.z[2]; tri.z[2] = tmp;
+  }
+
+  float lo_x = fminf(tri.x[0], fminf(tri.x[1], tri.x[2]));
+  float hi_x = fmaxf(tri.x[0], fmaxf(tri.x[1], tri.x[2]));
+  float lo_y = fminf(tri.y[0], fminf(tri.y[1], tri.y[2]));
+  float hi_y = fmaxf(tri.y[0], fmaxf(tri.y[1], tri.y[2]));
+  if (hi_x < 0 || hi_y < 0 || lo_x >= target->width || lo_y >= target->height) {
+    return;
+  }
+  tri.min_x = clampi((int)lo_x, 0, target->width  - 1);
+  tri.max_x = clampi((int)hi_x, 0, target->width  - 1);
+  tri.min_y = clampi((int)lo_y, 0, target->height - 1);
+  tri.max_y = clampi((int)hi_y, 0, target->height - 1);
+
+  memcpy(tri.rgb, rgb, 3);
+  array__add_item_val(target->tris, tri);
+}
+
+// Clips the triangle against the near plane, z >= -w, and adds what's left.
+static void clip_and_add(softrast__Target *target, vec4 clip[3],
+                         const uint8_t *rgb) {
+  const float min_w = 1e-5f;
+  vec4 poly[4];
+  int  n = 0;
+  for (int i = 0; i < 3; ++i) {
+    vec4 a = clip[i], b = clip[(i + 1) % 3];
+    float da = a.z + a.w, db = b.z + b.w;
+    if (da >= 0 && a.w > min_w) poly[n++] = a;
+    if ((da >= 0) != (db >= 0)) {
+      vec4 p = mix(a, b, da / (da - db));
+      if (p.w > min_w) poly[n++] = p;
+    }
+  }
+  // The clipped polygon is a triangle or a quad.
+  for (int i = 1; i + 1 < n; ++i) {
+    vec4 tri[3] = {poly[0], poly[i], poly[i + 1]};
+    add_screen_tri(target, tri, rgb);
+  }
+}
+
+static void bin_triangles(softrast__Target *target) {
+  int num_tiles = target->tiles_x * target->tiles_y;
+  for (int t = 0; t < num_tiles; ++t) array__clear(target->bins[t]);
+
+  array__for(ScreenTri *, tri, target->tris, tri_idx) {
+    for (int ty = tri->min_y / tile_size; ty <= tri->max_y / tile_size; ++ty) {
+      for (int tx = tri->min_x / tile_size; tx <= tri->max_x / tile_size;
+           ++tx) {
+        array__new_val(target->bins[ty * target->tiles_x + tx], int) = tri_idx;
+      }
+    }
+  }
+}
+
+// Draws the part of tri within [x0, x1] x [y0, y1], inclusive.
+static void raster_tri(softrast__Target *target, ScreenTri *tri,
+                       int x0, int y0, int x1, int y1) {
+  x0 = x0 > tri->min_x ? x0 : tri->min_x;
+  y0 = y0 > tri->min_y ? y0 : tri->min_y;
+  x1 = x1 < tri->max_x ? x1 : tri->max_x;
+  y1 = y1 < tri->max_y ? y1 : tri->max_y;
+  if (x0 > x1 || y0 > y1) return;
+
+  // Edge i is opposite vertex i. Each edge function is e = a * x + b * y + c,
+  // and it's the area of the triangle formed by the edge and the point.
+  float a[3], b[3], c[3];
+  for (int i = 0; i < 3; ++i) {
+    int j = (i + 1) % 3, k = (i + 2) % 3;
+    a[i] = tri->y[j] - tri->y[k];
+    b[i] = tri->x[k] - tri->x[j];
+    c[i] = tri->x[j] * tri->y[k] - tri->y[j] * tri->x[k];
+  }
+  float area     = c[0] + c[1] + c[2];  // The sum of the edges at any point.
+  float inv_area = 1.0f / area;
+
+  // Depth is linear in screen space, so we set it up as a plane as well.
+  float za = 0, zb = 0, zc = 0;
+  for (int i = 0; i < 3; ++i) {
+    za += a[i] * tri->z[i] * inv_area;
+    zb += b[i] * tri->z[i] * inv_area;
+    zc += c[i] * tri->z[i] * inv_area;
+  }
+
+  for (int y = y0; y <= y1; ++y) {
+    float    py    = y + 0.5f;
+    float   *depth = target->depth  + y * target->width;
+    uint8_t *rgb   = target->pixels + y * target->width * 3;
+
+    // The parts of the edge functions and depth that are constant along the
+    // row. Both loops below add these in the same order, so they round alike.
+    float ey[3];
+    for (int i = 0; i < 3; ++i) ey[i] = b[i] * py + c[i];
+    float zy = zb * py + zc;
+
+    int x = x0;
+
+#ifdef __SSE__
+    // This works on 4 pixels at a time, and only on pixels within [x0, x1]. The
+    // pixels past x1 belong to the next tile, which another thread may be
+    // drawing, so even a store that leaves their values alone could undo its
+    // writes.
+    __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    __m128 zero    = _mm_setzero_ps();
+    for (; x + 3 <= x1; x += 4) {
+      __m128 px   = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+      __m128 mask = _mm_cmpeq_ps(zero, zero);  // All lanes are on.
+      for (int i = 0; i < 3; ++i) {
+        __m128 e = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i]), px),
+                              _mm_set1_ps(ey[i]));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(e, zero));
+      }
+      __m128 z   = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px),
+                              _mm_set1_ps(zy));
+      __m128 old = _mm_loadu_ps(depth + x);
+      mask       = _mm_and_ps(mask, _mm_cmplt_ps(z, old));
+      int bits   = _mm_movemask_ps(mask);
+      if (bits == 0) continue;
+      _mm_storeu_ps(depth + x, _mm_or_ps(_mm_and_ps   (mask, z),
+                                         _mm_andnot_ps(mask, old)));
+      for (int lane = 0; lane < 4; ++lane) {
+        if (bits & (1 << lane)) memcpy(rgb + 3 * (x + lane), tri->rgb, 3);
+      }
+    }
+#endif
+
+    // These are the pixels left over by the SSE loop, or all of them without
+    // SSE.
+    for (; x <= x1; ++x) {
+      float px = x + 0.5f;
+      if (a[0] * px + ey[0] < 0 ||
+          a[1] * px + ey[1] < 0 ||
+          a[2] * px + ey[2] < 0) continue;
+      float z = za * px + zy;
+      if (z >= depth[x]) continue;
+      depth[x] = z;
+      memcpy(rgb + 3 * x, tri->rgb, 3);
+    }
+  }
+}
+
+static void raster_tile(softrast__Target *target, int tile) {
+  int tx = tile % target->tiles_x, ty = tile / target->tiles_x;
+  int x0 = tx * tile_size, y0 = ty * tile_size;
+  int x1 = x0 + tile_size - 1, y1 = y0 + tile_size - 1;
+  if (x1 >= target->width)  x1 = target->width  - 1;
+  if (y1 >= target->height) y1 = target->height - 1;
+
+  // The bins keep submission order, so equal depths resolve as they do in GL.
+  ScreenTri *tris = (ScreenTri *)target->tris->items;
+  array__for_range(int *, tri_idx, target->bins[tile]) {
+    ScreenTri *tri = tris + *tri_idx;
+    raster_tri(target, tri, x0, y0, x1, y1);
+  }
+}
+
+static void *raster_thread(void *arg) {
+  softrast__Target *target = (softrast__Target *)arg;
+  int num_tiles = target->tiles_x * target->tiles_y;
+  while (1) {
+    int tile = __sync_fetch_and_add(&target->next_tile, 1);
+    if (tile >= num_tiles) break;
+    raster_tile(target, tile);
+  }
+  return NULL;
+}
+
+
+// Internal: Lua C functions.
+
+// Lua C function.
+// Expected parameters: filename, width, height, meshes
+// where meshes is a sequence of {pts = {..}, color = {r, g, b}} tables.
+static int softrast__write_png(lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  int width  = (int)luaL_checkinteger(L, 2);
+  int height = (int)luaL_checkinteger(L, 3);
+  luaL_checktype(L, 4, LUA_TTABLE);
+  luaL_argcheck(L, width > 0 && height > 0, 2, "expected a positive size");
+
+  // Collect the meshes and their bounding box.
+  int   num_meshes = (int)luaL_len(L, 4);
+  Array meshes     = array__new(num_meshes, sizeof(Array));
+  Array colors     = array__new(num_meshes, sizeof(vec3));
+  vec3  lo(FLT_MAX), hi(-FLT_MAX);
+  for (int i = 1; i <= num_meshes; ++i) {
+    lua_geti(L, 4, i);
+        // stack = [.., mesh]
+    lua_getfield(L, -1, "pts");
+        // stack = [.., mesh, pts]
+    Array pts = luahelp__new_float_array(L, lua_gettop(L));
+    array__add_item_val(meshes, pts);
+    for (int j = 0; j + 2 < pts->count; j += 3) {
+      vec3 pt = make_vec3((float *)array__item_ptr(pts, j));
+      lo = min(lo, pt);
+      hi = max(hi, pt);
+    }
+    lua_pop(L, 1);
+        // stack = [.., mesh]
+
+    vec3 color = vec3(0.494, 0.349, 0.204);
+    lua_getfield(L, -1, "color");
+        // stack = [.., mesh, color]
+    if (lua_istable(L, -1)) {
+      for (int j = 0; j < 3; ++j) {
+        lua_geti(L, -1, j + 1);
+        color[j] = (float)lua_tonumber(L, -1);
+        lua_pop(L, 1);
+      }
+    }
+    array__add_item_val(colors, color);
+    lua_pop(L, 2);
+        // stack = [..]
+  }
+  if (lo.x > hi.x) lo = hi = vec3(0);
+
+  // Fit the camera to the bounding sphere of all the meshes. The view
+  // direction matches the default medium perspective in luarender.cc.
+  float fov_y  = radians(45.0f);
+  vec3  center = (lo + hi) / 2.0f;
+  float radius = fmaxf(length(hi - lo) / 2.0f, 1e-3f);
+  float dist   = 1.1f * radius / sinf(fov_y / 2);
+  vec3  eye    = center + dist * normalize(vec3(6.0, 3.0, 2.0));
+  mat4  view   = lookAt(eye, center, vec3(0.0, 1.0, 0.0));
+  mat4  proj   = perspective(fov_y, (float)width / height,
+                             fmaxf(dist - 2 * radius, dist * 0.01f),  // near
+                             dist + 2 * radius);                      // far
+  mat4  mvp    = proj * view;
+  mat3  normal_xform(1.0);
+  vec3  light_dir = normalize(vec3(1, 2, 2));
+
+  softrast__Target *target = softrast__new_target(width, height);
+  softrast__set_frame(target, value_ptr(mvp), value_ptr(normal_xform),
+                      value_ptr(light_dir));
+  for (int i = 0; i < num_meshes; ++i) {
+    Array pts   = array__item_val(meshes, i, Array);
+    vec3  color = array__item_val(colors, i, vec3);
+    softrast__add_triangles(target, (float *)pts->items, pts->count / 3,
+                            value_ptr(color));
+    array__delete(pts);
+  }
+  array__delete(meshes);
+  array__delete(colors);
+
+  softrast__render(target, 0);  // 0 --> one thread per core
+  int ok = image__write_png(filename, width, height, softrast__pixels(target));
+  softrast__delete_target(target);
+
+  lua_pushboolean(L, ok);
+  return 1;  // --> 1 Lua return value
+}
+
+
+// Public functions.
+
+extern "C" softrast__Target *softrast__new_target(int width, int height) {
+  softrast__Target *target =
+      (softrast__Target *)calloc(1, sizeof(softrast__Target));
+  target->width        = width;
+  target->height       = height;
+  target->tiles_x      = (width  + tile_size - 1) / tile_size;
+  target->tiles_y      = (height + tile_size - 1) / tile_size;
+  target->pixels       = (uint8_t *)malloc(3 * width * height);
+  target->depth        = (float *)malloc(sizeof(float) * width * height);
+  target->tris         = array__new(1024, sizeof(ScreenTri));
+
+  int num_tiles = target->tiles_x * target->tiles_y;
+  target->bins  = (Array *)malloc(num_tiles * sizeof(Array));
+  for (int t = 0; t < num_tiles; ++t) {
+    target->bins[t] = array__new(64, sizeof(int));
+  }
+
+  return target;
+}
+
+extern "C" void softrast__delete_target(softrast__Target *target) {
+  int num_tiles = target->tiles_x * target->tiles_y;
+  for (int t = 0; t < num_tiles; ++t) array__delete(target->bins[t]);
+  free(target->bins);
+  array__delete(target->tris);
+  free(target->depth);
+  free(target->pixels);
+  free(target);
+}
+
+extern "C" void softrast__set_frame(softrast__Target *target,
+                                    const float      *mvp,
+                                    const float      *normal_xform,
+                                    const float      *light_dir) {
+  target->mvp          = make_mat4(mvp);
+  target->normal_xform = make_mat3(normal_xform);
+  target->light_dir    = make_vec3(light_dir);
+
+  memset(target->pixels, 255, 3 * target->width * target->height);  // White.
+  for (int i = 0; i < target->width * target->height; ++i) {
+    target->depth[i] = 1.0f;
+  }
+  array__clear(target->tris);
+}
+
+extern "C" void softrast__add_triangles(softrast__Target *target,
+                                        const float      *pts,
+                                        int               num_pts,
+                                        const float      *color) {
+  vec3 base_color = make_vec3(color);
+  for (int k = 0; k + 2 < num_pts; k += 3) {
+    vec3 p[3];
+    vec4 clip[3];
+    for (int i = 0; i < 3; ++i) {
+      p[i]    = make_vec3(pts + 3 * (k + i));
+      clip[i] = target->mvp * vec4(p[i], 1);
+    }
+
+    // This matches normals__new_for_vertices and bark.frag.glsl.
+    vec3  n = cross(p[1] - p[0], p[2] - p[1]);
+    float len = length(n);
+    n = len > 0 ? target->normal_xform * (n / len) : vec3(0);
+    vec3  shaded = clamp(base_color * (dot(n, target->light_dir) * 0.5f + 0.5f),
+                         0.0f, 1.0f);
+    uint8_t rgb[3];
+    for (int i = 0; i < 3; ++i) rgb[i] = (uint8_t)(shaded[i] * 255.0f + 0.5f);
+
+    clip_and_add(target, clip, rgb);
+  }
+}
+
+extern "C" void softrast__render(softrast__Target *target, int num_threads) {
+  bin_triangles(target);
+
+  if (num_threads <= 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_threads <= 0) num_threads = 1;
+  if (num_threads > max_threads) num_threads = max_threads;
+
+  // The calling thread does its share of the work too.
+  target->next_tile = 0;
+  pthread_t threads[max_threads];
+  for (int i = 1; i < num_threads; ++i) {
+    pthread_create(&threads[i], NULL, raster_thread, target);
+  }
+  raster_thread(target);
+  for (int i = 1; i < num_threads; ++i) pthread_join(threads[i], NULL);
+
+  array__clear(target->tris);
+}
+
+extern "C" const uint8_t *softrast__pixels(softrast__Target *target) {
+  return target->pixels;
+}
+
+extern "C" void softrast__load_lib(lua_State *L) {
+  // Add `softrast` as a global module table.
+  static const struct luaL_Reg lib[] = {
+    {"write_png", softrast__write_png},
+    {NULL, NULL}};
+  luaL_newlib(L, lib);           // --> stack = [.., softrast]
+  lua_setglobal(L, "softrast");  // --> stack = [..]
+}
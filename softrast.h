@@ -0,0 +1,75 @@
+// softrast.h
+//
+// A cpu-only renderer for thumbnails and for regression images on machines
+// without a gpu.
+//
+// It draws the same flat-shaded triangle meshes as VertexArray, with the same
+// Lambert shading as bark.frag.glsl:
+//
+//   color * (dot(normal, light_dir) * 0.5 + 0.5)
+//
+// Triangles are transformed and shaded as they're added, and binned into
+// screen tiles when rendering. Tiles are then rasterized in parallel, one
+// thread per core, with the edge functions evaluated four pixels at a time
+// using SSE when it's available.
+//
+// C usage:
+//
+//   softrast__Target *target = softrast__new_target(width, height);
+//   softrast__set_frame(target, mvp, normal_xform, light_dir);
+//   softrast__add_triangles(target, pts, num_pts, color);  // Any # of times.
+//   softrast__render(target, 0);  // 0 --> use one thread per core.
+//   image__write_png(path, width, height, softrast__pixels(target));
+//   softrast__delete_target(target);
+//
+// Lua interface:
+//
+//   -- Each mesh is a flat sequence of triangle corners, as for VertexArray.
+//   -- The camera is placed to fit all the meshes in view. Returns true on
+//   -- success.
+//   softrast.write_png(filename, width, height,
+//                      {{pts = bark_pts, color = {r, g, b}}, ..})
+//
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lua/lua.h"
+
+#include <stdint.h>
+
+typedef struct softrast__Target softrast__Target;
+
+softrast__Target *softrast__new_target   (int width, int height);
+void              softrast__delete_target(softrast__Target *target);
+
+// The mvp is a column-major 4x4 matrix, and normal_xform is a column-major 3x3
+// matrix. The light_dir is expected to point toward the light and to be
+// normalized. This also clears the target to white.
+void softrast__set_frame(softrast__Target *target,
+                         const float      *mvp,
+                         const float      *normal_xform,
+                         const float      *light_dir);
+
+// This expects num_pts points as triples of floats, with each three points
+// being a triangle, and an rgb color with components in [0, 1].
+void softrast__add_triangles(softrast__Target *target,
+                             const float      *pts,
+                             int               num_pts,
+                             const float      *color);
+
+// Rasterizes all added triangles, and then forgets them. A num_threads value of
+// 0 means to use one thread per core.
+void softrast__render(softrast__Target *target, int num_threads);
+
+// Returns the rgb pixels, 3 bytes each, with the top row first.
+const uint8_t *softrast__pixels(softrast__Target *target);
+
+void softrast__load_lib(lua_State *L);
+
+#ifdef __cplusplus
+}
+#endif
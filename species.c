@@ -0,0 +1,359 @@
+// species.c
+//
+
+#include "species.h"
+
+// Local includes.
+#include "config.h"
+#include "cstructs/cstructs.h"
+#include "file.h"
+#include "luacompat.h"
+
+// Library includes.
+#include "lua/lauxlib.h"
+
+// Standard library includes.
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Internal types and globals.
+
+typedef enum {
+  key_type_int,
+  key_type_num
+} KeyType;
+
+typedef struct {
+  const char *name;
+  KeyType     type;
+  size_t      offset;      // The offset of the key's field in a Species.
+  int         num_values;  // species__max_levels for a per-level key, else 1.
+} Key;
+
+#define int_key(name)       { #name, key_type_int, offsetof(Species, name), 1 }
+#define num_key(name)       { #name, key_type_num, offsetof(Species, name), 1 }
+#define level_key(name)     { #name, key_type_num, offsetof(Species, name), \
+                              species__max_levels }
+
+static Key keys[] = {
+  int_key  (max_height),
+  int_key  (min_height),
+  num_key  (trunk_len),
+  num_key  (min_len),
+  level_key(length_decay),
+  level_key(split_angle),
+  level_key(cutoff_prob),
+  num_key  (turn_angle),
+  num_key  (turn_jitter),
+  int_key  (ring_resolution),
+  int_key  (leaf_glob_depth),
+  num_key  (leaf_glob_scale),
+  int_key  (leaf_glob_pts)
+};
+
+#define num_keys (int)(sizeof(keys) / sizeof(keys[0]))
+
+#define max_line_len 1024
+
+static char error_msg[512];
+
+// Species pointers, in load order. Only the render thread loads species, and
+// each one keeps its address for the life of the process.
+static Array all_species = NULL;
+
+
+// Internal functions.
+
+static void set_error(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(error_msg, sizeof(error_msg), fmt, args);
+  va_end(args);
+}
+
+static Key *find_key(const char *name) {
+  for (int i = 0; i < num_keys; ++i) {
+    if (strcmp(keys[i].name, name) == 0) return keys + i;
+  }
+  return NULL;
+}
+
+// Sets the field of key in species from the given values. A per-level key
+// repeats its last value through the remaining levels.
+static void set_values(Species *species, Key *key, double *values,
+                       int num_values) {
+  char *field = (char *)species + key->offset;
+  for (int i = 0; i < key->num_values; ++i) {
+    double value = values[i < num_values ? i : num_values - 1];
+    if (key->type == key_type_int) {
+      ((int *)field)[i] = (int)value;
+    } else {
+      ((double *)field)[i] = value;
+    }
+  }
+}
+
+// Parses the key and values of a single line, which has had any comment
+// removed. Returns nonzero on success.
+static int parse_line(Species *species, char *line, int line_num) {
+  const char *space = " \t\r\n";
+  char *saveptr;
+  char *name = strtok_r(line, space, &saveptr);
+  if (name == NULL) return 1;  // A blank line.
+
+  Key *key = find_key(name);
+  if (key == NULL) {
+    set_error("line %d: unknown key '%s'", line_num, name);
+    return 0;
+  }
+
+  double values[species__max_levels];
+  int    num_values = 0;
+  char  *token;
+  while ((token = strtok_r(NULL, space, &saveptr))) {
+    if (num_values == key->num_values) {
+      set_error("line %d: %s takes at most %d value%s", line_num, name,
+                key->num_values, key->num_values == 1 ? "" : "s");
+      return 0;
+    }
+    char  *end;
+    double value = strtod(token, &end);
+    if (*end || !isfinite(value)) {
+      set_error("line %d: expected a number for %s, not '%s'", line_num, name,
+                token);
+      return 0;
+    }
+    if (key->type == key_type_int &&
+        (value != floor(value) || fabs(value) > 1e9)) {
+      set_error("line %d: expected an integer for %s, not '%s'", line_num,
+                name, token);
+      return 0;
+    }
+    values[num_values++] = value;
+  }
+  if (num_values == 0) {
+    set_error("line %d: %s needs a value", line_num, name);
+    return 0;
+  }
+
+  set_values(species, key, values, num_values);
+  return 1;
+}
+
+// Returns nonzero if species' values can make a tree.
+static int check_species(Species *species) {
+  Species *s = species;
+  if (s->max_height < 0 || s->max_height >= species__max_levels) {
+    set_error("max_height must be from 0 to %d", species__max_levels - 1);
+    return 0;
+  }
+  if (s->min_height < 0 || s->min_height > s->max_height) {
+    set_error("min_height must be from 0 to max_height");
+    return 0;
+  }
+  if (s->trunk_len <= 0 || s->min_len < 0) {
+    set_error("trunk_len must be positive, and min_len can't be negative");
+    return 0;
+  }
+  for (int i = 0; i < species__max_levels; ++i) {
+    if (s->length_decay[i] <= 0) {
+      set_error("length_decay must be positive");
+      return 0;
+    }
+    if (s->cutoff_prob[i] < 0 || s->cutoff_prob[i] > 1) {
+      set_error("cutoff_prob must be from 0 to 1");
+      return 0;
+    }
+  }
+  if (s->turn_jitter < 0) {
+    set_error("turn_jitter can't be negative");
+    return 0;
+  }
+  if (s->ring_resolution < 3) {
+    set_error("ring_resolution must be at least 3");
+    return 0;
+  }
+  if (s->leaf_glob_depth < 1 || s->leaf_glob_scale <= 0) {
+    set_error("leaf_glob_depth and leaf_glob_scale must be positive");
+    return 0;
+  }
+  if (s->leaf_glob_pts < 4) {
+    set_error("leaf_glob_pts must be at least 4");
+    return 0;
+  }
+  return 1;
+}
+
+static void push_levels(lua_State *L, const double *values) {
+  lua_createtable(L, species__max_levels, 0);
+      // stack = [.., levels]
+  for (int i = 0; i < species__max_levels; ++i) {
+    lua_pushnumber(L, values[i]);
+        // stack = [.., levels, values[i]]
+    lua_rawseti(L, -2, i + 1);
+        // stack = [.., levels]
+  }
+}
+
+
+// Internal: Lua C functions.
+
+// Lua C function.
+// Expected parameters: name.
+// Returns a table of the species' parameters.
+static int species__lua_load(lua_State *L) {
+  const char    *name    = luaL_checkstring(L, 1);
+  const Species *species = species__load(name);
+  if (species == NULL) return luaL_error(L, "%s", species__error());
+  species__push_params(L, species);
+  return 1;  // --> 1 Lua return value
+}
+
+// Lua C function.
+// Expected parameters: none.
+// Returns a table of the default parameters, with the name default.
+static int species__lua_defaults(lua_State *L) {
+  Species species;
+  species__set_defaults(&species, "default");
+  species__push_params(L, &species);
+  return 1;  // --> 1 Lua return value
+}
+
+
+// Public functions.
+
+void species__load_lib(lua_State *L) {
+  static const struct luaL_Reg lib[] = {
+    {"load",     species__lua_load},
+    {"defaults", species__lua_defaults},
+    {NULL, NULL}};
+  luaL_newlib(L, lib);          // --> stack = [.., species]
+  lua_setglobal(L, "species");  // --> stack = [..]
+}
+
+void species__set_defaults(Species *species, const char *name) {
+  memset(species, 0, sizeof(Species));
+  snprintf(species->name, sizeof(species->name), "%s", name);
+
+  species->max_height      = max_tree_height;
+  species->min_height      = min_tree_height;
+  species->trunk_len       = 0.5;
+  species->min_len         = 0.01;
+  species->turn_angle      = M_PI / 2;
+  species->turn_jitter     = 0.7;
+  species->ring_resolution = max_ring_pts;
+  species->leaf_glob_depth = 3;
+  species->leaf_glob_scale = 1.2;
+  species->leaf_glob_pts   = 30;
+  for (int i = 0; i < species__max_levels; ++i) {
+    species->length_decay[i] = branch_size_factor;
+    species->split_angle[i]  = 0.55;
+    species->cutoff_prob[i]  = 0.3;
+  }
+}
+
+int species__parse(Species *species, const char *text) {
+  char line[max_line_len + 1];
+  int  line_num = 0;
+  while (*text) {
+    ++line_num;
+    size_t len = strcspn(text, "\n");
+    if (len > max_line_len) {
+      set_error("line %d is longer than %d characters", line_num,
+                max_line_len);
+      return 0;
+    }
+    memcpy(line, text, len);
+    line[len] = '\0';
+    text += len + (text[len] == '\n');
+
+    char *comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    if (!parse_line(species, line, line_num)) return 0;
+  }
+  return check_species(species);
+}
+
+const Species *species__load(const char *name) {
+  const Species *species = species__find(name);
+  if (species) return species;
+
+  if (strlen(name) > species__max_name_len) {
+    set_error("the species name '%s' is too long", name);
+    return NULL;
+  }
+  char filename[species__max_name_len + 16];
+  snprintf(filename, sizeof(filename), "%s.species", name);
+  char *path = file__get_path(filename);
+  if (path == NULL || !file__exists(path)) {
+    set_error("can't find the species file %s", filename);
+    return NULL;
+  }
+  size_t size;
+  char  *text = file__contents(path, &size);
+  if (text == NULL) {
+    set_error("can't read the species file %s", filename);
+    return NULL;
+  }
+
+  Species *new_species = malloc(sizeof(Species));
+  species__set_defaults(new_species, name);
+  int ok = species__parse(new_species, text);
+  free(text);
+  if (!ok) {
+    char msg[sizeof(error_msg)];
+    snprintf(msg, sizeof(msg), "%s", error_msg);
+    set_error("error in %s, %s", filename, msg);
+    free(new_species);
+    return NULL;
+  }
+
+  if (all_species == NULL) all_species = array__new(0, sizeof(Species *));
+  array__add_item_val(all_species, new_species);
+  return new_species;
+}
+
+const Species *species__find(const char *name) {
+  if (all_species == NULL) return NULL;
+  array__for(Species **, species, all_species, i) {
+    if (strcmp((*species)->name, name) == 0) return *species;
+  }
+  return NULL;
+}
+
+const char *species__error() {
+  return error_msg;
+}
+
+void species__push_params(lua_State *L, const Species *species) {
+  const Species *s = species;
+  lua_newtable(L);
+      // stack = [.., params]
+
+#define set_field(push, name)    \
+    push(L, s->name);            \
+    lua_setfield(L, -2, #name);
+
+  set_field(lua_pushstring,  name);
+  set_field(lua_pushinteger, max_height);
+  set_field(lua_pushinteger, min_height);
+  set_field(lua_pushnumber,  trunk_len);
+  set_field(lua_pushnumber,  min_len);
+  set_field(push_levels,     length_decay);
+  set_field(push_levels,     split_angle);
+  set_field(push_levels,     cutoff_prob);
+  set_field(lua_pushnumber,  turn_angle);
+  set_field(lua_pushnumber,  turn_jitter);
+  set_field(lua_pushinteger, ring_resolution);
+  set_field(lua_pushinteger, leaf_glob_depth);
+  set_field(lua_pushnumber,  leaf_glob_scale);
+  set_field(lua_pushinteger, leaf_glob_pts);
+
+#undef set_field
+      // stack = [.., params]
+}
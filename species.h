@@ -0,0 +1,102 @@
+// species.h
+//
+// Tree species, which are sets of the parameters that shape generated trees.
+//
+// Each species is described by a text file, species/<name>.species. Each line
+// is a key followed by its values, which are numbers, and a # starts a comment
+// that runs to the end of the line:
+//
+//   max_height   10
+//   split_angle  0.7 0.6 0.55  # In radians; one value per level.
+//
+// Levels count sticks from the trunk, which is level 1. Per-level keys take one
+// value per level, up to species__max_levels of them, and the last value given
+// is used for every level past it. Other keys take a single value. Keys that a
+// file leaves out keep their default values, which match config.h and the
+// trees made before species existed. The keys are:
+//
+//   max_height       The most forks between the trunk and a leaf.
+//   min_height       The fewest forks before a branch may stop early.
+//   trunk_len        The average length of the trunk.
+//   min_len          Sticks shorter than this end in a leaf.
+//   length_decay     Per level; the average length of a stick's kids, as a
+//                    fraction of the stick's own average length.
+//   split_angle      Per level; the average angle between the kids of a stick.
+//   cutoff_prob      Per level; once min_height is reached, the chance that a
+//                    stick ends in a leaf.
+//   turn_angle       How far each fork's plane turns from its parent's, at
+//                    every other level.
+//   turn_jitter      The most that a fork's turn is randomly moved by.
+//   ring_resolution  The most points in a bark ring; at least 3.
+//   leaf_glob_depth  Leaf globs grow at forks this many sticks below a leaf.
+//   leaf_glob_scale  A glob's radius, as a multiple of its fork's distance to
+//                    its farthest leaf.
+//   leaf_glob_pts    The number of corners of each glob; at least 4.
+//
+// A file is parsed once into a Species, a flat block of numbers. Loaded species
+// are never changed or freed, so they can be read from any thread; the
+// generator thread makes trees of any loaded species without loading anything
+// itself. Species are only loaded from the render thread.
+//
+// Lua interface:
+//
+//   -- Loads species/<name>.species, unless it's already loaded, and returns
+//   -- its parameters as a table for make_tree.make. The table has a key for
+//   -- each of the keys above, along with name. Per-level values are sequences
+//   -- with an item for every level. Raises an error if the file can't be found
+//   -- or parsed.
+//   params = species.load(name)
+//
+//   -- Returns the default parameters, in the same format, with the name
+//   -- default. These are what make_tree uses for trees made without a species.
+//   params = species.defaults()
+//
+
+#pragma once
+
+#include "lua/lua.h"
+
+#define species__max_levels   32
+#define species__max_name_len 63
+
+typedef struct {
+  char   name[species__max_name_len + 1];
+  int    max_height;
+  int    min_height;
+  double trunk_len;
+  double min_len;
+  double length_decay[species__max_levels];
+  double split_angle [species__max_levels];
+  double cutoff_prob [species__max_levels];
+  double turn_angle;
+  double turn_jitter;
+  int    ring_resolution;
+  int    leaf_glob_depth;
+  double leaf_glob_scale;
+  int    leaf_glob_pts;
+} Species;
+
+void           species__load_lib(lua_State *L);
+
+// Sets every parameter of species to its default, and its name to name.
+void           species__set_defaults(Species *species, const char *name);
+
+// Parses text, in the format above, into species, on top of its current
+// values. Returns nonzero on success; otherwise, species__error describes the
+// problem, and species may be partly changed.
+int            species__parse(Species *species, const char *text);
+
+// Returns the species with the given name, loading it if needed. Returns NULL
+// if it can't be loaded; species__error then describes why.
+const Species *species__load(const char *name);
+
+// Returns the loaded species with the given name, or NULL if there isn't one.
+const Species *species__find(const char *name);
+
+// Returns a description of the last error from species__parse or species__load.
+// It's overwritten by the next error.
+const char    *species__error();
+
+// Pushes a new table of species' parameters, as returned by species.load, onto
+// L's stack. This can be called from any thread, with that thread's state.
+void           species__push_params(lua_State *L, const Species *species);
@@ -0,0 +1,47 @@
+// spsc.c
+//
+
+#include "spsc.h"
+
+// Standard library includes.
+#include <stdlib.h>
+
+
+// Public functions.
+
+void spsc__init(spsc__Queue *queue, int capacity) {
+  size_t size = 1;
+  while (size < (size_t)capacity) size *= 2;
+  queue->items = calloc(size, sizeof(void *));
+  queue->mask  = size - 1;
+  queue->head  = 0;
+  queue->tail  = 0;
+}
+
+void spsc__release(spsc__Queue *queue) {
+  free(queue->items);
+  queue->items = NULL;
+}
+
+int spsc__push(spsc__Queue *queue, void *item) {
+  size_t tail = queue->tail;  // Only we write this, so a plain read is fine.
+  size_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+  if (tail - head > queue->mask) return 0;  // Full.
+
+  queue->items[tail & queue->mask] = item;
+  // The release store makes the item visible before the new tail is.
+  __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+void *spsc__pop(spsc__Queue *queue) {
+  size_t head = queue->head;  // Only we write this, so a plain read is fine.
+  size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+  if (head == tail) return NULL;  // Empty.
+
+  void *item = queue->items[head & queue->mask];
+  // The release store keeps the producer from reusing the slot before we've
+  // read it.
+  __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+  return item;
+}
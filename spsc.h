@@ -0,0 +1,42 @@
+// spsc.h
+//
+// A lock-free, bounded, single-producer/single-consumer queue of pointers.
+//
+// Exactly one thread may push and exactly one thread may pop; neither ever
+// blocks. The head and tail indexes live on separate cache lines so the two
+// threads don't contend over them.
+//
+// Usage:
+//
+//   spsc__Queue queue;
+//   spsc__init(&queue, 8);  // The capacity is rounded up to a power of two.
+//
+//   // Producer thread.
+//   if (!spsc__push(&queue, item)) { /* The queue is full. */ }
+//
+//   // Consumer thread.
+//   void *item = spsc__pop(&queue);  // NULL if the queue is empty.
+//
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct {
+  void   **items;
+  size_t   mask;      // The capacity minus one.
+  char     pad0[64];
+  size_t   head;      // The next index to pop; written only by the consumer.
+  char     pad1[64];
+  size_t   tail;      // The next index to push; written only by the producer.
+  char     pad2[64];
+} spsc__Queue;
+
+void  spsc__init   (spsc__Queue *queue, int capacity);
+void  spsc__release(spsc__Queue *queue);
+
+// Returns nonzero on success, and 0 if the queue is full. Items can't be NULL.
+int   spsc__push(spsc__Queue *queue, void *item);
+
+// Returns NULL if the queue is empty.
+void *spsc__pop (spsc__Queue *queue);
@@ -0,0 +1,167 @@
+// stream_buffer.c
+//
+
+#include "stream_buffer.h"
+
+// Local includes.
+#include "glstate.h"
+
+// Standard library includes.
+#include <string.h>
+
+
+// Internal types and globals.
+
+static int frame = 0;
+
+
+// Internal functions.
+
+static void delete_fences(stream_buffer__Buffer *stream) {
+  for (int i = 0; i < stream_buffer__num_regions; ++i) {
+    if (stream->fences[i]) glDeleteSync(stream->fences[i]);
+    stream->fences[i] = NULL;
+  }
+}
+
+// This (re)allocates the buffer's data store and starts over at region 0.
+static void allocate(stream_buffer__Buffer *stream) {
+  glstate__bind_array_buffer(stream->vbo);
+  glBufferData(GL_ARRAY_BUFFER,                   // buffer use target
+               stream_buffer__num_regions *
+               stream->region_size * stream->vertex_size,  // size
+               NULL,                              // data
+               GL_STREAM_DRAW);                   // usage hint
+  stream->region   = 0;
+  stream->num_used = 0;
+}
+
+// Fences off the region we've been writing, and moves on to the next one. This
+// waits until the gpu is done with any earlier draws from that next region.
+static void next_region(stream_buffer__Buffer *stream) {
+  if (stream->num_used) {
+    stream->fences[stream->region] =
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);  // 0 --> flags
+  }
+
+  stream->region   = (stream->region + 1) % stream_buffer__num_regions;
+  stream->num_used = 0;
+
+  GLsync fence = stream->fences[stream->region];
+  if (fence == NULL) return;
+  GLenum status;
+  do {
+    status = glClientWaitSync(fence,                       // sync
+                              GL_SYNC_FLUSH_COMMANDS_BIT,  // flags
+                              1000000);                    // timeout in ns
+  } while (status == GL_TIMEOUT_EXPIRED);
+  glDeleteSync(fence);
+  stream->fences[stream->region] = NULL;
+}
+
+// Copies num_bytes from offset read_offset of read_buffer to offset
+// write_offset of write_buffer, on the gpu.
+static void copy_data(GLuint read_buffer, GLintptr read_offset,
+                      GLuint write_buffer, GLintptr write_offset,
+                      GLsizeiptr num_bytes) {
+  glBindBuffer(GL_COPY_READ_BUFFER,  read_buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, write_buffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER,   // read target
+                      GL_COPY_WRITE_BUFFER,  // write target
+                      read_offset,           // read offset
+                      write_offset,          // write offset
+                      num_bytes);            // size
+}
+
+// Makes room for num_vertices more vertices in the current region.
+//
+// Queued draws may refer to this frame's data by vertex index, and they must
+// stay in the draw queue's order, so the data is copied to the same place in
+// the new data store, whose region 0 is large enough to hold it along with the
+// new vertices. Orphaning the old data store lets the driver keep any data from
+// earlier frames alive for draws the gpu hasn't finished.
+static void grow(stream_buffer__Buffer *stream, GLsizei num_vertices) {
+  // This frame's data runs from vertex start to end; if there isn't any, it
+  // can start at 0.
+  GLsizei start    = 0;
+  if (stream->num_used) start = stream->region * stream->region_size;
+  GLsizei end      = start + stream->num_used;
+  GLsizei new_size = stream->region_size;
+  while (new_size < end + num_vertices) new_size *= 2;
+
+  GLsizeiptr num_bytes = (GLsizeiptr)stream->num_used * stream->vertex_size;
+  GLuint     saved     = 0;
+  if (num_bytes) {
+    glGenBuffers(1, &saved);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, saved);
+    glBufferData(GL_COPY_WRITE_BUFFER, num_bytes, NULL, GL_STREAM_COPY);
+    copy_data(stream->vbo, (GLintptr)start * stream->vertex_size,  // read
+              saved, 0,                                            // write
+              num_bytes);
+  }
+
+  delete_fences(stream);
+  stream->region_size = new_size;
+  allocate(stream);
+
+  if (saved) {
+    copy_data(saved, 0,                                            // read
+              stream->vbo, (GLintptr)start * stream->vertex_size,  // write
+              num_bytes);
+    glDeleteBuffers(1, &saved);
+  }
+  stream->num_used = end;
+}
+
+// Public functions.
+
+void stream_buffer__init(stream_buffer__Buffer *stream,
+                         GLsizei vertex_size, GLsizei num_vertices) {
+  stream->vertex_size = vertex_size;
+  stream->region_size = num_vertices > 0 ? num_vertices : 1;
+  stream->frame       = frame;
+  for (int i = 0; i < stream_buffer__num_regions; ++i) stream->fences[i] = NULL;
+
+  glGenBuffers(1, &stream->vbo);
+  allocate(stream);
+}
+
+GLint stream_buffer__push(stream_buffer__Buffer *stream,
+                          const void *vertices, GLsizei num_vertices) {
+  if (stream->frame != frame) {
+    next_region(stream);
+    stream->frame = frame;
+  }
+  if (stream->num_used + num_vertices > stream->region_size) {
+    grow(stream, num_vertices);
+  }
+
+  GLint first = stream->region * stream->region_size + stream->num_used;
+  if (num_vertices == 0) return first;
+
+  glstate__bind_array_buffer(stream->vbo);
+  GLbitfield access = GL_MAP_WRITE_BIT             |
+                      GL_MAP_UNSYNCHRONIZED_BIT    |
+                      GL_MAP_INVALIDATE_RANGE_BIT;
+  void *dst = glMapBufferRange(GL_ARRAY_BUFFER,                  // target
+                               first * stream->vertex_size,      // offset
+                               num_vertices * stream->vertex_size,  // length
+                               access);                          // access
+  if (dst) {
+    memcpy(dst, vertices, num_vertices * stream->vertex_size);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+  }
+
+  stream->num_used += num_vertices;
+  return first;
+}
+
+void stream_buffer__release(stream_buffer__Buffer *stream) {
+  delete_fences(stream);
+  glstate__delete_buffer(stream->vbo);
+  stream->vbo = 0;
+}
+
+void stream_buffer__end_frame() {
+  frame++;
+}
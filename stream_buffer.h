@@ -0,0 +1,64 @@
+// stream_buffer.h
+//
+// Vertex buffers for data that changes every frame.
+//
+// Each stream buffer is one OpenGL buffer split into three regions. Every frame
+// writes into the next region, so the gpu can keep reading the data from the
+// last two frames while the cpu writes new data. Writes go through
+// glMapBufferRange with GL_MAP_UNSYNCHRONIZED_BIT, and a fence per region
+// ensures we never overwrite data that's still waiting to be drawn. After
+// setup, pushing data allocates no OpenGL objects.
+//
+// Data is pushed in whole vertices, and each push returns the index of its
+// first vertex. That means a vao can set up its attributes once, with offsets
+// relative to the start of the buffer, and draw pushed data by using the
+// returned index as the first vertex in glDrawArrays.
+//
+// Usage:
+//
+//   // Once:
+//   stream_buffer__Buffer stream;
+//   stream_buffer__init(&stream, sizeof(MyVertex), 1024);
+//   // Set up a vao's attributes using stream.vbo.
+//
+//   // Any number of times per frame:
+//   GLint first = stream_buffer__push(&stream, vertices, num_vertices);
+//   // Draw num_vertices vertices starting at first.
+//
+//   // Once per frame, after all draws have been made:
+//   stream_buffer__end_frame();
+//
+
+#pragma once
+
+#include "glinclude.h"
+
+#define stream_buffer__num_regions 3
+
+typedef struct {
+  GLuint  vbo;
+  GLsizei vertex_size;     // In bytes.
+  GLsizei region_size;     // In vertices.
+  int     region;          // The region currently being written.
+  GLsizei num_used;        // The number of vertices used in this region.
+  int     frame;           // The frame of the last push.
+  GLsync  fences[stream_buffer__num_regions];
+} stream_buffer__Buffer;
+
+// This creates the buffer with room for num_vertices vertices per region.
+void  stream_buffer__init(stream_buffer__Buffer *stream,
+                          GLsizei vertex_size, GLsizei num_vertices);
+
+// This copies the given vertices into the current region and returns the index
+// of the first one. If they don't fit, the buffer is reallocated with larger
+// regions. The data already pushed this frame keeps its vertex indexes, so
+// queued draws of it stay valid.
+GLint stream_buffer__push(stream_buffer__Buffer *stream,
+                          const void *vertices, GLsizei num_vertices);
+
+// This deletes the buffer and any fences.
+void  stream_buffer__release(stream_buffer__Buffer *stream);
+
+// This marks the end of a frame for all stream buffers. The next push into any
+// stream buffer starts a new region.
+void  stream_buffer__end_frame();
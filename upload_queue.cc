@@ -0,0 +1,124 @@
+// upload_queue.cc
+//
+
+#include "upload_queue.h"
+
+extern "C" {
+#include "cstructs/cstructs.h"
+#include "frame_uniforms.h"
+}
+
+#include "glm/glm.hpp"
+#define GLM_FORCE_RADIANS
+#include "glm/gtc/type_ptr.hpp"
+using namespace glm;
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// Internal types and globals.
+
+typedef struct {
+  upload_queue__Job job;
+  GLsizeiptr        num_sent;
+  float             priority;  // Smaller values go first.
+} Item;
+
+static Array items = NULL;  // Item values.
+
+
+// Internal functions.
+
+static int compare_items(void *context, const void *a, const void *b) {
+  (void)context;
+  float pa = ((const Item *)a)->priority, pb = ((const Item *)b)->priority;
+  return (pa > pb) - (pa < pb);
+}
+
+// Sets each item's priority to its squared distance from the eye, in model
+// space, or to -1 if it has no position.
+static void update_priorities() {
+  GLfloat model_view[16];
+  frame_uniforms__get_model_view(model_view);
+  vec3 eye = vec3(inverse(make_mat4(model_view)) * vec4(0, 0, 0, 1));
+
+  array__for(Item *, item, items, i) {
+    if (!item->job.has_center) {
+      item->priority = -1;
+      continue;
+    }
+    vec3 d = make_vec3(item->job.center) - eye;
+    item->priority = dot(d, d);
+  }
+}
+
+
+// Public functions.
+
+extern "C" void upload_queue__add(upload_queue__Job *job) {
+  if (items == NULL) items = array__new(64, sizeof(Item));
+  Item *item = (Item *)array__new_ptr(items);
+  item->job      = *job;
+  item->num_sent = 0;
+  item->priority = 0;
+}
+
+extern "C" void upload_queue__cancel(void *owner) {
+  if (items == NULL) return;
+  int n = 0;
+  array__for(Item *, item, items, i) {
+    if (item->job.owner == owner) {
+      free(item->job.data);
+    } else {
+      *(Item *)array__item_ptr(items, n++) = *item;
+    }
+  }
+  items->count = n;
+}
+
+extern "C" void upload_queue__run(size_t budget) {
+  if (items == NULL || items->count == 0) return;
+
+  update_priorities();
+  array__sort(items, compare_items, NULL);
+
+  // We use the copy-write target so as not to disturb the array buffer binding
+  // tracked by glstate.
+  size_t num_left = budget ? budget : (size_t)-1;
+  int    num_done = 0;
+  array__for(Item *, item, items, i) {
+    if (num_left == 0) break;
+    upload_queue__Job *job = &item->job;
+    GLsizeiptr size = job->size - item->num_sent;
+    if ((size_t)size > num_left) size = (GLsizeiptr)num_left;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, *job->vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER,                    // target
+                    job->offset + item->num_sent,            // offset
+                    size,                                    // size
+                    (char *)job->data + item->num_sent);     // data
+    item->num_sent += size;
+    num_left       -= size;
+
+    if (item->num_sent < job->size) break;  // The budget is used up.
+    free(job->data);
+    if (job->done) job->done(job->owner, job->tag);
+    num_done++;
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  // The finished items are all at the front, in sorted order.
+  int n = items->count - num_done;
+  memmove(items->items, array__item_ptr(items, num_done), n * sizeof(Item));
+  items->count = n;
+}
+
+extern "C" size_t upload_queue__bytes_pending() {
+  size_t num_bytes = 0;
+  if (items == NULL) return 0;
+  array__for(Item *, item, items, i) {
+    num_bytes += item->job.size - item->num_sent;
+  }
+  return num_bytes;
+}
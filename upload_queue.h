@@ -0,0 +1,69 @@
+// upload_queue.h
+//
+// Spreads large vertex buffer uploads over several frames.
+//
+// Rather than sending a whole mesh to the gpu at once, owners create their
+// buffers empty and add jobs here. Each frame, upload_queue__run sends at most
+// a fixed number of bytes, split into glBufferSubData calls, so a forest
+// streaming in doesn't cause frame time spikes. Jobs with a position are
+// uploaded nearest-to-the-camera first; jobs without one go before all others.
+//
+// Usage:
+//
+//   upload_queue__Job job = {
+//     .vbo   = &my_vbo,  // Read at upload time, so the owner can reallocate.
+//     .size  = num_bytes,
+//     .data  = data,     // malloc'd; the queue frees it when it's done.
+//     .owner = me,
+//     .done  = my_done_callback,
+//     .tag   = 3
+//   };
+//   upload_queue__add(&job);
+//
+//   // Once per frame, after frame_uniforms__set_frame and before drawing:
+//   upload_queue__run(budget_in_bytes);
+//
+//   // When the owner is deleted, so that its jobs are dropped:
+//   upload_queue__cancel(me);
+//
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "glinclude.h"
+
+#include <stddef.h>
+
+typedef struct {
+  GLuint     *vbo;
+  GLintptr    offset;       // The byte offset into the buffer.
+  GLsizeiptr  size;         // The number of bytes to upload.
+  void       *data;
+
+  int         has_center;   // If nonzero, center is used to prioritize.
+  GLfloat     center[3];    // In model space.
+
+  // This is called when the last byte of the job has been sent.
+  void       *owner;
+  void      (*done)(void *owner, int tag);
+  int         tag;
+} upload_queue__Job;
+
+// The job is copied, and the queue takes ownership of job->data.
+void upload_queue__add(upload_queue__Job *job);
+
+// Drops all unfinished jobs with the given owner without calling done.
+void upload_queue__cancel(void *owner);
+
+// Uploads up to budget bytes from the queue. A budget of 0 means no limit.
+void upload_queue__run(size_t budget);
+
+// Returns the number of bytes that haven't been uploaded yet.
+size_t upload_queue__bytes_pending();
+
+#ifdef __cplusplus
+}
+#endif
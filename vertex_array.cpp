@@ -5,8 +5,15 @@
 
 extern "C" {
 #include "cstructs/cstructs.h"
+#include "draw_queue.h"
 #include "file.h"
 #include "glhelp.h"
+#include "glstate.h"
+#include "luahelp.h"
+#include "normals.h"
+#include "stream_buffer.h"
+#include "upload_queue.h"
+#include "wind.h"
 #include "lua/lauxlib.h"
 }
 
@@ -15,6 +22,8 @@ extern "C" {
 #include "glm/gtc/matrix_transform.hpp"
 using namespace glm;
 
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define for_i_3 for(int i = 0; i < 3; ++i)
@@ -26,11 +35,11 @@ using namespace glm;
 
 // State shared across all VertexArray instances.
 static GLuint            program;
-static GLint             mvp_loc;
-static GLint    normal_xform_loc;
 static GLint           color_loc;
-static vertex_array__TransformCallback          mvp_callback = NULL;
-static vertex_array__TransformCallback normal_xform_callback = NULL;
+
+// Arrays with a Wind are drawn with this program instead.
+static GLuint       wind_program;
+static GLint      wind_color_loc;
 
 typedef enum {
   mode_triangle_strip,
@@ -47,68 +56,179 @@ typedef struct {
   int    num_pts;
   Mode   draw_mode;
   vec3   color;
+
+  // Dynamic arrays have no buffers of their own. They keep their interleaved
+  // DynamicVertex data here, and push it into the shared stream buffer each
+  // time they're drawn.
+  int    is_dynamic;
+  Array  dynamic_data;
+
+  // Arrays whose data goes through the upload queue aren't drawn until all of
+  // it has reached the gpu.
+  int    num_pending_uploads;
+
+  // Arrays skinned with set_wind have a SkinVertex per vertex in skin_vbo.
+  // The Wind is kept alive as the array's user value.
+  Wind  *wind;
+  GLuint skin_vbo;
 } VertexArray;
 
+// The normal is packed as GL_INT_2_10_10_10_REV.
+typedef struct {
+  GLfloat pt[3];
+  GLuint  normal;
+} DynamicVertex;
+
+// The bones and weight of a vertex, in the skin format of bones.lua. The
+// weight is normalized to [0, 1] by the gpu.
+typedef struct {
+  GLushort bones[2];  // The vertex's bone, then its parent.
+  GLushort weight;
+  GLushort padding;
+} SkinVertex;
+
+// All dynamic arrays share this stream buffer and vao.
+static stream_buffer__Buffer dynamic_stream;
+static GLuint                dynamic_vao;
+
 // Names for vertex attribute indexes in our vertex shader.
 enum {
   v_position,
   color,
-  normal
+  normal,
+  skin_bones,
+  skin_weight
 };
 
 
 // Internal: OpenGL utility code.
 
+// Normals are sent as GL_INT_2_10_10_10_REV, which is a quarter the size of
+// three floats. The shader sees them as normalized vec3s, as before.
+static void set_packed_normal_attrib(GLsizei stride, size_t offset) {
+  glEnableVertexAttribArray(normal);
+  glVertexAttribPointer(normal,                  // attrib index
+                        4,                       // num coords
+                        GL_INT_2_10_10_10_REV,   // coord type
+                        GL_TRUE,                 // gpu should normalize
+                        stride,                  // stride
+                        (void *)offset);         // offset
+}
+
+// Returns a new Array of GLuints with the packed form of each normal in n_vecs.
+static Array new_packed_normals(Array n_vecs) {
+  int      num_normals = n_vecs->count / 3;
+  Array    packed      = array__new(num_normals, sizeof(GLuint));
+  GLuint  *out = (GLuint *)array__resize_uninitialized(packed, num_normals);
+  GLfloat *n   = (GLfloat *)n_vecs->items;
+  for (int j = 0; j < num_normals; ++j) {
+    out[j] = normals__pack_2_10_10_10(n + 3 * j);
+  }
+  return packed;
+}
+
+// Returns a new Array of SkinVertex values for the flat sequence of skin
+// triples in skin_nums, or NULL if any bone isn't below num_bones or doesn't
+// fit in a GLushort.
+static Array new_skin(Array skin_nums, int num_bones) {
+  Array skin = array__new(skin_nums->count / 3, sizeof(SkinVertex));
+  for (int j = 0; j + 2 < skin_nums->count; j += 3) {
+    GLfloat    *nums = (GLfloat *)array__item_ptr(skin_nums, j);
+    SkinVertex *v    = (SkinVertex *)array__new_ptr(skin);
+    for (int i = 0; i < 2; ++i) {
+      if (nums[i] < 0 || nums[i] >= num_bones || nums[i] > UINT16_MAX) {
+        array__delete(skin);
+        return NULL;
+      }
+      v->bones[i] = (GLushort)nums[i];
+    }
+    v->weight  = (GLushort)(clamp(nums[2], 0.0f, 1.0f) * 65535 + 0.5);
+    v->padding = 0;
+  }
+  return skin;
+}
+
 // Initialize data that's constant across all instances.
 // This function is expected to be called only once.
 static void gl_init() {
   program = glhelp__load_program("bark.vert.glsl",
                                  "bark.frag.glsl");
 
-  mvp_loc            = glGetUniformLocation(program, "mvp");
-  normal_xform_loc   = glGetUniformLocation(program, "normal_xform");
   color_loc          = glGetUniformLocation(program, "color");
-}
 
-static void set_array_as_buffer_data(Array array) {
-  glBufferData(GL_ARRAY_BUFFER,                  // buffer use target
-               array->count * array->item_size,  // size
-               array->items,                     // data
-               GL_STATIC_DRAW);                  // usage hint
-}
+  wind_program   = glhelp__load_program("bark_wind.vert.glsl",
+                                        "bark.frag.glsl");
+  wind_color_loc = glGetUniformLocation(wind_program, "color");
 
-static void gl_setup_new_vertex_array(VertexArray *v_array,
-                                      Array v_pts) {
-
-  // Compute the normals of each triangle.
-  Array n_vecs = array__new(v_pts->count, sizeof(GLfloat));
-  float sign = 1;
-  array__for(GLfloat *, pt, v_pts, j) {
-    if (j % 3) continue;  // Only use pt when it is 3-aligned.
-    if (j < 6) {
-      // The first two normals can be all-zero.
-      for_i_3 array__new_val(n_vecs, GLfloat) = 0.0f;
-      continue;
-    }
+  // The palette is always on texture unit 0.
+  glUniform1i(glGetUniformLocation(wind_program, "palette"), 0);
 
-    vec3 pt0 = vec3(pt[-6], pt[-5], pt[-4]);
-    vec3 pt1 = vec3(pt[-3], pt[-2], pt[-1]);
-    vec3 pt2 = vec3(pt[ 0], pt[ 1], pt[ 2]);
+  stream_buffer__init(&dynamic_stream, sizeof(DynamicVertex), 4096);
 
-    vec3 n = sign * normalize(cross(pt1 - pt0, pt2 - pt1));
-    for_i_3 array__new_val(n_vecs, GLfloat) = n[i];
+  glGenVertexArrays(1, &dynamic_vao);
+  glstate__bind_vertex_array(dynamic_vao);
+  glstate__bind_array_buffer(dynamic_stream.vbo);
+  glEnableVertexAttribArray(v_position);
+  glVertexAttribPointer(v_position,                            // attrib index
+                        3,                                     // num coords
+                        GL_FLOAT,                              // coord type
+                        GL_FALSE,                              // normalize
+                        sizeof(DynamicVertex),                 // stride
+                        (void *)offsetof(DynamicVertex, pt));  // offset
+  set_packed_normal_attrib(sizeof(DynamicVertex),
+                           offsetof(DynamicVertex, normal));
+}
 
-    if (v_array->draw_mode == mode_triangle_strip) sign *= -1;
-  }
+// This is called by the upload queue when one of an array's uploads is done.
+static void upload_done(void *owner, int tag) {
+  (void)tag;
+  ((VertexArray *)owner)->num_pending_uploads--;
+}
+
+// This expects vbo to be bound as the array buffer. If v_array is NULL, the
+// data is sent now. Otherwise the buffer starts out empty, and a copy of the
+// data is sent by the upload queue over the next few frames.
+static void set_array_as_buffer_data(Array array, GLuint *vbo,
+                                     VertexArray *v_array) {
+  GLsizeiptr size = array->count * array->item_size;
+  glBufferData(GL_ARRAY_BUFFER,                     // buffer use target
+               size,                                // size
+               v_array ? NULL : array->items,       // data
+               GL_STATIC_DRAW);                     // usage hint
+  if (v_array == NULL || size == 0) return;
+
+  upload_queue__Job job = {
+    .vbo        = vbo,
+    .offset     = 0,
+    .size       = size,
+    .data       = memcpy(malloc(size), array->items, size),
+    .has_center = 0,
+    .center     = {0, 0, 0},
+    .owner      = v_array,
+    .done       = upload_done,
+    .tag        = 0
+  };
+  upload_queue__add(&job);
+  v_array->num_pending_uploads++;
+}
+
+// This expects packed_normals to hold one packed normal per vertex, as from
+// vertex_array__new_packed_normals. If do_queue is nonzero, the data is sent
+// through the upload queue.
+static void gl_setup_new_vertex_array(VertexArray *v_array,
+                                      Array v_pts,
+                                      Array packed_normals,
+                                      int   do_queue) {
+  VertexArray *queue_owner = do_queue ? v_array : NULL;
 
   // Set up and bind the vao.
   glGenVertexArrays(1, &v_array->vao);
-  glBindVertexArray(v_array->vao);
+  glstate__bind_vertex_array(v_array->vao);
 
   // Set up the vertex position vbo.
   glGenBuffers(1, &v_array->vertices_vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, v_array->vertices_vbo);
-  set_array_as_buffer_data(v_pts);
+  glstate__bind_array_buffer(v_array->vertices_vbo);
+  set_array_as_buffer_data(v_pts, &v_array->vertices_vbo, queue_owner);
   glEnableVertexAttribArray(v_position);
   glVertexAttribPointer(v_position,    // attrib index
                         3,             // num coords
@@ -122,72 +242,212 @@ static void gl_setup_new_vertex_array(VertexArray *v_array,
 
   // Set up the normal vectors vbo.
   glGenBuffers(1, &v_array->normals_vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, v_array->normals_vbo);
-  set_array_as_buffer_data(n_vecs);
-  glEnableVertexAttribArray(normal);
-  glVertexAttribPointer(normal,        // attrib index
-                        3,             // num coords
-                        GL_FLOAT,      // coord type
-                        GL_FALSE,      // gpu should normalize
-                        0,             // stride
-                        (void *)(0));  // offset
+  glstate__bind_array_buffer(v_array->normals_vbo);
+  set_array_as_buffer_data(packed_normals, &v_array->normals_vbo,
+                           queue_owner);
+  set_packed_normal_attrib(0, 0);  // 0, 0 --> stride, offset
 
   glhelp__error_check;
 }
 
+// This expects skin to hold one SkinVertex per vertex of v_array, as from
+// new_skin. If v_array is still being uploaded, the skin is sent through the
+// upload queue as well.
+static void gl_set_skin(VertexArray *v_array, Array skin) {
+  VertexArray *queue_owner = v_array->num_pending_uploads ? v_array : NULL;
+
+  glstate__bind_vertex_array(v_array->vao);
+  if (v_array->skin_vbo == 0) glGenBuffers(1, &v_array->skin_vbo);
+  glstate__bind_array_buffer(v_array->skin_vbo);
+  set_array_as_buffer_data(skin, &v_array->skin_vbo, queue_owner);
+  glEnableVertexAttribArray(skin_bones);
+  glVertexAttribIPointer(skin_bones,                            // attrib index
+                         2,                                     // num coords
+                         GL_UNSIGNED_SHORT,                     // coord type
+                         sizeof(SkinVertex),                    // stride
+                         (void *)offsetof(SkinVertex, bones));  // offset
+  glEnableVertexAttribArray(skin_weight);
+  glVertexAttribPointer(skin_weight,                            // attrib index
+                        1,                                      // num coords
+                        GL_UNSIGNED_SHORT,                      // coord type
+                        GL_TRUE,                                // normalize
+                        sizeof(SkinVertex),                     // stride
+                        (void *)offsetof(SkinVertex, weight));  // offset
 
-// Internal: Lua C functions.
+  glhelp__error_check;
+}
 
-// This function expects an error string to be on top of the stack. It prints
-// that message along with a stack trace starting with the first callee before
-// the current C function. This function does not return.
-//
-// This function was originally based on code found here:
-// http://stackoverflow.com/questions/12256455/
-static int lua_traceback(lua_State *L) {
-  int msg_index = lua_gettop(L);
-  lua_getglobal(L, "debug");
-  lua_getfield(L, -1, "traceback");
-  lua_pushvalue(L, msg_index);
-  lua_pushinteger(L, 2);
-  lua_call(L, 2, 1);
-  return lua_error(L);
+// Replaces num_old vertices, starting with vertex first, of the num_vertices
+// vertices in vbo with the data in new_data. Each vertex has vertex_size bytes.
+// The buffer keeps its name, so the vaos that refer to it don't change. If the
+// size changes, the old contents are copied into a temporary buffer and back,
+// all on the gpu.
+static void replace_buffer_range(GLuint vbo, GLsizeiptr vertex_size,
+                                 int num_vertices, int first, int num_old,
+                                 Array new_data) {
+  GLintptr   offset   = first * vertex_size;
+  GLsizeiptr new_size = new_data->count * new_data->item_size;
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+  if (new_size == num_old * vertex_size) {
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, new_size, new_data->items);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return;
+  }
+
+  GLsizeiptr old_size  = num_vertices * vertex_size;
+  GLintptr   old_tail  = (first + num_old) * vertex_size;
+  GLsizeiptr tail_size = old_size - old_tail;
+
+  GLuint old_copy;
+  glGenBuffers(1, &old_copy);
+  glBindBuffer(GL_COPY_READ_BUFFER, old_copy);
+  glBufferData(GL_COPY_READ_BUFFER,         // buffer use target
+               old_size,                    // size
+               NULL,                        // data
+               GL_STREAM_COPY);             // usage hint
+  glCopyBufferSubData(GL_COPY_WRITE_BUFFER,  // read target
+                      GL_COPY_READ_BUFFER,   // write target
+                      0, 0,                  // read offset, write offset
+                      old_size);             // size
+
+  glBufferData(GL_COPY_WRITE_BUFFER,        // buffer use target
+               old_size - (old_tail - offset) + new_size,  // size
+               NULL,                        // data
+               GL_STATIC_DRAW);             // usage hint
+  if (offset > 0) {
+    glCopyBufferSubData(GL_COPY_READ_BUFFER,   // read target
+                        GL_COPY_WRITE_BUFFER,  // write target
+                        0, 0,                  // read offset, write offset
+                        offset);               // size
+  }
+  if (new_size > 0) {
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, new_size, new_data->items);
+  }
+  if (tail_size > 0) {
+    glCopyBufferSubData(GL_COPY_READ_BUFFER,        // read target
+                        GL_COPY_WRITE_BUFFER,       // write target
+                        old_tail,                   // read offset
+                        offset + new_size,          // write offset
+                        tail_size);                 // size
+  }
+
+  glBindBuffer(GL_COPY_READ_BUFFER,  0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glDeleteBuffers(1, &old_copy);
 }
 
-// This creates an Array of GLfloats from what is expected to be a Lua array at
-// the given index on L's stack. The caller is responsible for calling
-// array__delete on the returned Array. L's stack is preserved.
-static Array c_array_from_lua_array(lua_State *L, int index) {
-
-  int arr_len = (int)lua_rawlen(L, index);
-
-  Array arr = array__new(arr_len, sizeof(GLfloat));
-  for (int i = 1;; lua_pop(L, 1), ++i) {
-      // stack = [.. lua_arr ..]
-    lua_rawgeti(L, index, i);
-      // stack = [.. lua_arr .. lua_arr[i]]
-    if (lua_isnil(L, -1)) break;
-    if (!lua_isnumber(L, -1)) {
-      lua_pushstring(L, "Expected a flat array.");
-      lua_traceback(L);  // This function never returns.
-    }
-    array__new_val(arr, GLfloat) = lua_tonumber(L, -1);
+// Replaces the data of a dynamic array. No OpenGL calls are made here; the data
+// is sent each time the array is drawn.
+static void set_dynamic_data(VertexArray *v_array, Array v_pts) {
+  int is_strip = (v_array->draw_mode == mode_triangle_strip);
+  Array n_vecs = normals__new_for_vertices(v_pts, is_strip);
+
+  v_array->num_pts = v_pts->count / 3;
+  array__clear(v_array->dynamic_data);
+  for (int j = 0; j < v_array->num_pts; ++j) {
+    DynamicVertex *v = (DynamicVertex *)array__new_ptr(v_array->dynamic_data);
+    for_i_3 v->pt[i] = array__item_val(v_pts, 3 * j + i, GLfloat);
+    GLfloat *n = (GLfloat *)array__item_ptr(n_vecs, 3 * j);
+    v->normal  = normals__pack_2_10_10_10(n);
+  }
+
+  array__delete(n_vecs);
+}
+
+
+// Internal: Lua helper functions.
+
+// This makes the VertexArray at index sway with the Wind at wind_index, where
+// skin_nums holds a skin triple per vertex. Returns NULL on success, and an
+// error message otherwise.
+static const char *set_wind(lua_State *L, int index, int wind_index,
+                            Array skin_nums) {
+  index      = lua_absindex(L, index);
+  wind_index = lua_absindex(L, wind_index);
+  VertexArray *v_array =
+      (VertexArray *)luaL_checkudata(L, index, vertex_array_metatable);
+  Wind *wind = wind__check(L, wind_index);
+
+  if (v_array->is_dynamic || v_array->draw_mode != mode_triangles) {
+    return "set_wind expects a non-dynamic array of triangles";
+  }
+  Array skin = NULL;
+  if (skin_nums->count == 3 * v_array->num_pts) {
+    skin = new_skin(skin_nums, wind__num_bones(wind));
+  }
+  if (skin == NULL) {
+    return "Expected a skin triple per vertex, with bones from the given Wind";
   }
-      // stack = [.. lua_arr .. nil]
-  lua_pop(L, 1);
-      // stack = [.. lua_arr ..]
-  return arr;
+
+  gl_set_skin(v_array, skin);
+  array__delete(skin);
+
+  // The array keeps its Wind alive.
+  v_array->wind = wind;
+  lua_pushvalue(L, wind_index);
+      // stack = [.., wind]
+  lua_setuservalue(L, index);
+      // stack = [..]
+  return NULL;
+}
+
+// Returns 0 if mode_str names a valid mode, and -1 otherwise.
+static int parse_mode(const char *mode_str, Mode *mode) {
+  if (strcmp(mode_str, "triangle strip") == 0) {
+    *mode = mode_triangle_strip;
+  } else if (strcmp(mode_str, "triangles") == 0) {
+    *mode = mode_triangles;
+  } else if (strcmp(mode_str, "points") == 0) {
+    *mode = mode_points;
+  } else if (strcmp(mode_str, "lines") == 0) {
+    *mode = mode_lines;
+  } else {
+    return -1;
+  }
+  return 0;
 }
 
-static void luaL_checkindexable(lua_State *L, int narg) {
-  if (lua_istable(L, narg)) return;  // tables are indexable.
-  if (!luaL_getmetafield(L, narg, "__index")) {
-    // This function will show the user narg and the Lua-visible function name.
-    luaL_argerror(L, narg, "expected an indexable value such as a table");
+// This reads an optional {R, G, B} color at index narg. It raises a Lua error
+// if there's a table there with non-numeric values.
+static vec3 opt_color(lua_State *L, int narg) {
+  vec3 color = vec3(0.494, 0.349, 0.204);
+  if (lua_istable(L, narg)) {
+    for (int i = 1; i <= 3; ++i) {
+      lua_rawgeti(L, narg, i);  // Push color[i] on top of the stack.
+        // stack = [.., color[i]]
+      int isnum;
+      color[i - 1] = lua_tonumberx(L, -1, &isnum);
+      if (!isnum) {
+        luaL_argerror(L, narg, "Expected color to contain numeric values");
+      }
+      lua_pop(L, 1);
+        // stack = [..]
+    }
   }
-  lua_pop(L, 1);  // Pop the value of getmetable(narg).__index.
+  return color;
 }
 
+// Pushes a new VertexArray userdata onto the stack and returns it.
+static VertexArray *push_new_vertex_array(lua_State *L) {
+  VertexArray *v_array =
+      (VertexArray *)lua_newuserdata(L, sizeof(VertexArray));
+      // stack = [.., v_array]
+  luaL_getmetatable(L, vertex_array_metatable);
+      // stack = [.., v_array, mt]
+  lua_setmetatable(L, -2);
+      // stack = [.., v_array]
+  v_array->is_dynamic          = 0;
+  v_array->dynamic_data        = NULL;
+  v_array->num_pending_uploads = 0;
+  v_array->wind                = NULL;
+  v_array->skin_vbo            = 0;
+  return v_array;
+}
+
+
+// Internal: Lua C functions.
+
 // Lua C function.
 // Expected parameters: {points table}, draw_mode, [color]
 // where draw_mode is 'triangle strip', 'triangles', 'points', or 'lines'.
@@ -196,20 +456,20 @@ static void luaL_checkindexable(lua_State *L, int narg) {
 static int vertex_array__new(lua_State *L) {
 
   // Expect the 1st value to be table-like.
-  luaL_checkindexable(L, 2);
+  luahelp__check_indexable(L, 2);
       // stack = [self, v_pts, ..]
 
   // Collect v_pts and draw_mode.
-  Array v_pts = c_array_from_lua_array(L, 2);
   const char *mode_str = luaL_checkstring(L, 3);
   Mode draw_mode;
-  if (strcmp(mode_str, "triangle strip") == 0) {
-    draw_mode = mode_triangle_strip;
-  } else if (strcmp(mode_str, "triangles") == 0) {
-    draw_mode = mode_triangles;
-  } else if (strcmp(mode_str, "points") == 0) {
-    draw_mode = mode_points;
-
+  if (parse_mode(mode_str, &draw_mode) != 0) {
+    const char *msg = "Expected mode to be 'triangle strip', 'triangles', "
+                      "'points', or 'lines'.";
+    return luaL_argerror(L,     // state
+                         3,     // arg
+                         msg);  // msg
+  }
+  if (draw_mode == mode_points) {
     // Check for an optional point size parameter.
     // HACKY For now, if we see this, we just set the point size immediately.
     // This breaks horrifically if the user ever does anything that would make
@@ -217,57 +477,185 @@ static int vertex_array__new(lua_State *L) {
     int isnum;
     GLfloat point_size = lua_tonumberx(L, 5, &isnum);
     if (isnum) glPointSize(point_size);
-
-  } else if (strcmp(mode_str, "lines") == 0) {
-    draw_mode = mode_lines;
-  } else {
-    const char *msg = "Expected mode to be 'triangle strip', 'triangles', "
-                      "'points', or 'lines'.";
-    return luaL_argerror(L,     // state
-                         3,     // arg
-                         msg);  // msg
   }
 
   // Check for the optional color parameter.
-  vec3 color = vec3(0.494, 0.349, 0.204);
-  if (lua_istable(L, 4)) {
-    for (int i = 1; i <= 3; ++i) {
-      lua_rawgeti(L, 4, i);  // Push color[i] on top of the stack.
-        // stack = [self, v_pts, draw_mode, color, .., color[i]]
-      int isnum;
-      color[i - 1] = lua_tonumberx(L, -1, &isnum);
-      if (!isnum) {
-        return luaL_argerror(L, 4, "Expected color to contain numeric values");
-      }
-      lua_pop(L, 1);
-        // stack = [self, v_pts, draw_mode, color, ..]
-    }
-  }
+  vec3 color = opt_color(L, 4);
+
+  Array v_pts = luahelp__new_float_array(L, 2);
 
   lua_settop(L, 0);
       // stack = []
 
   // Create a VertexArray instance and set its metatable.
-  VertexArray *v_array =
-      (VertexArray *)lua_newuserdata(L, sizeof(VertexArray));
-      // stack = [v_array]
-  luaL_getmetatable(L, vertex_array_metatable);
-      // stack = [v_array, mt]
-  lua_setmetatable(L, 1);
+  VertexArray *v_array = push_new_vertex_array(L);
       // stack = [v_array]
-  
+
   // Set up the C data.
   v_array->draw_mode = draw_mode;
   v_array->color     = color;
-  gl_setup_new_vertex_array(v_array, v_pts);
+  int is_strip = (draw_mode == mode_triangle_strip);
+  Array n_vecs = normals__new_for_vertices(v_pts, is_strip);
+  Array packed = new_packed_normals(n_vecs);
+  gl_setup_new_vertex_array(v_array, v_pts, packed, 0);  // 0 --> send it now
 
   glhelp__error_check;
 
+  array__delete(packed);
+  array__delete(n_vecs);
   array__delete(v_pts);
 
   return 1;  // --> 1 Lua return value
 }
 
+// Lua C function.
+// Expected parameters: draw_mode, [color]
+// This creates an empty dynamic VertexArray. Its data is set by calling
+// v_array:update(pts), which can be done as often as every frame.
+static int vertex_array__new_dynamic(lua_State *L) {
+
+  const char *mode_str = luaL_checkstring(L, 2);
+  Mode draw_mode;
+  if (parse_mode(mode_str, &draw_mode) != 0) {
+    const char *msg = "Expected mode to be 'triangle strip', 'triangles', "
+                      "'points', or 'lines'.";
+    return luaL_argerror(L,     // state
+                         2,     // arg
+                         msg);  // msg
+  }
+  vec3 color = opt_color(L, 3);
+
+  lua_settop(L, 0);
+      // stack = []
+
+  VertexArray *v_array = push_new_vertex_array(L);
+      // stack = [v_array]
+  v_array->draw_mode    = draw_mode;
+  v_array->color        = color;
+  v_array->is_dynamic   = 1;
+  v_array->dynamic_data = array__new(64, sizeof(DynamicVertex));
+
+  return 1;  // --> 1 Lua return value
+}
+
+// Lua C function.
+// Expected parameters: self, {points table}
+// This replaces the points of a dynamic VertexArray.
+static int vertex_array__update(lua_State *L) {
+
+  VertexArray *v_array =
+      (VertexArray *)luaL_checkudata(L, 1, vertex_array_metatable);
+  if (!v_array->is_dynamic) {
+    return luaL_error(L, "update can only be called on dynamic VertexArrays");
+  }
+  luahelp__check_indexable(L, 2);
+
+  Array v_pts = luahelp__new_float_array(L, 2);
+  set_dynamic_data(v_array, v_pts);
+  array__delete(v_pts);
+
+  return 0;  // --> 0 Lua return values
+}
+
+// Lua C function.
+// Expected parameters: self, first, count, {points table}, [{skin table}]
+// This replaces count vertices, starting with vertex number first, with the
+// vertices in the points table, which may have a different number of them.
+// Only arrays drawn as 'triangles' are supported, and both ranges must hold
+// whole triangles. Arrays with a Wind also expect the skin of the new vertices,
+// in the format of bones.lua.
+static int vertex_array__replace_range(lua_State *L) {
+
+  VertexArray *v_array =
+      (VertexArray *)luaL_checkudata(L, 1, vertex_array_metatable);
+  int first = (int)luaL_checkinteger(L, 2) - 1;  // Lua's indexes start at 1.
+  int count = (int)luaL_checkinteger(L, 3);
+  luahelp__check_indexable(L, 4);
+
+  if (v_array->is_dynamic || v_array->draw_mode != mode_triangles) {
+    return luaL_error(L, "replace_range expects a non-dynamic array of "
+                         "triangles");
+  }
+  if (v_array->num_pending_uploads > 0) {
+    return luaL_error(L, "replace_range can't be called until the array is "
+                         "uploaded");
+  }
+  luaL_argcheck(L, first >= 0 && first % 3 == 0, 2,
+                "Expected first to start a triangle");
+  luaL_argcheck(L, count >= 0 && count % 3 == 0 &&
+                   first + count <= v_array->num_pts, 3,
+                "Expected count to cover whole triangles within the array");
+
+  luaL_argcheck(L, lua_rawlen(L, 4) % 9 == 0, 4,
+                "Expected the points to make whole triangles");
+  if (v_array->wind) {
+    luahelp__check_indexable(L, 5);
+    luaL_argcheck(L, luahelp__is_float_array(L, 5) &&
+                     lua_rawlen(L, 5) == lua_rawlen(L, 4), 5,
+                  "Expected a skin triple per new vertex");
+  }
+
+  // Everything above that can raise an error has been checked, so the Arrays
+  // below can't leak. If the points aren't all numbers, the conversion raises
+  // an error before anything else is allocated.
+  Array v_pts     = luahelp__new_float_array(L, 4);
+  int   new_count = v_pts->count / 3;
+
+  Array skin = NULL;
+  if (v_array->wind) {
+    Array skin_nums = luahelp__new_float_array(L, 5);
+    if (skin_nums->count == 3 * new_count) {
+      skin = new_skin(skin_nums, wind__num_bones(v_array->wind));
+    }
+    array__delete(skin_nums);
+    if (skin == NULL) {
+      array__delete(v_pts);
+      return luaL_argerror(L, 5, "Expected a skin triple per new vertex, "
+                                 "with bones from the array's Wind");
+    }
+  }
+  Array packed = vertex_array__new_packed_normals(v_pts);
+
+  // Queued draws use the current vertex count, so they need to happen before
+  // the count changes.
+  if (new_count != count) draw_queue__flush();
+
+  replace_buffer_range(v_array->vertices_vbo, 3 * sizeof(GLfloat),
+                       v_array->num_pts, first, count, v_pts);
+  replace_buffer_range(v_array->normals_vbo, sizeof(GLuint),
+                       v_array->num_pts, first, count, packed);
+  if (skin) {
+    replace_buffer_range(v_array->skin_vbo, sizeof(SkinVertex),
+                         v_array->num_pts, first, count, skin);
+    array__delete(skin);
+  }
+  v_array->num_pts += new_count - count;
+
+  glhelp__error_check;
+
+  array__delete(packed);
+  array__delete(v_pts);
+
+  return 0;  // --> 0 Lua return values
+}
+
+// Lua C function.
+// Expected parameters: self, wind, {skin table}
+// This makes the array sway with wind. The skin table is a flat sequence with
+// a skin triple per vertex, in the format of bones.lua.
+static int vertex_array__set_wind(lua_State *L) {
+  luaL_checkudata(L, 1, vertex_array_metatable);
+  wind__check(L, 2);
+  luahelp__check_indexable(L, 3);
+
+  Array skin_nums = luahelp__new_float_array(L, 3);
+  const char *err = set_wind(L, 1, 2, skin_nums);
+  array__delete(skin_nums);
+  if (err) return luaL_error(L, "%s", err);
+
+  return 0;  // --> 0 Lua return values
+}
+
 // This performs common argument handling for the draw() and
 // draw_without_setup() methods. This method will not return if there is an
 // error.
@@ -317,10 +705,10 @@ static int get_self_and_mode(lua_State *L,
 // Lua C function.
 // Expected parameters: none.
 static int vertex_array__setup_drawing(lua_State *L) {
+  (void)L;
+
   // Prepare for OpenGL drawing.
-  glUseProgram(program);
-  mvp_callback(mvp_loc);
-  normal_xform_callback(normal_xform_loc);
+  glstate__use_program(program);
 
   return 0;  // --> 0 Lua return values
 }
@@ -336,11 +724,32 @@ static int vertex_array__draw_without_setup(lua_State *L) {
   VertexArray *v_array;
   GLenum mode;
   get_self_and_mode(L, &v_array, &mode);
+  if (v_array->num_pending_uploads > 0) return 0;  // It's not ready yet.
+
+  // Skinned and plain arrays may be drawn in the same batch, so the program is
+  // chosen on every call.
+  GLuint draw_program   = program;
+  GLint  draw_color_loc = color_loc;
+  if (v_array->wind) {
+    draw_program   = wind_program;
+    draw_color_loc = wind_color_loc;
+    glstate__bind_buffer_texture(wind__palette_texture(v_array->wind));
+  }
+  glstate__use_program(draw_program);
+  draw_queue__send_color(draw_program, draw_color_loc, &v_array->color[0]);
 
   // Execute OpenGL drawing.
-  glBindVertexArray(v_array->vao);
+  GLint first = 0;
+  if (v_array->is_dynamic) {
+    first = stream_buffer__push(&dynamic_stream,
+                                v_array->dynamic_data->items,
+                                v_array->num_pts);
+    glstate__bind_vertex_array(dynamic_vao);
+  } else {
+    glstate__bind_vertex_array(v_array->vao);
+  }
   glDrawArrays(mode,               // mode
-               0,                  // start
+               first,              // start
                v_array->num_pts);  // count
 
   return 0;  // --> 0 Lua return values
@@ -350,29 +759,83 @@ static int vertex_array__draw_without_setup(lua_State *L) {
 // Expected parameters:
 //   self      = a VertexArray instance.
 //   [mode]    = a string with a valid mode value.
+// The draw is added to the draw queue, which is flushed once per frame after
+// render.draw returns.
 static int vertex_array__draw(lua_State *L) {
 
   // Parse arguments.
   VertexArray *v_array;
   GLenum mode;
   get_self_and_mode(L, &v_array, &mode);
+  if (v_array->num_pending_uploads > 0) return 0;  // It's not ready yet.
+
+  // Dynamic arrays send their data now, and are drawn from the shared stream.
+  GLuint vao   = v_array->vao;
+  GLint  first = 0;
+  if (v_array->is_dynamic) {
+    vao   = dynamic_vao;
+    first = stream_buffer__push(&dynamic_stream,
+                                v_array->dynamic_data->items,
+                                v_array->num_pts);
+  }
 
-  // Prepare for and execute OpenGL drawing.
-  glUseProgram(program);
-  glBindVertexArray(v_array->vao);
-  mvp_callback(mvp_loc);
-  normal_xform_callback(normal_xform_loc);
-  glUniform3fv(color_loc,            // location
-               1,                    // count
-               &v_array->color[0]);  // data
-  glDrawArrays(mode,               // mode
-               0,                  // start
-               v_array->num_pts);  // count
+  // Queue up the draw.
+  vec3 &color = v_array->color;
+  draw_queue__Item item = {
+    .program        = program,
+    .vao            = vao,
+    .mode           = mode,
+    .first          = first,
+    .count          = v_array->num_pts,
+    .index_type     = 0,
+    .use_restart    = 0,
+    .color_loc      = color_loc,
+    .color          = {color[0], color[1], color[2]},
+    .firsts         = NULL,
+    .counts         = NULL,
+    .draw_count     = 0,
+    .buffer_texture = 0
+  };
+  if (v_array->wind) {
+    item.program        = wind_program;
+    item.color_loc      = wind_color_loc;
+    item.buffer_texture = wind__palette_texture(v_array->wind);
+  }
+  draw_queue__add(&item);
 
   return 0;  // --> 0 Lua return values
 }
 
-// TODO Add and test/debug a gc function.
+// Lua C function.
+// Expected parameters: self.
+// Returns true once all of the array's data has been sent to the gpu.
+static int vertex_array__is_uploaded(lua_State *L) {
+  VertexArray *v_array =
+      (VertexArray *)luaL_checkudata(L, 1, vertex_array_metatable);
+  lua_pushboolean(L, v_array->num_pending_uploads == 0);
+  return 1;  // --> 1 Lua return value
+}
+
+// Lua C function.
+// Expected parameters: self.
+static int vertex_array__gc(lua_State *L) {
+  VertexArray *v_array =
+      (VertexArray *)luaL_checkudata(L, 1, vertex_array_metatable);
+
+  // A queued draw may still refer to our objects.
+  draw_queue__flush();
+  upload_queue__cancel(v_array);
+
+  if (v_array->is_dynamic) {
+    array__delete(v_array->dynamic_data);
+  } else {
+    glstate__delete_vertex_array(v_array->vao);
+    glstate__delete_buffer(v_array->vertices_vbo);
+    glstate__delete_buffer(v_array->normals_vbo);
+    if (v_array->skin_vbo) glstate__delete_buffer(v_array->skin_vbo);
+  }
+  return 0;  // --> 0 Lua return values
+}
 
 
 // Public functions.
@@ -393,12 +856,18 @@ extern "C" void vertex_array__load_lib(lua_State *L) {
   // Add the instance methods.
   add_fn(vertex_array__draw, "draw");
   add_fn(vertex_array__draw_without_setup, "draw_without_setup");
+  add_fn(vertex_array__update, "update");
+  add_fn(vertex_array__replace_range, "replace_range");
+  add_fn(vertex_array__set_wind, "set_wind");
+  add_fn(vertex_array__is_uploaded, "is_uploaded");
+  add_fn(vertex_array__gc, "__gc");
 
   lua_pop(L, 1);  // --> stack = [..]
 
   // Add `VertexArray` as a global module table with a single `new` function.
   static const struct luaL_Reg lib[] = {
     {"new", vertex_array__new},
+    {"new_dynamic", vertex_array__new_dynamic},
     {"setup_drawing", vertex_array__setup_drawing},
     {NULL, NULL}};
   luaL_newlib(L, lib);              // --> stack = [.., VertexArray]
@@ -407,10 +876,27 @@ extern "C" void vertex_array__load_lib(lua_State *L) {
   gl_init();
 }
 
-void vertex_array__set_mvp_callback(vertex_array__TransformCallback cb) {
-  mvp_callback = cb;
+extern "C" Array vertex_array__new_packed_normals(Array v_pts) {
+  Array n_vecs = normals__new_for_vertices(v_pts, 0);  // 0 --> not a strip
+  Array packed = new_packed_normals(n_vecs);
+  array__delete(n_vecs);
+  return packed;
+}
+
+extern "C" void vertex_array__push_new_triangles(lua_State   *L,
+                                                 Array        v_pts,
+                                                 Array        packed_normals,
+                                                 const float *color) {
+  VertexArray *v_array = push_new_vertex_array(L);
+      // stack = [.., v_array]
+  v_array->draw_mode = mode_triangles;
+  v_array->color     = color ? vec3(color[0], color[1], color[2])
+                             : vec3(0.494, 0.349, 0.204);
+  gl_setup_new_vertex_array(v_array, v_pts, packed_normals, 1);  // 1 --> queue
 }
 
-void vertex_array__set_normal_callback(vertex_array__TransformCallback cb) {
-  normal_xform_callback = cb;
+extern "C" void vertex_array__skin_with_wind(lua_State *L, int index,
+                                             int wind_index, Array skin_nums) {
+  const char *err = set_wind(L, index, wind_index, skin_nums);
+  if (err) luaL_error(L, "%s", err);
 }
@@ -10,8 +10,32 @@
 //
 //   -- Call this for every frame where you want to draw the model.
 //   -- Valid modes: 'triangle strip', 'triangles', 'points', 'lines'.
+//   -- The draw is queued, and happens when the C code calls
+//   -- draw_queue__flush at the end of the frame.
 //   v_array:draw('triangle strip')
 //   
+//   -- For data that changes often, create a dynamic array instead. It starts
+//   -- out empty, and its points can be replaced as often as every frame
+//   -- without creating new OpenGL objects.
+//   v_array = VertexArray:new_dynamic('triangles', [color])
+//   v_array:update({flat sequence of vertex points})
+//
+//   -- Replaces count vertices, starting with vertex number first, of a
+//   -- 'triangles' array with the given points, which may hold a different
+//   -- number of vertices. Only the changed range is sent to the gpu. Arrays
+//   -- with a Wind also expect the skin of the new vertices.
+//   v_array:replace_range(first, count, {flat sequence of vertex points},
+//                         [{flat sequence of skin triples}])
+//
+//   -- Makes a 'triangles' array sway with the given Wind; see wind.h. The
+//   -- skin has a triple per vertex, in the format of bones.lua.
+//   v_array:set_wind(wind, {flat sequence of skin triples})
+//
+//   -- Returns true once all of the array's data is on the gpu. Arrays from
+//   -- generator.poll are uploaded over several frames, and draw does nothing
+//   -- until then.
+//   v_array:is_uploaded()
+//
 //   -- There is an alternative drawing technique that's more efficient if
 //   -- you're drawing many vertex arrays, assuming they share the same
 //   -- underlying shader and transforms:
@@ -27,19 +51,37 @@
 extern "C" {
 #endif
 
+#include "cstructs/cstructs.h"
 #include "lua/lua.h"
   
-#include <OpenGL/gl3.h>
+#include "glinclude.h"
 
+// The transforms used by the shader come from the uniform buffers set up in
+// the frame_uniforms module.
 void vertex_array__load_lib(lua_State *L);
-  
-// A vertex_array__TransformCallback is a function that accepts the location
-// of a shader uniform and sets a mat4 matrix value. That value may be either an
-// mvp matrix or a normal tranformation matrix.
-typedef void (*vertex_array__TransformCallback)(GLint);
 
-void vertex_array__set_mvp_callback   (vertex_array__TransformCallback cb);
-void vertex_array__set_normal_callback(vertex_array__TransformCallback cb);
+// Returns a new Array of packed normals, one per vertex, for the flat-shaded
+// triangles in v_pts. This makes no OpenGL calls, so it's safe to call from
+// any thread.
+Array vertex_array__new_packed_normals(Array v_pts);
+
+// Pushes a new VertexArray for the triangles in v_pts onto L's stack. This
+// expects packed_normals to come from vertex_array__new_packed_normals, and
+// color to be either NULL, for the default bark color, or an {r, g, b} triple.
+// The data is copied, and sent to the gpu over the next few frames by the
+// upload_queue module; the array isn't drawn until that's done. The arrays
+// still belong to the caller.
+void  vertex_array__push_new_triangles(lua_State   *L,
+                                       Array        v_pts,
+                                       Array        packed_normals,
+                                       const float *color);
+
+// This does the same as v_array:set_wind(wind, skin) in Lua, for the
+// VertexArray and Wind at the given indexes of L's stack. The skin_nums Array
+// holds GLfloat skin triples, and still belongs to the caller. If the array is
+// still being uploaded, so is its skin.
+void  vertex_array__skin_with_wind(lua_State *L, int index, int wind_index,
+                                   Array skin_nums);
 
 
 #ifdef __cplusplus
@@ -8,7 +8,7 @@ local Vec3 = require 'Vec3'
 
 local v = Vec3:new(1, 2, 3)
 
-assert(getmetatable(v) == Vec3)
+assert(Vec3.is_vec3(v))
 
 local w = v + 3 * v
 
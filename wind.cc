@@ -0,0 +1,260 @@
+// wind.cc
+//
+
+#include "wind.h"
+
+extern "C" {
+#include "cstructs/cstructs.h"
+#include "draw_queue.h"
+#include "glhelp.h"
+#include "glstate.h"
+#include "luahelp.h"
+#include "lua/lauxlib.h"
+}
+
+#include "config.h"
+
+#include "glm/glm.hpp"
+#define GLM_FORCE_RADIANS
+#include "glm/gtc/matrix_transform.hpp"
+using namespace glm;
+
+#include <math.h>
+
+#define wind_metatable "Trees.Wind"
+
+// The number of numbers per bone in the tree.bones format of bones.lua.
+#define floats_per_bone 8
+
+// The largest angle, in radians, that a single bone bends by. Bends add up from
+// the trunk out, so twigs move several times this much.
+#define max_bend 0.05
+
+
+// Internal types and globals.
+
+typedef struct {
+  int   parent;
+  vec3  base;
+  vec3  dir;    // The normalized direction from the base to the tip.
+  float flex;   // This is 0 for the thickest bone, and approaches 1 for twigs.
+  float phase;  // This keeps neighboring bones from swaying in lockstep.
+} Bone;
+
+struct Wind {
+  Array  bones;         // Bones, starting with bone 0.
+  Array  xforms;        // The palette, as one mat4 per bone.
+  double palette_time;  // The time of the palette in xforms.
+  GLuint palette_vbo;
+  GLuint palette_tex;
+};
+
+// This points in the direction the wind blows.
+static const vec3 wind_dir = normalize(vec3(1, 0, 0.4));
+
+// The time, in seconds, shared by all Winds.
+static double now = 0.0;
+
+
+// Internal functions.
+
+// This replaces the bones of wind with those in floats, which is in the
+// tree.bones format of bones.lua. Returns 0 if floats is in that format, and
+// -1 otherwise.
+static int set_bones(Wind *wind, Array floats) {
+  if (floats->count % floats_per_bone != 0) return -1;
+  int num_bones = floats->count / floats_per_bone + 1;
+
+  // Each bone's flex is based on its radius relative to the thickest bone's.
+  float max_radius = 0;
+  for (int i = 1; i < num_bones; ++i) {
+    GLfloat *f = (GLfloat *)array__item_ptr(floats, (i - 1) * floats_per_bone);
+    if (f[0] < 0 || f[0] >= i) return -1;  // The parent must come first.
+    if (f[7] > max_radius) max_radius = f[7];
+  }
+
+  array__clear(wind->bones);
+  Bone *ground   = (Bone *)array__new_ptr(wind->bones);
+  ground->parent = 0;
+  ground->flex   = 0;
+  ground->phase  = 0;
+  for (int i = 1; i < num_bones; ++i) {
+    GLfloat *f    = (GLfloat *)array__item_ptr(floats,
+                                               (i - 1) * floats_per_bone);
+    Bone    *bone = (Bone *)array__new_ptr(wind->bones);
+    vec3     tip  = vec3(f[4], f[5], f[6]);
+    bone->parent = (int)f[0];
+    bone->base   = vec3(f[1], f[2], f[3]);
+    bone->dir    = normalize(tip - bone->base);
+    bone->flex   = max_radius > 0 ? 1 - f[7] / max_radius : 0;
+    bone->phase  = fmodf(2.39996f * i, 2 * M_PI);  // The golden angle.
+  }
+
+  // Bone 0 never moves; the others are set by update_palette.
+  array__clear(wind->xforms);
+  for (int i = 0; i < num_bones; ++i) {
+    array__new_val(wind->xforms, mat4) = mat4(1);
+  }
+  wind->palette_time = -1;  // The palette is out of date.
+  return 0;
+}
+
+// This returns the transform of bone relative to its parent at the current
+// time: a bend with the wind and a smaller flutter across it, both around the
+// bone's base.
+static mat4 local_xform(Bone *bone, float gust) {
+  vec3 with_axis = cross(bone->dir, wind_dir);
+  if (length(with_axis) < 1e-4) return mat4(1);  // It points along the wind.
+  with_axis = normalize(with_axis);
+  vec3 across_axis = cross(bone->dir, with_axis);
+
+  // Thin bones sway faster and farther than thick ones.
+  float freq    = 1.2 + 1.8 * bone->flex;
+  float sway    = sin(freq * now + bone->phase);
+  float amount  = wind_strength * max_bend * bone->flex;
+  float bend    = amount * gust * (0.6 + 0.4 * sway);
+  float flutter = amount * 0.3 * sin(2.3 * freq * now + 2 * bone->phase);
+
+  mat4 xform = translate(mat4(1), bone->base);
+  xform = rotate(xform, bend,    with_axis);
+  xform = rotate(xform, flutter, across_axis);
+  return translate(xform, -bone->base);
+}
+
+// This recomputes the palette of wind for the current time and sends it to
+// the gpu, unless that's already been done.
+static void update_palette(Wind *wind) {
+  if (wind->palette_time == now) return;
+
+  // The gusts rise and fall slowly, and are shared by the whole tree.
+  float gust = 0.7 + 0.3 * sin(0.37 * now) * sin(0.23 * now + 1.0);
+
+  // Each bone's parent comes before it, so its transform is ready first.
+  mat4 *xforms = (mat4 *)wind->xforms->items;
+  for (int i = 1; i < wind->bones->count; ++i) {
+    Bone *bone = (Bone *)array__item_ptr(wind->bones, i);
+    xforms[i] = xforms[bone->parent] * local_xform(bone, gust);
+  }
+
+  glBindBuffer(GL_TEXTURE_BUFFER, wind->palette_vbo);
+  glBufferData(GL_TEXTURE_BUFFER,                                // target
+               wind->xforms->count * wind->xforms->item_size,  // size
+               wind->xforms->items,                            // data
+               GL_STREAM_DRAW);                                // usage
+  wind->palette_time = now;
+}
+
+
+// Internal: Lua C functions.
+
+// Lua C function.
+// Expected parameters: bones
+// where bones is a flat sequence in the tree.bones format of bones.lua.
+static int wind__new(lua_State *L) {
+  luahelp__check_indexable(L, 2);
+  Array bones = luahelp__new_float_array(L, 2);
+  lua_settop(L, 0);
+      // stack = []
+  wind__push_new(L, bones);
+      // stack = [wind]
+  array__delete(bones);
+  return 1;  // --> 1 Lua return value
+}
+
+// Lua C function.
+// Expected parameters: self, bones
+static int wind__set_bones(lua_State *L) {
+  Wind *wind = wind__check(L, 1);
+  luahelp__check_indexable(L, 2);
+  Array bones = luahelp__new_float_array(L, 2);
+  int   err   = set_bones(wind, bones);
+  array__delete(bones);
+  if (err) return luaL_argerror(L, 2, "Expected bones in the bones.lua format");
+  return 0;  // --> 0 Lua return values
+}
+
+// Lua C function.
+// Expected parameters: self.
+static int wind__gc(lua_State *L) {
+  Wind *wind = wind__check(L, 1);
+
+  // A queued draw may still refer to our palette.
+  draw_queue__flush();
+
+  array__delete(wind->bones);
+  array__delete(wind->xforms);
+  glstate__delete_buffer(wind->palette_vbo);
+  glstate__delete_texture(wind->palette_tex);
+
+  return 0;  // --> 0 Lua return values
+}
+
+
+// Public functions.
+
+#define add_fn(fn, name)        \
+    lua_pushcfunction(L, fn);   \
+    lua_setfield(L, -2, name);
+
+extern "C" void wind__load_lib(lua_State *L) {
+
+  // If this metatable already exists, the library is already loaded.
+  if (!luaL_newmetatable(L, wind_metatable)) return;
+
+  // metatable.__index = metatable
+  lua_pushvalue(L, -1);            // --> stack = [.., mt, mt]
+  lua_setfield(L, -2, "__index");  // --> stack = [.., mt]
+
+  // Add the instance methods.
+  add_fn(wind__set_bones, "set_bones");
+  add_fn(wind__gc,        "__gc");
+
+  lua_pop(L, 1);  // --> stack = [..]
+
+  // Add `Wind` as a global module table with a single `new` function.
+  static const struct luaL_Reg lib[] = {
+    {"new", wind__new},
+    {NULL, NULL}};
+  luaL_newlib(L, lib);       // --> stack = [.., Wind]
+  lua_setglobal(L, "Wind");  // --> stack = [..]
+}
+
+extern "C" void wind__update(double dt) {
+  now += dt;
+}
+
+extern "C" void wind__push_new(lua_State *L, Array bones) {
+  Wind *wind = (Wind *)lua_newuserdata(L, sizeof(Wind));
+      // stack = [.., wind]
+  luaL_getmetatable(L, wind_metatable);
+      // stack = [.., wind, mt]
+  lua_setmetatable(L, -2);
+      // stack = [.., wind]
+
+  wind->bones  = array__new(64, sizeof(Bone));
+  wind->xforms = array__new(64, sizeof(mat4));
+  glGenBuffers(1, &wind->palette_vbo);
+  glGenTextures(1, &wind->palette_tex);
+  glstate__bind_buffer_texture(wind->palette_tex);
+  glBindBuffer(GL_TEXTURE_BUFFER, wind->palette_vbo);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, wind->palette_vbo);
+
+  if (set_bones(wind, bones)) {
+    luaL_error(L, "Expected bones in the bones.lua format");
+  }
+
+  glhelp__error_check;
+}
+
+extern "C" Wind *wind__check(lua_State *L, int narg) {
+  return (Wind *)luaL_checkudata(L, narg, wind_metatable);
+}
+
+extern "C" int wind__num_bones(Wind *wind) {
+  return wind->bones->count;
+}
+
+extern "C" GLuint wind__palette_texture(Wind *wind) {
+  update_palette(wind);
+  return wind->palette_tex;
+}
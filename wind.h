@@ -0,0 +1,61 @@
+// wind.h
+//
+// A Lua-facing library that sways the branches of a tree in the wind.
+//
+// Each stick of a tree is a bone, as set up by bones.lua. Every frame, each
+// bone is rotated around its base by an angle that depends on the time, the
+// wind, and how thin the bone is, on top of the transform of its parent bone.
+// These transforms make up the tree's palette, which is kept in a buffer
+// texture. Vertex arrays that are skinned with a Wind - see
+// VertexArray:set_wind - are drawn with the bark_wind vertex shader, which
+// moves each vertex by its blend of two transforms in the palette. So the tree
+// sways without its vertices being rebuilt or sent to the gpu again.
+//
+// The palette is computed at most once per frame, the first time a skinned
+// array that uses it is drawn.
+//
+// Lua interface:
+//
+//   -- bones is a flat sequence in the tree.bones format of bones.lua.
+//   wind = Wind:new(bones)
+//
+//   -- Call this after the tree's skeleton has been edited.
+//   wind:set_bones(bones)
+//
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "cstructs/cstructs.h"
+#include "lua/lua.h"
+
+#include "glinclude.h"
+
+typedef struct Wind Wind;
+
+void   wind__load_lib(lua_State *L);
+
+// Advances the time used by all Winds by dt seconds.
+void   wind__update(double dt);
+
+// Pushes a new Wind onto L's stack. The bones Array holds GLfloats in the
+// tree.bones format of bones.lua; it still belongs to the caller.
+void   wind__push_new(lua_State *L, Array bones);
+
+// Returns the Wind at index narg of L's stack, or raises a Lua error if
+// there's something else there.
+Wind  *wind__check(lua_State *L, int narg);
+
+// Returns the number of bones of wind, including bone 0.
+int    wind__num_bones(Wind *wind);
+
+// Returns the buffer texture that holds wind's palette for the current time,
+// computing the palette first if needed.
+GLuint wind__palette_texture(Wind *wind);
+
+#ifdef __cplusplus
+}
+#endif